@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <string.h>
+#include "aot.h"
+#include "machine.h"
+
+#define LOAD_ADDRESS 0x1000
+
+/* Whether the store about to be interpreted writes to translated code */
+static int writes_code(const AotProgram *program, const Processor *processor, Word instruction_bits) {
+    DecodedOp op = decode_op(instruction_bits);
+    Address address;
+
+    if (op.kind != OP_SB && op.kind != OP_SH && op.kind != OP_SW && op.kind != OP_FSW) {
+        return 0;
+    }
+    address = processor->R[op.rs1] + op.imm;
+    return address + 4 > program->code_start && address < program->code_end;
+}
+
+int aot_main(const AotProgram *program) {
+    RvSimConfig config;
+    RvSimStatus status;
+    Processor *processor;
+    AotBlock block;
+    Word instruction_bits;
+    Address pc;
+    int modified = 0, code;
+    RvSim *sim;
+
+    memset(&config, 0, sizeof(config));
+    config.interpreter = 1;
+    config.console = stdout;
+    config.input = stdin;
+    sim = rvsim_create(&config);
+    if (sim == NULL || rvsim_load_words(sim, program->image, program->words) < 0) {
+        fprintf(stderr, "Cannot create the simulator\n");
+        return -1;
+    }
+    processor = &sim->processor;
+
+    for (;;) {
+        pc = processor->PC;
+        if (!modified && pc - LOAD_ADDRESS < 4 * program->words && (pc & 3) == 0
+            && (block = program->blocks[(pc - LOAD_ADDRESS) >> 2]) != NULL) {
+            processor->PC = block(processor, sim->memory, &sim->instret, sim->events.next);
+            sim->events.now = sim->instret;
+            if (processor->PC != pc && sim->instret < sim->events.next) {
+                continue;
+            }
+            /* the interpreter fires what is due before its next instruction,
+               and runs the first one of a block that could not */
+            pc = processor->PC;
+        }
+        if (!modified && rvsim_read_memory(sim, pc, &instruction_bits, 4) == 0) {
+            modified = writes_code(program, processor, instruction_bits);
+        }
+        status = rvsim_step(sim);
+        if (status != RVSIM_OK) {
+            break;
+        }
+    }
+    rvsim_report(sim, status, stdout);
+    code = rvsim_exit_code(sim);
+    rvsim_destroy(sim);
+    return code;
+}
@@ -0,0 +1,28 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include "types.h"
+
+/* Runtime for programs translated to C by riscv2c. Every basic block
+   became a function that runs it on the registers and memory and returns
+   the next PC; it returns the PC of an instruction it cannot run itself
+   (ecalls, CSRs, device accesses, stores into the translated code), which
+   then goes to the interpreter, like any code that was not translated.
+   Blocks add the instructions they retired to instret, and a block that
+   loops on itself returns once instret reaches deadline, the time of the
+   next event, so the interpreter can take the interrupt. */
+typedef Address (*AotBlock)(Processor *processor, Byte *memory, uint64_t *instret, uint64_t deadline);
+
+typedef struct {
+    const Word *image;          /* loaded at 0x1000 */
+    unsigned words;
+    const AotBlock *blocks;     /* per word of image, NULL if no block starts there */
+    Address code_start;         /* translated instructions; once one of them */
+    Address code_end;           /* is overwritten the program is interpreted */
+} AotProgram;
+
+/* Runs the program the way ./riscv would run its .input file and returns
+   the exit code */
+int aot_main(const AotProgram *program);
+
+#endif
@@ -0,0 +1,354 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "types.h"
+#include "utils.h"
+#include "riscv.h"
+#include "memory.h"
+
+/* Microbenchmarks of the primitives the interpreter is built from. Every
+ * benchmark runs over a table of random inputs made beforehand, for a
+ * number of samples of about a millisecond each, and reports the mean
+ * cost per operation with a 95% confidence interval over the samples.
+ *
+ *     ./bench [-r SAMPLES] [-o out.json] [-b baseline.json]
+ *
+ * The JSON has one benchmark per line so two runs diff cleanly. With -b
+ * every benchmark is also compared against a previous run on stderr, and
+ * the ones that got slower by more than both intervals together are
+ * marked. */
+
+#define INPUTS 4096             /* a power of two */
+#define MAX_SAMPLES 200
+#define SAMPLE_NS 1000000
+#define DATA_BASE 0x80000       /* what loads and stores address */
+
+typedef struct {
+    const char *name;
+    void (*run)(unsigned count);
+} Benchmark;
+
+typedef struct {
+    double ns, ci95, min;
+} Result;
+
+static Word words[INPUTS], fields[INPUTS], addresses[INPUTS][3];
+static unsigned widths[INPUTS];
+static Instruction parsed[INPUTS];
+static Word programs[8][INPUTS];
+static Byte *memory;
+static Processor processor;
+static volatile Word sink;
+
+static Word random_word(void) {
+    return ((Word) rand() << 16) ^ (Word) rand();
+}
+
+/* Instruction encodings for execute_instruction(). Destinations are x5 to
+ * x9; x20 to x23 hold DATA_BASE and are never written, and a0 keeps the
+ * print-integer ecall. */
+static Word rd(void) { return 5 + rand() % 5; }
+static Word rs(void) { return rand() % 2 ? 5 + rand() % 5 : 20 + rand() % 4; }
+static Word base(void) { return 20 + rand() % 4; }
+
+static Word rtype(void) {
+    static const Word ops[][2] = {
+        {0, 0x00}, {0, 0x20}, {1, 0x00}, {2, 0x00}, {4, 0x00}, {5, 0x00}, {5, 0x20}, {6, 0x00}, {7, 0x00},
+        {0, 0x01}, {4, 0x01}, {6, 0x01},       /* not mulh, which logs to stderr */
+    };
+    const Word *op = ops[rand() % (sizeof(ops) / sizeof(ops[0]))];
+    /* divisors come from the registers that are never zero */
+    Word rs2 = op[1] == 0x01 ? base() : rs();
+    return op[1] << 25 | rs2 << 20 | rs() << 15 | op[0] << 12 | rd() << 7 | 0x33;
+}
+
+static Word itype(void) {
+    static const Word funct3s[] = {0, 1, 2, 4, 5, 6, 7};
+    Word funct3 = funct3s[rand() % 7];
+    Word imm = funct3 == 1 || funct3 == 5 ? (rand() % 32) | (funct3 == 5 && rand() % 2 ? 0x400 : 0)
+                                          : rand() & 0xFFF;
+    return imm << 20 | rs() << 15 | funct3 << 12 | rd() << 7 | 0x13;
+}
+
+static Word load_type(void) {
+    Word funct3 = rand() % 3;
+    return (Word) ((rand() % 256) << funct3) << 20 | base() << 15 | funct3 << 12 | rd() << 7 | 0x03;
+}
+
+static Word store_type(void) {
+    Word funct3 = rand() % 3, imm = (rand() % 256) << funct3;
+    return (imm >> 5) << 25 | rs() << 20 | base() << 15 | funct3 << 12 | (imm & 0x1F) << 7 | 0x23;
+}
+
+static Word branch_type(void) {
+    Word imm = (rand() % 64) << 1;
+    return ((imm >> 12) & 1) << 31 | ((imm >> 5) & 0x3F) << 25 | rs() << 20 | rs() << 15
+        | (rand() % 2) << 12 | ((imm >> 1) & 0xF) << 8 | ((imm >> 11) & 1) << 7 | 0x63;
+}
+
+static Word jal_type(void) {
+    Word imm = (rand() % 512) << 1;
+    return ((imm >> 1) & 0x3FF) << 21 | ((imm >> 11) & 1) << 20 | ((imm >> 12) & 0xFF) << 12 | rd() << 7 | 0x6F;
+}
+
+static Word lui_type(void) {
+    return (random_word() & 0xFFFFF000) | rd() << 7 | 0x37;
+}
+
+static Word ecall_type(void) {
+    return 0x73;
+}
+
+static Word (*const generators[])(void) = {
+    rtype, itype, load_type, store_type, branch_type, jal_type, lui_type, ecall_type
+};
+
+static void setup(void) {
+    unsigned i, k;
+
+    srand(61);
+    memory = alloc_memory();
+    if (memory == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    for (i = 0; i < INPUTS; i++) {
+        for (k = 0; k < 8; k++) {
+            programs[k][i] = generators[k]();
+        }
+        /* a mix of every class, so the decoder's switch is not predictable */
+        words[i] = programs[rand() % 8][i];
+        fields[i] = random_word() & 0x7FFFFFFF;
+        widths[i] = 1 + rand() % 31;
+        parsed[i] = parse_instruction(words[i]);
+        addresses[i][0] = rand() % MEMORY_SPACE;
+        addresses[i][1] = (rand() % MEMORY_SPACE) & ~1;
+        addresses[i][2] = (rand() % MEMORY_SPACE) & ~3;
+    }
+    init_processor(&processor);
+    for (i = 5; i < 10; i++) {
+        processor.R[i] = random_word();
+    }
+    for (i = 20; i < 24; i++) {
+        processor.R[i] = DATA_BASE;
+    }
+    processor.R[10] = 1;
+}
+
+static void run_sign_extend(unsigned count) {
+    unsigned i;
+    for (i = 0; i < count; i++) {
+        sink += sign_extend_number(fields[i & (INPUTS - 1)], widths[i & (INPUTS - 1)]);
+    }
+}
+
+static void run_parse(unsigned count) {
+    unsigned i;
+    for (i = 0; i < count; i++) {
+        sink += parse_instruction(words[i & (INPUTS - 1)]).rtype.rs2;
+    }
+}
+
+static void run_branch_offset(unsigned count) {
+    unsigned i;
+    for (i = 0; i < count; i++) {
+        sink += get_branch_offset(parsed[i & (INPUTS - 1)]);
+    }
+}
+
+static void run_jump_offset(unsigned count) {
+    unsigned i;
+    for (i = 0; i < count; i++) {
+        sink += get_jump_offset(parsed[i & (INPUTS - 1)]);
+    }
+}
+
+static void run_store_offset(unsigned count) {
+    unsigned i;
+    for (i = 0; i < count; i++) {
+        sink += get_store_offset(parsed[i & (INPUTS - 1)]);
+    }
+}
+
+#define LOAD_STORE(width, index, alignment) \
+    static void run_load_##width(unsigned count) { \
+        unsigned i; \
+        for (i = 0; i < count; i++) { \
+            sink += load(memory, addresses[i & (INPUTS - 1)][index], alignment); \
+        } \
+    } \
+    static void run_store_##width(unsigned count) { \
+        unsigned i; \
+        for (i = 0; i < count; i++) { \
+            store(memory, addresses[i & (INPUTS - 1)][index], alignment, i); \
+        } \
+    }
+
+LOAD_STORE(byte, 0, LENGTH_BYTE)
+LOAD_STORE(half, 1, LENGTH_HALF_WORD)
+LOAD_STORE(word, 2, LENGTH_WORD)
+
+#define EXECUTE(class, index) \
+    static void run_execute_##class(unsigned count) { \
+        unsigned i; \
+        for (i = 0; i < count; i++) { \
+            execute_instruction(programs[index][i & (INPUTS - 1)], &processor, memory); \
+        } \
+    }
+
+EXECUTE(rtype, 0)
+EXECUTE(itype, 1)
+EXECUTE(load, 2)
+EXECUTE(store, 3)
+EXECUTE(branch, 4)
+EXECUTE(jal, 5)
+EXECUTE(lui, 6)
+EXECUTE(ecall, 7)
+
+static const Benchmark benchmarks[] = {
+    {"sign_extend_number", run_sign_extend},
+    {"parse_instruction", run_parse},
+    {"get_branch_offset", run_branch_offset},
+    {"get_jump_offset", run_jump_offset},
+    {"get_store_offset", run_store_offset},
+    {"load_byte", run_load_byte},
+    {"load_half", run_load_half},
+    {"load_word", run_load_word},
+    {"store_byte", run_store_byte},
+    {"store_half", run_store_half},
+    {"store_word", run_store_word},
+    {"execute_rtype", run_execute_rtype},
+    {"execute_itype", run_execute_itype},
+    {"execute_load", run_execute_load},
+    {"execute_store", run_execute_store},
+    {"execute_branch", run_execute_branch},
+    {"execute_jal", run_execute_jal},
+    {"execute_lui", run_execute_lui},
+    {"execute_ecall", run_execute_ecall},
+};
+
+static double elapsed_ns(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+static Result measure(const Benchmark *benchmark, unsigned samples) {
+    double ns[MAX_SAMPLES], sum = 0, squares = 0, mean;
+    struct timespec start;
+    unsigned count = INPUTS, i;
+    Result result;
+
+    /* warm up, and size the samples */
+    for (;;) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        benchmark->run(count);
+        if (elapsed_ns(&start) >= SAMPLE_NS || count >= 1U << 30) {
+            break;
+        }
+        count *= 2;
+    }
+    result.min = INFINITY;
+    for (i = 0; i < samples; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        benchmark->run(count);
+        ns[i] = elapsed_ns(&start) / count;
+        sum += ns[i];
+        if (ns[i] < result.min) {
+            result.min = ns[i];
+        }
+    }
+    mean = sum / samples;
+    for (i = 0; i < samples; i++) {
+        squares += (ns[i] - mean) * (ns[i] - mean);
+    }
+    result.ns = mean;
+    /* normal approximation, good enough from a dozen samples on */
+    result.ci95 = samples > 1 ? 1.96 * sqrt(squares / (samples - 1)) / sqrt(samples) : 0;
+    return result;
+}
+
+/* Finds name in a file written by this program; returns 0 if found */
+static int baseline_result(FILE *file, const char *name, Result *result) {
+    char line[256], found[64];
+
+    rewind(file);
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, " \"%63[^\"]\": {\"ns\": %lf, \"ci95\": %lf, \"min\": %lf}",
+                   found, &result->ns, &result->ci95, &result->min) == 4 && strcmp(found, name) == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int main(int argc, char **argv) {
+    unsigned samples = 30, i, count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+    const char *output = NULL, *baseline = NULL;
+    Result results[sizeof(benchmarks) / sizeof(benchmarks[0])], old;
+    FILE *out = stdout, *previous = NULL;
+    double change;
+    int c;
+
+    while ((c = getopt(argc, argv, "r:o:b:")) != -1) {
+        switch (c) {
+            case 'r':
+                samples = strtoul(optarg, NULL, 0);
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'b':
+                baseline = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-r SAMPLES] [-o out.json] [-b baseline.json]\n", argv[0]);
+                return -1;
+        }
+    }
+    if (samples < 2 || samples > MAX_SAMPLES) {
+        fprintf(stderr, "Between 2 and %d samples\n", MAX_SAMPLES);
+        return -1;
+    }
+    if (baseline && (previous = fopen(baseline, "r")) == NULL) {
+        fprintf(stderr, "Cannot read %s\n", baseline);
+        return -1;
+    }
+
+    setup();
+    for (i = 0; i < count; i++) {
+        results[i] = measure(&benchmarks[i], samples);
+    }
+
+    if (output && (out = fopen(output, "w")) == NULL) {
+        fprintf(stderr, "Cannot write %s\n", output);
+        return -1;
+    }
+    fprintf(out, "{\n  \"samples\": %u,\n  \"benchmarks\": {\n", samples);
+    for (i = 0; i < count; i++) {
+        fprintf(out, "    \"%s\": {\"ns\": %.3f, \"ci95\": %.3f, \"min\": %.3f}%s\n", benchmarks[i].name,
+                results[i].ns, results[i].ci95, results[i].min, i + 1 < count ? "," : "");
+    }
+    fprintf(out, "  }\n}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    for (i = 0; previous && i < count; i++) {
+        if (baseline_result(previous, benchmarks[i].name, &old) != 0) {
+            fprintf(stderr, "%-20s %8.3f ns  (new)\n", benchmarks[i].name, results[i].ns);
+            continue;
+        }
+        change = 100 * (results[i].ns - old.ns) / old.ns;
+        fprintf(stderr, "%-20s %8.3f ns  %8.3f ns  %+6.1f%%%s\n", benchmarks[i].name, old.ns, results[i].ns,
+                change, results[i].ns - old.ns > results[i].ci95 + old.ci95 ? "  SLOWER" : "");
+    }
+    if (previous) {
+        fclose(previous);
+    }
+    free_memory(memory);
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "riscv.h"
+#include "utils.h"
+#include "memory.h"
+#include "engine.h"
+#include "cosim.h"
+
+static const char *status_names[] = {
+    "running", "exited", "invalid instruction", "bad read", "bad write",
+    "breakpoint", "watchpoint", "page fault"
+};
+
+/* Prints both machine states side by side, marking every difference */
+static void dump_states(const Processor *ref, Byte *ref_memory,
+                        const Processor *fast, Byte *fast_memory) {
+    Address mismatch;
+    int i;
+
+    fprintf(stderr, "       reference   engine\n");
+    fprintf(stderr, "%c pc   %08x    %08x\n", ref->PC != fast->PC ? '*' : ' ', ref->PC, fast->PC);
+    for (i = 0; i < 32; i++) {
+        fprintf(stderr, "%c r%2d  %08x    %08x\n", ref->R[i] != fast->R[i] ? '*' : ' ',
+                i, ref->R[i], fast->R[i]);
+    }
+    for (i = 0; i < 32; i++) {
+        if (ref->F[i] != fast->F[i]) {
+            fprintf(stderr, "* f%2d  %08x    %08x\n", i, ref->F[i], fast->F[i]);
+        }
+    }
+    fprintf(stderr, "%c fcsr %08x    %08x\n", ref->fcsr != fast->fcsr ? '*' : ' ', ref->fcsr, fast->fcsr);
+    if (compare_dirty_pages(ref_memory, fast_memory, &mismatch)) {
+        fprintf(stderr, "* mem[%08x]  %02x    %02x\n", mismatch,
+                ref_memory[mismatch], fast_memory[mismatch]);
+    }
+}
+
+/* Runs the reference interpreter from part2.c and the predecoded engine in
+ * lockstep on separate copies of the loaded program, comparing registers
+ * and dirty memory every interval instructions. Returns the exit code for
+ * the simulator: the guest's if both engines agree until it exits, 1 on
+ * the first divergence. */
+int cosimulate(const Processor *initial, Byte *memory, uint64_t interval) {
+    Processor ref = *initial, fast = *initial;
+    Byte *fast_memory = alloc_memory();
+    Engine engine;
+    EngineStatus status;
+    uint64_t instret = 0, checked = 0, n;
+    uint32_t instruction_bits;
+    Address mismatch;
+    int exiting = 0, diverged, ref_status = EXEC_OK;
+
+    if (fast_memory == NULL || engine_init(&engine, &fast, fast_memory, NULL) != 0) {
+        fprintf(stderr, "Out of memory for co-simulation\n");
+        return -1;
+    }
+    memcpy(fast_memory, memory, MEMORY_SPACE);
+    clear_dirty(memory);
+
+    while (!exiting) {
+        /* reference side; stop short of the exit ecall so the final states
+           can still be compared. Faulting instructions change nothing, so
+           the states are compared up to them too. */
+        for (n = 0; n < interval; n++) {
+            if (fetch_instruction(&ref, memory, &instruction_bits) != EXEC_OK
+                || (instruction_bits == 0x00000073 && ref.R[10] == 10)) {
+                exiting = 1;
+                break;
+            }
+            ref_status = execute_instruction(instruction_bits, &ref, memory);
+            if (ref_status != EXEC_OK) {
+                exiting = 1;
+                break;
+            }
+            ref.R[0] = 0;
+        }
+        instret += n;
+
+        status = engine_run(&engine, n);
+        diverged = status != ENGINE_BUDGET || engine.instret != instret
+            || ref.PC != fast.PC || memcmp(ref.R, fast.R, sizeof(ref.R)) != 0
+            || memcmp(ref.F, fast.F, sizeof(ref.F)) != 0 || ref.fcsr != fast.fcsr
+            || compare_dirty_pages(memory, fast_memory, &mismatch);
+        if (diverged) {
+            fprintf(stderr, "Co-simulation diverged between instructions %llu and %llu",
+                    (unsigned long long) checked, (unsigned long long) instret);
+            if (status != ENGINE_BUDGET) {
+                fprintf(stderr, " (engine stopped early: %s)", status_names[status]);
+            }
+            fprintf(stderr, "\n");
+            dump_states(&ref, memory, &fast, fast_memory);
+            engine_free(&engine);
+            free_memory(fast_memory);
+            return 1;
+        }
+        clear_dirty(memory);
+        clear_dirty(fast_memory);
+        checked = instret;
+    }
+
+    fprintf(stderr, "Co-simulation matched for %llu instructions\n", (unsigned long long) instret);
+    engine_free(&engine);
+    free_memory(fast_memory);
+
+    /* let the reference perform the exit ecall itself, or repeat the fetch
+       that failed */
+    if (ref_status == EXEC_OK) {
+        ref_status = fetch_instruction(&ref, memory, &instruction_bits);
+    }
+    if (ref_status == EXEC_OK) {
+        ref_status = execute_instruction(instruction_bits, &ref, memory);
+    }
+    switch (ref_status) {
+        case EXEC_EXIT:
+            return MEMORY_CONTEXT(memory)->exit_code;
+        case EXEC_INVALID_INSTRUCTION:
+            handle_invalid_instruction(parse_instruction(MEMORY_CONTEXT(memory)->fault));
+            break;
+        case EXEC_BAD_READ:
+            handle_invalid_read(MEMORY_CONTEXT(memory)->fault);
+            break;
+        case EXEC_BAD_WRITE:
+            handle_invalid_write(MEMORY_CONTEXT(memory)->fault);
+            break;
+    }
+    return -1;
+}
@@ -0,0 +1,10 @@
+#ifndef COSIM_H
+#define COSIM_H
+
+#include <stdint.h>
+#include "types.h"
+
+/* see cosim.c */
+int cosimulate(const Processor *initial, Byte *memory, uint64_t interval);
+
+#endif
@@ -0,0 +1,87 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include "coverage.h"
+
+/* File layout: the magic, then the three bitmaps as in Coverage */
+#define COVERAGE_MAGIC "RVCOV1\n"
+
+void coverage_mark_range(Coverage *coverage, Address address, unsigned count) {
+    for (; count > 0 && (address & 31); count--, address += 4) {
+        COVERAGE_MARK(coverage->executed, address);
+    }
+    /* whole bytes of the bitmap */
+    for (; count >= 8; count -= 8, address += 32) {
+        coverage->executed[(address >> 5) & (COVERAGE_WORDS / 8 - 1)] = 0xFF;
+    }
+    for (; count > 0; count--, address += 4) {
+        COVERAGE_MARK(coverage->executed, address);
+    }
+}
+
+static void merge(Coverage *coverage, const Coverage *other) {
+    unsigned i;
+
+    for (i = 0; i < COVERAGE_WORDS / 8; i++) {
+        coverage->executed[i] |= other->executed[i];
+        coverage->taken[i] |= other->taken[i];
+        coverage->not_taken[i] |= other->not_taken[i];
+    }
+}
+
+static int read_file(int fd, Coverage *coverage) {
+    char magic[sizeof(COVERAGE_MAGIC)];
+
+    if (read(fd, magic, sizeof(magic)) != sizeof(magic) || memcmp(magic, COVERAGE_MAGIC, sizeof(magic)) != 0
+        || read(fd, coverage, sizeof(Coverage)) != sizeof(Coverage)) {
+        return -1;
+    }
+    return 0;
+}
+
+int coverage_merge(Coverage *coverage, const char *path) {
+    Coverage *other = malloc(sizeof(Coverage));
+    int fd = open(path, O_RDONLY), result = -1;
+
+    if (other && fd >= 0 && read_file(fd, other) == 0) {
+        merge(coverage, other);
+        result = 0;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(other);
+    return result;
+}
+
+/* The file stays locked from reading to writing, so runs that finish at
+ * the same time do not lose each other's coverage */
+int coverage_save(const Coverage *coverage, const char *path) {
+    Coverage *merged = malloc(sizeof(Coverage));
+    int fd = open(path, O_RDWR | O_CREAT, 0644), result = -1;
+
+    if (merged == NULL || fd < 0 || flock(fd, LOCK_EX) != 0) {
+        goto done;
+    }
+    if (lseek(fd, 0, SEEK_END) > 0) {
+        lseek(fd, 0, SEEK_SET);
+        if (read_file(fd, merged) != 0) {
+            goto done;
+        }
+        merge(merged, coverage);
+    } else {
+        memcpy(merged, coverage, sizeof(Coverage));
+    }
+    if (pwrite(fd, COVERAGE_MAGIC, sizeof(COVERAGE_MAGIC), 0) == sizeof(COVERAGE_MAGIC)
+        && pwrite(fd, merged, sizeof(Coverage), sizeof(COVERAGE_MAGIC)) == sizeof(Coverage)) {
+        result = 0;
+    }
+done:
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(merged);
+    return result;
+}
@@ -0,0 +1,31 @@
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include "types.h"
+
+/* Guest code coverage: one bit per word of guest memory that retired as
+   an instruction, and one each for the taken and the not-taken edge of a
+   branch there. Addresses are physical. Files written by coverage_save()
+   are merged into instead of overwritten, so one file collects many runs;
+   covreport turns them into an lcov report. */
+
+#define COVERAGE_WORDS (MEMORY_SPACE / 4)
+
+typedef struct {
+    Byte executed[COVERAGE_WORDS / 8];
+    Byte taken[COVERAGE_WORDS / 8];
+    Byte not_taken[COVERAGE_WORDS / 8];
+} Coverage;
+
+#define COVERAGE_MARK(bits, address) ((bits)[((address) >> 5) & (COVERAGE_WORDS / 8 - 1)] |= 1 << (((address) >> 2) & 7))
+#define COVERAGE_TEST(bits, address) (((bits)[((address) >> 5) & (COVERAGE_WORDS / 8 - 1)] >> (((address) >> 2) & 7)) & 1)
+
+/* Marks count words from address as executed */
+void coverage_mark_range(Coverage *coverage, Address address, unsigned count);
+/* Adds the coverage in path to coverage. Returns 0, or -1 if path is not
+   a coverage file. */
+int coverage_merge(Coverage *coverage, const char *path);
+/* Writes coverage merged with what path already holds */
+int coverage_save(const Coverage *coverage, const char *path);
+
+#endif
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "coverage.h"
+
+/* Merges the coverage files written by ./riscv -C FILE and writes an lcov
+ * tracefile for the program, for genhtml or lcov --summary. Line N of the
+ * report is the instruction at 0x1000 + 4 * (N - 1), which is line N of
+ * the .input file and of ./riscv -d; -s names a saved -d listing as the
+ * source instead. Symbols in nm format (-y) become functions, counted as
+ * hit if their first instruction ran. -m also writes the merged coverage. */
+
+#define LOAD_ADDRESS 0x1000
+#define MAX_WORDS ((MEMORY_SPACE - LOAD_ADDRESS) / 4)
+#define MAX_SYMBOLS 4096
+
+typedef struct {
+    Address address;
+    char name[128];
+} Symbol;
+
+/* The same format load_program() reads */
+static int read_program(const char *path, Word *words) {
+    FILE *file = fopen(path, "r");
+    char line[50];
+    int count = 0;
+
+    if (file == NULL) {
+        return -1;
+    }
+    while (count < MAX_WORDS && fgets(line, sizeof(line), file) != NULL) {
+        words[count++] = strtoul(line, NULL, 16);
+    }
+    fclose(file);
+    return count;
+}
+
+/* "address type name" lines as printed by nm, or just "address name" */
+static int read_symbols(const char *path, Symbol *symbols) {
+    FILE *file = fopen(path, "r");
+    char line[256], first[128], second[128];
+    unsigned address;
+    int count = 0, fields;
+
+    if (file == NULL) {
+        return -1;
+    }
+    while (count < MAX_SYMBOLS && fgets(line, sizeof(line), file) != NULL) {
+        fields = sscanf(line, "%x %127s %127s", &address, first, second);
+        if (fields >= 2) {
+            symbols[count].address = address;
+            strcpy(symbols[count].name, fields == 3 ? second : first);
+            count++;
+        }
+    }
+    fclose(file);
+    return count;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: covreport [-s source] [-y symbols] [-m merged] [-o report] program coverage...\n");
+}
+
+int main(int argc, char **argv) {
+    const char *source = NULL, *symbol_path = NULL, *merged = NULL, *report = NULL;
+    static Word words[MAX_WORDS];
+    static Symbol symbols[MAX_SYMBOLS];
+    Coverage *coverage = calloc(1, sizeof(Coverage));
+    unsigned lines_hit = 0, edges = 0, edges_hit = 0, functions = 0, functions_hit = 0;
+    int count, symbol_count = 0, i, c, hit;
+    Address address;
+    FILE *out = stdout;
+
+    while ((c = getopt(argc, argv, "s:y:m:o:")) != -1) {
+        switch (c) {
+            case 's':
+                source = optarg;
+                break;
+            case 'y':
+                symbol_path = optarg;
+                break;
+            case 'm':
+                merged = optarg;
+                break;
+            case 'o':
+                report = optarg;
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    if (argc - optind < 2) {
+        usage();
+        return 1;
+    }
+    count = read_program(argv[optind], words);
+    if (count < 0) {
+        fprintf(stderr, "Cannot read %s\n", argv[optind]);
+        return 1;
+    }
+    if (symbol_path && (symbol_count = read_symbols(symbol_path, symbols)) < 0) {
+        fprintf(stderr, "Cannot read %s\n", symbol_path);
+        return 1;
+    }
+    for (i = optind + 1; i < argc; i++) {
+        if (coverage_merge(coverage, argv[i]) != 0) {
+            fprintf(stderr, "%s is not a coverage file\n", argv[i]);
+            return 1;
+        }
+    }
+    if (merged && coverage_save(coverage, merged) != 0) {
+        fprintf(stderr, "Cannot write %s\n", merged);
+        return 1;
+    }
+    if (report && (out = fopen(report, "w")) == NULL) {
+        fprintf(stderr, "Cannot write %s\n", report);
+        return 1;
+    }
+
+    fprintf(out, "TN:\nSF:%s\n", source ? source : argv[optind]);
+    for (i = 0; i < symbol_count; i++) {
+        address = symbols[i].address;
+        if (address >= LOAD_ADDRESS && address < LOAD_ADDRESS + 4 * (Address) count && !(address & 3)) {
+            fprintf(out, "FN:%u,%s\n", (address - LOAD_ADDRESS) / 4 + 1, symbols[i].name);
+        }
+    }
+    for (i = 0; i < symbol_count; i++) {
+        address = symbols[i].address;
+        if (address >= LOAD_ADDRESS && address < LOAD_ADDRESS + 4 * (Address) count && !(address & 3)) {
+            hit = COVERAGE_TEST(coverage->executed, address);
+            fprintf(out, "FNDA:%d,%s\n", hit, symbols[i].name);
+            functions++;
+            functions_hit += hit;
+        }
+    }
+    if (symbol_count > 0) {
+        fprintf(out, "FNF:%u\nFNH:%u\n", functions, functions_hit);
+    }
+    /* a branch that never ran has no edges to count, "-" in lcov */
+    for (i = 0; i < count; i++) {
+        address = LOAD_ADDRESS + 4 * i;
+        if ((words[i] & 0x7F) != 0x63) {
+            continue;
+        }
+        edges += 2;
+        if (COVERAGE_TEST(coverage->executed, address)) {
+            fprintf(out, "BRDA:%d,0,0,%d\nBRDA:%d,0,1,%d\n",
+                    i + 1, COVERAGE_TEST(coverage->taken, address),
+                    i + 1, COVERAGE_TEST(coverage->not_taken, address));
+            edges_hit += COVERAGE_TEST(coverage->taken, address) + COVERAGE_TEST(coverage->not_taken, address);
+        } else {
+            fprintf(out, "BRDA:%d,0,0,-\nBRDA:%d,0,1,-\n", i + 1, i + 1);
+        }
+    }
+    fprintf(out, "BRF:%u\nBRH:%u\n", edges, edges_hit);
+    for (i = 0; i < count; i++) {
+        hit = COVERAGE_TEST(coverage->executed, LOAD_ADDRESS + 4 * i);
+        fprintf(out, "DA:%d,%d\n", i + 1, hit);
+        lines_hit += hit;
+    }
+    fprintf(out, "LF:%d\nLH:%u\nend_of_record\n", count, lines_hit);
+
+    fprintf(stderr, "%u of %d instructions executed, %u of %u branch edges taken\n",
+            lines_hit, count, edges_hit, edges);
+    if (out != stdout) {
+        fclose(out);
+    }
+    free(coverage);
+    return 0;
+}
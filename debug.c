@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "memory.h"
+#include "engine.h"
+#include "debug.h"
+
+/* The SIGSEGV handler has no way to find its debugger other than this */
+static Debugger *active_debugger;
+static struct sigaction previous_action;
+static long host_page_size;
+
+static void watch_handler(int sig, siginfo_t *info, void *context) {
+    Debugger *debugger = active_debugger;
+    Byte *memory = debugger ? debugger->engine->memory : NULL;
+    Byte *address = info->si_addr;
+
+    if (memory == NULL || address < memory || address >= memory + MEMORY_SPACE) {
+        /* a real crash: let it happen */
+        sigaction(SIGSEGV, &previous_action, NULL);
+        return;
+    }
+    /* let the access go through, debug_run() puts the protection back */
+    mprotect(memory + ((address - memory) & ~(host_page_size - 1)), host_page_size,
+             PROT_READ | PROT_WRITE);
+    if (!debugger->engine->translating) {
+        debugger->hit_address = address - memory;
+        debugger->engine->stop = 1;
+    }
+}
+
+int debug_init(Debugger *debugger, Engine *engine) {
+    struct sigaction action;
+
+    memset(debugger, 0, sizeof(Debugger));
+    debugger->engine = engine;
+    host_page_size = sysconf(_SC_PAGESIZE);
+
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = watch_handler;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGSEGV, &action, &previous_action) != 0) {
+        return -1;
+    }
+    active_debugger = debugger;
+    return 0;
+}
+
+void debug_free(Debugger *debugger) {
+    if (active_debugger == debugger) {
+        sigaction(SIGSEGV, &previous_action, NULL);
+        active_debugger = NULL;
+    }
+}
+
+static int overlaps(Watchpoint *watchpoint, Address start, Word length) {
+    return start < watchpoint->address + watchpoint->length
+        && watchpoint->address < start + length;
+}
+
+/* Applies the protection every watchpoint needs: read-only pages catch
+ * writes, inaccessible pages catch reads as well */
+static void protect_watched(Debugger *debugger, int enable) {
+    Byte *memory = debugger->engine->memory;
+    Address page, first, last;
+    unsigned i;
+    int prot;
+
+    for (i = 0; i < debugger->watchpoint_count; i++) {
+        Watchpoint *watchpoint = &debugger->watchpoints[i];
+        first = watchpoint->address & ~(host_page_size - 1);
+        last = (watchpoint->address + watchpoint->length - 1) & ~(host_page_size - 1);
+        prot = watchpoint->type == WATCH_WRITE ? PROT_READ : PROT_NONE;
+        for (page = first; page <= last && page < MEMORY_SPACE; page += host_page_size) {
+            if (!enable) {
+                prot = PROT_READ | PROT_WRITE;
+            } else if (prot == PROT_READ) {
+                /* another watchpoint on this page may need PROT_NONE */
+                unsigned j;
+                for (j = 0; j < debugger->watchpoint_count; j++) {
+                    if (debugger->watchpoints[j].type != WATCH_WRITE
+                        && overlaps(&debugger->watchpoints[j], page, host_page_size)) {
+                        prot = PROT_NONE;
+                    }
+                }
+            }
+            mprotect(memory + page, host_page_size, prot);
+        }
+    }
+}
+
+/* Turning watchpoints on or off changes how blocks are cut */
+static void update_watch_mode(Debugger *debugger) {
+    int watch_mode = debugger->watchpoint_count > 0;
+    if (debugger->engine->watch_mode != watch_mode) {
+        debugger->engine->watch_mode = watch_mode;
+        engine_flush(debugger->engine);
+    }
+}
+
+int debug_set_watchpoint(Debugger *debugger, Address address, Word length, WatchType type) {
+    Watchpoint *watchpoint;
+
+    if (length == 0 || address >= MEMORY_SPACE || length > MEMORY_SPACE - address
+        || debugger->watchpoint_count == MAX_WATCHPOINTS) {
+        return -1;
+    }
+    watchpoint = &debugger->watchpoints[debugger->watchpoint_count++];
+    watchpoint->address = address;
+    watchpoint->length = length;
+    watchpoint->type = type;
+    update_watch_mode(debugger);
+    return 0;
+}
+
+int debug_clear_watchpoint(Debugger *debugger, Address address, Word length, WatchType type) {
+    unsigned i;
+    for (i = 0; i < debugger->watchpoint_count; i++) {
+        Watchpoint *watchpoint = &debugger->watchpoints[i];
+        if (watchpoint->address == address && watchpoint->length == length && watchpoint->type == type) {
+            *watchpoint = debugger->watchpoints[--debugger->watchpoint_count];
+            update_watch_mode(debugger);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Works out which watchpoint, if any, the access that just stopped the
+ * engine belongs to. The accessing instruction is the one before the PC,
+ * since blocks end after every access in watch mode. */
+static Watchpoint *find_hit(Debugger *debugger) {
+    Engine *engine = debugger->engine;
+    Address pc = engine->processor->PC - 4;
+    DecodedOp op = decode_op(pc < MEMORY_SPACE ? *(Word *) (engine->memory + pc) : 0);
+    int is_write = (op.kind >= OP_SB && op.kind <= OP_SW) || op.kind == OP_FSW;
+    unsigned i;
+
+    for (i = 0; i < debugger->watchpoint_count; i++) {
+        Watchpoint *watchpoint = &debugger->watchpoints[i];
+        if (!overlaps(watchpoint, debugger->hit_address, 1)) {
+            continue;
+        }
+        if (watchpoint->type == WATCH_ACCESS || (watchpoint->type == WATCH_WRITE) == is_write) {
+            return watchpoint;
+        }
+    }
+    return NULL;
+}
+
+/* Runs like engine_run(), but steps over a breakpoint at the current PC
+ * and filters out accesses that only share a page with a watchpoint. */
+EngineStatus debug_run(Debugger *debugger, uint64_t budget) {
+    Engine *engine = debugger->engine;
+    EngineStatus status = ENGINE_BUDGET;
+    Address pc = engine->processor->PC;
+    uint64_t start;
+
+    debugger->hit = NULL;
+    while (budget > 0) {
+        start = engine->instret;
+        protect_watched(debugger, 1);
+        if (engine_has_breakpoint(engine, pc)) {
+            engine_clear_breakpoint(engine, pc);
+            status = engine_run(engine, 1);
+            engine_set_breakpoint(engine, pc);
+            if (status == ENGINE_BUDGET && budget > 1) {
+                status = engine_run(engine, budget - 1);
+            }
+        } else {
+            status = engine_run(engine, budget);
+        }
+        protect_watched(debugger, 0);
+
+        budget -= engine->instret - start;
+        pc = engine->processor->PC;
+        if (status != ENGINE_WATCHPOINT) {
+            break;
+        }
+        debugger->hit = find_hit(debugger);
+        if (debugger->hit) {
+            break;
+        }
+        status = ENGINE_BUDGET;
+    }
+    return status;
+}
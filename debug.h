@@ -0,0 +1,39 @@
+#ifndef DEBUG_H
+#define DEBUG_H
+
+#include "types.h"
+#include "engine.h"
+
+#define MAX_WATCHPOINTS 16
+
+typedef enum {
+    WATCH_WRITE = 2,    /* numbered like the gdb Z2/Z3/Z4 packets */
+    WATCH_READ = 3,
+    WATCH_ACCESS = 4,
+} WatchType;
+
+typedef struct {
+    Address address;
+    Word length;
+    WatchType type;
+} Watchpoint;
+
+/* Breakpoints and watchpoints on top of the predecoded engine. Breakpoints
+   live in the engine's decode cache; watchpoints protect the host pages
+   backing the watched guest memory, so neither costs anything while the
+   guest runs code that does not touch them. */
+typedef struct {
+    Engine *engine;
+    Watchpoint watchpoints[MAX_WATCHPOINTS];
+    unsigned watchpoint_count;
+    Watchpoint *hit;            /* watchpoint behind the last ENGINE_WATCHPOINT */
+    Address hit_address;
+} Debugger;
+
+int debug_init(Debugger *debugger, Engine *engine);
+void debug_free(Debugger *debugger);
+int debug_set_watchpoint(Debugger *debugger, Address address, Word length, WatchType type);
+int debug_clear_watchpoint(Debugger *debugger, Address address, Word length, WatchType type);
+EngineStatus debug_run(Debugger *debugger, uint64_t budget);
+
+#endif
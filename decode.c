@@ -0,0 +1,142 @@
+#include <string.h>
+#include "decode.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+/* Decodes instruction i of words the plain way. Used for the tail of a
+ * block and on hosts without vector units. */
+static void decode_one(const Word *words, unsigned i, DecodedBlock *block) {
+    Word bits = words[i];
+    sWord sbits = (sWord) bits;
+
+    block->bits[i] = bits;
+    block->opcode[i] = bits & 0x7F;
+    block->rd[i] = (bits >> 7) & 0x1F;
+    block->funct3[i] = (bits >> 12) & 0x7;
+    block->rs1[i] = (bits >> 15) & 0x1F;
+    block->rs2[i] = (bits >> 20) & 0x1F;
+    block->funct7[i] = bits >> 25;
+    block->imm_i[i] = sbits >> 20;
+    block->imm_s[i] = ((sbits >> 20) & ~0x1F) | ((bits >> 7) & 0x1F);
+    block->imm_b[i] = ((sbits >> 19) & ~0xFFF) | ((bits << 4) & 0x800)
+        | ((bits >> 20) & 0x7E0) | ((bits >> 7) & 0x1E);
+    block->imm_u[i] = bits & 0xFFFFF000;
+    block->imm_j[i] = ((sbits >> 11) & ~0xFFFFF) | (bits & 0xFF000)
+        | ((bits >> 9) & 0x800) | ((bits >> 20) & 0x7FE);
+}
+
+#ifdef HAVE_X86
+/* The same computation as decode_one(), 8 instructions per iteration */
+__attribute__((target("avx2")))
+static unsigned decode_avx2(const Word *words, unsigned count, DecodedBlock *block) {
+    const __m256i m5 = _mm256_set1_epi32(0x1F);
+    unsigned i;
+
+    for (i = 0; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (words + i));
+        __m256i rd = _mm256_and_si256(_mm256_srli_epi32(v, 7), m5);
+        __m256i imm_i = _mm256_srai_epi32(v, 20);
+        __m256i b, j;
+
+        _mm256_storeu_si256((__m256i *) (block->bits + i), v);
+        _mm256_storeu_si256((__m256i *) (block->opcode + i), _mm256_and_si256(v, _mm256_set1_epi32(0x7F)));
+        _mm256_storeu_si256((__m256i *) (block->rd + i), rd);
+        _mm256_storeu_si256((__m256i *) (block->funct3 + i),
+                            _mm256_and_si256(_mm256_srli_epi32(v, 12), _mm256_set1_epi32(0x7)));
+        _mm256_storeu_si256((__m256i *) (block->rs1 + i), _mm256_and_si256(_mm256_srli_epi32(v, 15), m5));
+        _mm256_storeu_si256((__m256i *) (block->rs2 + i), _mm256_and_si256(_mm256_srli_epi32(v, 20), m5));
+        _mm256_storeu_si256((__m256i *) (block->funct7 + i), _mm256_srli_epi32(v, 25));
+        _mm256_storeu_si256((__m256i *) (block->imm_i + i), imm_i);
+        _mm256_storeu_si256((__m256i *) (block->imm_s + i),
+                            _mm256_or_si256(_mm256_andnot_si256(m5, imm_i), rd));
+
+        b = _mm256_andnot_si256(_mm256_set1_epi32(0xFFF), _mm256_srai_epi32(v, 19));
+        b = _mm256_or_si256(b, _mm256_and_si256(_mm256_slli_epi32(v, 4), _mm256_set1_epi32(0x800)));
+        b = _mm256_or_si256(b, _mm256_and_si256(_mm256_srli_epi32(v, 20), _mm256_set1_epi32(0x7E0)));
+        b = _mm256_or_si256(b, _mm256_and_si256(_mm256_srli_epi32(v, 7), _mm256_set1_epi32(0x1E)));
+        _mm256_storeu_si256((__m256i *) (block->imm_b + i), b);
+
+        _mm256_storeu_si256((__m256i *) (block->imm_u + i),
+                            _mm256_and_si256(v, _mm256_set1_epi32(0xFFFFF000)));
+
+        j = _mm256_andnot_si256(_mm256_set1_epi32(0xFFFFF), _mm256_srai_epi32(v, 11));
+        j = _mm256_or_si256(j, _mm256_and_si256(v, _mm256_set1_epi32(0xFF000)));
+        j = _mm256_or_si256(j, _mm256_and_si256(_mm256_srli_epi32(v, 9), _mm256_set1_epi32(0x800)));
+        j = _mm256_or_si256(j, _mm256_and_si256(_mm256_srli_epi32(v, 20), _mm256_set1_epi32(0x7FE)));
+        _mm256_storeu_si256((__m256i *) (block->imm_j + i), j);
+    }
+    return i;
+}
+
+/* SSE2 is always there on x86-64, 4 instructions per iteration */
+static unsigned decode_sse2(const Word *words, unsigned count, DecodedBlock *block) {
+    const __m128i m5 = _mm_set1_epi32(0x1F);
+    unsigned i;
+
+    for (i = 0; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (words + i));
+        __m128i rd = _mm_and_si128(_mm_srli_epi32(v, 7), m5);
+        __m128i imm_i = _mm_srai_epi32(v, 20);
+        __m128i b, j;
+
+        _mm_storeu_si128((__m128i *) (block->bits + i), v);
+        _mm_storeu_si128((__m128i *) (block->opcode + i), _mm_and_si128(v, _mm_set1_epi32(0x7F)));
+        _mm_storeu_si128((__m128i *) (block->rd + i), rd);
+        _mm_storeu_si128((__m128i *) (block->funct3 + i),
+                         _mm_and_si128(_mm_srli_epi32(v, 12), _mm_set1_epi32(0x7)));
+        _mm_storeu_si128((__m128i *) (block->rs1 + i), _mm_and_si128(_mm_srli_epi32(v, 15), m5));
+        _mm_storeu_si128((__m128i *) (block->rs2 + i), _mm_and_si128(_mm_srli_epi32(v, 20), m5));
+        _mm_storeu_si128((__m128i *) (block->funct7 + i), _mm_srli_epi32(v, 25));
+        _mm_storeu_si128((__m128i *) (block->imm_i + i), imm_i);
+        _mm_storeu_si128((__m128i *) (block->imm_s + i), _mm_or_si128(_mm_andnot_si128(m5, imm_i), rd));
+
+        b = _mm_andnot_si128(_mm_set1_epi32(0xFFF), _mm_srai_epi32(v, 19));
+        b = _mm_or_si128(b, _mm_and_si128(_mm_slli_epi32(v, 4), _mm_set1_epi32(0x800)));
+        b = _mm_or_si128(b, _mm_and_si128(_mm_srli_epi32(v, 20), _mm_set1_epi32(0x7E0)));
+        b = _mm_or_si128(b, _mm_and_si128(_mm_srli_epi32(v, 7), _mm_set1_epi32(0x1E)));
+        _mm_storeu_si128((__m128i *) (block->imm_b + i), b);
+
+        _mm_storeu_si128((__m128i *) (block->imm_u + i), _mm_and_si128(v, _mm_set1_epi32(0xFFFFF000)));
+
+        j = _mm_andnot_si128(_mm_set1_epi32(0xFFFFF), _mm_srai_epi32(v, 11));
+        j = _mm_or_si128(j, _mm_and_si128(v, _mm_set1_epi32(0xFF000)));
+        j = _mm_or_si128(j, _mm_and_si128(_mm_srli_epi32(v, 9), _mm_set1_epi32(0x800)));
+        j = _mm_or_si128(j, _mm_and_si128(_mm_srli_epi32(v, 20), _mm_set1_epi32(0x7FE)));
+        _mm_storeu_si128((__m128i *) (block->imm_j + i), j);
+    }
+    return i;
+}
+#endif
+
+/* Splits count (at most DECODE_BLOCK_SIZE) instruction words into their
+ * fields, using the widest vector unit the host has */
+void decode_block(const Word *words, unsigned count, DecodedBlock *block) {
+    unsigned i = 0;
+#ifdef HAVE_X86
+    static int have_avx2 = -1;
+    if (have_avx2 < 0) {
+        __builtin_cpu_init();
+        have_avx2 = __builtin_cpu_supports("avx2");
+    }
+    i = have_avx2 ? decode_avx2(words, count, block) : decode_sse2(words, count, block);
+#endif
+    for (; i < count; i++) {
+        decode_one(words, i, block);
+    }
+}
+
+/* Returns whether the simulator implements anything with this opcode */
+int is_known_opcode(Word opcode) {
+    switch (opcode) {
+        case 0x33: case 0x13: case 0x03: case 0x23:
+        case 0x63: case 0x6F: case 0x37: case 0x73:
+        case 0x07: case 0x27: case 0x53:
+        case 0x43: case 0x47: case 0x4B: case 0x4F:
+            return 1;
+        default:
+            return 0;
+    }
+}
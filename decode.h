@@ -0,0 +1,30 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#include "types.h"
+
+/* Instructions decoded per decode_block() call */
+#define DECODE_BLOCK_SIZE 64
+
+/* Every field of a run of instructions, one array per field. The
+   immediates are sign-extended and already in byte units, so imm_b and
+   imm_j are the real branch and jump offsets. */
+typedef struct {
+    Word opcode[DECODE_BLOCK_SIZE];
+    Word rd[DECODE_BLOCK_SIZE];
+    Word funct3[DECODE_BLOCK_SIZE];
+    Word rs1[DECODE_BLOCK_SIZE];
+    Word rs2[DECODE_BLOCK_SIZE];
+    Word funct7[DECODE_BLOCK_SIZE];
+    sWord imm_i[DECODE_BLOCK_SIZE];
+    sWord imm_s[DECODE_BLOCK_SIZE];
+    sWord imm_b[DECODE_BLOCK_SIZE];
+    sWord imm_u[DECODE_BLOCK_SIZE];
+    sWord imm_j[DECODE_BLOCK_SIZE];
+    Word bits[DECODE_BLOCK_SIZE];
+} DecodedBlock;
+
+void decode_block(const Word *words, unsigned count, DecodedBlock *block);
+int is_known_opcode(Word opcode);
+
+#endif
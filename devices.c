@@ -0,0 +1,396 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "types.h"
+#include "memory.h"
+#include "devices.h"
+#include "eventlog.h"
+#include "events.h"
+#include "trap.h"
+
+void device_map_init(DeviceMap *map, Byte *memory) {
+    memset(map, 0, sizeof(DeviceMap));
+    map->memory = memory;
+}
+
+int device_map_add(DeviceMap *map, Device *device) {
+    if (device == NULL || map->count == MAX_DEVICES) {
+        return -1;
+    }
+    device->map = map;
+    map->devices[map->count++] = device;
+    memset(map->cache_tags, 0, sizeof(map->cache_tags));
+    return 0;
+}
+
+void device_map_reset(DeviceMap *map) {
+    unsigned i;
+
+    for (i = 0; i < map->count; i++) {
+        if (map->devices[i]->reset) {
+            map->devices[i]->reset(map->devices[i]);
+        }
+    }
+}
+
+size_t device_map_state_size(const DeviceMap *map) {
+    size_t size = 0;
+    unsigned i;
+
+    for (i = 0; i < map->count; i++) {
+        size += map->devices[i]->state_size;
+    }
+    return size;
+}
+
+void device_map_save(const DeviceMap *map, void *state) {
+    Byte *next = state;
+    unsigned i;
+
+    for (i = 0; i < map->count; i++) {
+        memcpy(next, map->devices[i]->state, map->devices[i]->state_size);
+        next += map->devices[i]->state_size;
+    }
+}
+
+void device_map_restore(DeviceMap *map, const void *state) {
+    const Byte *next = state;
+    unsigned i;
+
+    for (i = 0; i < map->count; i++) {
+        memcpy(map->devices[i]->state, next, map->devices[i]->state_size);
+        next += map->devices[i]->state_size;
+    }
+}
+
+/* Finds the device covering address. The answer, including "no device",
+ * is cached per page, so repeated accesses skip the region scan. */
+Device *device_lookup(DeviceMap *map, Address address) {
+    Word page = address >> PAGE_SHIFT;
+    unsigned slot = page & (DEVICE_CACHE_SIZE - 1);
+    Device *found = NULL;
+    unsigned i;
+
+    if (map->cache_tags[slot] != page + 1) {
+        for (i = 0; i < map->count; i++) {
+            Device *device = map->devices[i];
+            if (page >= device->base >> PAGE_SHIFT
+                && page <= (device->base + device->size - 1) >> PAGE_SHIFT) {
+                found = device;
+                break;
+            }
+        }
+        map->cache_tags[slot] = page + 1;
+        map->cache[slot] = found;
+    }
+    found = map->cache[slot];
+    if (found && (address < found->base || address - found->base >= found->size)) {
+        return NULL;
+    }
+    return found;
+}
+
+/* Returns 0 and the value read if a device is mapped at address, -1 if
+ * the access is simply out of bounds */
+int device_read(DeviceMap *map, Address address, Alignment alignment, Word *value) {
+    Device *device = map ? device_lookup(map, address) : NULL;
+    if (device == NULL || device->read == NULL) {
+        return -1;
+    }
+    if (map->log && map->log->mode == LOG_REPLAY && replay_device_read(map->log, address, value) == 0) {
+        return 0;
+    }
+    *value = device->read(device, address - device->base, alignment);
+    if (map->log && map->log->mode == LOG_RECORD) {
+        log_device_read(map->log, address, *value);
+    }
+    return 0;
+}
+
+int device_write(DeviceMap *map, Address address, Alignment alignment, Word value) {
+    Device *device = map ? device_lookup(map, address) : NULL;
+    if (device == NULL || device->write == NULL) {
+        return -1;
+    }
+    device->write(device, address - device->base, alignment, value);
+    return 0;
+}
+
+static Device *device_create(const char *name, Address base, Word size, void *state) {
+    Device *device = calloc(1, sizeof(Device));
+    if (device) {
+        device->name = name;
+        device->base = base;
+        device->size = size;
+        device->state = state;
+    }
+    return device;
+}
+
+void device_destroy(Device *device) {
+    if (device) {
+        if (device->release) {
+            device->release(device);
+        }
+        free(device->state);
+        free(device);
+    }
+}
+
+/* UART: a byte-wide 16550 subset. Offset 0 transmits/receives, offset 5 is
+ * the line status register (bit 0 data ready, bits 5 and 6 transmitter
+ * empty). Either stream may be NULL. */
+
+typedef struct {
+    FILE *in;
+    FILE *out;
+} UartState;
+
+static Word uart_read(Device *device, Word offset, Alignment alignment) {
+    UartState *uart = device->state;
+    struct pollfd pfd;
+    int c;
+
+    if (uart->in == NULL) {
+        return offset == 5 ? 0x60 : 0;
+    }
+    pfd.fd = fileno(uart->in);
+    pfd.events = POLLIN;
+    switch (offset) {
+        case 0:
+            c = fgetc(uart->in);
+            return c == EOF ? 0 : c;
+        case 5:
+            return 0x60 | (poll(&pfd, 1, 0) > 0 ? 1 : 0);
+        default:
+            return 0;
+    }
+}
+
+static void uart_write(Device *device, Word offset, Alignment alignment, Word value) {
+    UartState *uart = device->state;
+    if (offset == 0 && uart->out && !MEMORY_CONTEXT(device->map->memory)->muted) {
+        fputc(value & 0xFF, uart->out);
+    }
+}
+
+Device *create_uart(FILE *in, FILE *out) {
+    UartState *uart = calloc(1, sizeof(UartState));
+    Device *device;
+
+    if (uart == NULL) {
+        return NULL;
+    }
+    uart->in = in;
+    uart->out = out;
+    device = device_create("uart", UART_BASE, 0x100, uart);
+    if (device) {
+        device->read = uart_read;
+        device->write = uart_write;
+    }
+    return device;
+}
+
+/* Timer: CLINT register layout. mtime (0xBFF8, 64 bits, read-only) is
+ * guest time, the instructions retired so far, so interrupts land on the
+ * same instruction every run. mtimecmp (0x4000, 64 bits) starts out at
+ * the maximum; writing it schedules EVENT_TIMER, and mip.MTIP is set from
+ * when mtime reaches it until it is written again with a later time. */
+
+typedef struct {
+    EventQueue *events;
+    Word *mip;
+    Double mtimecmp;
+} TimerState;
+
+static void timer_fire(void *opaque) {
+    TimerState *timer = opaque;
+    *timer->mip |= MIP_MTIP;
+}
+
+static Word timer_read(Device *device, Word offset, Alignment alignment) {
+    TimerState *timer = device->state;
+    switch (offset) {
+        case 0x4000: return (Word) timer->mtimecmp;
+        case 0x4004: return (Word) (timer->mtimecmp >> 32);
+        case 0xBFF8: return (Word) timer->events->now;
+        case 0xBFFC: return (Word) (timer->events->now >> 32);
+        default: return 0;
+    }
+}
+
+static void timer_write(Device *device, Word offset, Alignment alignment, Word value) {
+    TimerState *timer = device->state;
+    switch (offset) {
+        case 0x4000:
+            timer->mtimecmp = (timer->mtimecmp & 0xFFFFFFFF00000000ULL) | value;
+            break;
+        case 0x4004:
+            timer->mtimecmp = (timer->mtimecmp & 0xFFFFFFFFULL) | ((Double) value << 32);
+            break;
+        default:
+            return;
+    }
+    *timer->mip &= ~MIP_MTIP;
+    event_schedule(timer->events, EVENT_TIMER, timer->mtimecmp);
+}
+
+/* The event queue is reset by its owner */
+static void timer_reset(Device *device) {
+    TimerState *timer = device->state;
+    timer->mtimecmp = EVENT_NEVER;
+}
+
+Device *create_timer(EventQueue *events, Word *mip) {
+    TimerState *timer = calloc(1, sizeof(TimerState));
+    Device *device;
+
+    if (timer == NULL) {
+        return NULL;
+    }
+    timer->events = events;
+    timer->mip = mip;
+    timer->mtimecmp = EVENT_NEVER;
+    event_set_handler(events, EVENT_TIMER, timer_fire, timer);
+    device = device_create("timer", TIMER_BASE, 0x10000, timer);
+    if (device) {
+        device->read = timer_read;
+        device->write = timer_write;
+        device->reset = timer_reset;
+        device->state_size = sizeof(TimerState);
+    }
+    return device;
+}
+
+/* Block device backed by a host file. The guest sets SECTOR, BUFFER (a
+ * guest address) and COUNT, then writes 1 (read) or 2 (write) to COMMAND;
+ * the transfer completes before the store returns and STATUS says whether
+ * it worked. CAPACITY is the file size in sectors. */
+
+#define BLOCK_SECTOR 0x00
+#define BLOCK_BUFFER 0x04
+#define BLOCK_COUNT 0x08
+#define BLOCK_COMMAND 0x0C
+#define BLOCK_STATUS 0x10
+#define BLOCK_CAPACITY 0x14
+
+typedef struct {
+    int fd;
+    Word sector, buffer, count, status, capacity;
+} BlockState;
+
+/* When replaying, the data read comes from the log and the image is left
+ * alone */
+static void block_transfer(Device *device, BlockState *block, int write_to_file) {
+    Byte *memory = device->map->memory;
+    EventLog *log = device->map->log;
+    Word length, logged;
+    off_t position;
+    ssize_t done;
+    Address page, address;
+
+    /* checked before multiplying, so nothing here can wrap */
+    if (block->count > block->capacity || block->sector > block->capacity - block->count
+        || block->buffer >= MEMORY_SPACE || block->count > (MEMORY_SPACE - block->buffer) / BLOCK_SECTOR_SIZE) {
+        block->status = 1;
+        return;
+    }
+    length = block->count * BLOCK_SECTOR_SIZE;
+    position = (off_t) block->sector * BLOCK_SECTOR_SIZE;
+    if (write_to_file) {
+        done = log && log->mode == LOG_REPLAY ? length
+            : pwrite(block->fd, memory + block->buffer, length, position);
+    } else {
+        if (log && log->mode == LOG_REPLAY && replay_memory(log, memory, &address, &logged) == 0) {
+            done = logged;
+        } else {
+            done = pread(block->fd, memory + block->buffer, length, position);
+        }
+        if (log && log->mode == LOG_RECORD && done > 0) {
+            log_memory(log, block->buffer, memory + block->buffer, done);
+        }
+        for (page = block->buffer; page < block->buffer + length; page += PAGE_SIZE) {
+            MARK_DIRTY(memory, page);
+        }
+        if (length) {
+            MARK_DIRTY(memory, block->buffer + length - 1);
+        }
+        if (device->map->dma_written) {
+            device->map->dma_written(device->map->opaque, block->buffer, length);
+        }
+    }
+    block->status = done == (ssize_t) length ? 0 : 1;
+}
+
+static Word block_read(Device *device, Word offset, Alignment alignment) {
+    BlockState *block = device->state;
+    switch (offset) {
+        case BLOCK_SECTOR: return block->sector;
+        case BLOCK_BUFFER: return block->buffer;
+        case BLOCK_COUNT: return block->count;
+        case BLOCK_STATUS: return block->status;
+        case BLOCK_CAPACITY: return block->capacity;
+        default: return 0;
+    }
+}
+
+static void block_write(Device *device, Word offset, Alignment alignment, Word value) {
+    BlockState *block = device->state;
+    switch (offset) {
+        case BLOCK_SECTOR: block->sector = value; break;
+        case BLOCK_BUFFER: block->buffer = value; break;
+        case BLOCK_COUNT: block->count = value; break;
+        case BLOCK_COMMAND:
+            if (value == 1 || value == 2) {
+                block_transfer(device, block, value == 2);
+            } else {
+                block->status = 1;
+            }
+            break;
+    }
+}
+
+static void block_reset(Device *device) {
+    BlockState *block = device->state;
+    block->sector = block->buffer = block->count = block->status = 0;
+}
+
+static void block_release(Device *device) {
+    BlockState *block = device->state;
+    close(block->fd);
+}
+
+Device *create_block_device(const char *path) {
+    BlockState *block = calloc(1, sizeof(BlockState));
+    Device *device;
+    struct stat st;
+
+    if (block == NULL) {
+        return NULL;
+    }
+    block->fd = open(path, O_RDWR);
+    if (block->fd < 0 || fstat(block->fd, &st) != 0) {
+        goto fail;
+    }
+    block->capacity = st.st_size / BLOCK_SECTOR_SIZE;
+    device = device_create("block", BLOCK_BASE, 0x100, block);
+    if (device == NULL) {
+        goto fail;
+    }
+    device->read = block_read;
+    device->write = block_write;
+    device->release = block_release;
+    device->reset = block_reset;
+    device->state_size = sizeof(BlockState);
+    return device;
+fail:
+    if (block->fd >= 0) {
+        close(block->fd);
+    }
+    free(block);
+    return NULL;
+}
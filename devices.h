@@ -0,0 +1,63 @@
+#ifndef DEVICES_H
+#define DEVICES_H
+
+#include <stdio.h>
+#include "types.h"
+#include "events.h"
+
+/* Devices live above MEMORY_SPACE, so the bounds check every RAM access
+   already makes is the only test on the fast path. Anything that fails it
+   goes through the region table below before it counts as a bad access. */
+#define UART_BASE 0x10000000
+#define TIMER_BASE 0x02000000
+#define BLOCK_BASE 0x10001000
+
+#define MAX_DEVICES 8
+#define DEVICE_CACHE_SIZE 64    /* pages remembered by device_lookup() */
+#define BLOCK_SECTOR_SIZE 512
+
+typedef struct Device {
+    const char *name;
+    Address base;
+    Word size;
+    Word (*read)(struct Device *device, Word offset, Alignment alignment);
+    void (*write)(struct Device *device, Word offset, Alignment alignment, Word value);
+    void (*release)(struct Device *device);
+    void (*reset)(struct Device *device);   /* back to power-on state, or NULL */
+    void *state;
+    size_t state_size;          /* bytes of state snapshots keep, 0 for none */
+    struct DeviceMap *map;
+} Device;
+
+/* The region table. DMA from devices lands in memory; dma_written (if set)
+   is told about it so decoded code and dirty maps stay correct. */
+typedef struct DeviceMap {
+    Device *devices[MAX_DEVICES];
+    unsigned count;
+    Word cache_tags[DEVICE_CACHE_SIZE];     /* page number + 1, 0 = empty */
+    Device *cache[DEVICE_CACHE_SIZE];
+    Byte *memory;
+    void (*dma_written)(void *opaque, Address address, Word length);
+    void *opaque;
+    struct EventLog *log;       /* record or replay reads and DMA, see eventlog.h */
+} DeviceMap;
+
+void device_map_init(DeviceMap *map, Byte *memory);
+int device_map_add(DeviceMap *map, Device *device);
+/* Resets every device, for a machine that starts over */
+void device_map_reset(DeviceMap *map);
+/* The registers of every device as one block of device_map_state_size()
+   bytes, for reverse execution */
+size_t device_map_state_size(const DeviceMap *map);
+void device_map_save(const DeviceMap *map, void *state);
+void device_map_restore(DeviceMap *map, const void *state);
+Device *device_lookup(DeviceMap *map, Address address);
+int device_read(DeviceMap *map, Address address, Alignment alignment, Word *value);
+int device_write(DeviceMap *map, Address address, Alignment alignment, Word value);
+
+Device *create_uart(FILE *in, FILE *out);
+Device *create_timer(EventQueue *events, Word *mip);
+Device *create_block_device(const char *path);
+void device_destroy(Device *device);
+
+#endif
@@ -0,0 +1,1055 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "engine.h"
+#include "decode.h"
+#include "plugin.h"
+#include "fpu.h"
+#include "trap.h"
+#include "events.h"
+
+/* Longest run of operations translated as one block */
+#define MAX_BLOCK_OPS DECODE_BLOCK_SIZE
+
+/* Mmu written hook: a page table walk set A or D in a PTE that shares a
+ * page with code. The operation making the access is still running, so the
+ * page is dropped once the block leaves, as after a store into it. */
+static void engine_pte_written(void *opaque, Address address, Word length) {
+    Engine *engine = opaque;
+
+    if (engine->code_pages[address >> PAGE_SHIFT]) {
+        engine->dropped_page = (address >> PAGE_SHIFT) + 1;
+    }
+}
+
+static void drop_written_page(Engine *engine) {
+    if (engine->dropped_page) {
+        engine_invalidate_page(engine, engine->dropped_page - 1);
+        engine->dropped_page = 0;
+    }
+}
+
+/* Takes the devices and system calls from MEMORY_CONTEXT(memory), pointing
+ * their write notifications at the new engine */
+int engine_init(Engine *engine, Processor *processor, Byte *memory, FILE *console) {
+    MemoryContext *context = MEMORY_CONTEXT(memory);
+
+    memset(engine, 0, sizeof(Engine));
+    engine->processor = processor;
+    engine->memory = memory;
+    engine->console = console;
+    engine->code = calloc(MEMORY_SPACE / 4, sizeof(DecodedOp));
+    mmu_init(&engine->mmu, memory);
+    engine->mmu.written = engine_pte_written;
+    engine->mmu.opaque = engine;
+    engine->devices = context->devices;
+    if (engine->devices) {
+        engine->devices->dma_written = engine_dma_written;
+        engine->devices->opaque = engine;
+    }
+    engine->syscalls = context->syscalls;
+    if (engine->syscalls) {
+        engine->syscalls->translate = engine_translate;
+        engine->syscalls->written = engine_dma_written;
+        engine->syscalls->opaque = engine;
+    }
+    return engine->code == NULL ? -1 : 0;
+}
+
+void engine_free(Engine *engine) {
+    free(engine->code);
+    engine->code = NULL;
+}
+
+static DecodedOp make_op(OpKind kind, unsigned rd, unsigned rs1, unsigned rs2, int imm) {
+    DecodedOp op;
+    op.kind = kind;
+    op.rd = rd;
+    op.rs1 = rs1;
+    op.rs2 = rs2;
+    op.len = 1;
+    op.cls = CLASS_OTHER;
+    op.imm = imm;
+    return op;
+}
+
+static DecodedOp invalid_op(uint32_t instruction_bits) {
+    return make_op(OP_INVALID, 0, 0, 0, instruction_bits);
+}
+
+static OpKind decode_rtype(Word funct3, Word funct7) {
+    switch (funct3 | (funct7 << 3)) {
+        case 0x0 | (0x00 << 3): return OP_ADD;
+        case 0x0 | (0x01 << 3): return OP_MUL;
+        case 0x0 | (0x20 << 3): return OP_SUB;
+        case 0x1 | (0x00 << 3): return OP_SLL;
+        case 0x1 | (0x01 << 3): return OP_MULH;
+        case 0x2 | (0x00 << 3): return OP_SLT;
+        case 0x4 | (0x00 << 3): return OP_XOR;
+        case 0x4 | (0x01 << 3): return OP_DIV;
+        case 0x5 | (0x00 << 3): return OP_SRL;
+        case 0x5 | (0x20 << 3): return OP_SRA;
+        case 0x6 | (0x00 << 3): return OP_OR;
+        case 0x6 | (0x01 << 3): return OP_REM;
+        case 0x7 | (0x00 << 3): return OP_AND;
+        default: return OP_INVALID;
+    }
+}
+
+static OpKind decode_itype_except_load(Word funct3, Word bits) {
+    switch (funct3) {
+        case 0x0: return OP_ADDI;
+        case 0x1: return OP_SLLI;
+        case 0x2: return OP_SLTI;
+        case 0x4: return OP_XORI;
+        case 0x5: return (bits >> 30) ? OP_SRAI : OP_SRLI;
+        case 0x6: return OP_ORI;
+        case 0x7: return OP_ANDI;
+        default: return OP_INVALID;
+    }
+}
+
+static OpKind decode_csr(Word funct3) {
+    switch (funct3) {
+        case 0x1: return OP_CSRRW;
+        case 0x2: return OP_CSRRS;
+        case 0x3: return OP_CSRRC;
+        case 0x5: return OP_CSRRWI;
+        case 0x6: return OP_CSRRSI;
+        case 0x7: return OP_CSRRCI;
+        default: return OP_INVALID;
+    }
+}
+
+/* Turns instruction i of a batch-decoded block into an engine operation.
+ * With paged set, loads and stores go through the TLB. */
+static DecodedOp decode_fields(const DecodedBlock *block, unsigned i, int paged) {
+    Word bits = block->bits[i];
+    Word rd = block->rd[i], rs1 = block->rs1[i], rs2 = block->rs2[i];
+    OpKind kind;
+
+    switch (block->opcode[i]) {
+        case 0x33:
+            kind = decode_rtype(block->funct3[i], block->funct7[i]);
+            if (kind == OP_INVALID) {
+                return invalid_op(bits);
+            }
+            return make_op(rd ? kind : OP_NOP, rd, rs1, rs2, 0);
+        case 0x13:
+            kind = decode_itype_except_load(block->funct3[i], bits);
+            if (kind == OP_INVALID) {
+                return invalid_op(bits);
+            }
+            if (kind == OP_SLLI || kind == OP_SRLI || kind == OP_SRAI) {
+                return make_op(rd ? kind : OP_NOP, rd, rs1, 0, rs2);
+            }
+            return make_op(rd ? kind : OP_NOP, rd, rs1, 0, block->imm_i[i]);
+        case 0x03:
+            switch (block->funct3[i]) {
+                case 0x0: kind = OP_LB; break;
+                case 0x1: kind = OP_LH; break;
+                case 0x2: kind = OP_LW; break;
+                default: return invalid_op(bits);
+            }
+            if (paged) {
+                kind += OP_LB_V - OP_LB;
+            }
+            return make_op(kind, rd, rs1, 0, block->imm_i[i]);
+        case 0x23:
+            switch (block->funct3[i]) {
+                case 0x0: kind = OP_SB; break;
+                case 0x1: kind = OP_SH; break;
+                case 0x2: kind = OP_SW; break;
+                default: return invalid_op(bits);
+            }
+            if (paged) {
+                kind += OP_SB_V - OP_SB;
+            }
+            return make_op(kind, 0, rs1, rs2, block->imm_s[i]);
+        case 0x63:
+            switch (block->funct3[i]) {
+                case 0x0: kind = OP_BEQ; break;
+                case 0x1: kind = OP_BNE; break;
+                default: return invalid_op(bits);
+            }
+            return make_op(kind, 0, rs1, rs2, block->imm_b[i]);
+        case 0x6F:
+            return make_op(OP_JAL, rd, 0, 0, block->imm_j[i]);
+        case 0x37:
+            return make_op(rd ? OP_LUI : OP_NOP, rd, 0, 0, block->imm_u[i]);
+        case 0x07:
+            if (block->funct3[i] != 0x2) {
+                return invalid_op(bits);
+            }
+            return make_op(paged ? OP_FLW_V : OP_FLW, rd, rs1, 0, block->imm_i[i]);
+        case 0x27:
+            if (block->funct3[i] != 0x2) {
+                return invalid_op(bits);
+            }
+            return make_op(paged ? OP_FSW_V : OP_FSW, 0, rs1, rs2, block->imm_s[i]);
+        case 0x53: case 0x43: case 0x47: case 0x4B: case 0x4F:
+            return make_op(OP_FP, rd, rs1, rs2, bits);
+        case 0x73:
+            if (block->funct3[i] == 0x0) {
+                if (block->funct7[i] == 0x09) {
+                    return make_op(OP_SFENCE_VMA, 0, rs1, rs2, 0);
+                }
+                if (bits == MRET_BITS) {
+                    return make_op(OP_MRET, 0, 0, 0, 0);
+                }
+                if (bits == WFI_BITS) {
+                    return make_op(OP_NOP, 0, 0, 0, 0);
+                }
+                return make_op(OP_ECALL, 0, 0, 0, 0);
+            }
+            kind = decode_csr(block->funct3[i]);
+            if (kind == OP_INVALID
+                || ((bits >> 20) != CSR_SATP && !IS_FPU_CSR(bits >> 20) && !IS_TRAP_CSR(bits >> 20))) {
+                return invalid_op(bits);
+            }
+            return make_op(kind, rd, rs1, 0, bits >> 20);
+        default:
+            return invalid_op(bits);
+    }
+}
+
+/* Decodes one instruction word into the engine's operation format */
+DecodedOp decode_op(uint32_t instruction_bits) {
+    DecodedBlock block;
+    decode_block(&instruction_bits, 1, &block);
+    return decode_fields(&block, 0, 0);
+}
+
+/* Decodes the block starting at physical address pc (virtual address
+ * vaddr). A block ends after a branch, jump, system or invalid instruction,
+ * at MAX_BLOCK_OPS, or at the end of the page, so that dropping a page
+ * never leaves a stale block behind and a block is never split across two
+ * virtual pages. */
+static void translate_block(Engine *engine, Address vaddr, Address pc) {
+    DecodedOp *first = &engine->code[pc >> 2];
+    Address page_end = (pc | (PAGE_SIZE - 1)) + 1;
+    unsigned count = 0, tail = 0, words = (page_end - pc) / 4;
+    DecodedBlock block;
+    Address addr;
+    OpKind kind;
+
+    if (words > MAX_BLOCK_OPS) {
+        words = MAX_BLOCK_OPS;
+    }
+    engine->translating = 1;
+    decode_block((Word *) (engine->memory + pc), words, &block);
+    for (addr = pc; count < words; addr += 4) {
+        if (count > 0 && engine->plugins && engine->plugins->starts[(pc >> 2) + count]) {
+            /* another block starts here, see plugin.h */
+            break;
+        }
+        if (first[count].kind != OP_UNDECODED) {
+            /* joined an already translated block */
+            tail = first[count].len;
+            break;
+        }
+        if (engine->breakpoint_count && engine_has_breakpoint(engine, addr)) {
+            first[count++] = make_op(OP_BREAK, 0, 0, 0, 0);
+            break;
+        }
+        first[count] = decode_fields(&block, count, engine->paging);
+        first[count].cls = instruction_class(block.bits[count]);
+        count++;
+        if (first[count - 1].kind >= OP_BEQ) {
+            break;
+        }
+        /* with watchpoints set, stop right after each access so a hit is
+           reported at the instruction that caused it */
+        kind = first[count - 1].kind;
+        if (engine->watch_mode && ((kind >= OP_LB && kind <= OP_SW_V) || (kind >= OP_FLW && kind <= OP_FSW_V))) {
+            break;
+        }
+    }
+    engine->translating = 0;
+    if (count > 0) {
+        idiom_translate(engine, first, count, pc);
+    }
+    if (engine->plugins) {
+        plugins_translate(engine->plugins, first, vaddr, pc, count, block.bits);
+    }
+    for (; count > 0; count--) {
+        first[count - 1].len = (tail + 1 > MAX_BLOCK_OPS) ? MAX_BLOCK_OPS : tail + 1;
+        tail = first[count - 1].len;
+    }
+    engine->code_pages[pc >> PAGE_SHIFT] = 1;
+}
+
+void engine_invalidate_page(Engine *engine, unsigned page) {
+    memset(&engine->code[page << (PAGE_SHIFT - 2)], 0, (PAGE_SIZE / 4) * sizeof(DecodedOp));
+    engine->code_pages[page] = 0;
+    if (engine->idiom_count > 0) {
+        idiom_drop_page(engine, page);
+    }
+    if (engine->plugins) {
+        plugins_drop_page(engine->plugins, page);
+    }
+}
+
+void engine_flush(Engine *engine) {
+    unsigned page;
+    for (page = 0; page < NUM_PAGES; page++) {
+        if (engine->code_pages[page]) {
+            engine_invalidate_page(engine, page);
+        }
+    }
+}
+
+/* Copies every page dirtied since the dirty map was last cleared back from
+ * pristine, dropping any code decoded from those pages */
+void engine_restore_memory(Engine *engine, const Byte *pristine) {
+    Byte *dirty = DIRTY_MAP(engine->memory);
+    unsigned page;
+
+    for (page = 0; page < NUM_PAGES; page++) {
+        if (dirty[page]) {
+            memcpy(engine->memory + (page << PAGE_SHIFT), pristine + (page << PAGE_SHIFT), PAGE_SIZE);
+            if (engine->code_pages[page]) {
+                engine_invalidate_page(engine, page);
+            }
+            dirty[page] = 0;
+        }
+    }
+}
+
+/* DeviceMap dma_written hook: drops code the device just overwrote */
+void engine_dma_written(void *opaque, Address address, Word length) {
+    Engine *engine = opaque;
+    Address page;
+
+    if (length == 0) {
+        return;
+    }
+    for (page = address >> PAGE_SHIFT; page <= (address + length - 1) >> PAGE_SHIFT; page++) {
+        if (engine->code_pages[page]) {
+            engine_invalidate_page(engine, page);
+        }
+    }
+}
+
+int engine_has_breakpoint(Engine *engine, Address address) {
+    unsigned i;
+    for (i = 0; i < engine->breakpoint_count; i++) {
+        if (engine->breakpoints[i] == address) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Breakpoints are patched into the decode cache as OP_BREAK when their
+ * block is translated, so setting one only drops the page it is on. */
+int engine_set_breakpoint(Engine *engine, Address address) {
+    if (address >= MEMORY_SPACE || (address & 3)) {
+        return -1;
+    }
+    if (engine_has_breakpoint(engine, address)) {
+        return 0;
+    }
+    if (engine->breakpoint_count == MAX_BREAKPOINTS) {
+        return -1;
+    }
+    engine->breakpoints[engine->breakpoint_count++] = address;
+    engine_invalidate_page(engine, address >> PAGE_SHIFT);
+    return 0;
+}
+
+int engine_clear_breakpoint(Engine *engine, Address address) {
+    unsigned i;
+    for (i = 0; i < engine->breakpoint_count; i++) {
+        if (engine->breakpoints[i] == address) {
+            engine->breakpoints[i] = engine->breakpoints[--engine->breakpoint_count];
+            engine_invalidate_page(engine, address >> PAGE_SHIFT);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static Word engine_read_csr(Engine *engine, Word csr) {
+    switch (csr) {
+        case CSR_SATP:
+            return engine->mmu.satp;
+        case CSR_FFLAGS:
+        case CSR_FRM:
+        case CSR_FCSR:
+            return fpu_read_csr(engine->processor, csr);
+        default:
+            return trap_read_csr(engine->processor, csr);
+    }
+}
+
+static void engine_write_csr(Engine *engine, Word csr, Word value) {
+    switch (csr) {
+        case CSR_SATP:
+            /* there are no ASIDs, and changing the root table alone needs
+               an sfence.vma like on hardware */
+            value &= SATP_MODE | SATP_PPN;
+            if ((value ^ engine->mmu.satp) & SATP_MODE) {
+                /* decoded loads and stores are for the other mode */
+                engine_flush(engine);
+                tlb_flush(&engine->mmu);
+            }
+            engine->mmu.satp = value;
+            engine->paging = (value & SATP_MODE) != 0;
+            break;
+        case CSR_FFLAGS:
+        case CSR_FRM:
+        case CSR_FCSR:
+            fpu_write_csr(engine->processor, csr, value);
+            break;
+        default:
+            trap_write_csr(engine->processor, csr, value);
+            break;
+    }
+}
+
+/* Back to bare mode with nothing left over from the previous run, for a
+ * machine that starts over. Code decoded from unchanged pages is kept. */
+void engine_reset(Engine *engine) {
+    engine_write_csr(engine, CSR_SATP, 0);
+    engine->previous_location = 0;
+    engine->exit_code = 0;
+    engine->fault = 0;
+}
+
+/* Syscalls translate hook: guest buffers are virtual while paging is on */
+Byte *engine_translate(void *opaque, Address address, Word length, int write) {
+    Engine *engine = opaque;
+
+    if (!engine->paging) {
+        return address < MEMORY_SPACE && length <= MEMORY_SPACE - address ? engine->memory + address : NULL;
+    }
+    return tlb_lookup(&engine->mmu, address, length, write ? ACCESS_WRITE : ACCESS_READ);
+}
+
+/* Same calls as execute_ecall() in part2.c, but output goes to the engine's
+ * console and exit is reported to the caller instead of ending the process */
+static EngineStatus engine_ecall(Engine *engine) {
+    Register *R = engine->processor->R;
+    FILE *console = MEMORY_CONTEXT(engine->memory)->muted ? NULL : engine->console;
+    Byte *start, *end;
+
+    if (engine->syscalls) {
+        if (linux_syscall(engine->syscalls, R) != 0) {
+            engine->exit_code = engine->syscalls->exit_code;
+            return ENGINE_EXIT;
+        }
+        return ENGINE_BUDGET;
+    }
+    switch (R[10]) {
+        case 1: // print an integer
+            if (console) {
+                fprintf(console, "%d", R[11]);
+            }
+            break;
+        case 4: // print a string
+            if (console && R[11] < MEMORY_SPACE) {
+                start = engine->memory + R[11];
+                end = memchr(start, 0, MEMORY_SPACE - R[11]);
+                fwrite(start, 1, (end ? end : engine->memory + MEMORY_SPACE) - start, console);
+            }
+            break;
+        case 10: // exit
+            if (console) {
+                fprintf(console, "exiting the simulator\n");
+            }
+            engine->exit_code = 0;
+            return ENGINE_EXIT;
+        case 11: // print a character
+            if (console) {
+                fputc(R[11], console);
+            }
+            break;
+        default: // undefined ecall
+            if (console) {
+                fprintf(console, "Illegal ecall number %d\n", R[10]);
+            }
+            engine->exit_code = -1;
+            return ENGINE_EXIT;
+    }
+    return ENGINE_BUDGET;
+}
+
+/* Marks the operations from first up to op as executed and, if the last of
+ * them was a branch, the edge it took; block_pc is the virtual address of
+ * first and pc where execution goes next */
+static void cover_block(Engine *engine, DecodedOp *first, DecodedOp *op, Address block_pc, Address pc) {
+    Address physical = (first - engine->code) << 2;
+    unsigned kind;
+
+    coverage_mark_range(engine->coverage, physical, op - first);
+    if (op > first) {
+        kind = op[-1].kind & ~OP_HOOKED;
+        if (kind == OP_BEQ || kind == OP_BNE) {
+            COVERAGE_MARK(pc == block_pc + 4 * (op - first) ? engine->coverage->not_taken : engine->coverage->taken,
+                          physical + 4 * (op - 1 - first));
+        }
+    }
+}
+
+/* Device accesses are how the middle of a block reaches the event queue:
+ * they see mtime as of their own instruction, done being the number of
+ * instructions of the block before it */
+static int engine_device_read(Engine *engine, uint64_t done, Address address, Alignment alignment, Word *value) {
+    if (engine->events) {
+        engine->events->now = engine->instret + done;
+    }
+    return device_read(engine->devices, address, alignment, value);
+}
+
+static int engine_device_write(Engine *engine, uint64_t done, Address address, Alignment alignment, Word value) {
+    if (engine->events) {
+        engine->events->now = engine->instret + done;
+    }
+    return device_write(engine->devices, address, alignment, value);
+}
+
+/* Runs at most budget instructions. On a fault the PC is left at the
+ * faulting instruction and it is not counted as retired. While paging is
+ * enabled pc is virtual and each block is fetched through the TLB once. */
+EngineStatus engine_run(Engine *engine, uint64_t budget) {
+    Register *R = engine->processor->R;
+    Word *F = engine->processor->F;
+    Byte *memory = engine->memory;
+    Address pc = engine->processor->PC;
+    Address address, physical, block_pc;
+    Word value, old;
+    Byte *host;
+    unsigned size, kind;
+    EngineStatus status = ENGINE_BUDGET;
+    DecodedOp *first, *op, *end;
+    unsigned n;
+    uint64_t retired;
+
+    while (budget > 0) {
+        if ((pc & 3) || (!engine->paging && pc >= MEMORY_SPACE)) {
+            engine->fault = pc;
+            status = ENGINE_BAD_READ;
+            break;
+        }
+        physical = pc;
+        if (engine->paging) {
+            host = tlb_lookup(&engine->mmu, pc, 4, ACCESS_FETCH);
+            if (host == NULL) {
+                engine->fault = pc;
+                status = engine->mmu.fault ? ENGINE_PAGE_FAULT : ENGINE_BAD_READ;
+                break;
+            }
+            physical = host - memory;
+        }
+        drop_written_page(engine);
+        if (engine->edge_map) {
+            /* count the edge into this block */
+            Word location = ((pc >> 2) * 0x9E3779B1u) >> 16;
+            engine->edge_map[(location ^ engine->previous_location) & (EDGE_MAP_SIZE - 1)]++;
+            engine->previous_location = location >> 1;
+        }
+        first = op = &engine->code[physical >> 2];
+        block_pc = pc;
+        if (engine->plugins && op->kind != OP_UNDECODED && !engine->plugins->starts[physical >> 2]) {
+            if (engine->plugins->resumes[physical >> 2]) {
+                /* the rest of a block the last run stopped in, whose
+                   block hooks already ran */
+                engine->plugins->resumes[physical >> 2] = 0;
+            } else {
+                /* jumped into the middle of a block: retranslate so that
+                   this is where a block starts, see plugin.h */
+                engine_invalidate_page(engine, physical >> PAGE_SHIFT);
+            }
+        }
+        if (op->kind == OP_UNDECODED) {
+            translate_block(engine, pc, physical);
+        }
+        n = op->len < budget ? op->len : budget;
+        end = op + n;
+
+        for (; op < end; op++) {
+            engine->stats.classes[op->cls]++;
+            kind = op->kind;
+        dispatch:
+            switch (kind) {
+                case OP_NOP:
+                    break;
+                case OP_ADD:
+                    R[op->rd] = R[op->rs1] + R[op->rs2];
+                    break;
+                case OP_MUL:
+                    R[op->rd] = (sWord) R[op->rs1] * (sWord) R[op->rs2];
+                    break;
+                case OP_SUB:
+                    R[op->rd] = R[op->rs1] - R[op->rs2];
+                    break;
+                case OP_SLL:
+                    R[op->rd] = R[op->rs1] << (R[op->rs2] & 0x1F);
+                    break;
+                case OP_MULH:
+                    R[op->rd] = ((sDouble) (sWord) R[op->rs1] * (sWord) R[op->rs2]) >> 32;
+                    break;
+                case OP_SLT:
+                    R[op->rd] = (sWord) R[op->rs1] < (sWord) R[op->rs2];
+                    break;
+                case OP_XOR:
+                    R[op->rd] = R[op->rs1] ^ R[op->rs2];
+                    break;
+                case OP_DIV:
+                    if (R[op->rs2] == 0) {
+                        R[op->rd] = -1;
+                    } else if (R[op->rs1] == 0x80000000 && R[op->rs2] == 0xFFFFFFFF) {
+                        R[op->rd] = 0x80000000;
+                    } else {
+                        R[op->rd] = (sWord) R[op->rs1] / (sWord) R[op->rs2];
+                    }
+                    break;
+                case OP_SRL:
+                    R[op->rd] = R[op->rs1] >> (R[op->rs2] & 0x1F);
+                    break;
+                case OP_SRA:
+                    R[op->rd] = (sWord) R[op->rs1] >> (R[op->rs2] & 0x1F);
+                    break;
+                case OP_OR:
+                    R[op->rd] = R[op->rs1] | R[op->rs2];
+                    break;
+                case OP_REM:
+                    if (R[op->rs2] == 0) {
+                        R[op->rd] = R[op->rs1];
+                    } else if (R[op->rs1] == 0x80000000 && R[op->rs2] == 0xFFFFFFFF) {
+                        R[op->rd] = 0;
+                    } else {
+                        R[op->rd] = (sWord) R[op->rs1] % (sWord) R[op->rs2];
+                    }
+                    break;
+                case OP_AND:
+                    R[op->rd] = R[op->rs1] & R[op->rs2];
+                    break;
+                case OP_ADDI:
+                    R[op->rd] = R[op->rs1] + op->imm;
+                    break;
+                case OP_SLLI:
+                    R[op->rd] = R[op->rs1] << op->imm;
+                    break;
+                case OP_SLTI:
+                    R[op->rd] = (sWord) R[op->rs1] < op->imm;
+                    break;
+                case OP_XORI:
+                    R[op->rd] = R[op->rs1] ^ op->imm;
+                    break;
+                case OP_SRLI:
+                    R[op->rd] = R[op->rs1] >> op->imm;
+                    break;
+                case OP_SRAI:
+                    R[op->rd] = (sWord) R[op->rs1] >> op->imm;
+                    break;
+                case OP_ORI:
+                    R[op->rd] = R[op->rs1] | op->imm;
+                    break;
+                case OP_ANDI:
+                    R[op->rd] = R[op->rs1] & op->imm;
+                    break;
+                case OP_LB:
+                    address = R[op->rs1] + op->imm;
+                    if (address >= MEMORY_SPACE) {
+                        if (engine_device_read(engine, op - first, address, LENGTH_BYTE, &value) != 0) {
+                            goto bad_read;
+                        }
+                        R[op->rd] = (sByte) value;
+                    } else {
+                        R[op->rd] = (sByte) memory[address];
+                    }
+                    R[0] = 0;
+                    engine->stats.bytes_loaded += 1;
+                    break;
+                case OP_LH:
+                    address = R[op->rs1] + op->imm;
+                    if (address >= MEMORY_SPACE - 1) {
+                        if (engine_device_read(engine, op - first, address, LENGTH_HALF_WORD, &value) != 0) {
+                            goto bad_read;
+                        }
+                        R[op->rd] = (sHalf) value;
+                    } else {
+                        R[op->rd] = *(sHalf *) (memory + address);
+                    }
+                    R[0] = 0;
+                    engine->stats.bytes_loaded += 2;
+                    break;
+                case OP_LW:
+                    address = R[op->rs1] + op->imm;
+                    if (address >= MEMORY_SPACE - 3) {
+                        if (engine_device_read(engine, op - first, address, LENGTH_WORD, &value) != 0) {
+                            goto bad_read;
+                        }
+                        R[op->rd] = value;
+                    } else {
+                        R[op->rd] = *(Word *) (memory + address);
+                    }
+                    R[0] = 0;
+                    engine->stats.bytes_loaded += 4;
+                    break;
+                case OP_SB:
+                    address = R[op->rs1] + op->imm;
+                    size = 1;
+                    if (address >= MEMORY_SPACE) {
+                        if (engine_device_write(engine, op - first, address, LENGTH_BYTE, R[op->rs2]) != 0) {
+                            goto bad_write;
+                        }
+                        goto device_stored;
+                    }
+                    memory[address] = R[op->rs2];
+                    goto stored;
+                case OP_SH:
+                    address = R[op->rs1] + op->imm;
+                    size = 2;
+                    if (address >= MEMORY_SPACE - 1) {
+                        if (engine_device_write(engine, op - first, address, LENGTH_HALF_WORD, R[op->rs2]) != 0) {
+                            goto bad_write;
+                        }
+                        goto device_stored;
+                    }
+                    *(Half *) (memory + address) = R[op->rs2];
+                    goto stored;
+                case OP_SW:
+                    address = R[op->rs1] + op->imm;
+                    size = 4;
+                    if (address >= MEMORY_SPACE - 3) {
+                        if (engine_device_write(engine, op - first, address, LENGTH_WORD, R[op->rs2]) != 0) {
+                            goto bad_write;
+                        }
+                        goto device_stored;
+                    }
+                    *(Word *) (memory + address) = R[op->rs2];
+                    goto stored;
+                case OP_LB_V:
+                case OP_LH_V:
+                case OP_LW_V:
+                    address = R[op->rs1] + op->imm;
+                    size = 1 << (kind - OP_LB_V);
+                    host = tlb_lookup(&engine->mmu, address, size, ACCESS_READ);
+                    if (host == NULL) {
+                        if (engine->mmu.fault) {
+                            goto page_fault;
+                        }
+                        address = engine->mmu.physical;
+                        if (engine_device_read(engine, op - first, address, size, &value) != 0) {
+                            goto bad_read;
+                        }
+                    } else {
+                        value = size == 1 ? *host : size == 2 ? *(Half *) host : *(Word *) host;
+                    }
+                    R[op->rd] = size == 1 ? (sByte) value : size == 2 ? (sHalf) value : (sWord) value;
+                    R[0] = 0;
+                    engine->stats.bytes_loaded += size;
+                    if (engine->dropped_page) {
+                        /* the walk for it dropped code, maybe this block's */
+                        pc += 4;
+                        op++;
+                        goto block_done;
+                    }
+                    break;
+                case OP_SB_V:
+                case OP_SH_V:
+                case OP_SW_V:
+                    address = R[op->rs1] + op->imm;
+                    size = 1 << (kind - OP_SB_V);
+                    host = tlb_lookup(&engine->mmu, address, size, ACCESS_WRITE);
+                    if (host == NULL) {
+                        if (engine->mmu.fault) {
+                            goto page_fault;
+                        }
+                        address = engine->mmu.physical;
+                        if (engine_device_write(engine, op - first, address, size, R[op->rs2]) != 0) {
+                            goto bad_write;
+                        }
+                        goto device_stored;
+                    }
+                    if (size == 1) {
+                        *host = R[op->rs2];
+                    } else if (size == 2) {
+                        *(Half *) host = R[op->rs2];
+                    } else {
+                        *(Word *) host = R[op->rs2];
+                    }
+                    address = host - memory;
+                stored:
+                    engine->stats.bytes_stored += size;
+                    /* address is physical from here on */
+                    MARK_DIRTY_ACCESS(memory, address, size);
+                    if (engine->code_pages[address >> PAGE_SHIFT]
+                        || engine->code_pages[(address + size - 1) >> PAGE_SHIFT]) {
+                        /* self-modifying code: drop the pages and leave the
+                           block, it may have just been overwritten */
+                        engine_invalidate_page(engine, address >> PAGE_SHIFT);
+                        if (((address + size - 1) ^ address) >> PAGE_SHIFT) {
+                            engine_invalidate_page(engine, (address + size - 1) >> PAGE_SHIFT);
+                        }
+                        pc += 4;
+                        op++;
+                        goto block_done;
+                    }
+                    if (engine->dropped_page) {
+                        pc += 4;
+                        op++;
+                        goto block_done;
+                    }
+                    break;
+                device_stored:
+                    engine->stats.bytes_stored += size;
+                    if (engine->events && engine->events->changed) {
+                        /* the device moved an event, which may be due
+                           before the end of the block */
+                        pc += 4;
+                        op++;
+                        status = ENGINE_EVENT;
+                        goto block_done;
+                    }
+                    if (engine->dropped_page) {
+                        pc += 4;
+                        op++;
+                        goto block_done;
+                    }
+                    break;
+                case OP_LUI:
+                    R[op->rd] = op->imm;
+                    break;
+                case OP_FLW:
+                    address = R[op->rs1] + op->imm;
+                    if (address >= MEMORY_SPACE - 3) {
+                        if (engine_device_read(engine, op - first, address, LENGTH_WORD, &value) != 0) {
+                            goto bad_read;
+                        }
+                        F[op->rd] = value;
+                    } else {
+                        F[op->rd] = *(Word *) (memory + address);
+                    }
+                    engine->stats.bytes_loaded += 4;
+                    break;
+                case OP_FSW:
+                    address = R[op->rs1] + op->imm;
+                    size = 4;
+                    if (address >= MEMORY_SPACE - 3) {
+                        if (engine_device_write(engine, op - first, address, LENGTH_WORD, F[op->rs2]) != 0) {
+                            goto bad_write;
+                        }
+                        goto device_stored;
+                    }
+                    *(Word *) (memory + address) = F[op->rs2];
+                    goto stored;
+                case OP_FLW_V:
+                    address = R[op->rs1] + op->imm;
+                    host = tlb_lookup(&engine->mmu, address, 4, ACCESS_READ);
+                    if (host == NULL) {
+                        if (engine->mmu.fault) {
+                            goto page_fault;
+                        }
+                        address = engine->mmu.physical;
+                        if (engine_device_read(engine, op - first, address, LENGTH_WORD, &value) != 0) {
+                            goto bad_read;
+                        }
+                        F[op->rd] = value;
+                    } else {
+                        F[op->rd] = *(Word *) host;
+                    }
+                    engine->stats.bytes_loaded += 4;
+                    if (engine->dropped_page) {
+                        pc += 4;
+                        op++;
+                        goto block_done;
+                    }
+                    break;
+                case OP_FSW_V:
+                    address = R[op->rs1] + op->imm;
+                    size = 4;
+                    host = tlb_lookup(&engine->mmu, address, 4, ACCESS_WRITE);
+                    if (host == NULL) {
+                        if (engine->mmu.fault) {
+                            goto page_fault;
+                        }
+                        address = engine->mmu.physical;
+                        if (engine_device_write(engine, op - first, address, LENGTH_WORD, F[op->rs2]) != 0) {
+                            goto bad_write;
+                        }
+                        goto device_stored;
+                    }
+                    *(Word *) host = F[op->rs2];
+                    address = host - memory;
+                    goto stored;
+                case OP_FP:
+                    if (fpu_execute(op->imm, engine->processor) != 0) {
+                        engine->fault = op->imm;
+                        status = ENGINE_INVALID_INSTRUCTION;
+                        goto stop;
+                    }
+                    R[0] = 0;
+                    break;
+                case OP_BEQ:
+                    if (R[op->rs1] == R[op->rs2]) {
+                        engine->stats.branches_taken++;
+                        pc += op->imm;
+                    } else {
+                        pc += 4;
+                    }
+                    op++;
+                    goto block_done;
+                case OP_BNE:
+                    if (R[op->rs1] != R[op->rs2]) {
+                        engine->stats.branches_taken++;
+                        pc += op->imm;
+                    } else {
+                        pc += 4;
+                    }
+                    op++;
+                    goto block_done;
+                case OP_LOOP:
+                    if (R[op->rs1] == R[op->rs2]) {
+                        pc += 4;
+                        op++;
+                        goto block_done;
+                    }
+                    /* back at the start with a whole iteration ahead */
+                    engine->stats.branches_taken++;
+                    pc += op->imm;
+                    op++;
+                    retired = idiom_run(engine, &engine->idioms[op[-1].rd], budget - (op - first), &pc);
+                    engine->instret += retired;
+                    budget -= retired;
+                    goto block_done;
+                case OP_JAL:
+                    R[op->rd] = pc + 4;
+                    R[0] = 0;
+                    pc += op->imm;
+                    op++;
+                    goto block_done;
+                case OP_CSRRW:
+                case OP_CSRRS:
+                case OP_CSRRC:
+                case OP_CSRRWI:
+                case OP_CSRRSI:
+                case OP_CSRRCI:
+                    value = kind >= OP_CSRRWI ? op->rs1 : R[op->rs1];
+                    old = engine_read_csr(engine, op->imm);
+                    if (kind == OP_CSRRW || kind == OP_CSRRWI) {
+                        engine_write_csr(engine, op->imm, value);
+                    } else if (op->rs1 != 0) {
+                        /* csrrs and csrrc with x0 or 0 do not write */
+                        engine_write_csr(engine, op->imm,
+                                         (kind == OP_CSRRS || kind == OP_CSRRSI) ? old | value : old & ~value);
+                    }
+                    R[op->rd] = old;
+                    R[0] = 0;
+                    if (engine->events && IS_TRAP_CSR(op->imm)) {
+                        /* may have enabled a pending interrupt */
+                        status = ENGINE_EVENT;
+                    }
+                    pc += 4;
+                    op++;
+                    goto block_done;
+                case OP_SFENCE_VMA:
+                    if (op->rs1 == 0) {
+                        tlb_flush(&engine->mmu);
+                    } else {
+                        tlb_flush_page(&engine->mmu, R[op->rs1]);
+                    }
+                    pc += 4;
+                    op++;
+                    goto block_done;
+                case OP_ECALL:
+                    engine->processor->PC = pc;
+                    status = engine_ecall(engine);
+                    op++;
+                    if (status != ENGINE_BUDGET) {
+                        goto block_done;
+                    }
+                    pc += 4;
+                    goto block_done;
+                case OP_MRET:
+                    engine->processor->PC = pc;
+                    trap_return(engine->processor);
+                    pc = engine->processor->PC;
+                    op++;
+                    if (engine->events) {
+                        status = ENGINE_EVENT;
+                    }
+                    goto block_done;
+                case OP_BREAK:
+                    status = ENGINE_BREAKPOINT;
+                    goto stop;
+                default:
+                    if (kind & OP_HOOKED) {
+                        plugins_run_hooks(engine->plugins, op, op - engine->code, pc, R, F);
+                        kind &= ~OP_HOOKED;
+                        goto dispatch;
+                    }
+                    engine->fault = op->imm;
+                    status = ENGINE_INVALID_INSTRUCTION;
+                    goto stop;
+            }
+            pc += 4;
+        }
+    block_done:
+        if (engine->coverage) {
+            cover_block(engine, first, op, block_pc, pc);
+        }
+        engine->instret += op - first;
+        budget -= op - first;
+        if (engine->plugins && op - first < first->len && op->kind != OP_UNDECODED) {
+            engine->plugins->resumes[op - engine->code] = 1;
+        }
+        drop_written_page(engine);
+        if (status != ENGINE_BUDGET) {
+            break;
+        }
+        if (engine->stop) {
+            engine->stop = 0;
+            status = ENGINE_WATCHPOINT;
+            break;
+        }
+        continue;
+
+    bad_read:
+        engine->fault = address;
+        status = ENGINE_BAD_READ;
+        goto stop;
+    bad_write:
+        engine->fault = address;
+        status = ENGINE_BAD_WRITE;
+        goto stop;
+    page_fault:
+        engine->fault = address;
+        status = ENGINE_PAGE_FAULT;
+    stop:
+        /* the operation that stopped the run did not retire */
+        engine->stats.classes[op->cls]--;
+        engine->instret += op - first;
+        if (engine->coverage) {
+            coverage_mark_range(engine->coverage, (first - engine->code) << 2, op - first);
+        }
+        break;
+    }
+
+    engine->processor->PC = pc;
+    return status;
+}
+
+/* Prints the same messages as the handle_invalid_* functions in utils.c */
+void engine_report(Engine *engine, EngineStatus status) {
+    switch (status) {
+        case ENGINE_INVALID_INSTRUCTION:
+            printf("Invalid Instruction: 0x%08x\n", engine->fault);
+            break;
+        case ENGINE_BAD_READ:
+            printf("Bad Read. Address: 0x%08x\n", engine->fault);
+            break;
+        case ENGINE_BAD_WRITE:
+            printf("Bad Write. Address: 0x%08x\n", engine->fault);
+            break;
+        case ENGINE_PAGE_FAULT:
+            printf("Page Fault. Address: 0x%08x\n", engine->fault);
+            break;
+        default:
+            break;
+    }
+}
@@ -0,0 +1,136 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stdio.h>
+#include <signal.h>
+#include "types.h"
+#include "memory.h"
+#include "devices.h"
+#include "mmu.h"
+#include "syscalls.h"
+#include "stats.h"
+#include "idiom.h"
+#include "coverage.h"
+
+/* Operations understood by the predecoded engine. Writes to x0 are
+   translated to OP_NOP, so no operation has to re-zero x0 afterwards. */
+typedef enum {
+    OP_UNDECODED = 0,
+    OP_NOP,
+    OP_ADD, OP_MUL, OP_SUB, OP_SLL, OP_MULH, OP_SLT, OP_XOR, OP_DIV,
+    OP_SRL, OP_SRA, OP_OR, OP_REM, OP_AND,
+    OP_ADDI, OP_SLLI, OP_SLTI, OP_XORI, OP_SRLI, OP_SRAI, OP_ORI, OP_ANDI,
+    OP_LB, OP_LH, OP_LW,
+    OP_SB, OP_SH, OP_SW,
+    /* the same accesses through the TLB, used while paging is enabled */
+    OP_LB_V, OP_LH_V, OP_LW_V,
+    OP_SB_V, OP_SH_V, OP_SW_V,
+    OP_LUI,
+    /* RV32F: word accesses to the FP registers, plain and through the
+       TLB, and every other instruction run by fpu_execute() from imm */
+    OP_FLW, OP_FSW, OP_FLW_V, OP_FSW_V, OP_FP,
+    /* everything below ends a block */
+    OP_BEQ, OP_BNE, OP_JAL,
+    OP_LOOP,    /* bne closing a loop in idioms[rd], see idiom.c */
+    OP_CSRRW, OP_CSRRS, OP_CSRRC, OP_CSRRWI, OP_CSRRSI, OP_CSRRCI,
+    OP_SFENCE_VMA, OP_ECALL, OP_MRET,
+    OP_BREAK,   /* breakpoint patched over the instruction, never executed */
+    OP_INVALID
+} OpKind;
+
+/* Set in the kind of operations a plugin attached callbacks to, see
+   plugin.h */
+#define OP_HOOKED 0x80
+
+/* A fully decoded instruction. imm holds the sign-extended immediate (the
+   CSR number for CSR operations, the raw instruction bits for OP_FP and
+   OP_INVALID).
+   len is the number of operations from this one to the end of its block,
+   so execution never re-checks block boundaries inside a block. cls is the
+   InstructionClass the instruction is counted as in the run statistics. */
+typedef struct {
+    uint8_t kind;
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    uint8_t len;
+    uint8_t cls;
+    sWord imm;
+} DecodedOp;
+
+/* Why engine_run() returned */
+typedef enum {
+    ENGINE_BUDGET,          /* ran the requested number of instructions */
+    ENGINE_EXIT,            /* guest exit ecall, see exit_code */
+    ENGINE_INVALID_INSTRUCTION,
+    ENGINE_BAD_READ,
+    ENGINE_BAD_WRITE,
+    ENGINE_BREAKPOINT,      /* stopped in front of a breakpoint */
+    ENGINE_WATCHPOINT,      /* stopped after an access to a watched page */
+    ENGINE_PAGE_FAULT,      /* fault is the virtual address */
+    ENGINE_EVENT,           /* events changed the schedule or the interrupt
+                               state, see events.h; run again after them */
+} EngineStatus;
+
+#define MAX_BREAKPOINTS 64
+
+/* CSRs the engine implements, besides those of the FPU */
+#define CSR_SATP 0x180
+
+/* Size of the AFL-style edge coverage map, a power of two */
+#define EDGE_MAP_SIZE 65536
+
+/* The predecoded execution engine. It owns a decode cache with one entry
+   per word of guest memory, filled a block at a time on first execution and
+   dropped per page when the guest writes to code. The cache is indexed by
+   physical address, so it survives changes to the page tables. */
+typedef struct {
+    Processor *processor;
+    Byte *memory;               /* allocated with alloc_memory() */
+    DecodedOp *code;
+    Byte code_pages[NUM_PAGES]; /* pages with decoded code in them */
+    FILE *console;              /* ecall output, NULL to discard */
+    uint64_t instret;           /* instructions retired */
+    int exit_code;
+    Word fault;                 /* faulting address or instruction bits */
+    Address breakpoints[MAX_BREAKPOINTS];
+    unsigned breakpoint_count;
+    int watch_mode;             /* end blocks after every load and store */
+    volatile sig_atomic_t translating;
+    volatile sig_atomic_t stop; /* set from a signal handler, see debug.c */
+    DeviceMap *devices;         /* accesses outside of RAM, or NULL */
+    Byte *edge_map;             /* EDGE_MAP_SIZE hit counters, or NULL */
+    Coverage *coverage;         /* executed code, or NULL */
+    Word previous_location;
+    Mmu mmu;
+    int paging;                 /* satp.MODE is Sv32 */
+    unsigned dropped_page;      /* code page + 1 a page walk wrote, or 0 */
+    Syscalls *syscalls;         /* Linux system calls, or NULL */
+    struct EventQueue *events;  /* set by rvsim_run()'s owner, or NULL */
+    RunStats stats;             /* see stats.h */
+    struct Plugins *plugins;    /* instrumentation, or NULL */
+    Idiom idioms[MAX_IDIOMS];
+    unsigned idiom_count;       /* slots in use */
+} Engine;
+
+int engine_init(Engine *engine, Processor *processor, Byte *memory, FILE *console);
+void engine_free(Engine *engine);
+DecodedOp decode_op(uint32_t instruction_bits);
+EngineStatus engine_run(Engine *engine, uint64_t budget);
+void engine_invalidate_page(Engine *engine, unsigned page);
+void engine_flush(Engine *engine);
+void engine_restore_memory(Engine *engine, const Byte *pristine);
+void engine_reset(Engine *engine);
+void engine_dma_written(void *opaque, Address address, Word length);
+Byte *engine_translate(void *opaque, Address address, Word length, int write);
+int engine_set_breakpoint(Engine *engine, Address address);
+int engine_clear_breakpoint(Engine *engine, Address address);
+int engine_has_breakpoint(Engine *engine, Address address);
+void engine_report(Engine *engine, EngineStatus status);
+
+/* see idiom.c */
+void idiom_translate(Engine *engine, DecodedOp *first, unsigned count, Address pc);
+void idiom_drop_page(Engine *engine, unsigned page);
+uint64_t idiom_run(Engine *engine, const Idiom *idiom, uint64_t budget, Address *pc);
+
+#endif
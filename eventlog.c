@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "types.h"
+#include "memory.h"
+#include "eventlog.h"
+
+/* Buffered like any FILE, with a bigger buffer: recording costs a few
+ * byte stores per event and a write() every EVENT_LOG_BUFFER bytes */
+#define EVENT_LOG_BUFFER 65536
+
+static void put_number(FILE *file, Word value) {
+    while (value >= 0x80) {
+        putc_unlocked((value & 0x7F) | 0x80, file);
+        value >>= 7;
+    }
+    putc_unlocked(value, file);
+}
+
+static int get_number(FILE *file, Word *value) {
+    unsigned shift;
+    int c;
+
+    *value = 0;
+    for (shift = 0; shift < 35; shift += 7) {
+        c = getc_unlocked(file);
+        if (c == EOF) {
+            return -1;
+        }
+        *value |= (Word) (c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int event_log_open(EventLog *log, const char *path, LogMode mode) {
+    Word magic, version;
+
+    memset(log, 0, sizeof(EventLog));
+    log->file = fopen(path, mode == LOG_RECORD ? "wb" : "rb");
+    if (log->file == NULL) {
+        return -1;
+    }
+    setvbuf(log->file, NULL, _IOFBF, EVENT_LOG_BUFFER);
+    if (mode == LOG_RECORD) {
+        put_number(log->file, EVENT_LOG_MAGIC);
+        put_number(log->file, EVENT_LOG_VERSION);
+    } else if (get_number(log->file, &magic) != 0 || magic != EVENT_LOG_MAGIC
+               || get_number(log->file, &version) != 0 || version != EVENT_LOG_VERSION) {
+        fprintf(stderr, "%s is not an event log\n", path);
+        fclose(log->file);
+        log->file = NULL;
+        return -1;
+    }
+    log->mode = mode;
+    return 0;
+}
+
+/* A recording that only lives as long as the simulator, for reverse
+ * execution */
+int event_log_temporary(EventLog *log) {
+    memset(log, 0, sizeof(EventLog));
+    log->file = tmpfile();
+    if (log->file == NULL) {
+        return -1;
+    }
+    setvbuf(log->file, NULL, _IOFBF, EVENT_LOG_BUFFER);
+    put_number(log->file, EVENT_LOG_MAGIC);
+    put_number(log->file, EVENT_LOG_VERSION);
+    log->mode = LOG_RECORD;
+    return 0;
+}
+
+long event_log_tell(EventLog *log) {
+    return log->file ? ftell(log->file) : 0;
+}
+
+/* Replays a recording (opened with event_log_temporary()) from an earlier
+ * event_log_tell(). Once the replay reaches the end of what was recorded
+ * the log goes back to recording. */
+int event_log_rewind(EventLog *log, long offset) {
+    if (log->file == NULL || (log->mode != LOG_RECORD && !log->rewound)
+        || fseek(log->file, offset, SEEK_SET) != 0) {
+        return -1;
+    }
+    log->mode = LOG_REPLAY;
+    log->rewound = 1;
+    return 0;
+}
+
+/* Forgets the recording after the current position of a rewound log: the
+ * run took another path from here */
+void event_log_truncate(EventLog *log) {
+    long offset;
+
+    if (!log->rewound) {
+        return;
+    }
+    offset = ftell(log->file);
+    fflush(log->file);
+    if (ftruncate(fileno(log->file), offset) == 0) {
+        fseek(log->file, offset, SEEK_SET);
+    }
+    log->mode = LOG_RECORD;
+    log->rewound = 0;
+}
+
+static int caught_up(EventLog *log) {
+    clearerr(log->file);
+    fseek(log->file, 0, SEEK_END);
+    log->mode = LOG_RECORD;
+    log->rewound = 0;
+    return -1;
+}
+
+void event_log_close(EventLog *log) {
+    if (log->file) {
+        fclose(log->file);
+    }
+    memset(log, 0, sizeof(EventLog));
+}
+
+/* Recording */
+
+void log_device_read(EventLog *log, Address address, Word value) {
+    putc_unlocked(EVENT_DEVICE_READ, log->file);
+    put_number(log->file, address);
+    put_number(log->file, value);
+    log->events++;
+}
+
+void log_memory(EventLog *log, Address address, const Byte *data, Word length) {
+    putc_unlocked(EVENT_MEMORY, log->file);
+    put_number(log->file, address);
+    put_number(log->file, length);
+    fwrite(data, 1, length, log->file);
+    log->events++;
+}
+
+void log_syscall(EventLog *log, Word number, Word result) {
+    putc_unlocked(EVENT_SYSCALL, log->file);
+    put_number(log->file, number);
+    put_number(log->file, result);
+    log->events++;
+}
+
+/* Replaying. Anything unexpected ends the replay: the run carries on
+ * against the host from there. A rewound log that runs out has caught up
+ * with the recording and records again. */
+
+int replay_diverged(EventLog *log, const char *what) {
+    fprintf(stderr, "Replay diverged after %llu events: %s\n", (unsigned long long) log->events, what);
+    log->mode = LOG_OFF;
+    return -1;
+}
+
+/* The type of the next event, or -1 at the end of the log */
+int replay_peek(EventLog *log) {
+    int c = getc_unlocked(log->file);
+    if (c != EOF) {
+        ungetc(c, log->file);
+    }
+    return c == EOF ? -1 : c;
+}
+
+static int expect(EventLog *log, EventType type, const char *what) {
+    int c = getc_unlocked(log->file);
+    if (c == EOF) {
+        return log->rewound ? caught_up(log) : replay_diverged(log, "log ended");
+    }
+    if (c != type) {
+        return replay_diverged(log, what);
+    }
+    log->events++;
+    return 0;
+}
+
+int replay_device_read(EventLog *log, Address address, Word *value) {
+    Word logged;
+
+    if (expect(log, EVENT_DEVICE_READ, "expected a device read") != 0) {
+        return -1;
+    }
+    if (get_number(log->file, &logged) != 0 || logged != address
+        || get_number(log->file, value) != 0) {
+        return replay_diverged(log, "device read from another address");
+    }
+    return 0;
+}
+
+/* Copies the bytes of a memory event into guest memory */
+int replay_memory(EventLog *log, Byte *memory, Address *address, Word *length) {
+    if (expect(log, EVENT_MEMORY, "expected a memory write") != 0) {
+        return -1;
+    }
+    if (get_number(log->file, address) != 0 || get_number(log->file, length) != 0
+        || *address > MEMORY_SPACE || *length > MEMORY_SPACE - *address
+        || fread(memory + *address, 1, *length, log->file) != *length) {
+        return replay_diverged(log, "bad memory write");
+    }
+    return 0;
+}
+
+int replay_syscall(EventLog *log, Word number, Word *result) {
+    Word logged;
+
+    if (expect(log, EVENT_SYSCALL, "expected a system call") != 0) {
+        return -1;
+    }
+    if (get_number(log->file, &logged) != 0 || logged != number
+        || get_number(log->file, result) != 0) {
+        return replay_diverged(log, "different system call");
+    }
+    return 0;
+}
@@ -0,0 +1,55 @@
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+#include <stdio.h>
+#include "types.h"
+
+/* Record and replay. Everything a run gets from the host rather than from
+   its own instructions is logged while recording: device register reads,
+   system call results and the guest memory system calls or DMA wrote.
+   Replaying feeds the log back instead of asking the host, so the run
+   repeats exactly. Guest output still goes to the host.
+
+   The log is a header followed by events, each a type byte and LEB128
+   fields, so most events take 3 to 6 bytes. Addresses and system call
+   numbers are kept to catch a replay that went a different way. */
+#define EVENT_LOG_MAGIC 0x4C455652  /* "RVEL" */
+#define EVENT_LOG_VERSION 1
+
+typedef enum {
+    EVENT_DEVICE_READ = 1,      /* address, value */
+    EVENT_MEMORY,               /* physical address, length, bytes */
+    EVENT_SYSCALL,              /* number, result */
+} EventType;
+
+typedef enum {
+    LOG_OFF,
+    LOG_RECORD,
+    LOG_REPLAY,
+} LogMode;
+
+typedef struct EventLog {
+    FILE *file;
+    LogMode mode;               /* falls back to LOG_OFF once a replay diverges */
+    int rewound;                /* replaying our own recording, see event_log_rewind() */
+    uint64_t events;
+} EventLog;
+
+int event_log_open(EventLog *log, const char *path, LogMode mode);
+int event_log_temporary(EventLog *log);
+long event_log_tell(EventLog *log);
+int event_log_rewind(EventLog *log, long offset);
+void event_log_truncate(EventLog *log);
+void event_log_close(EventLog *log);
+
+void log_device_read(EventLog *log, Address address, Word value);
+void log_memory(EventLog *log, Address address, const Byte *data, Word length);
+void log_syscall(EventLog *log, Word number, Word result);
+
+int replay_device_read(EventLog *log, Address address, Word *value);
+int replay_memory(EventLog *log, Byte *memory, Address *address, Word *length);
+int replay_syscall(EventLog *log, Word number, Word *result);
+int replay_peek(EventLog *log);
+int replay_diverged(EventLog *log, const char *what);
+
+#endif
@@ -0,0 +1,72 @@
+#include <string.h>
+#include "events.h"
+
+/* There are only a few kinds of events, each scheduled at most once, so
+ * the queue is an array by kind with the earliest time kept on the side. */
+
+static void find_next(EventQueue *queue) {
+    unsigned i;
+
+    queue->next = EVENT_NEVER;
+    for (i = 0; i < EVENT_KINDS; i++) {
+        if (queue->events[i].when < queue->next) {
+            queue->next = queue->events[i].when;
+        }
+    }
+}
+
+void event_queue_init(EventQueue *queue) {
+    memset(queue, 0, sizeof(EventQueue));
+    event_queue_reset(queue);
+}
+
+void event_queue_reset(EventQueue *queue) {
+    unsigned i;
+
+    for (i = 0; i < EVENT_KINDS; i++) {
+        queue->events[i].when = EVENT_NEVER;
+    }
+    queue->now = 0;
+    queue->next = EVENT_NEVER;
+    queue->changed = 0;
+}
+
+void event_set_handler(EventQueue *queue, EventKind kind, void (*fire)(void *opaque), void *opaque) {
+    queue->events[kind].fire = fire;
+    queue->events[kind].opaque = opaque;
+}
+
+void event_schedule(EventQueue *queue, EventKind kind, uint64_t when) {
+    queue->events[kind].when = when;
+    find_next(queue);
+    queue->changed = 1;
+}
+
+void event_cancel(EventQueue *queue, EventKind kind) {
+    event_schedule(queue, kind, EVENT_NEVER);
+}
+
+uint64_t event_budget(const EventQueue *queue, uint64_t budget) {
+    if (queue->next <= queue->now) {
+        return 0;
+    }
+    return queue->next - queue->now < budget ? queue->next - queue->now : budget;
+}
+
+/* A handler may schedule its own kind again, so each event is taken off
+ * the queue before it fires */
+void event_fire_due(EventQueue *queue) {
+    unsigned i;
+
+    while (queue->next <= queue->now) {
+        for (i = 0; i < EVENT_KINDS; i++) {
+            if (queue->events[i].when <= queue->now) {
+                queue->events[i].when = EVENT_NEVER;
+                find_next(queue);
+                if (queue->events[i].fire) {
+                    queue->events[i].fire(queue->events[i].opaque);
+                }
+            }
+        }
+    }
+}
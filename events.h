@@ -0,0 +1,46 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdint.h>
+
+/* Things that fall due at a point in guest time, which is the number of
+   instructions retired. Instead of every instruction asking the devices
+   whether something happened, rvsim_run() asks the queue how far it may
+   run before the next event, lets the engine count that down a block at a
+   time and fires whatever is due when it comes back. */
+
+#define EVENT_NEVER UINT64_MAX
+
+typedef enum {
+    EVENT_TIMER,        /* mtime reached mtimecmp, see devices.c */
+    EVENT_KINDS
+} EventKind;
+
+typedef struct {
+    uint64_t when;      /* EVENT_NEVER while not scheduled */
+    void (*fire)(void *opaque);
+    void *opaque;
+} Event;
+
+typedef struct EventQueue {
+    uint64_t now;       /* guest time as of the last instruction run */
+    uint64_t next;      /* earliest when of all events */
+    Event events[EVENT_KINDS];
+    /* set when the schedule or the interrupt state changed in the middle
+       of a run; the run loop stops and looks again */
+    int changed;
+} EventQueue;
+
+void event_queue_init(EventQueue *queue);
+/* Cancels everything and goes back to time 0, keeping the handlers */
+void event_queue_reset(EventQueue *queue);
+void event_set_handler(EventQueue *queue, EventKind kind, void (*fire)(void *opaque), void *opaque);
+/* Replaces the kind's earlier schedule, if any. when may be in the past. */
+void event_schedule(EventQueue *queue, EventKind kind, uint64_t when);
+void event_cancel(EventQueue *queue, EventKind kind);
+/* How many of budget instructions can run before the next event */
+uint64_t event_budget(const EventQueue *queue, uint64_t budget);
+/* Fires every event due at queue->now */
+void event_fire_due(EventQueue *queue);
+
+#endif
@@ -0,0 +1,354 @@
+#include <fenv.h>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include "fpu.h"
+
+/* Rounding modes, as in the rm field of an instruction and in frm */
+enum { RM_RNE, RM_RTZ, RM_RDN, RM_RUP, RM_RMM, RM_DYN = 7 };
+
+#define FRM_SHIFT 5
+#define FFLAGS_MASK 0x1F
+#define SIGN 0x80000000
+#define QUIET 0x00400000
+#define CANONICAL_NAN 0x7FC00000
+
+/* The operations whose result depends on the rounding mode */
+typedef enum {
+    ROUND_ADD, ROUND_SUB, ROUND_MUL, ROUND_DIV,
+    ROUND_MADD, ROUND_MSUB, ROUND_NMSUB, ROUND_NMADD,
+    ROUND_SQRT, ROUND_FROM_INT, ROUND_FROM_UINT
+} Rounded;
+
+static float to_float(Word bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static Word to_bits(float value) {
+    Word bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static int is_nan(Word bits) {
+    return (bits & ~SIGN) > 0x7F800000;
+}
+
+static int is_infinity(Word bits) {
+    return (bits & ~SIGN) == 0x7F800000;
+}
+
+static int is_signaling(Word bits) {
+    return is_nan(bits) && !(bits & QUIET);
+}
+
+/* The exceptions the host raised since they were last cleared */
+static Word raised_flags(void) {
+    int raised = fetestexcept(FE_ALL_EXCEPT);
+
+    return (raised & FE_INEXACT ? FFLAG_NX : 0) | (raised & FE_UNDERFLOW ? FFLAG_UF : 0)
+        | (raised & FE_OVERFLOW ? FFLAG_OF : 0) | (raised & FE_DIVBYZERO ? FFLAG_DZ : 0)
+        | (raised & FE_INVALID ? FFLAG_NV : 0);
+}
+
+/* Runs op on the host FPU in its current rounding mode, which is a single
+ * SSE instruction on x86-64 for all but the fused operations. Both detect
+ * tininess after rounding, so the flags are the ones RISC-V wants. The
+ * volatiles keep the compiler from moving the arithmetic across the calls
+ * that set the mode and read the flags. */
+static float host_single(Rounded op, Word a, Word b, Word c) {
+    volatile float x = to_float(a), y = to_float(b), z = to_float(c), result;
+    volatile sWord integer = a;
+
+    switch (op) {
+        case ROUND_ADD: result = x + y; break;
+        case ROUND_SUB: result = x - y; break;
+        case ROUND_MUL: result = x * y; break;
+        case ROUND_DIV: result = x / y; break;
+        case ROUND_MADD: result = fmaf(x, y, z); break;
+        case ROUND_MSUB: result = fmaf(x, y, -z); break;
+        case ROUND_NMSUB: result = fmaf(-x, y, z); break;
+        case ROUND_NMADD: result = fmaf(-x, y, -z); break;
+        case ROUND_SQRT: result = sqrtf(x); break;
+        case ROUND_FROM_INT: result = integer; break;
+        default: result = (Word) integer; break;
+    }
+    return result;
+}
+
+/* The same in double precision, which holds the exact result whenever it
+ * has no more than 53 significant bits */
+static double host_double(Rounded op, Word a, Word b, Word c) {
+    volatile double x = to_float(a), y = to_float(b), z = to_float(c), result;
+    volatile sWord integer = a;
+
+    switch (op) {
+        case ROUND_ADD: result = x + y; break;
+        case ROUND_SUB: result = x - y; break;
+        case ROUND_MUL: result = x * y; break;
+        case ROUND_DIV: result = x / y; break;
+        case ROUND_MADD: result = fma(x, y, z); break;
+        case ROUND_MSUB: result = fma(x, y, -z); break;
+        case ROUND_NMSUB: result = fma(-x, y, z); break;
+        case ROUND_NMADD: result = fma(-x, y, -z); break;
+        case ROUND_SQRT: result = sqrt(x); break;
+        case ROUND_FROM_INT: result = integer; break;
+        default: result = (Word) integer; break;
+    }
+    return result;
+}
+
+/* Rounds to nearest with ties away from zero, which the host has no mode
+ * for. It only differs from ties to even when the exact result lies
+ * halfway between two floats, and such a result has 25 significant bits,
+ * so it comes out of the double precision operation exactly. */
+static float round_max_magnitude(Rounded op, Word a, Word b, Word c, Word *flags) {
+    float nearest = host_single(op, a, b, c), low, high;
+    double exact;
+
+    *flags = raised_flags();
+    if (!(*flags & FFLAG_NX) || isinf(nearest)) {
+        return nearest;
+    }
+    feclearexcept(FE_ALL_EXCEPT);
+    exact = host_double(op, a, b, c);
+    if (fetestexcept(FE_INEXACT)) {
+        return nearest;
+    }
+    if (fabs(nearest) > fabs(exact)) {
+        high = nearest;
+        low = nextafterf(nearest, 0);
+    } else {
+        low = nearest;
+        high = nextafterf(nearest, copysignf(INFINITY, nearest));
+    }
+    if ((double) low + (double) high != 2 * exact) {
+        return nearest;
+    }
+    *flags = FFLAG_NX | (fabsf(high) < FLT_MIN ? FFLAG_UF : 0);
+    return high;
+}
+
+/* Runs op with rounding mode rm and accrues its exceptions. The host is
+ * always left rounding to nearest even, the mode compilers use, so that
+ * case costs one instruction and clearing and reading the flags. */
+static Word rounded(Processor *processor, Rounded op, Word rm, Word a, Word b, Word c) {
+    static const int host_modes[] = { FE_TONEAREST, FE_TOWARDZERO, FE_DOWNWARD, FE_UPWARD };
+    Word result, flags;
+
+    feclearexcept(FE_ALL_EXCEPT);
+    if (rm == RM_RNE) {
+        result = to_bits(host_single(op, a, b, c));
+        flags = raised_flags();
+    } else if (rm == RM_RMM) {
+        result = to_bits(round_max_magnitude(op, a, b, c, &flags));
+    } else {
+        fesetround(host_modes[rm]);
+        result = to_bits(host_single(op, a, b, c));
+        flags = raised_flags();
+        fesetround(FE_TONEAREST);
+    }
+    processor->fcsr |= flags;
+    /* the host passes on the payload of a NaN operand, RISC-V does not */
+    return is_nan(result) ? CANONICAL_NAN : result;
+}
+
+/* fcvt.w.s and fcvt.wu.s, which saturate NaNs and values out of range */
+static Word to_integer(Processor *processor, Word bits, Word rm, int is_unsigned) {
+    float value = to_float(bits), integral;
+
+    if (is_nan(bits)) {
+        processor->fcsr |= FFLAG_NV;
+        return is_unsigned ? 0xFFFFFFFF : 0x7FFFFFFF;
+    }
+    switch (rm) {
+        case RM_RNE: integral = nearbyintf(value); break;
+        case RM_RTZ: integral = truncf(value); break;
+        case RM_RDN: integral = floorf(value); break;
+        case RM_RUP: integral = ceilf(value); break;
+        default: integral = roundf(value); break;
+    }
+    if (is_unsigned ? integral <= -1.0f || integral >= 4294967296.0f
+                    : integral < -2147483648.0f || integral >= 2147483648.0f) {
+        processor->fcsr |= FFLAG_NV;
+        if (is_unsigned) {
+            return integral < 0 ? 0 : 0xFFFFFFFF;
+        }
+        return integral < 0 ? 0x80000000 : 0x7FFFFFFF;
+    }
+    if (integral != value) {
+        processor->fcsr |= FFLAG_NX;
+    }
+    return is_unsigned ? (Word) integral : (Word) (sWord) integral;
+}
+
+/* fmin.s and fmax.s: a NaN only wins against another NaN, and -0 is
+ * smaller than +0 */
+static Word min_max(Processor *processor, int is_max, Word a, Word b) {
+    float x = to_float(a), y = to_float(b);
+
+    if (is_signaling(a) || is_signaling(b)) {
+        processor->fcsr |= FFLAG_NV;
+    }
+    if (is_nan(a) || is_nan(b)) {
+        return is_nan(a) && is_nan(b) ? CANONICAL_NAN : is_nan(a) ? b : a;
+    }
+    if (x == y) {
+        /* equal values only differ in the sign of a zero */
+        return is_max ? a & b : a | b;
+    }
+    return (x < y) != is_max ? a : b;
+}
+
+/* fle.s, flt.s and feq.s. Only feq.s is quiet about quiet NaNs. */
+static Word compare(Processor *processor, Word funct3, Word a, Word b) {
+    float x = to_float(a), y = to_float(b);
+
+    if (is_nan(a) || is_nan(b)) {
+        if (funct3 != 2 || is_signaling(a) || is_signaling(b)) {
+            processor->fcsr |= FFLAG_NV;
+        }
+        return 0;
+    }
+    return funct3 == 0 ? x <= y : funct3 == 1 ? x < y : x == y;
+}
+
+/* fclass.s: one bit out of -inf, -normal, -subnormal, -0, +0, +subnormal,
+ * +normal, +inf, signaling NaN and quiet NaN */
+static Word classify(Word bits) {
+    Word exponent = (bits >> 23) & 0xFF, fraction = bits & 0x7FFFFF;
+    int negative = bits >> 31;
+
+    if (exponent == 0xFF) {
+        if (fraction != 0) {
+            return bits & QUIET ? 1 << 9 : 1 << 8;
+        }
+        return negative ? 1 << 0 : 1 << 7;
+    }
+    if (exponent == 0) {
+        if (fraction != 0) {
+            return negative ? 1 << 2 : 1 << 5;
+        }
+        return negative ? 1 << 3 : 1 << 4;
+    }
+    return negative ? 1 << 1 : 1 << 6;
+}
+
+int fpu_execute(Word instruction_bits, Processor *processor) {
+    Word opcode = instruction_bits & 0x7F;
+    Word rd = (instruction_bits >> 7) & 0x1F;
+    Word funct3 = (instruction_bits >> 12) & 0x7;
+    Word rs1 = (instruction_bits >> 15) & 0x1F;
+    Word rs2 = (instruction_bits >> 20) & 0x1F;
+    Word funct7 = instruction_bits >> 25;
+    Word rm = funct3 == RM_DYN ? processor->fcsr >> FRM_SHIFT : funct3;
+    Word *F = processor->F, a = F[rs1], b = F[rs2], c, sign;
+    Register *R = processor->R;
+
+    if (opcode != 0x53) {
+        /* fmadd.s, fmsub.s, fnmsub.s and fnmadd.s, with rs3 above fmt */
+        if (!IS_FPU_OPCODE(opcode) || (funct7 & 0x3) != 0 || rm > RM_RMM) {
+            return -1;
+        }
+        c = F[funct7 >> 2];
+        if (is_nan(c) && ((is_infinity(a) && (b & ~SIGN) == 0) || ((a & ~SIGN) == 0 && is_infinity(b)))) {
+            /* invalid even though the addend is a quiet NaN, which the
+               host's fused multiply-add does not signal */
+            processor->fcsr |= FFLAG_NV;
+        }
+        F[rd] = rounded(processor, ROUND_MADD + ((opcode >> 2) & 0x3), rm, a, b, c);
+        return 0;
+    }
+    switch (funct7) {
+        case 0x00: case 0x04: case 0x08: case 0x0C:
+            /* fadd.s, fsub.s, fmul.s, fdiv.s */
+            if (rm > RM_RMM) {
+                return -1;
+            }
+            F[rd] = rounded(processor, ROUND_ADD + (funct7 >> 2), rm, a, b, 0);
+            return 0;
+        case 0x2C:
+            if (rm > RM_RMM || rs2 != 0) {
+                return -1;
+            }
+            F[rd] = rounded(processor, ROUND_SQRT, rm, a, 0, 0);
+            return 0;
+        case 0x10:
+            /* fsgnj.s, fsgnjn.s, fsgnjx.s */
+            if (funct3 > 2) {
+                return -1;
+            }
+            sign = funct3 == 0 ? b : funct3 == 1 ? ~b : a ^ b;
+            F[rd] = (a & ~SIGN) | (sign & SIGN);
+            return 0;
+        case 0x14:
+            if (funct3 > 1) {
+                return -1;
+            }
+            F[rd] = min_max(processor, funct3, a, b);
+            return 0;
+        case 0x50:
+            if (funct3 > 2) {
+                return -1;
+            }
+            R[rd] = compare(processor, funct3, a, b);
+            return 0;
+        case 0x60:
+            /* fcvt.w.s, fcvt.wu.s */
+            if (rm > RM_RMM || rs2 > 1) {
+                return -1;
+            }
+            R[rd] = to_integer(processor, a, rm, rs2);
+            return 0;
+        case 0x68:
+            /* fcvt.s.w, fcvt.s.wu */
+            if (rm > RM_RMM || rs2 > 1) {
+                return -1;
+            }
+            F[rd] = rounded(processor, rs2 ? ROUND_FROM_UINT : ROUND_FROM_INT, rm, R[rs1], 0, 0);
+            return 0;
+        case 0x70:
+            /* fmv.x.w, fclass.s */
+            if (rs2 != 0 || funct3 > 1) {
+                return -1;
+            }
+            R[rd] = funct3 ? classify(a) : a;
+            return 0;
+        case 0x78:
+            /* fmv.w.x */
+            if (rs2 != 0 || funct3 != 0) {
+                return -1;
+            }
+            F[rd] = R[rs1];
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+Word fpu_read_csr(const Processor *processor, Word csr) {
+    switch (csr) {
+        case CSR_FFLAGS:
+            return processor->fcsr & FFLAGS_MASK;
+        case CSR_FRM:
+            return processor->fcsr >> FRM_SHIFT;
+        default:
+            return processor->fcsr;
+    }
+}
+
+void fpu_write_csr(Processor *processor, Word csr, Word value) {
+    switch (csr) {
+        case CSR_FFLAGS:
+            processor->fcsr = (processor->fcsr & ~FFLAGS_MASK) | (value & FFLAGS_MASK);
+            break;
+        case CSR_FRM:
+            processor->fcsr = (processor->fcsr & FFLAGS_MASK) | (value & 0x7) << FRM_SHIFT;
+            break;
+        default:
+            processor->fcsr = value & 0xFF;
+            break;
+    }
+}
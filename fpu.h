@@ -0,0 +1,36 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include "types.h"
+
+/* The F extension, shared by the interpreter and the engine. Its state is
+   Processor.F, the bits of the single-precision registers, and
+   Processor.fcsr, the rounding mode (frm) above the accrued exception
+   flags (fflags). There is no mstatus.FS: floating point is always on. */
+
+/* CSRs */
+#define CSR_FFLAGS 0x001
+#define CSR_FRM 0x002
+#define CSR_FCSR 0x003
+#define IS_FPU_CSR(csr) ((csr) >= CSR_FFLAGS && (csr) <= CSR_FCSR)
+
+/* fflags */
+#define FFLAG_NX 0x01           /* inexact */
+#define FFLAG_UF 0x02           /* underflow */
+#define FFLAG_OF 0x04           /* overflow */
+#define FFLAG_DZ 0x08           /* divide by zero */
+#define FFLAG_NV 0x10           /* invalid operation */
+
+/* OP-FP and the four fused multiply-adds. flw (0x07) and fsw (0x27) are
+   plain word accesses the callers do themselves. */
+#define IS_FPU_OPCODE(opcode) ((opcode) == 0x53 || ((opcode) & 0x73) == 0x43)
+
+/* Runs an instruction with an FPU opcode, without moving the PC. Returns
+   0, or -1 for an encoding outside RV32F or a reserved rounding mode, in
+   the instruction or in frm; the instruction then changed nothing. */
+int fpu_execute(Word instruction_bits, Processor *processor);
+
+Word fpu_read_csr(const Processor *processor, Word csr);
+void fpu_write_csr(Processor *processor, Word csr, Word value);
+
+#endif
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "types.h"
+#include "riscv.h"
+#include "memory.h"
+#include "engine.h"
+
+/* In-process fuzzing harness for guest programs, in the libFuzzer
+ * interface. The guest named by RISCV_FUZZ_PROGRAM is loaded once; every
+ * input is copied to the guest buffer at RISCV_FUZZ_BUFFER (default
+ * 0x80000, at most RISCV_FUZZ_SIZE bytes) and the guest starts with a0
+ * pointing at it and a1 holding its length. It then runs until its exit
+ * ecall or for at most RISCV_FUZZ_BUDGET instructions, after which only
+ * the pages it dirtied are restored for the next input.
+ *
+ * Invalid instructions, bad reads and writes, and illegal ecalls abort(),
+ * which the fuzzer records as a crash. Guest edges are fed back through
+ * libFuzzer's extra counters.
+ *
+ * Built with -DLIBFUZZER this links against libFuzzer; otherwise main()
+ * below replays the files given on the command line. */
+
+__attribute__((section("__libfuzzer_extra_counters")))
+static Byte edge_counters[EDGE_MAP_SIZE];
+
+static Byte *memory, *pristine;
+static Processor processor;
+static Engine engine;
+static Address buffer_address = 0x80000;
+static Word buffer_size = 4096;
+static uint64_t budget = 1000000;
+
+static unsigned long env_number(const char *name, unsigned long fallback) {
+    const char *value = getenv(name);
+    return value ? strtoul(value, NULL, 0) : fallback;
+}
+
+int LLVMFuzzerInitialize(int *argc, char ***argv) {
+    const char *program = getenv("RISCV_FUZZ_PROGRAM");
+
+    buffer_address = env_number("RISCV_FUZZ_BUFFER", buffer_address);
+    buffer_size = env_number("RISCV_FUZZ_SIZE", buffer_size);
+    budget = env_number("RISCV_FUZZ_BUDGET", budget);
+    if (program == NULL) {
+        fprintf(stderr, "Set RISCV_FUZZ_PROGRAM to the guest program to fuzz\n");
+        exit(-1);
+    }
+    if (buffer_address >= MEMORY_SPACE || buffer_size > MEMORY_SPACE - buffer_address) {
+        fprintf(stderr, "Guest buffer 0x%x+%u is outside of memory\n", buffer_address, buffer_size);
+        exit(-1);
+    }
+
+    memory = alloc_memory();
+    pristine = alloc_memory();
+    if (memory == NULL || pristine == NULL
+        || engine_init(&engine, &processor, memory, NULL) != 0) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    if (load_program(memory, MEMORY_SPACE, 0x1000, program, 0) < 0) {
+        fprintf(stderr, "Cannot read %s\n", program);
+        exit(-1);
+    }
+    memcpy(pristine, memory, MEMORY_SPACE);
+    clear_dirty(memory);
+    engine.edge_map = edge_counters;
+    return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    EngineStatus status;
+    Address address;
+
+    if (size > buffer_size) {
+        size = buffer_size;
+    }
+    memcpy(memory + buffer_address, data, size);
+    for (address = buffer_address; address < buffer_address + size; address += PAGE_SIZE) {
+        MARK_DIRTY(memory, address);
+    }
+    if (size > 0) {
+        MARK_DIRTY(memory, buffer_address + size - 1);
+    }
+
+    /* nothing the previous input did may change how this one runs */
+    init_processor(&processor);
+    processor.R[10] = buffer_address;
+    processor.R[11] = size;
+    engine_reset(&engine);
+    engine.instret = 0;
+    memset(&engine.stats, 0, sizeof(engine.stats));
+
+    status = engine_run(&engine, budget);
+    if (status == ENGINE_EXIT && engine.exit_code != 0) {
+        fprintf(stderr, "Illegal ecall %d at %08x\n", processor.R[10], processor.PC);
+        abort();
+    }
+    if (status != ENGINE_EXIT && status != ENGINE_BUDGET) {
+        engine_report(&engine, status);
+        fprintf(stderr, "Guest crashed at %08x\n", processor.PC);
+        fflush(stdout);
+        abort();
+    }
+
+    engine_restore_memory(&engine, pristine);
+    return 0;
+}
+
+#ifndef LIBFUZZER
+/* Runs each file named on the command line through the harness once */
+int main(int argc, char **argv) {
+    FILE *file;
+    uint8_t *data;
+    long size;
+    int i;
+
+    LLVMFuzzerInitialize(&argc, &argv);
+    for (i = 1; i < argc; i++) {
+        file = fopen(argv[i], "rb");
+        if (file == NULL) {
+            fprintf(stderr, "Cannot read %s\n", argv[i]);
+            return -1;
+        }
+        fseek(file, 0, SEEK_END);
+        size = ftell(file);
+        rewind(file);
+        data = malloc(size ? size : 1);
+        if (fread(data, 1, size, file) != (size_t) size) {
+            size = 0;
+        }
+        fclose(file);
+        LLVMFuzzerTestOneInput(data, size);
+        printf("%s: ok\n", argv[i]);
+        free(data);
+    }
+    return 0;
+}
+#endif
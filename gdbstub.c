@@ -0,0 +1,526 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "types.h"
+#include "memory.h"
+#include "engine.h"
+#include "debug.h"
+#include "reverse.h"
+#include "gdbstub.h"
+
+/* Largest packet we accept or send, advertised in qSupported */
+#define PACKET_SIZE 4096
+
+/* Instructions run between checks for a ^C from gdb */
+#define INTERRUPT_INTERVAL 1000000
+
+static const char target_xml[] =
+    "<?xml version=\"1.0\"?>"
+    "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+    "<target><architecture>riscv:rv32</architecture></target>";
+
+typedef struct {
+    int fd;
+    char input[PACKET_SIZE];
+    size_t input_length, input_position;
+    Engine *engine;
+    Debugger *debugger;
+    Reverse *reverse;           /* NULL without reverse execution */
+    EngineStatus status;        /* of the last debug_run() */
+} Connection;
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/* Appends value as little-endian hex bytes, the way gdb sends registers */
+static char *put_word(char *out, Word value) {
+    int i;
+    for (i = 0; i < 4; i++, value >>= 8) {
+        *out++ = hex_digits[(value >> 4) & 0xF];
+        *out++ = hex_digits[value & 0xF];
+    }
+    return out;
+}
+
+static Word get_word(const char *in) {
+    Word value = 0;
+    int i;
+    for (i = 3; i >= 0; i--) {
+        value = (value << 8) | (hex_value(in[2 * i]) << 4) | hex_value(in[2 * i + 1]);
+    }
+    return value;
+}
+
+static int get_char(Connection *connection) {
+    ssize_t n;
+    if (connection->input_position == connection->input_length) {
+        n = read(connection->fd, connection->input, sizeof(connection->input));
+        if (n <= 0) {
+            return -1;
+        }
+        connection->input_length = n;
+        connection->input_position = 0;
+    }
+    return (unsigned char) connection->input[connection->input_position++];
+}
+
+/* Reads the next packet into buffer, acknowledging it. Returns its length,
+ * or -1 when gdb went away. */
+static int read_packet(Connection *connection, char *buffer) {
+    int c, length, checksum;
+
+    for (;;) {
+        do {
+            c = get_char(connection);
+            if (c < 0) {
+                return -1;
+            }
+        } while (c != '$');
+
+        length = 0;
+        checksum = 0;
+        while ((c = get_char(connection)) != '#') {
+            if (c < 0) {
+                return -1;
+            }
+            if (length < PACKET_SIZE - 1) {
+                buffer[length++] = c;
+            }
+            checksum += c;
+        }
+        buffer[length] = '\0';
+        c = hex_value(get_char(connection)) << 4;
+        c |= hex_value(get_char(connection));
+        if (c == (checksum & 0xFF)) {
+            write(connection->fd, "+", 1);
+            return length;
+        }
+        write(connection->fd, "-", 1);
+    }
+}
+
+static void send_packet(Connection *connection, const char *data) {
+    char frame[PACKET_SIZE + 4];
+    size_t length = strlen(data), i;
+    int checksum = 0;
+
+    frame[0] = '$';
+    for (i = 0; i < length; i++) {
+        frame[i + 1] = data[i];
+        checksum += (unsigned char) data[i];
+    }
+    frame[length + 1] = '#';
+    frame[length + 2] = hex_digits[(checksum >> 4) & 0xF];
+    frame[length + 3] = hex_digits[checksum & 0xF];
+    write(connection->fd, frame, length + 4);
+}
+
+/* Checks for a ^C from gdb without blocking the guest */
+static int interrupt_pending(Connection *connection) {
+    struct pollfd pfd;
+    int c;
+
+    pfd.fd = connection->fd;
+    pfd.events = POLLIN;
+    while (connection->input_position < connection->input_length || poll(&pfd, 1, 0) > 0) {
+        c = get_char(connection);
+        if (c == 0x03 || c < 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static Register *get_register(Connection *connection, unsigned n) {
+    Processor *processor = connection->engine->processor;
+    if (n < 32) {
+        return &processor->R[n];
+    }
+    return n == 32 ? &processor->PC : NULL;
+}
+
+/* The guest as reverse execution sees it, see reverse.h */
+static uint64_t run_guest(void *opaque, uint64_t budget, int *stopped) {
+    Connection *connection = opaque;
+    uint64_t start = connection->engine->instret;
+
+    connection->status = debug_run(connection->debugger, budget);
+    *stopped = connection->status != ENGINE_BUDGET;
+    return connection->engine->instret - start;
+}
+
+static int at_breakpoint(void *opaque) {
+    Engine *engine = ((Connection *) opaque)->engine;
+    return engine_has_breakpoint(engine, engine->processor->PC);
+}
+
+static void guest_written(void *opaque, Address address, Word length) {
+    engine_dma_written(((Connection *) opaque)->engine, address, length);
+}
+
+static EngineStatus run_for(Connection *connection, uint64_t budget) {
+    int stopped;
+
+    if (connection->reverse == NULL) {
+        return debug_run(connection->debugger, budget);
+    }
+    connection->status = ENGINE_BUDGET;
+    reverse_run(connection->reverse, budget, &stopped);
+    return connection->status;
+}
+
+/* gdb changed the machine: the history after this point is gone */
+static void changed(Connection *connection) {
+    if (connection->reverse) {
+        reverse_forget_future(connection->reverse);
+    }
+}
+
+/* Runs the guest until something worth telling gdb happens */
+static void resume(Connection *connection, const char *packet, int step, char *reply) {
+    Engine *engine = connection->engine;
+    Debugger *debugger = connection->debugger;
+    EngineStatus status;
+    static const char *watch_names[] = { "", "", "watch", "rwatch", "awatch" };
+
+    if (packet[1]) {
+        engine->processor->PC = strtoul(packet + 1, NULL, 16);
+        changed(connection);
+    }
+    for (;;) {
+        status = run_for(connection, step ? 1 : INTERRUPT_INTERVAL);
+        if (step || status != ENGINE_BUDGET) {
+            break;
+        }
+        if (interrupt_pending(connection)) {
+            fflush(stdout);
+            strcpy(reply, "S02");
+            return;
+        }
+    }
+    fflush(stdout);
+
+    switch (status) {
+        case ENGINE_EXIT:
+            sprintf(reply, "W%02x", engine->exit_code & 0xFF);
+            break;
+        case ENGINE_WATCHPOINT:
+            sprintf(reply, "T05%s:%x;", watch_names[debugger->hit->type], debugger->hit_address);
+            break;
+        case ENGINE_INVALID_INSTRUCTION:
+            strcpy(reply, "S04");
+            break;
+        case ENGINE_BAD_READ:
+        case ENGINE_BAD_WRITE:
+        case ENGINE_PAGE_FAULT:
+            strcpy(reply, "S0b");
+            break;
+        default:
+            strcpy(reply, "S05");
+            break;
+    }
+}
+
+/* bs and bc packets: back one instruction or to the previous stop. gdb
+ * learns it went past the start of history from replaylog. */
+static void reverse(Connection *connection, int step, char *reply) {
+    int result;
+
+    if (connection->reverse == NULL) {
+        reply[0] = '\0';
+        return;
+    }
+    result = step ? reverse_step(connection->reverse, 1) : reverse_continue(connection->reverse);
+    strcpy(reply, result == 0 ? "S05" : "T05replaylog:begin;");
+}
+
+static void read_memory(Connection *connection, const char *packet, char *reply) {
+    Byte *memory = connection->engine->memory;
+    char *end;
+    Address address = strtoul(packet + 1, &end, 16);
+    Word length = strtoul(end + 1, NULL, 16), i;
+
+    if (address >= MEMORY_SPACE || length > MEMORY_SPACE - address || length > PACKET_SIZE / 2 - 1) {
+        strcpy(reply, "E01");
+        return;
+    }
+    for (i = 0; i < length; i++) {
+        *reply++ = hex_digits[memory[address + i] >> 4];
+        *reply++ = hex_digits[memory[address + i] & 0xF];
+    }
+    *reply = '\0';
+}
+
+static void write_memory(Connection *connection, const char *packet, char *reply) {
+    Engine *engine = connection->engine;
+    char *end;
+    Address address = strtoul(packet + 1, &end, 16);
+    Word length = strtoul(end + 1, &end, 16), i;
+
+    if (*end != ':' || address >= MEMORY_SPACE || length > MEMORY_SPACE - address
+        || strlen(end + 1) / 2 < length) {
+        strcpy(reply, "E01");
+        return;
+    }
+    /* nothing is written unless all of the data is good */
+    for (i = 0; i < 2 * length; i++) {
+        if (hex_value(end[1 + i]) < 0) {
+            strcpy(reply, "E01");
+            return;
+        }
+    }
+    for (i = 0; i < length; i++) {
+        engine->memory[address + i] = (hex_value(end[1 + 2 * i]) << 4) | hex_value(end[2 + 2 * i]);
+        MARK_DIRTY(engine->memory, address + i);
+        if (engine->code_pages[(address + i) >> PAGE_SHIFT]) {
+            engine_invalidate_page(engine, (address + i) >> PAGE_SHIFT);
+        }
+    }
+    changed(connection);
+    strcpy(reply, "OK");
+}
+
+/* Z and z packets: type,address,kind */
+static void set_point(Connection *connection, const char *packet, char *reply) {
+    int insert = packet[0] == 'Z', type = packet[1] - '0', result;
+    char *end;
+    Address address = strtoul(packet + 3, &end, 16);
+    Word length = strtoul(end + 1, NULL, 16);
+
+    switch (type) {
+        case 0:
+        case 1:
+            result = insert ? engine_set_breakpoint(connection->engine, address)
+                            : engine_clear_breakpoint(connection->engine, address);
+            break;
+        case WATCH_WRITE:
+        case WATCH_READ:
+        case WATCH_ACCESS:
+            result = insert ? debug_set_watchpoint(connection->debugger, address, length, type)
+                            : debug_clear_watchpoint(connection->debugger, address, length, type);
+            break;
+        default:
+            reply[0] = '\0';
+            return;
+    }
+    strcpy(reply, result == 0 ? "OK" : "E01");
+}
+
+static void query(Connection *connection, const char *packet, char *reply) {
+    Word offset, length;
+    char *end;
+
+    if (strncmp(packet, "qSupported", 10) == 0) {
+        sprintf(reply, "PacketSize=%x;qXfer:features:read+%s", PACKET_SIZE,
+                connection->reverse ? ";ReverseStep+;ReverseContinue+" : "");
+    } else if (strncmp(packet, "qXfer:features:read:target.xml:", 31) == 0) {
+        offset = strtoul(packet + 31, &end, 16);
+        length = strtoul(end + 1, NULL, 16);
+        if (offset >= sizeof(target_xml) - 1) {
+            strcpy(reply, "l");
+            return;
+        }
+        if (length > PACKET_SIZE - 2) {
+            length = PACKET_SIZE - 2;
+        }
+        if (length >= sizeof(target_xml) - 1 - offset) {
+            length = sizeof(target_xml) - 1 - offset;
+            reply[0] = 'l';
+        } else {
+            reply[0] = 'm';
+        }
+        memcpy(reply + 1, target_xml + offset, length);
+        reply[length + 1] = '\0';
+    } else if (strcmp(packet, "qAttached") == 0) {
+        strcpy(reply, "1");
+    } else {
+        reply[0] = '\0';
+    }
+}
+
+/* Serves one gdb session until it detaches, kills the guest or goes away */
+static int serve_connection(Connection *connection) {
+    char packet[PACKET_SIZE], reply[PACKET_SIZE], *out;
+    Register *reg;
+    char *end;
+    unsigned n;
+
+    strcpy(reply, "S05");
+    for (;;) {
+        if (read_packet(connection, packet) < 0) {
+            return 0;
+        }
+        switch (packet[0]) {
+            case '?':
+                strcpy(reply, "S05");
+                break;
+            case 'g':
+                out = reply;
+                for (n = 0; n <= 32; n++) {
+                    out = put_word(out, *get_register(connection, n));
+                }
+                *out = '\0';
+                break;
+            case 'G':
+                for (n = 0; n <= 32 && strlen(packet + 1) >= 8 * (n + 1); n++) {
+                    *get_register(connection, n) = get_word(packet + 1 + 8 * n);
+                }
+                connection->engine->processor->R[0] = 0;
+                changed(connection);
+                strcpy(reply, "OK");
+                break;
+            case 'p':
+                reg = get_register(connection, strtoul(packet + 1, NULL, 16));
+                if (reg) {
+                    *put_word(reply, *reg) = '\0';
+                } else {
+                    strcpy(reply, "xxxxxxxx");
+                }
+                break;
+            case 'P':
+                reg = get_register(connection, strtoul(packet + 1, &end, 16));
+                if (reg && *end == '=') {
+                    *reg = get_word(end + 1);
+                    connection->engine->processor->R[0] = 0;
+                    changed(connection);
+                    strcpy(reply, "OK");
+                } else {
+                    strcpy(reply, "E01");
+                }
+                break;
+            case 'm':
+                read_memory(connection, packet, reply);
+                break;
+            case 'M':
+                write_memory(connection, packet, reply);
+                break;
+            case 'c':
+            case 's':
+                resume(connection, packet, packet[0] == 's', reply);
+                break;
+            case 'b':
+                if (packet[1] == 's' || packet[1] == 'c') {
+                    reverse(connection, packet[1] == 's', reply);
+                } else {
+                    reply[0] = '\0';
+                }
+                break;
+            case 'Z':
+            case 'z':
+                set_point(connection, packet, reply);
+                break;
+            case 'q':
+                query(connection, packet, reply);
+                break;
+            case 'H':
+                strcpy(reply, "OK");
+                break;
+            case 'D':
+                send_packet(connection, "OK");
+                return 0;
+            case 'k':
+                return -1;
+            default:
+                reply[0] = '\0';
+                break;
+        }
+        send_packet(connection, reply);
+    }
+}
+
+/* Listens on a Unix socket if where looks like a path, else on a TCP port
+ * on the loopback interface */
+static int open_listener(const char *where) {
+    int fd, one = 1;
+
+    if (strchr(where, '/')) {
+        struct sockaddr_un addr;
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, where, sizeof(addr.sun_path) - 1);
+        unlink(where);
+        if (fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+            return -1;
+        }
+    } else {
+        struct sockaddr_in addr;
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(atoi(where));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+            return -1;
+        }
+    }
+    return listen(fd, 1) == 0 ? fd : -1;
+}
+
+/* Runs the guest under control of a gdb attached through where, keeping
+ * up to history bytes of snapshots for reverse execution (0 for none).
+ * Returns the simulator's exit code. */
+int gdb_serve(Processor *processor, Byte *memory, const char *where, size_t history) {
+    Connection connection;
+    Engine engine;
+    Debugger debugger;
+    Reverse reverse;
+    int listener, one = 1;
+
+    listener = open_listener(where);
+    if (listener < 0) {
+        fprintf(stderr, "Cannot listen for gdb on %s\n", where);
+        return -1;
+    }
+    if (engine_init(&engine, processor, memory, stdout) != 0 || debug_init(&debugger, &engine) != 0) {
+        fprintf(stderr, "Cannot set up the debugger\n");
+        return -1;
+    }
+    fprintf(stderr, "Waiting for gdb on %s\n", where);
+
+    memset(&connection, 0, sizeof(connection));
+    connection.engine = &engine;
+    connection.debugger = &debugger;
+    if (history > 0) {
+        if (reverse_init(&reverse, processor, memory, history, run_guest, &connection) == 0) {
+            reverse.at_breakpoint = at_breakpoint;
+            reverse.written = guest_written;
+            connection.reverse = &reverse;
+        } else {
+            fprintf(stderr, "Cannot go backwards while recording or replaying\n");
+        }
+    }
+    connection.fd = accept(listener, NULL, NULL);
+    close(listener);
+    if (connection.fd < 0) {
+        return -1;
+    }
+    setsockopt(connection.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    serve_connection(&connection);
+
+    close(connection.fd);
+    if (strchr(where, '/')) {
+        unlink(where);
+    }
+    if (connection.reverse) {
+        reverse_free(&reverse);
+    }
+    debug_free(&debugger);
+    engine_free(&engine);
+    return engine.exit_code;
+}
@@ -0,0 +1,10 @@
+#ifndef GDBSTUB_H
+#define GDBSTUB_H
+
+#include <stddef.h>
+#include "types.h"
+
+/* see gdbstub.c */
+int gdb_serve(Processor *processor, Byte *memory, const char *where, size_t history);
+
+#endif
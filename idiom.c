@@ -0,0 +1,274 @@
+#include <string.h>
+#include "types.h"
+#include "memory.h"
+#include "engine.h"
+
+/* Guest copy, fill and string loops run natively. translate_block() hands
+ * every block to idiom_translate(), which looks for a loop that only moves
+ * memory and turns its closing bne into OP_LOOP. When engine_run() takes
+ * that branch it calls idiom_run(), which does the remaining iterations in
+ * one go and leaves registers, memory and statistics exactly as running
+ * them one by one would. Anything it cannot prove safe at that point
+ * (devices, overlap, code pages, a loop that would wrap around) is left to
+ * the normal path. */
+
+static int step_index(const Idiom *idiom, unsigned reg) {
+    unsigned i;
+    for (i = 0; i < idiom->steps; i++) {
+        if (idiom->step_reg[i] == reg) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int walks(const Idiom *idiom, unsigned reg, unsigned width) {
+    int i = step_index(idiom, reg);
+    return i >= 0 && idiom->step[i] == (sWord) width;
+}
+
+static int recognize(Idiom *idiom, const DecodedOp *body, unsigned ops) {
+    const DecodedOp *branch = &body[ops - 1], *op;
+    sWord offset[32];
+    unsigned i, load_width = 0, store_width = 0, store_after_load = 0;
+    int index;
+
+    memset(offset, 0, sizeof(offset));
+    for (op = body; op < branch; op++) {
+        switch (op->kind) {
+            case OP_NOP:
+                break;
+            case OP_ADDI:
+                if (op->rd != op->rs1 || (idiom->has_load && op->rd == idiom->load_rd)) {
+                    return -1;
+                }
+                index = step_index(idiom, op->rd);
+                if (index < 0) {
+                    if (idiom->steps == MAX_IDIOM_STEPS) {
+                        return -1;
+                    }
+                    index = idiom->steps++;
+                    idiom->step_reg[index] = op->rd;
+                }
+                idiom->step[index] += op->imm;
+                offset[op->rd] += op->imm;
+                break;
+            case OP_LB:
+            case OP_LH:
+            case OP_LW:
+                if (idiom->has_load || op->rd == 0 || op->rd == op->rs1 || step_index(idiom, op->rd) >= 0) {
+                    return -1;
+                }
+                idiom->has_load = 1;
+                idiom->load_rd = op->rd;
+                idiom->load_base = op->rs1;
+                idiom->load_offset = op->imm + offset[op->rs1];
+                load_width = 1 << (op->kind - OP_LB);
+                break;
+            case OP_SB:
+            case OP_SH:
+            case OP_SW:
+                if (idiom->has_store) {
+                    return -1;
+                }
+                idiom->has_store = 1;
+                idiom->store_base = op->rs1;
+                idiom->store_value = op->rs2;
+                idiom->store_offset = op->imm + offset[op->rs1];
+                store_width = 1 << (op->kind - OP_SB);
+                store_after_load = idiom->has_load;
+                break;
+            default:
+                return -1;
+        }
+    }
+
+    /* what moves memory: a copy, a fill or a scan */
+    if (idiom->has_load && idiom->has_store) {
+        if (idiom->store_value != idiom->load_rd || !store_after_load || load_width != store_width
+            || idiom->store_base == idiom->load_rd) {
+            return -1;
+        }
+    } else if (idiom->has_store) {
+        if (step_index(idiom, idiom->store_value) >= 0) {
+            return -1;
+        }
+    } else if (!idiom->has_load) {
+        return -1;
+    }
+    idiom->width = idiom->has_load ? load_width : store_width;
+    if ((idiom->has_load && !walks(idiom, idiom->load_base, idiom->width))
+        || (idiom->has_store && !walks(idiom, idiom->store_base, idiom->width))) {
+        return -1;
+    }
+
+    /* and when it ends */
+    for (i = 0; i < 2; i++) {
+        unsigned a = i ? branch->rs2 : branch->rs1, b = i ? branch->rs1 : branch->rs2;
+        if (idiom->has_load && a == idiom->load_rd && b == 0) {
+            idiom->until_zero = 1;
+            return 0;
+        }
+        index = step_index(idiom, a);
+        if (index >= 0 && idiom->step[index] != 0 && step_index(idiom, b) < 0
+            && !(idiom->has_load && b == idiom->load_rd)) {
+            idiom->counter = a;
+            idiom->limit = b;
+            idiom->counter_step = idiom->step[index];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Looks at a freshly translated block of count operations at physical
+ * address pc for a loop back to somewhere inside it */
+void idiom_translate(Engine *engine, DecodedOp *first, unsigned count, Address pc) {
+    DecodedOp *branch = &first[count - 1];
+    unsigned start, slot;
+    Idiom idiom;
+
+    /* instrumentation, coverage and watchpoints want every iteration */
+    if (count < 2 || branch->kind != OP_BNE || branch->imm >= 0 || engine->plugins || engine->edge_map || engine->coverage
+        || engine->watch_mode || engine->paging || (unsigned) (-branch->imm / 4) > count - 1) {
+        return;
+    }
+    start = count - 1 - (unsigned) (-branch->imm / 4);
+    memset(&idiom, 0, sizeof(idiom));
+    if (recognize(&idiom, first + start, count - start) != 0) {
+        return;
+    }
+    for (slot = 0; slot < MAX_IDIOMS && engine->idioms[slot].ops != 0; slot++) {
+    }
+    if (slot == MAX_IDIOMS) {
+        return;
+    }
+    idiom.start = pc + 4 * start;
+    idiom.ops = count - start;
+    engine->idioms[slot] = idiom;
+    engine->idiom_count++;
+    branch->kind = OP_LOOP;
+    branch->rd = slot;
+}
+
+/* Frees the idioms of a page whose decoded code was dropped */
+void idiom_drop_page(Engine *engine, unsigned page) {
+    unsigned slot;
+
+    for (slot = 0; engine->idiom_count > 0 && slot < MAX_IDIOMS; slot++) {
+        if (engine->idioms[slot].ops != 0 && engine->idioms[slot].start >> PAGE_SHIFT == page) {
+            engine->idioms[slot].ops = 0;
+            engine->idiom_count--;
+        }
+    }
+}
+
+/* Elements from element up to and including the first zero one, or 0 if
+ * there is none before the end of memory */
+static uint64_t until_zero(const Byte *memory, Address address, unsigned width) {
+    const Byte *end;
+    Address a;
+
+    if (width == 1) {
+        end = memchr(memory + address, 0, MEMORY_SPACE - address);
+        return end ? end - (memory + address) + 1 : 0;
+    }
+    for (a = address; a <= MEMORY_SPACE - width; a += width) {
+        if ((width == 2 && *(Half *) (memory + a) == 0) || (width == 4 && *(Word *) (memory + a) == 0)) {
+            return (a - address) / width + 1;
+        }
+    }
+    return 0;
+}
+
+static Word load_element(const Byte *memory, Address address, unsigned width) {
+    switch (width) {
+        case 1: return (sByte) memory[address];
+        case 2: return (sHalf) *(Half *) (memory + address);
+        default: return *(Word *) (memory + address);
+    }
+}
+
+/* Runs the rest of a loop from its start, but no more than budget
+ * instructions of it. Returns the number of instructions retired and
+ * moves pc past the loop if it ended, or 0 to run it the normal way. */
+uint64_t idiom_run(Engine *engine, const Idiom *idiom, uint64_t budget, Address *pc) {
+    Register *R = engine->processor->R;
+    Byte *memory = engine->memory;
+    const DecodedOp *body = &engine->code[idiom->start >> 2];
+    Address source = R[idiom->load_base] + idiom->load_offset;
+    Address target = R[idiom->store_base] + idiom->store_offset;
+    uint64_t n, most = budget / idiom->ops, bytes;
+    Word distance, step, value = 0, element;
+    unsigned width = idiom->width, i, page;
+    int ends = 1;
+
+    if (most == 0 || (idiom->has_load && source >= MEMORY_SPACE)) {
+        return 0;
+    }
+    if (idiom->until_zero) {
+        n = until_zero(memory, source, width);
+    } else {
+        distance = idiom->counter_step > 0 ? R[idiom->limit] - R[idiom->counter]
+                                           : R[idiom->counter] - R[idiom->limit];
+        step = idiom->counter_step > 0 ? idiom->counter_step : -idiom->counter_step;
+        n = distance % step == 0 ? distance / step : 0;
+    }
+    if (n == 0) {
+        return 0;
+    }
+    if (n > most) {
+        n = most;
+        ends = 0;
+    }
+    bytes = n * width;
+    if ((idiom->has_load && bytes > MEMORY_SPACE - source)
+        || (idiom->has_store && (target >= MEMORY_SPACE || bytes > MEMORY_SPACE - target))) {
+        return 0;
+    }
+    if (idiom->has_store) {
+        /* a forward copy onto itself repeats a pattern, memmove() does not */
+        if (idiom->has_load && target > source && target < source + bytes) {
+            return 0;
+        }
+        for (page = target >> PAGE_SHIFT; page <= (target + bytes - 1) >> PAGE_SHIFT; page++) {
+            if (engine->code_pages[page]) {
+                return 0;
+            }
+        }
+    }
+
+    if (idiom->has_load) {
+        value = load_element(memory, source + (n - 1) * width, width);
+        engine->stats.bytes_loaded += bytes;
+    }
+    if (idiom->has_store) {
+        if (idiom->has_load) {
+            memmove(memory + target, memory + source, bytes);
+        } else if (width == 1) {
+            memset(memory + target, R[idiom->store_value], bytes);
+        } else {
+            element = R[idiom->store_value];
+            for (i = 0; i < n; i++) {
+                memcpy(memory + target + i * width, &element, width);
+            }
+        }
+        for (page = target >> PAGE_SHIFT; page <= (target + bytes - 1) >> PAGE_SHIFT; page++) {
+            MARK_DIRTY(memory, page << PAGE_SHIFT);
+        }
+        engine->stats.bytes_stored += bytes;
+    }
+
+    for (i = 0; i < idiom->steps; i++) {
+        R[idiom->step_reg[i]] += (Word) n * idiom->step[i];
+    }
+    if (idiom->has_load) {
+        R[idiom->load_rd] = value;
+    }
+    for (i = 0; i < idiom->ops; i++) {
+        engine->stats.classes[body[i].cls] += n;
+    }
+    engine->stats.branches_taken += ends ? n - 1 : n;
+    *pc = ends ? idiom->start + 4 * idiom->ops : idiom->start;
+    return n * idiom->ops;
+}
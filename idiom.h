@@ -0,0 +1,34 @@
+#ifndef IDIOM_H
+#define IDIOM_H
+
+#include "types.h"
+
+/* Loops the engine can have recognized at once */
+#define MAX_IDIOMS 256
+
+/* Registers an idiom may step with addi: source, destination, counter */
+#define MAX_IDIOM_STEPS 4
+
+/* A loop that only moves memory, recognized when its block is translated
+   and then run with memmove(), memset() and memchr(), see idiom.c. The
+   loop is ops instructions from start ending in a bne back to start: at
+   most one load, at most one store of the same width, and addi steps of
+   the registers it walks memory with. Offsets are from the base registers
+   as they are at start. */
+typedef struct {
+    Address start;              /* physical */
+    uint8_t ops;                /* 0 for a free slot */
+    uint8_t width;              /* bytes per element */
+    uint8_t has_load, has_store;
+    uint8_t load_base, load_rd;
+    uint8_t store_base, store_value;
+    uint8_t until_zero;         /* ends after loading a zero, else on counter == limit */
+    uint8_t counter, limit;
+    uint8_t steps;
+    uint8_t step_reg[MAX_IDIOM_STEPS];
+    sWord step[MAX_IDIOM_STEPS];
+    sWord counter_step;
+    sWord load_offset, store_offset;
+} Idiom;
+
+#endif
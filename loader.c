@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "types.h"
+#include "riscv.h"
+#include "decode.h"
+
+/* Warns about every loaded word the simulator has no implementation for */
+int validate_program(const Word *words, unsigned count, Address address) {
+    DecodedBlock block;
+    unsigned i, n;
+    int invalid = 0;
+
+    for (; count > 0; count -= n, words += n, address += 4 * n) {
+        n = count < DECODE_BLOCK_SIZE ? count : DECODE_BLOCK_SIZE;
+        decode_block(words, n, &block);
+        for (i = 0; i < n; i++) {
+            if (!is_known_opcode(block.opcode[i])) {
+                fprintf(stderr, "Warning: undefined opcode in instruction 0x%08x at %08x\n",
+                        block.bits[i], address + 4 * i);
+                invalid++;
+            }
+        }
+    }
+    return invalid;
+}
+
+/* Loads a program in .input format (one hex word per line). Returns the
+ * number of words loaded, or -1 if the file cannot be read. */
+int load_program(uint8_t *mem, size_t memsize, int startaddr, const char *filename, int disasm) {
+    FILE *file = fopen(filename, "r");
+    const int MAX_SIZE = 50;
+    char line[MAX_SIZE];
+    int instruction, offset = 0;    
+
+    if (file == NULL) {
+        return -1;
+    }
+    while (fgets(line, MAX_SIZE, file) != NULL && startaddr + offset + 4 <= memsize) {
+        instruction = (int32_t) strtol(line, NULL, 16);
+        mem[startaddr + offset] = instruction & 0xFF;
+	mem[startaddr + offset + 1] = (instruction >> 8) & 0xFF;
+	mem[startaddr + offset + 2] = (instruction >> 16) & 0xFF;
+	mem[startaddr + offset + 3] = (instruction >> 24) & 0xFF;
+        offset += 4;
+    } 
+    fclose(file);
+
+    if (disasm) {
+        disassemble((Word *) (mem + startaddr), offset / 4, startaddr);
+    } else {
+        validate_program((Word *) (mem + startaddr), offset / 4, startaddr);
+    }
+    return offset / 4;
+}
+
+/* Puts the CPU in the state every program starts in */
+void init_processor(Processor *processor) {
+    int i;
+
+    /* zero out all registers */
+    for (i = 0; i < 32; i++) {
+        processor->R[i] = 0;
+        processor->F[i] = 0;
+    }
+    processor->fcsr = 0;
+    processor->mstatus = processor->mie = processor->mip = processor->mtvec = 0;
+    processor->mscratch = processor->mepc = processor->mcause = processor->mtval = 0;
+
+    /* Set the global pointer to 0x3000. We arbitrarily call this the middle of the static data segment */
+    processor->R[3] = 0x3000;
+
+    /* Set the stack pointer near the top of the memory array */
+    processor->R[2] = 0xEFFFF;
+
+    processor->PC = 0x1000;
+}
@@ -0,0 +1,136 @@
+#include <string.h>
+#include "lz.h"
+
+#define HASH_BITS 14
+#define MAX_OFFSET 65535
+/* matches end this far before the end of the input, so the compressor can
+ * always read 4 bytes ahead */
+#define END_LITERALS 5
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static unsigned hash(uint32_t sequence) {
+    return (sequence * 2654435761U) >> (32 - HASH_BITS);
+}
+
+/* Lengths that do not fit the token nibble continue in bytes of 255 */
+static uint8_t *put_length(uint8_t *out, size_t length) {
+    for (; length >= 255; length -= 255) {
+        *out++ = 255;
+    }
+    *out++ = length;
+    return out;
+}
+
+static uint8_t *put_sequence(uint8_t *out, const uint8_t *literals, size_t literal_length,
+                             size_t offset, size_t match_length) {
+    uint8_t *token = out++;
+    size_t match_code = match_length ? match_length - LZ_MIN_MATCH : 0;
+
+    *token = (literal_length < 15 ? literal_length : 15) << 4;
+    if (literal_length >= 15) {
+        out = put_length(out, literal_length - 15);
+    }
+    memcpy(out, literals, literal_length);
+    out += literal_length;
+    if (match_length) {
+        *out++ = offset & 0xFF;
+        *out++ = offset >> 8;
+        *token |= match_code < 15 ? match_code : 15;
+        if (match_code >= 15) {
+            out = put_length(out, match_code - 15);
+        }
+    }
+    return out;
+}
+
+/* Greedy parse: the most recent position with the same 4-byte hash is the
+ * only match candidate */
+size_t lz_compress(const uint8_t *in, size_t length, uint8_t *out) {
+    uint32_t table[1 << HASH_BITS];     /* position + 1, 0 = empty */
+    uint8_t *start = out;
+    size_t position = 0, anchor = 0, candidate, match_length;
+    uint32_t sequence;
+    unsigned h;
+
+    memset(table, 0, sizeof(table));
+    while (length > LZ_MIN_MATCH + END_LITERALS && position < length - LZ_MIN_MATCH - END_LITERALS) {
+        sequence = read32(in + position);
+        h = hash(sequence);
+        candidate = table[h];
+        table[h] = position + 1;
+        if (candidate == 0 || position - (candidate - 1) > MAX_OFFSET
+            || read32(in + candidate - 1) != sequence) {
+            position++;
+            continue;
+        }
+        candidate--;
+        match_length = LZ_MIN_MATCH;
+        while (position + match_length < length - END_LITERALS
+               && in[candidate + match_length] == in[position + match_length]) {
+            match_length++;
+        }
+        out = put_sequence(out, in + anchor, position - anchor, position - candidate, match_length);
+        position += match_length;
+        anchor = position;
+    }
+    out = put_sequence(out, in + anchor, length - anchor, 0, 0);
+    return out - start;
+}
+
+static int get_length(const uint8_t **in, const uint8_t *end, size_t *length) {
+    uint8_t byte;
+    do {
+        if (*in == end) {
+            return -1;
+        }
+        byte = *(*in)++;
+        *length += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+long lz_decompress(const uint8_t *in, size_t length, uint8_t *out, size_t capacity) {
+    const uint8_t *end = in + length;
+    size_t done = 0, literal_length, match_length, offset;
+    uint8_t token;
+
+    while (in < end) {
+        token = *in++;
+        literal_length = token >> 4;
+        if (literal_length == 15 && get_length(&in, end, &literal_length) != 0) {
+            return -1;
+        }
+        if (literal_length > (size_t) (end - in) || literal_length > capacity - done) {
+            return -1;
+        }
+        memcpy(out + done, in, literal_length);
+        in += literal_length;
+        done += literal_length;
+        if (in == end) {
+            break;      /* the last sequence has no match */
+        }
+        if (end - in < 2) {
+            return -1;
+        }
+        offset = in[0] | (in[1] << 8);
+        in += 2;
+        match_length = token & 0xF;
+        if (match_length == 15 && get_length(&in, end, &match_length) != 0) {
+            return -1;
+        }
+        match_length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > done || match_length > capacity - done) {
+            return -1;
+        }
+        /* byte by byte: the match may overlap what it copies */
+        for (; match_length > 0; match_length--, done++) {
+            out[done] = out[done - offset];
+        }
+    }
+    return done;
+}
@@ -0,0 +1,22 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A small LZ77 codec in the style of LZ4: byte-aligned sequences of
+   literals followed by a match (16-bit offset, length of at least
+   LZ_MIN_MATCH). No entropy coding, so both directions run at memory
+   speed, and register dumps, which mostly repeat the previous dump,
+   still shrink by well over an order of magnitude. */
+#define LZ_MIN_MATCH 4
+
+/* Worst case output size for length input bytes */
+#define LZ_BOUND(length) ((length) + (length) / 255 + 16)
+
+size_t lz_compress(const uint8_t *in, size_t length, uint8_t *out);
+/* Returns the number of bytes written to out, or -1 if in is corrupt or
+   would not fit in capacity bytes */
+long lz_decompress(const uint8_t *in, size_t length, uint8_t *out, size_t capacity);
+
+#endif
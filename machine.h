@@ -0,0 +1,36 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include "rvsim.h"
+#include "types.h"
+#include "memory.h"
+#include "devices.h"
+#include "syscalls.h"
+#include "stats.h"
+#include "engine.h"
+#include "plugin.h"
+#include "eventlog.h"
+#include "events.h"
+
+/* What an RvSim handle points to. Only the front end in riscv.c looks
+   inside, for the debugging modes that are not part of the library. */
+struct RvSim {
+    RvSimConfig config;
+    Processor processor;
+    Byte *memory;               /* allocated with alloc_memory() */
+    int memory_fd;              /* memfd behind memory, or -1 */
+    Byte *pristine;             /* memory as loaded, see rvsim_reset() */
+    unsigned words;             /* size of the loaded program */
+    DeviceMap devices;
+    Syscalls syscalls;
+    Engine engine;              /* unused with config.interpreter */
+    Plugins plugins;            /* engine instrumentation, see plugin.h */
+    EventLog log;               /* record or replay, see eventlog.h */
+    EventQueue events;          /* timer interrupts, see events.h */
+    Coverage *coverage;         /* see rvsim_enable_coverage(), or NULL */
+    RunStats stats;             /* the interpreter's, the engine keeps its own */
+    uint64_t instret;           /* the interpreter's */
+    RvSimStatus status;         /* sticky once the guest stopped */
+};
+
+#endif
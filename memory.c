@@ -0,0 +1,114 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "memory.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Allocates zeroed guest memory followed by its (clean) dirty map and an
+ * empty MemoryContext. The memory is mapped rather than malloc'd so that
+ * guest pages line up with host pages and can be protected individually
+ * (see debug.c). */
+Byte *alloc_memory(void) {
+    void *memory = mmap(NULL, MEMORY_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return memory == MAP_FAILED ? NULL : memory;
+}
+
+/* The same, backed by a memfd called name so that other processes can map
+ * it (through /proc/PID/fd/FD) and watch the guest while it runs. The
+ * simulator's own accesses are plain loads and stores either way. *fd is
+ * left open for as long as the memory is in use. */
+Byte *alloc_shared_memory(const char *name, int *fd) {
+    void *memory;
+
+    *fd = memfd_create(name, MFD_CLOEXEC);
+    if (*fd < 0) {
+        return NULL;
+    }
+    if (ftruncate(*fd, MEMORY_SIZE) != 0
+        || (memory = mmap(NULL, MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0)) == MAP_FAILED) {
+        close(*fd);
+        *fd = -1;
+        return NULL;
+    }
+    return memory;
+}
+
+void free_memory(Byte *memory) {
+    munmap(memory, MEMORY_SIZE);
+}
+
+void clear_dirty(Byte *memory) {
+    memset(DIRTY_MAP(memory), 0, NUM_PAGES);
+}
+
+/* Copies every dirty page back from pristine (MEMORY_SPACE bytes) and
+ * clears the dirty map */
+void restore_dirty(Byte *memory, const Byte *pristine) {
+    Byte *dirty = DIRTY_MAP(memory);
+    unsigned page;
+
+    for (page = 0; page < NUM_PAGES; page++) {
+        if (dirty[page]) {
+            memcpy(memory + (page << PAGE_SHIFT), pristine + (page << PAGE_SHIFT), PAGE_SIZE);
+            dirty[page] = 0;
+        }
+    }
+}
+
+/* Returns the offset of the first differing byte in a page, or -1 if both
+ * pages are identical. Compares 64 bytes per iteration. */
+static int compare_page(const Byte *a, const Byte *b) {
+    int offset;
+#ifdef __SSE2__
+    for (offset = 0; offset < PAGE_SIZE; offset += 64) {
+        const __m128i *va = (const __m128i *) (a + offset);
+        const __m128i *vb = (const __m128i *) (b + offset);
+        __m128i eq = _mm_and_si128(
+            _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(va), _mm_loadu_si128(vb)),
+                          _mm_cmpeq_epi8(_mm_loadu_si128(va + 1), _mm_loadu_si128(vb + 1))),
+            _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(va + 2), _mm_loadu_si128(vb + 2)),
+                          _mm_cmpeq_epi8(_mm_loadu_si128(va + 3), _mm_loadu_si128(vb + 3))));
+        if (_mm_movemask_epi8(eq) != 0xFFFF) {
+            break;
+        }
+    }
+    if (offset == PAGE_SIZE) {
+        return -1;
+    }
+    /* narrow down to the byte inside the mismatching chunk */
+    for (; a[offset] == b[offset]; offset++);
+    return offset;
+#else
+    if (memcmp(a, b, PAGE_SIZE) == 0) {
+        return -1;
+    }
+    for (offset = 0; a[offset] == b[offset]; offset++);
+    return offset;
+#endif
+}
+
+/* Compares every page that is dirty in either memory. Returns 0 if they all
+ * match, otherwise 1 with the first differing address in *mismatch. */
+int compare_dirty_pages(Byte *a, Byte *b, Address *mismatch) {
+    Byte *dirty_a = DIRTY_MAP(a);
+    Byte *dirty_b = DIRTY_MAP(b);
+    int page, offset;
+
+    for (page = 0; page < NUM_PAGES; page++) {
+        if (!dirty_a[page] && !dirty_b[page]) {
+            continue;
+        }
+        offset = compare_page(a + (page << PAGE_SHIFT), b + (page << PAGE_SHIFT));
+        if (offset >= 0) {
+            *mismatch = (page << PAGE_SHIFT) + offset;
+            return 1;
+        }
+    }
+    return 0;
+}
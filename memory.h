@@ -0,0 +1,45 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <stdio.h>
+#include "types.h"
+
+/* Guest memory is tracked in 4 KByte pages */
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1 << PAGE_SHIFT)
+#define NUM_PAGES (MEMORY_SPACE >> PAGE_SHIFT)
+
+/* One dirty byte per page lives directly after the guest memory, so every
+   memory allocated with alloc_memory() carries its own dirty map. Marking a
+   page is a single byte store. */
+#define DIRTY_MAP(memory) ((memory) + MEMORY_SPACE)
+#define MARK_DIRTY(memory, address) \
+    (DIRTY_MAP(memory)[((address) >> PAGE_SHIFT) & (NUM_PAGES - 1)] = 1)
+/* An access of at most a page can touch two */
+#define MARK_DIRTY_ACCESS(memory, address, size) \
+    (MARK_DIRTY(memory, address), MARK_DIRTY(memory, (address) + (size) - 1))
+
+/* The rest of the machine the reference interpreter in part2.c needs. It
+   lives after the dirty map, so each memory allocated with alloc_memory()
+   is a complete machine and part2.c keeps no global state. */
+typedef struct {
+    struct DeviceMap *devices;  /* accesses outside of RAM, or NULL */
+    struct Syscalls *syscalls;  /* Linux system calls, or NULL */
+    FILE *console;              /* ecall output, NULL to discard */
+    int muted;                  /* set while history is run again: no output */
+    int exit_code;              /* set when the guest exits */
+    int faulted;                /* set by a failed load() or store() */
+    Word fault;                 /* faulting address or instruction bits */
+} MemoryContext;
+
+#define MEMORY_CONTEXT(memory) ((MemoryContext *) (DIRTY_MAP(memory) + NUM_PAGES))
+#define MEMORY_SIZE (MEMORY_SPACE + NUM_PAGES + sizeof(MemoryContext))
+
+Byte *alloc_memory(void);
+Byte *alloc_shared_memory(const char *name, int *fd);
+void free_memory(Byte *memory);
+void clear_dirty(Byte *memory);
+void restore_dirty(Byte *memory, const Byte *pristine);
+int compare_dirty_pages(Byte *a, Byte *b, Address *mismatch);
+
+#endif
@@ -0,0 +1,108 @@
+#include <string.h>
+#include "types.h"
+#include "memory.h"
+#include "mmu.h"
+
+void mmu_init(Mmu *mmu, Byte *memory) {
+    memset(mmu, 0, sizeof(Mmu));
+    mmu->memory = memory;
+    tlb_flush(mmu);
+    mmu->flushes = 0;
+}
+
+void tlb_flush(Mmu *mmu) {
+    /* tags are at most 20 bits, so all ones never matches */
+    memset(mmu->tlb, 0xFF, sizeof(mmu->tlb));
+    mmu->flushes++;
+}
+
+/* sfence.vma with an address: drops only that page, from every TLB */
+void tlb_flush_page(Mmu *mmu, Address address) {
+    Word page = address >> PAGE_SHIFT;
+    int access;
+
+    for (access = ACCESS_READ; access <= ACCESS_FETCH; access++) {
+        TlbEntry *entry = &mmu->tlb[access][page & (TLB_SIZE - 1)];
+        if (entry->tag == page) {
+            entry->tag = 0xFFFFFFFF;
+        }
+    }
+    mmu->flushes++;
+}
+
+/* Walks the two-level Sv32 page table for address. Returns the physical
+ * address of the start of its (4 KByte) page, or -1 on a page fault. Sets
+ * the accessed and dirty bits the way hardware would. */
+static int64_t walk(Mmu *mmu, Address address, AccessType access) {
+    Word table = (mmu->satp & SATP_PPN) << PAGE_SHIFT;
+    Word pte, pte_address, ppn, needed;
+    int level;
+
+    for (level = 1; level >= 0; level--) {
+        pte_address = table + ((address >> (12 + 10 * level)) & 0x3FF) * 4;
+        if ((mmu->satp & SATP_PPN) >= (MEMORY_SPACE >> PAGE_SHIFT) || pte_address >= MEMORY_SPACE) {
+            return -1;
+        }
+        pte = *(Word *) (mmu->memory + pte_address);
+        if (!(pte & PTE_V) || (!(pte & PTE_R) && (pte & PTE_W))) {
+            return -1;
+        }
+        ppn = pte >> 10;
+        if (pte & (PTE_R | PTE_X)) {
+            break;
+        }
+        if (level == 0 || ppn >= (1 << 20)) {
+            return -1;
+        }
+        table = ppn << PAGE_SHIFT;
+    }
+
+    needed = access == ACCESS_READ ? PTE_R : access == ACCESS_WRITE ? PTE_W : PTE_X;
+    if (!(pte & needed) || ppn >= (1 << 20)) {
+        return -1;
+    }
+    if (level == 1) {
+        /* megapage: the low PPN bits must be clear, they come from the VPN */
+        if (ppn & 0x3FF) {
+            return -1;
+        }
+        ppn |= (address >> PAGE_SHIFT) & 0x3FF;
+    }
+    if (!(pte & PTE_A) || (access == ACCESS_WRITE && !(pte & PTE_D))) {
+        pte |= PTE_A | (access == ACCESS_WRITE ? PTE_D : 0);
+        *(Word *) (mmu->memory + pte_address) = pte;
+        MARK_DIRTY(mmu->memory, pte_address);
+        if (mmu->written) {
+            mmu->written(mmu->opaque, pte_address, 4);
+        }
+    }
+    return (int64_t) ppn << PAGE_SHIFT;
+}
+
+/* The TLB miss path of tlb_lookup() */
+Byte *tlb_fill(Mmu *mmu, Address address, unsigned size, AccessType access) {
+    Word page = address >> PAGE_SHIFT;
+    TlbEntry *entry = &mmu->tlb[access][page & (TLB_SIZE - 1)];
+    int64_t physical;
+
+    mmu->misses++;
+    mmu->fault = 0;
+    if ((address ^ (address + size - 1)) >> PAGE_SHIFT) {
+        /* the two halves may not be contiguous in physical memory */
+        mmu->fault = 1;
+        return NULL;
+    }
+    physical = walk(mmu, address, access);
+    if (physical < 0) {
+        mmu->fault = 1;
+        return NULL;
+    }
+    if (physical >= MEMORY_SPACE) {
+        /* a device, never cached */
+        mmu->physical = physical | (address & (PAGE_SIZE - 1));
+        return NULL;
+    }
+    entry->tag = page;
+    entry->addend = (uintptr_t) (mmu->memory + physical) - (page << PAGE_SHIFT);
+    return mmu->memory + physical + (address & (PAGE_SIZE - 1));
+}
@@ -0,0 +1,79 @@
+#ifndef MMU_H
+#define MMU_H
+
+#include <stdint.h>
+#include "types.h"
+#include "memory.h"
+
+/* Sv32 address translation. satp selects bare mode (MODE = 0, addresses
+   are physical) or Sv32 (MODE = 1) with the root page table at PPN. */
+#define SATP_MODE 0x80000000
+#define SATP_PPN 0x003FFFFF
+
+#define PTE_V 0x01
+#define PTE_R 0x02
+#define PTE_W 0x04
+#define PTE_X 0x08
+#define PTE_U 0x10
+#define PTE_G 0x20
+#define PTE_A 0x40
+#define PTE_D 0x80
+
+/* Entries per TLB, a power of two */
+#define TLB_SIZE 256
+
+typedef enum {
+    ACCESS_READ,
+    ACCESS_WRITE,
+    ACCESS_FETCH,
+} AccessType;
+
+/* A direct-mapped software TLB entry: virtual page number and the value
+   that turns a virtual address on that page into a host pointer */
+typedef struct {
+    Word tag;
+    uintptr_t addend;
+} TlbEntry;
+
+typedef struct {
+    Word satp;
+    TlbEntry tlb[3][TLB_SIZE];  /* one TLB per AccessType */
+    Byte *memory;
+    /* told about the page table entries a walk set A or D in, like
+       dma_written */
+    void (*written)(void *opaque, Address address, Word length);
+    void *opaque;
+    int fault;                  /* set when tlb_fill() returns a page fault */
+    Address physical;           /* tlb_fill() result that is not RAM */
+    uint64_t lookups;
+    uint64_t misses;
+    uint64_t flushes;
+} Mmu;
+
+/* The key an access is looked up by. It is the virtual page number,
+   except for accesses that straddle two pages, which get a key no entry
+   can match so they always take the slow path. */
+#define TLB_KEY(address, size) \
+    (((address) >> PAGE_SHIFT) | ((((address) ^ ((address) + (size) - 1)) >> PAGE_SHIFT) << 20))
+
+void mmu_init(Mmu *mmu, Byte *memory);
+Byte *tlb_fill(Mmu *mmu, Address address, unsigned size, AccessType access);
+void tlb_flush(Mmu *mmu);
+void tlb_flush_page(Mmu *mmu, Address address);
+
+/* Translates a virtual address to a host pointer. A hit costs one compare
+ * and one add; otherwise tlb_fill() walks the page table and returns NULL
+ * for page faults (mmu->fault set) and for physical addresses outside of
+ * RAM (mmu->physical). */
+static inline Byte *tlb_lookup(Mmu *mmu, Address address, unsigned size, AccessType access) {
+    Word key = TLB_KEY(address, size);
+    TlbEntry *entry = &mmu->tlb[access][key & (TLB_SIZE - 1)];
+
+    mmu->lookups++;
+    if (entry->tag == key) {
+        return (Byte *) (address + entry->addend);
+    }
+    return tlb_fill(mmu, address, size, access);
+}
+
+#endif
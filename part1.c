@@ -1,8 +1,12 @@
 #include <stdio.h> // for stderr
 #include <stdlib.h> // for exit()
+#include <stdarg.h>
 #include "types.h"
 #include "utils.h"
+#include "decode.h"
+#include "trap.h"
 
+void write_instruction(Instruction);
 void print_rtype(char *, Instruction);
 void print_itype_except_load(char *, Instruction, int);
 void print_load(char *, Instruction);
@@ -11,11 +15,23 @@ void print_branch(char *, Instruction);
 void print_lui(Instruction);
 void print_jal(Instruction);
 void print_ecall(Instruction);
+void print_csr(char *, Instruction);
+void print_sfence(Instruction);
+void print_system(const char *);
+void write_system(Instruction);
 void write_rtype(Instruction);
 void write_itype_except_load(Instruction); 
 void write_load(Instruction);
 void write_store(Instruction);
 void write_branch(Instruction);
+void write_float_load(Instruction);
+void write_float_store(Instruction);
+void write_float(Instruction);
+void write_fused(Instruction);
+const char *rounding_mode(Instruction);
+void print_float_rtype(char *, Instruction, int);
+void print_float_compare(char *, Instruction);
+void print_float_unary(char *, Instruction, char, char, int);
 
 void debug_print_rtype(char *, Instruction);
 void debug_print_itype_except_load(char *, Instruction, int);
@@ -34,8 +50,7 @@ void print_debug_instruction(uint32_t instruction_bits);
 void debug_handle_invalid_instruction(Instruction instruction);
 
 
-void decode_instruction(uint32_t instruction_bits) {
-    Instruction instruction = parse_instruction(instruction_bits);
+void write_instruction(Instruction instruction) {
     switch(instruction.opcode) {
         case 0x33:
             write_rtype(instruction);
@@ -59,7 +74,19 @@ void decode_instruction(uint32_t instruction_bits) {
             print_jal(instruction);
             break;
         case 0x73:
-            print_ecall(instruction);
+            write_system(instruction);
+            break;
+        case 0x7:
+            write_float_load(instruction);
+            break;
+        case 0x27:
+            write_float_store(instruction);
+            break;
+        case 0x53:
+            write_float(instruction);
+            break;
+        case 0x43: case 0x47: case 0x4B: case 0x4F:
+            write_fused(instruction);
             break;
         default: // undefined opcode
             handle_invalid_instruction(instruction);
@@ -67,6 +94,139 @@ void decode_instruction(uint32_t instruction_bits) {
     }
 }
 
+void decode_instruction(uint32_t instruction_bits) {
+    write_instruction(parse_instruction(instruction_bits));
+}
+
+/* Like every line of the disassembly, to stdout and stderr */
+static void print_both(const char *format, ...) {
+    va_list args;
+
+    va_start(args, format);
+    vfprintf(stdout, format, args);
+    va_end(args);
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+static const char *rtype_name(Word funct3, Word funct7) {
+    static const char *base[8] = {"add", "sll", "slt", NULL, "xor", "srl", "or", "and"};
+    static const char *muldiv[8] = {"mul", "mulh", NULL, NULL, "div", NULL, "rem", NULL};
+
+    if (funct3 == 0x2 || funct3 == 0x7) {
+        /* funct7 is not looked at for these */
+        return base[funct3];
+    }
+    switch (funct7) {
+        case 0x0: return base[funct3];
+        case 0x1: return muldiv[funct3];
+        case 0x20: return funct3 == 0x0 ? "sub" : funct3 == 0x5 ? "sra" : NULL;
+        default: return NULL;
+    }
+}
+
+/* Prints instruction i of block straight from its decoded fields, with
+ * the same output as write_instruction(). Returns 0 for what it leaves to
+ * write_instruction(): system and FP arithmetic, and bad encodings. */
+static int write_decoded(const DecodedBlock *block, unsigned i) {
+    static const char *itype[8] = {"addi", "slli", "slti", NULL, "xori", NULL, "ori", "andi"};
+    static const char *loads[3] = {"lb", "lh", "lw"};
+    static const char *stores[3] = {"sb", "sh", "sw"};
+    Word funct3 = block->funct3[i];
+    const char *name;
+
+    switch (block->opcode[i]) {
+        case 0x33:
+            if ((name = rtype_name(funct3, block->funct7[i])) == NULL) {
+                return 0;
+            }
+            print_both(RTYPE_FORMAT, name, block->rd[i], block->rs1[i], block->rs2[i]);
+            return 1;
+        case 0x13:
+            if (funct3 == 0x5) {
+                /* imm[11:10] tells srli from srai */
+                if ((block->funct7[i] >> 5) > 1) {
+                    return 0;
+                }
+                print_both(ITYPE_FORMAT, (block->funct7[i] >> 5) ? "srai" : "srli",
+                           block->rd[i], block->rs1[i], block->imm_i[i] & 0x1F);
+                return 1;
+            }
+            if (itype[funct3] == NULL) {
+                return 0;
+            }
+            print_both(ITYPE_FORMAT, itype[funct3], block->rd[i], block->rs1[i], block->imm_i[i]);
+            return 1;
+        case 0x03:
+            if (funct3 > 0x2) {
+                return 0;
+            }
+            /* the offset of loads has always been printed unsigned */
+            print_both(MEM_FORMAT, loads[funct3], block->rd[i], block->imm_i[i] & 0xFFF, block->rs1[i]);
+            return 1;
+        case 0x23:
+            if (funct3 > 0x2) {
+                return 0;
+            }
+            print_both(MEM_FORMAT, stores[funct3], block->rs2[i], block->imm_s[i], block->rs1[i]);
+            return 1;
+        case 0x63:
+            if (funct3 > 0x1) {
+                return 0;
+            }
+            print_both(BRANCH_FORMAT, funct3 ? "bne" : "beq", block->rs1[i], block->rs2[i], block->imm_b[i]);
+            return 1;
+        case 0x37:
+            print_both(LUI_FORMAT, block->rd[i], (Word) block->imm_u[i] >> 12);
+            return 1;
+        case 0x6F:
+            print_both(JAL_FORMAT, block->rd[i], block->imm_j[i]);
+            return 1;
+        case 0x07:
+            if (funct3 != 0x2) {
+                return 0;
+            }
+            print_both(FMEM_FORMAT, "flw", block->rd[i], block->imm_i[i], block->rs1[i]);
+            return 1;
+        case 0x27:
+            if (funct3 != 0x2) {
+                return 0;
+            }
+            print_both(FMEM_FORMAT, "fsw", block->rs2[i], block->imm_s[i], block->rs1[i]);
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* Disassembles count instruction words loaded at address. The words are
+ * split into fields a block at a time by decode_block(), and the common
+ * formats print from those fields; the rest go through the Instruction
+ * union, whose layout the raw bits already have. */
+void disassemble(const Word *words, unsigned count, Address address) {
+    DecodedBlock block;
+    Instruction instruction;
+    unsigned i, n;
+
+    for (; count > 0; count -= n, words += n, address += 4 * n) {
+        n = count < DECODE_BLOCK_SIZE ? count : DECODE_BLOCK_SIZE;
+        decode_block(words, n, &block);
+        for (i = 0; i < n; i++) {
+            printf("%08x: ", address + 4 * i);
+            if (write_decoded(&block, i)) {
+                continue;
+            }
+            instruction.bits = block.bits[i];
+            if (is_known_opcode(block.opcode[i])) {
+                write_instruction(instruction);
+            } else {
+                handle_invalid_instruction(instruction);
+            }
+        }
+    }
+}
+
 void write_rtype(Instruction instruction) {
     switch (instruction.rtype.funct3) {
         case 0x0:
@@ -238,6 +398,165 @@ void write_branch(Instruction instruction) {
     }
 }
 
+void write_system(Instruction instruction) {
+    switch (instruction.itype.funct3) {
+        case 0x0:
+            if (instruction.rtype.funct7 == 0x09) {
+                print_sfence(instruction);
+            } else if (instruction.bits == MRET_BITS) {
+                print_system(MRET_FORMAT);
+            } else if (instruction.bits == WFI_BITS) {
+                print_system(WFI_FORMAT);
+            } else {
+                print_ecall(instruction);
+            }
+            break;
+        case 0x1:
+            print_csr("csrrw", instruction);
+            break;
+        case 0x2:
+            print_csr("csrrs", instruction);
+            break;
+        case 0x3:
+            print_csr("csrrc", instruction);
+            break;
+        case 0x5:
+            print_csr("csrrwi", instruction);
+            break;
+        case 0x6:
+            print_csr("csrrsi", instruction);
+            break;
+        case 0x7:
+            print_csr("csrrci", instruction);
+            break;
+        default:
+            handle_invalid_instruction(instruction);
+            break;
+    }
+}
+
+void write_float_load(Instruction instruction) {
+    int offset = sign_extend_number(instruction.itype.imm, 12);
+
+    if (instruction.itype.funct3 != 0x2) {
+        handle_invalid_instruction(instruction);
+        return;
+    }
+    fprintf(stdout, FMEM_FORMAT, "flw", instruction.itype.rd, offset, instruction.itype.rs1);
+    fprintf(stderr, FMEM_FORMAT, "flw", instruction.itype.rd, offset, instruction.itype.rs1);
+}
+
+void write_float_store(Instruction instruction) {
+    if (instruction.stype.funct3 != 0x2) {
+        handle_invalid_instruction(instruction);
+        return;
+    }
+    fprintf(stdout, FMEM_FORMAT, "fsw", instruction.stype.rs2, get_store_offset(instruction), instruction.stype.rs1);
+    fprintf(stderr, FMEM_FORMAT, "fsw", instruction.stype.rs2, get_store_offset(instruction), instruction.stype.rs1);
+}
+
+void write_float(Instruction instruction) {
+    static char *sign_injections[] = {"fsgnj.s", "fsgnjn.s", "fsgnjx.s"};
+    static char *comparisons[] = {"fle.s", "flt.s", "feq.s"};
+    unsigned funct3 = instruction.rtype.funct3, rs2 = instruction.rtype.rs2;
+
+    switch (instruction.rtype.funct7) {
+        case 0x00:
+            print_float_rtype("fadd.s", instruction, 1);
+            break;
+        case 0x04:
+            print_float_rtype("fsub.s", instruction, 1);
+            break;
+        case 0x08:
+            print_float_rtype("fmul.s", instruction, 1);
+            break;
+        case 0x0C:
+            print_float_rtype("fdiv.s", instruction, 1);
+            break;
+        case 0x2C:
+            if (rs2 == 0) {
+                print_float_unary("fsqrt.s", instruction, 'f', 'f', 1);
+                return;
+            }
+            handle_invalid_instruction(instruction);
+            break;
+        case 0x10:
+            if (funct3 <= 2) {
+                print_float_rtype(sign_injections[funct3], instruction, 0);
+                return;
+            }
+            handle_invalid_instruction(instruction);
+            break;
+        case 0x14:
+            if (funct3 <= 1) {
+                print_float_rtype(funct3 ? "fmax.s" : "fmin.s", instruction, 0);
+                return;
+            }
+            handle_invalid_instruction(instruction);
+            break;
+        case 0x50:
+            if (funct3 <= 2) {
+                print_float_compare(comparisons[funct3], instruction);
+                return;
+            }
+            handle_invalid_instruction(instruction);
+            break;
+        case 0x60:
+            if (rs2 <= 1) {
+                print_float_unary(rs2 ? "fcvt.wu.s" : "fcvt.w.s", instruction, 'x', 'f', 1);
+                return;
+            }
+            handle_invalid_instruction(instruction);
+            break;
+        case 0x68:
+            if (rs2 <= 1) {
+                print_float_unary(rs2 ? "fcvt.s.wu" : "fcvt.s.w", instruction, 'f', 'x', 1);
+                return;
+            }
+            handle_invalid_instruction(instruction);
+            break;
+        case 0x70:
+            if (rs2 == 0 && funct3 <= 1) {
+                print_float_unary(funct3 ? "fclass.s" : "fmv.x.w", instruction, 'x', 'f', 0);
+                return;
+            }
+            handle_invalid_instruction(instruction);
+            break;
+        case 0x78:
+            if (rs2 == 0 && funct3 == 0) {
+                print_float_unary("fmv.w.x", instruction, 'f', 'x', 0);
+                return;
+            }
+            handle_invalid_instruction(instruction);
+            break;
+        default:
+            handle_invalid_instruction(instruction);
+            break;
+    }
+}
+
+/* fmadd.s, fmsub.s, fnmsub.s and fnmadd.s, with rs3 and fmt in funct7 */
+void write_fused(Instruction instruction) {
+    static char *names[] = {"fmadd.s", "fmsub.s", "fnmsub.s", "fnmadd.s"};
+    char *name = names[(instruction.opcode >> 2) & 0x3];
+    const char *rm = rounding_mode(instruction);
+    unsigned rs3 = instruction.rtype.funct7 >> 2;
+
+    if (rm == NULL || (instruction.rtype.funct7 & 0x3) != 0) {
+        handle_invalid_instruction(instruction);
+        return;
+    }
+    fprintf(stdout, FR4TYPE_FORMAT, name, instruction.rtype.rd, instruction.rtype.rs1, instruction.rtype.rs2, rs3, rm);
+    fprintf(stderr, FR4TYPE_FORMAT, name, instruction.rtype.rd, instruction.rtype.rs1, instruction.rtype.rs2, rs3, rm);
+}
+
+/* The rounding mode operand, which is left out when it is dynamic, or
+ * NULL for the reserved modes */
+const char *rounding_mode(Instruction instruction) {
+    static const char *modes[] = {", rne", ", rtz", ", rdn", ", rup", ", rmm", NULL, NULL, ""};
+    return modes[instruction.rtype.funct3];
+}
+
 void print_lui(Instruction instruction) {
     /*fprintf(stderr, "%s", "\nMY OUTPUT: ");
     fprintf(stderr, LUI_FORMAT, instruction.utype.rd, instruction.utype.imm);
@@ -262,6 +581,24 @@ void print_ecall(Instruction instruction) {
     fprintf(stderr, ECALL_FORMAT);
 }
 
+void print_csr(char *name, Instruction instruction) {
+    /* the immediate forms have a 5 bit unsigned immediate in rs1 */
+    const char *format = (instruction.itype.funct3 & 0x4) ? CSRI_FORMAT : CSR_FORMAT;
+    fprintf(stdout, format, name, instruction.itype.rd, instruction.itype.imm, instruction.itype.rs1);
+    fprintf(stderr, format, name, instruction.itype.rd, instruction.itype.imm, instruction.itype.rs1);
+}
+
+void print_sfence(Instruction instruction) {
+    fprintf(stdout, SFENCE_FORMAT, instruction.rtype.rs1, instruction.rtype.rs2);
+    fprintf(stderr, SFENCE_FORMAT, instruction.rtype.rs1, instruction.rtype.rs2);
+}
+
+/* instructions without operands */
+void print_system(const char *format) {
+    fprintf(stdout, "%s", format);
+    fprintf(stderr, "%s", format);
+}
+
 void print_rtype(char *name, Instruction instruction) {
     /*fprintf(stderr, "%s", "\nMY OUTPUT: ");
     fprintf(stderr, RTYPE_FORMAT, name, instruction.rtype.rd, instruction.rtype.rs1, instruction.rtype.rs2);
@@ -304,6 +641,35 @@ void print_branch(char *name, Instruction instruction) {
     fprintf(stderr, BRANCH_FORMAT, name, instruction.sbtype.rs1, instruction.sbtype.rs2, get_branch_offset(instruction));
 }
 
+void print_float_rtype(char *name, Instruction instruction, int rounds) {
+    const char *rm = rounds ? rounding_mode(instruction) : "";
+
+    if (rm == NULL) {
+        handle_invalid_instruction(instruction);
+        return;
+    }
+    fprintf(stdout, FRTYPE_FORMAT, name, instruction.rtype.rd, instruction.rtype.rs1, instruction.rtype.rs2, rm);
+    fprintf(stderr, FRTYPE_FORMAT, name, instruction.rtype.rd, instruction.rtype.rs1, instruction.rtype.rs2, rm);
+}
+
+void print_float_compare(char *name, Instruction instruction) {
+    fprintf(stdout, FCMP_FORMAT, name, instruction.rtype.rd, instruction.rtype.rs1, instruction.rtype.rs2);
+    fprintf(stderr, FCMP_FORMAT, name, instruction.rtype.rd, instruction.rtype.rs1, instruction.rtype.rs2);
+}
+
+/* Operations on one register; rd_file and rs1_file say which register
+ * file each operand is in, 'x' or 'f' */
+void print_float_unary(char *name, Instruction instruction, char rd_file, char rs1_file, int rounds) {
+    const char *rm = rounds ? rounding_mode(instruction) : "";
+
+    if (rm == NULL) {
+        handle_invalid_instruction(instruction);
+        return;
+    }
+    fprintf(stdout, FUNARY_FORMAT, name, rd_file, instruction.rtype.rd, rs1_file, instruction.rtype.rs1, rm);
+    fprintf(stderr, FUNARY_FORMAT, name, rd_file, instruction.rtype.rd, rs1_file, instruction.rtype.rs1, rm);
+}
+
 void print_debug_instruction(uint32_t instruction_bits) {
     Instruction instruction = parse_instruction(instruction_bits);
     switch(instruction.opcode) {
@@ -1,17 +1,27 @@
 #include <stdio.h> // for stderr
 #include <stdlib.h> // for exit()
+#include <string.h> // for memchr()
 #include "types.h"
 #include "utils.h"
 #include "riscv.h"
+#include "memory.h"
+#include "devices.h"
+#include "syscalls.h"
+#include "fpu.h"
+#include "trap.h"
 
-void execute_rtype(Instruction, Processor *);
-void execute_itype_except_load(Instruction, Processor *);
-void execute_branch(Instruction, Processor *);
+int execute_rtype(Instruction, Processor *);
+int execute_itype_except_load(Instruction, Processor *);
+int execute_branch(Instruction, Processor *);
 void execute_jal(Instruction, Processor *);
-void execute_load(Instruction, Processor *, Byte *);
-void execute_store(Instruction, Processor *, Byte *);
-void execute_ecall(Processor *, Byte *);
+int execute_load(Instruction, Processor *, Byte *);
+int execute_store(Instruction, Processor *, Byte *);
+int execute_ecall(Processor *, Byte *);
 void execute_lui(Instruction, Processor *);
+int execute_csr(Instruction, Processor *);
+int execute_float(uint32_t, Processor *);
+int execute_float_load(Instruction, Processor *, Byte *);
+int execute_float_store(Instruction, Processor *, Byte *);
 
 unsigned get_bit_range(unsigned, unsigned, unsigned);
 
@@ -19,41 +29,73 @@ unsigned set_bit(unsigned input, unsigned pos, unsigned val);
 
 void print_debug_instruction(uint32_t instruction_bits);
 
-void execute_instruction(uint32_t instruction_bits, Processor *processor,Byte *memory) {    
+/* Executes one instruction. Returns EXEC_OK, or why execution has to stop;
+ * MEMORY_CONTEXT(memory) then holds the exit code or the fault. */
+int execute_instruction(uint32_t instruction_bits, Processor *processor,Byte *memory) {    
     Instruction instruction = parse_instruction(instruction_bits);
+    int status = EXEC_OK;
+    MEMORY_CONTEXT(memory)->faulted = 0;
     switch(instruction.opcode) {
         case 0x33:
-            execute_rtype(instruction, processor);
+            status = execute_rtype(instruction, processor);
             break;
         case 0x13:
-            execute_itype_except_load(instruction, processor);
+            status = execute_itype_except_load(instruction, processor);
             break;
         case 0x73:
-            execute_ecall(processor, memory);
+            if (instruction.itype.funct3) {
+                status = execute_csr(instruction, processor);
+            } else if (instruction_bits == MRET_BITS) {
+                trap_return(processor);
+            } else if (instruction_bits == WFI_BITS) {
+                processor->PC += 4;
+            } else {
+                status = execute_ecall(processor, memory);
+            }
             break;
         case 0x63:
-            execute_branch(instruction, processor);
+            status = execute_branch(instruction, processor);
             break;
         case 0x6F:
             execute_jal(instruction, processor);
             break;
         case 0x23:
-            execute_store(instruction, processor, memory);
+            status = execute_store(instruction, processor, memory);
             break;
         case 0x03:
-            execute_load(instruction, processor, memory);
+            status = execute_load(instruction, processor, memory);
             break;
         case 0x37:
             execute_lui(instruction, processor);
             break;
+        case 0x07:
+            status = execute_float_load(instruction, processor, memory);
+            break;
+        case 0x27:
+            status = execute_float_store(instruction, processor, memory);
+            break;
+        case 0x53: case 0x43: case 0x47: case 0x4B: case 0x4F:
+            status = execute_float(instruction_bits, processor);
+            break;
         default: // undefined opcode
-            handle_invalid_instruction(instruction);
-            exit(-1);
+            status = EXEC_INVALID_INSTRUCTION;
             break;
     }
+    if (status == EXEC_INVALID_INSTRUCTION) {
+        MEMORY_CONTEXT(memory)->fault = instruction_bits;
+    }
+    return status;
 }
 
-void execute_rtype(Instruction instruction, Processor *processor) {
+/* Fetches the instruction at the PC. Returns EXEC_OK, or EXEC_BAD_READ with
+ * the PC as the fault. */
+int fetch_instruction(const Processor *processor, Byte *memory, uint32_t *instruction_bits) {
+    MEMORY_CONTEXT(memory)->faulted = 0;
+    *instruction_bits = load(memory, processor->PC, LENGTH_WORD);
+    return MEMORY_CONTEXT(memory)->faulted ? EXEC_BAD_READ : EXEC_OK;
+}
+
+int execute_rtype(Instruction instruction, Processor *processor) {
     switch (instruction.rtype.funct3){
         case 0x0:
             switch (instruction.rtype.funct7) {
@@ -73,9 +115,7 @@ void execute_rtype(Instruction instruction, Processor *processor) {
                     processor->PC += 4;
                     break;
                 default:
-                    handle_invalid_instruction(instruction);
-                    exit(-1);
-                    break;
+                    return EXEC_INVALID_INSTRUCTION;
             }
             break;
         case 0x1:
@@ -112,9 +152,7 @@ void execute_rtype(Instruction instruction, Processor *processor) {
                     processor->PC += 4;
                     break;
                 default:
-                    handle_invalid_instruction(instruction);
-                    exit(-1);
-                    break;
+                    return EXEC_INVALID_INSTRUCTION;
             }
             break;
         case 0x5:
@@ -130,9 +168,7 @@ void execute_rtype(Instruction instruction, Processor *processor) {
                     processor->PC += 4;
                     break;
                 default:
-                    handle_invalid_instruction(instruction);
-                    exit(-1);
-                    break;
+                    return EXEC_INVALID_INSTRUCTION;
             }
             break;
         case 0x6:
@@ -148,9 +184,7 @@ void execute_rtype(Instruction instruction, Processor *processor) {
                     processor->PC += 4;
                     break;
                 default:
-                    handle_invalid_instruction(instruction);
-                    exit(-1);
-                    break;
+                    return EXEC_INVALID_INSTRUCTION;
             }
             break;
         case 0x7:
@@ -159,13 +193,12 @@ void execute_rtype(Instruction instruction, Processor *processor) {
             processor->PC += 4;
             break;
         default:
-            handle_invalid_instruction(instruction);
-            exit(-1);
-            break;
+            return EXEC_INVALID_INSTRUCTION;
     }
+    return EXEC_OK;
 }
 
-void execute_itype_except_load(Instruction instruction, Processor *processor) {
+int execute_itype_except_load(Instruction instruction, Processor *processor) {
     int imm = sign_extend_number(instruction.itype.imm, 12);
     switch (instruction.itype.funct3) {
         case 0x0:
@@ -223,41 +256,63 @@ void execute_itype_except_load(Instruction instruction, Processor *processor) {
             processor->PC += 4;
             break;
         default:
-            handle_invalid_instruction(instruction);
-            break;
+            return EXEC_INVALID_INSTRUCTION;
     }
+    return EXEC_OK;
 }
 
-void execute_ecall(Processor *p, Byte *memory) {
-    Register i;
+int execute_ecall(Processor *p, Byte *memory) {
+    MemoryContext *context = MEMORY_CONTEXT(memory);
+    FILE *console = context->muted ? NULL : context->console;
+    Byte *start, *end;
+
+    if (context->syscalls) {
+        if (linux_syscall(context->syscalls, p->R) != 0) {
+            context->exit_code = context->syscalls->exit_code;
+            return EXEC_EXIT;
+        }
+        p->PC += 4;
+        return EXEC_OK;
+    }
     
     // syscall number is given by a0 (x10)
     // argument is given by a1
     switch(p->R[10]) {
         case 1: // print an integer
-            printf("%d",p->R[11]);
+            if (console) {
+                fprintf(console,"%d",p->R[11]);
+            }
             break;
-        case 4: // print a string
-            for(i=p->R[11];i<MEMORY_SPACE && load(memory,i,LENGTH_BYTE);i++) {
-                printf("%c",load(memory,i,LENGTH_BYTE));
+        case 4: // print a string, all of it at once
+            if (console && p->R[11] < MEMORY_SPACE) {
+                start = memory + p->R[11];
+                end = memchr(start, 0, MEMORY_SPACE - p->R[11]);
+                fwrite(start, 1, (end ? end : memory + MEMORY_SPACE) - start, console);
             }
             break;
         case 10: // exit
-            printf("exiting the simulator\n");
-            exit(0);
-            break;
+            if (console) {
+                fprintf(console,"exiting the simulator\n");
+            }
+            context->exit_code = 0;
+            return EXEC_EXIT;
         case 11: // print a character
-            printf("%c",p->R[11]);
+            if (console) {
+                fputc(p->R[11],console);
+            }
             break;
         default: // undefined ecall
-            printf("Illegal ecall number %d\n", p->R[10]);
-            exit(-1);
-            break;
+            if (console) {
+                fprintf(console,"Illegal ecall number %d\n", p->R[10]);
+            }
+            context->exit_code = -1;
+            return EXEC_EXIT;
     }
     p->PC += 4;
+    return EXEC_OK;
 }
 
-void execute_branch(Instruction instruction, Processor *processor) {
+int execute_branch(Instruction instruction, Processor *processor) {
     switch (instruction.sbtype.funct3) {
         case 0x0:
             // BEQ
@@ -276,57 +331,63 @@ void execute_branch(Instruction instruction, Processor *processor) {
         }
             break;
         default:
-            handle_invalid_instruction(instruction);
-            exit(-1);
-            break;
+            return EXEC_INVALID_INSTRUCTION;
     }
+    return EXEC_OK;
 }
 
-void execute_load(Instruction instruction, Processor *processor, Byte *memory) {
+int execute_load(Instruction instruction, Processor *processor, Byte *memory) {
+    Address address = processor->R[instruction.itype.rs1] + sign_extend_number(instruction.itype.imm, 12);
+    Word value;
     switch (instruction.itype.funct3) {
         case 0x0:
             // LB
-            processor->R[instruction.itype.rd] = sign_extend_number(load(memory, processor->R[instruction.itype.rs1] + sign_extend_number(instruction.itype.imm, 12), LENGTH_BYTE), 8);
-            processor->PC += 4;
+            value = sign_extend_number(load(memory, address, LENGTH_BYTE), 8);
             break;
         case 0x1:
             // LH
-            processor->R[instruction.itype.rd] = sign_extend_number(load(memory, processor->R[instruction.itype.rs1] + sign_extend_number(instruction.itype.imm, 12), LENGTH_HALF_WORD), 16);
-            processor->PC += 4;
+            value = sign_extend_number(load(memory, address, LENGTH_HALF_WORD), 16);
             break;
         case 0x2:
             // LW
-            processor->R[instruction.itype.rd] = load(memory, processor->R[instruction.itype.rs1] + sign_extend_number(instruction.itype.imm, 12), LENGTH_WORD);
-            processor->PC += 4;
+            value = load(memory, address, LENGTH_WORD);
             break;
         default:
-            handle_invalid_instruction(instruction);
-            break;
+            return EXEC_INVALID_INSTRUCTION;
     }
+    // a failed load leaves rd and the PC alone
+    if (MEMORY_CONTEXT(memory)->faulted) {
+        return EXEC_BAD_READ;
+    }
+    processor->R[instruction.itype.rd] = value;
+    processor->PC += 4;
+    return EXEC_OK;
 }
 
-void execute_store(Instruction instruction, Processor *processor, Byte *memory) {
+int execute_store(Instruction instruction, Processor *processor, Byte *memory) {
+    Address address = processor->R[instruction.stype.rs1] + get_store_offset(instruction);
+    MARK_DIRTY_ACCESS(memory, address, 1 << (instruction.stype.funct3 & 3));
     switch (instruction.stype.funct3) {
         case 0x0:
             // SB
-            store(memory, processor->R[instruction.stype.rs1] + get_store_offset(instruction), LENGTH_BYTE, processor->R[instruction.stype.rs2]);
-            processor->PC += 4;
+            store(memory, address, LENGTH_BYTE, processor->R[instruction.stype.rs2]);
             break;
         case 0x1:
             // SH
-            store(memory, processor->R[instruction.stype.rs1] + get_store_offset(instruction), LENGTH_HALF_WORD, processor->R[instruction.stype.rs2]);
-            processor->PC += 4;
+            store(memory, address, LENGTH_HALF_WORD, processor->R[instruction.stype.rs2]);
             break;
         case 0x2:
             // SW
-            store(memory, processor->R[instruction.stype.rs1] + get_store_offset(instruction), LENGTH_WORD, processor->R[instruction.stype.rs2]);
-            processor->PC += 4;
+            store(memory, address, LENGTH_WORD, processor->R[instruction.stype.rs2]);
             break;
         default:
-            handle_invalid_instruction(instruction);
-            exit(-1);
-            break;
+            return EXEC_INVALID_INSTRUCTION;
     }
+    if (MEMORY_CONTEXT(memory)->faulted) {
+        return EXEC_BAD_WRITE;
+    }
+    processor->PC += 4;
+    return EXEC_OK;
 }
 
 void execute_jal(Instruction instruction, Processor *processor) {
@@ -339,8 +400,92 @@ void execute_lui(Instruction instruction, Processor *processor) {
     processor->PC += 4;
 }
 
+/* The interpreter has the floating point and the trap CSRs, not satp */
+int execute_csr(Instruction instruction, Processor *processor) {
+    Word csr = instruction.itype.imm, funct3 = instruction.itype.funct3;
+    Word value = (funct3 & 0x4) ? instruction.itype.rs1 : processor->R[instruction.itype.rs1];
+    Word (*read_csr)(const Processor *, Word) = IS_FPU_CSR(csr) ? fpu_read_csr : trap_read_csr;
+    void (*write_csr)(Processor *, Word, Word) = IS_FPU_CSR(csr) ? fpu_write_csr : trap_write_csr;
+    Word old;
+
+    if ((!IS_FPU_CSR(csr) && !IS_TRAP_CSR(csr)) || (funct3 & 0x3) == 0) {
+        return EXEC_INVALID_INSTRUCTION;
+    }
+    old = read_csr(processor, csr);
+    switch (funct3 & 0x3) {
+        case 0x1:
+            // CSRRW, CSRRWI
+            write_csr(processor, csr, value);
+            break;
+        case 0x2:
+            // CSRRS, CSRRSI; with x0 or 0 they do not write
+            if (instruction.itype.rs1) {
+                write_csr(processor, csr, old | value);
+            }
+            break;
+        case 0x3:
+            // CSRRC, CSRRCI
+            if (instruction.itype.rs1) {
+                write_csr(processor, csr, old & ~value);
+            }
+            break;
+    }
+    processor->R[instruction.itype.rd] = old;
+    processor->PC += 4;
+    return EXEC_OK;
+}
+
+int execute_float(uint32_t instruction_bits, Processor *processor) {
+    if (fpu_execute(instruction_bits, processor) != 0) {
+        return EXEC_INVALID_INSTRUCTION;
+    }
+    processor->PC += 4;
+    return EXEC_OK;
+}
+
+int execute_float_load(Instruction instruction, Processor *processor, Byte *memory) {
+    Address address = processor->R[instruction.itype.rs1] + sign_extend_number(instruction.itype.imm, 12);
+    Word value;
+
+    if (instruction.itype.funct3 != 0x2) {
+        return EXEC_INVALID_INSTRUCTION;
+    }
+    // FLW
+    value = load(memory, address, LENGTH_WORD);
+    if (MEMORY_CONTEXT(memory)->faulted) {
+        return EXEC_BAD_READ;
+    }
+    processor->F[instruction.itype.rd] = value;
+    processor->PC += 4;
+    return EXEC_OK;
+}
+
+int execute_float_store(Instruction instruction, Processor *processor, Byte *memory) {
+    Address address = processor->R[instruction.stype.rs1] + get_store_offset(instruction);
+
+    if (instruction.stype.funct3 != 0x2) {
+        return EXEC_INVALID_INSTRUCTION;
+    }
+    // FSW
+    MARK_DIRTY_ACCESS(memory, address, LENGTH_WORD);
+    store(memory, address, LENGTH_WORD, processor->F[instruction.stype.rs2]);
+    if (MEMORY_CONTEXT(memory)->faulted) {
+        return EXEC_BAD_WRITE;
+    }
+    processor->PC += 4;
+    return EXEC_OK;
+}
+
 void store(Byte *memory, Address address, Alignment alignment, Word value) {
     //fprintf(stderr, "%s", "STORING WORD\n");
+    if (address > MEMORY_SPACE - alignment) {
+        // not RAM, so either a device or a bad address
+        if (device_write(MEMORY_CONTEXT(memory)->devices, address, alignment, value) != 0) {
+            MEMORY_CONTEXT(memory)->faulted = 1;
+            MEMORY_CONTEXT(memory)->fault = address;
+        }
+        return;
+    }
     if (alignment == LENGTH_WORD) {
         *(uint32_t*) (memory + address) = (uint32_t) value;
     } else if (alignment == LENGTH_HALF_WORD) {
@@ -354,7 +499,17 @@ void store(Byte *memory, Address address, Alignment alignment, Word value) {
 }
 
 Word load(Byte *memory, Address address, Alignment alignment) {
-    
+    Word value;
+
+    if (address > MEMORY_SPACE - alignment) {
+        // not RAM, so either a device or a bad address
+        if (device_read(MEMORY_CONTEXT(memory)->devices, address, alignment, &value) != 0) {
+            MEMORY_CONTEXT(memory)->faulted = 1;
+            MEMORY_CONTEXT(memory)->fault = address;
+            return 0;
+        }
+        return value;
+    }
     if (alignment == LENGTH_WORD) {
         //fprintf(stderr, "%s", "LOADING WORD\n");
         //fprintf(stderr, "%d%s", *(uint32_t*) (memory + address), "\n");
@@ -7,11 +7,12 @@ trace_format = "riscvcode/{0}/{1}.trace"
 max_num_instructions = 10000
 
 
-def run_test(name):
+def run_test(name, student_trace=None):
     pass_bool = True
     # open trace 
     ref_trace = open(trace_format.format("ref", name), 'r')
-    student_trace = open(trace_format.format("out", name), 'r')
+    if student_trace is None:
+        student_trace = open(trace_format.format("out", name), 'r')
 
     ref_registers = [0] * 32
     student_registers = [0] * 32
@@ -68,7 +69,8 @@ if __name__ == "__main__":
     test = sys.argv[1]
     print("")
     print "Starting {0} test".format(test)
-    has_passed = run_test(test)
+    # "-" reads the student trace from stdin, e.g. piped from ./tracecat
+    has_passed = run_test(test, sys.stdin if sys.argv[2:] == ["-"] else None)
     if has_passed:
         print "{0} test has passed.".format(test)
     else:
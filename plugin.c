@@ -0,0 +1,241 @@
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "memory.h"
+#include "decode.h"
+#include "engine.h"
+#include "plugin.h"
+
+#define MAX_PLUGIN_ARGS 16
+
+struct RvInsn {
+    struct RvBlock *block;
+    unsigned index;
+};
+
+struct RvBlock {
+    Plugins *plugins;
+    DecodedOp *first;
+    Address vaddr;
+    Address physical;
+    unsigned count;
+    const Word *bits;
+    RvInsn insns[DECODE_BLOCK_SIZE];
+};
+
+int plugins_init(Plugins *plugins) {
+    memset(plugins, 0, sizeof(Plugins));
+    plugins->hooks = calloc(MEMORY_SPACE / 4, sizeof(Hook *));
+    plugins->starts = calloc(MEMORY_SPACE / 4, 1);
+    plugins->resumes = calloc(MEMORY_SPACE / 4, 1);
+    return plugins->hooks == NULL || plugins->starts == NULL || plugins->resumes == NULL ? -1 : 0;
+}
+
+/* Loads "file.so,arg,arg..." and runs its rv_plugin_install() */
+int plugin_load(Plugins *plugins, const char *spec) {
+    int (*install)(RvPlugin *, int, int, char **);
+    char *argv[MAX_PLUGIN_ARGS];
+    int argc = 0;
+    RvPlugin *plugin;
+    char *next;
+
+    if (plugins->count == MAX_PLUGINS || (plugin = calloc(1, sizeof(RvPlugin))) == NULL) {
+        return -1;
+    }
+    plugin->plugins = plugins;
+    plugin->name = strdup(spec);
+    next = strchr(plugin->name, ',');
+    while (next != NULL && argc < MAX_PLUGIN_ARGS) {
+        *next++ = '\0';
+        argv[argc++] = next;
+        next = strchr(next, ',');
+    }
+
+    plugin->handle = dlopen(plugin->name, RTLD_NOW | RTLD_LOCAL);
+    if (plugin->handle == NULL) {
+        fprintf(stderr, "Cannot load plugin: %s\n", dlerror());
+        goto fail;
+    }
+    *(void **) &install = dlsym(plugin->handle, "rv_plugin_install");
+    if (install == NULL) {
+        fprintf(stderr, "Plugin %s has no rv_plugin_install\n", plugin->name);
+        goto fail;
+    }
+    if (install(plugin, RV_PLUGIN_VERSION, argc, argv) != 0) {
+        fprintf(stderr, "Plugin %s failed to install\n", plugin->name);
+        goto fail;
+    }
+    plugins->list[plugins->count++] = plugin;
+    return 0;
+
+fail:
+    if (plugin->handle) {
+        dlclose(plugin->handle);
+    }
+    free(plugin->name);
+    free(plugin);
+    return -1;
+}
+
+void rv_register_translate(RvPlugin *plugin, RvTranslateFn callback) {
+    plugin->translate = callback;
+}
+
+void rv_register_exit(RvPlugin *plugin, RvExitFn callback, void *userdata) {
+    plugin->exit = callback;
+    plugin->exit_userdata = userdata;
+}
+
+uint32_t rv_block_vaddr(const RvBlock *block) {
+    return block->vaddr;
+}
+
+unsigned rv_block_count(const RvBlock *block) {
+    return block->count;
+}
+
+RvInsn *rv_block_insn(RvBlock *block, unsigned index) {
+    return index < block->count ? &block->insns[index] : NULL;
+}
+
+uint32_t rv_insn_vaddr(const RvInsn *insn) {
+    return insn->block->vaddr + 4 * insn->index;
+}
+
+uint32_t rv_insn_bits(const RvInsn *insn) {
+    return insn->block->bits[insn->index];
+}
+
+/* Appends a callback to an instruction and marks its operation hooked */
+static void add_hook(RvBlock *block, unsigned index, RvExecFn exec, RvMemFn mem, void *userdata) {
+    Hook *hook = malloc(sizeof(Hook)), **tail;
+
+    if (hook == NULL) {
+        return;
+    }
+    hook->exec = exec;
+    hook->mem = mem;
+    hook->userdata = userdata;
+    hook->next = NULL;
+    for (tail = &block->plugins->hooks[(block->physical >> 2) + index]; *tail; tail = &(*tail)->next) {
+    }
+    *tail = hook;
+    block->first[index].kind |= OP_HOOKED;
+}
+
+void rv_block_register_exec(RvBlock *block, RvExecFn callback, void *userdata) {
+    add_hook(block, 0, callback, NULL, userdata);
+}
+
+void rv_insn_register_exec(RvInsn *insn, RvExecFn callback, void *userdata) {
+    add_hook(insn->block, insn->index, callback, NULL, userdata);
+}
+
+void rv_insn_register_mem(RvInsn *insn, RvMemFn callback, void *userdata) {
+    OpKind kind = insn->block->first[insn->index].kind & ~OP_HOOKED;
+
+    if ((kind >= OP_LB && kind <= OP_SW) || (kind >= OP_LB_V && kind <= OP_SW_V)
+        || (kind >= OP_FLW && kind <= OP_FSW_V)) {
+        add_hook(insn->block, insn->index, NULL, callback, userdata);
+    }
+}
+
+/* Called by translate_block() for the count operations it just decoded */
+void plugins_translate(Plugins *plugins, DecodedOp *first, Address vaddr, Address physical,
+                       unsigned count, const Word *bits) {
+    RvBlock block;
+    unsigned i;
+
+    plugins->starts[physical >> 2] = 1;
+    block.plugins = plugins;
+    block.first = first;
+    block.vaddr = vaddr;
+    block.physical = physical;
+    block.count = count;
+    block.bits = bits;
+    for (i = 0; i < count; i++) {
+        block.insns[i].block = &block;
+        block.insns[i].index = i;
+    }
+    for (i = 0; i < plugins->count; i++) {
+        if (plugins->list[i]->translate) {
+            plugins->list[i]->translate(plugins->list[i], &block);
+        }
+    }
+}
+
+/* Runs the callbacks of the hooked operation op, about to execute at pc */
+void plugins_run_hooks(Plugins *plugins, const DecodedOp *op, unsigned index, Address pc,
+                       const Register *R, const Word *F) {
+    OpKind kind = op->kind & ~OP_HOOKED;
+    Hook *hook;
+    unsigned size;
+    int is_store;
+
+    for (hook = plugins->hooks[index]; hook; hook = hook->next) {
+        if (hook->exec) {
+            hook->exec(pc, hook->userdata);
+            continue;
+        }
+        if (kind >= OP_FLW) {
+            /* FP loads and stores move a word */
+            is_store = kind == OP_FSW || kind == OP_FSW_V;
+            hook->mem(pc, R[op->rs1] + op->imm, 4, is_store, is_store ? F[op->rs2] : 0, hook->userdata);
+            continue;
+        }
+        if (kind >= OP_LB_V) {
+            kind -= OP_LB_V - OP_LB;
+        }
+        is_store = kind >= OP_SB;
+        size = 1 << (kind - (is_store ? OP_SB : OP_LB));
+        hook->mem(pc, R[op->rs1] + op->imm, size, is_store, is_store ? R[op->rs2] : 0, hook->userdata);
+    }
+}
+
+/* The engine dropped the decoded code of page, so drop its callbacks too;
+ * plugins attach new ones when the page is translated again */
+void plugins_drop_page(Plugins *plugins, unsigned page) {
+    Hook **hooks = &plugins->hooks[page << (PAGE_SHIFT - 2)], *hook;
+    unsigned i;
+
+    for (i = 0; i < PAGE_SIZE / 4; i++) {
+        while ((hook = hooks[i]) != NULL) {
+            hooks[i] = hook->next;
+            free(hook);
+        }
+    }
+    memset(&plugins->resumes[page << (PAGE_SHIFT - 2)], 0, PAGE_SIZE / 4);
+}
+
+void plugins_exit(Plugins *plugins) {
+    unsigned i;
+
+    for (i = 0; i < plugins->count; i++) {
+        if (plugins->list[i]->exit) {
+            plugins->list[i]->exit(plugins->list[i], plugins->list[i]->exit_userdata);
+        }
+    }
+}
+
+void plugins_free(Plugins *plugins) {
+    Hook *hook, *next;
+    unsigned i;
+
+    for (i = 0; plugins->hooks && i < MEMORY_SPACE / 4; i++) {
+        for (hook = plugins->hooks[i]; hook != NULL; hook = next) {
+            next = hook->next;
+            free(hook);
+        }
+    }
+    for (i = 0; i < plugins->count; i++) {
+        dlclose(plugins->list[i]->handle);
+        free(plugins->list[i]->name);
+        free(plugins->list[i]);
+    }
+    free(plugins->hooks);
+    free(plugins->starts);
+    free(plugins->resumes);
+    memset(plugins, 0, sizeof(Plugins));
+}
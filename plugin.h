@@ -0,0 +1,55 @@
+#ifndef PLUGIN_H
+#define PLUGIN_H
+
+#include "types.h"
+#include "rvplugin.h"
+#include "engine.h"
+
+#define MAX_PLUGINS 8
+
+/* A callback attached to one decoded instruction */
+typedef struct Hook {
+    RvExecFn exec;      /* exactly one of exec and mem is set */
+    RvMemFn mem;
+    void *userdata;
+    struct Hook *next;
+} Hook;
+
+struct RvPlugin {
+    void *handle;
+    char *name;
+    RvTranslateFn translate;
+    RvExitFn exit;
+    void *exit_userdata;
+    struct Plugins *plugins;
+};
+
+/* The loaded plugins and the callbacks they attached, by physical word
+   address. Hooked operations have OP_HOOKED set in their kind, which the
+   engine only looks at in the default case of its dispatch.
+
+   Blocks normally overlap: a jump into the middle of a block just runs
+   the rest of it. Plugins expect to see every block they run translated,
+   so with plugins loaded every address a block was entered at is
+   remembered in starts, and blocks are cut in front of them. A run that
+   stops inside a block (budget, single steps, events) marks where in
+   resumes; entering there again finishes that block instead. */
+typedef struct Plugins {
+    RvPlugin *list[MAX_PLUGINS];
+    unsigned count;
+    Hook **hooks;
+    Byte *starts;
+    Byte *resumes;
+} Plugins;
+
+int plugins_init(Plugins *plugins);
+int plugin_load(Plugins *plugins, const char *spec);
+void plugins_translate(Plugins *plugins, DecodedOp *first, Address vaddr, Address physical,
+                       unsigned count, const Word *bits);
+void plugins_run_hooks(Plugins *plugins, const DecodedOp *op, unsigned index, Address pc,
+                       const Register *R, const Word *F);
+void plugins_drop_page(Plugins *plugins, unsigned page);
+void plugins_exit(Plugins *plugins);
+void plugins_free(Plugins *plugins);
+
+#endif
@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "rvplugin.h"
+
+/* Counts how often each block runs and how many bytes it moves, then
+ * prints the busiest blocks: ./riscv -p plugins/hotblocks.so[,N] prog */
+
+#define MAX_BLOCKS 4096
+
+typedef struct {
+    uint32_t vaddr;
+    unsigned insns;
+    uint64_t executions;
+    uint64_t bytes;
+} Block;
+
+static Block blocks[MAX_BLOCKS];
+static unsigned block_count;
+static unsigned top = 10;
+
+static void block_exec(uint32_t pc, void *userdata) {
+    ((Block *) userdata)->executions++;
+}
+
+static void mem_access(uint32_t pc, uint32_t address, unsigned size, int is_store,
+                       uint32_t value, void *userdata) {
+    ((Block *) userdata)->bytes += size;
+}
+
+static Block *find_block(uint32_t vaddr, unsigned insns) {
+    unsigned i;
+    for (i = 0; i < block_count; i++) {
+        if (blocks[i].vaddr == vaddr && blocks[i].insns == insns) {
+            return &blocks[i];
+        }
+    }
+    if (block_count == MAX_BLOCKS) {
+        return NULL;
+    }
+    blocks[block_count].vaddr = vaddr;
+    blocks[block_count].insns = insns;
+    return &blocks[block_count++];
+}
+
+static void translate(RvPlugin *plugin, RvBlock *rv_block) {
+    Block *block = find_block(rv_block_vaddr(rv_block), rv_block_count(rv_block));
+    unsigned i;
+
+    if (block == NULL) {
+        return;
+    }
+    rv_block_register_exec(rv_block, block_exec, block);
+    for (i = 0; i < rv_block_count(rv_block); i++) {
+        rv_insn_register_mem(rv_block_insn(rv_block, i), mem_access, block);
+    }
+}
+
+static int by_instructions(const void *a, const void *b) {
+    uint64_t x = ((const Block *) a)->executions * ((const Block *) a)->insns;
+    uint64_t y = ((const Block *) b)->executions * ((const Block *) b)->insns;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static void report(RvPlugin *plugin, void *userdata) {
+    unsigned i;
+
+    qsort(blocks, block_count, sizeof(Block), by_instructions);
+    fprintf(stderr, "%-10s %6s %12s %12s\n", "block", "insns", "executions", "bytes");
+    for (i = 0; i < block_count && i < top; i++) {
+        fprintf(stderr, "0x%08x %6u %12llu %12llu\n", blocks[i].vaddr, blocks[i].insns,
+                (unsigned long long) blocks[i].executions, (unsigned long long) blocks[i].bytes);
+    }
+}
+
+int rv_plugin_install(RvPlugin *plugin, int version, int argc, char **argv) {
+    if (version != RV_PLUGIN_VERSION) {
+        return -1;
+    }
+    if (argc > 0) {
+        top = atoi(argv[0]);
+    }
+    rv_register_translate(plugin, translate);
+    rv_register_exit(plugin, report, NULL);
+    return 0;
+}
@@ -0,0 +1,428 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rvplugin.h"
+
+/* Dataflow limit study: every instruction starts as soon as its operands
+ * are ready and finishes a fixed latency later, so the longest chain of
+ * dependences through registers and memory words is the critical path and
+ * instructions / critical path is the ILP an ideal machine would reach.
+ * Branches are predicted perfectly. It runs in one pass in fixed memory:
+ * memory words are shadowed in a direct-mapped table, so a word evicted by
+ * another loses its dependence. Prints the critical path and the
+ * dependence chains it runs through most often.
+ *
+ *   ./riscv -p plugins/ilp.so[,window=N][,top=N][,class=cycles...] prog
+ *
+ * window=N limits the analysis to N instructions in flight, retired in
+ * order; the classes are alu mul div load store branch jump fp fpdiv
+ * system. */
+
+#define MAX_INSNS 65536      /* static instructions, hashed by pc */
+#define MAX_EDGES 65536      /* critical producer -> consumer pairs */
+#define SHADOW_BITS 18       /* memory words tracked */
+#define MAX_WINDOW (1 << 20)
+#define MAX_CHAIN 12
+#define NONE 0xFF
+
+enum { ALU, MUL, DIV, LOAD, STORE, BRANCH, JUMP, FP, FPDIV, SYSTEM, CLASSES };
+
+static const char *class_names[CLASSES] = {
+    "alu", "mul", "div", "load", "store", "branch", "jump", "fp", "fpdiv", "system"
+};
+static unsigned latency[CLASSES] = { 1, 3, 20, 3, 1, 1, 1, 4, 12, 1 };
+
+typedef struct {
+    uint32_t pc;             /* 0 for a free slot */
+    uint8_t cls;
+    uint8_t dst;             /* x0-x31 are 0-31, f0-f31 32-63 */
+    uint8_t src[3];
+} Insn;
+
+/* When a register or memory word becomes ready, and who produced it */
+typedef struct {
+    uint64_t ready;
+    uint32_t producer;
+} Value;
+
+typedef struct {
+    uint32_t tag;            /* word address + 1, 0 when unused */
+    Value value;
+} ShadowWord;
+
+typedef struct {
+    uint32_t from, to;
+    uint64_t count;
+} Edge;
+
+static Insn insns[MAX_INSNS];
+static Edge edges[MAX_EDGES];
+static ShadowWord shadow[1 << SHADOW_BITS];
+static Value regs[64];
+static uint64_t *retired;    /* ring of in-order retire times */
+static unsigned window;
+static unsigned top = 5;
+static uint64_t instructions, critical_path, last_retire, lost_edges;
+static int insns_full;
+
+static uint8_t x(unsigned reg) {
+    return reg ? reg : NONE;
+}
+
+static uint8_t f(unsigned reg) {
+    return 32 + reg;
+}
+
+static void operands(Insn *insn, uint8_t dst, uint8_t src0, uint8_t src1) {
+    insn->dst = dst;
+    insn->src[0] = src0;
+    insn->src[1] = src1;
+}
+
+static void decode(Insn *insn, uint32_t bits) {
+    unsigned rd = (bits >> 7) & 31, rs1 = (bits >> 15) & 31, rs2 = (bits >> 20) & 31;
+    unsigned funct3 = (bits >> 12) & 7, funct7 = bits >> 25;
+
+    insn->cls = ALU;
+    insn->src[2] = NONE;
+    operands(insn, NONE, NONE, NONE);
+    switch (bits & 0x7F) {
+        case 0x37: /* lui */
+        case 0x17: /* auipc */
+            operands(insn, x(rd), NONE, NONE);
+            break;
+        case 0x13:
+            operands(insn, x(rd), x(rs1), NONE);
+            break;
+        case 0x33:
+            if (funct7 == 1) {
+                insn->cls = funct3 < 4 ? MUL : DIV;
+            }
+            operands(insn, x(rd), x(rs1), x(rs2));
+            break;
+        case 0x03:
+            insn->cls = LOAD;
+            operands(insn, x(rd), x(rs1), NONE);
+            break;
+        case 0x23:
+            insn->cls = STORE;
+            operands(insn, NONE, x(rs1), x(rs2));
+            break;
+        case 0x63:
+            insn->cls = BRANCH;
+            operands(insn, NONE, x(rs1), x(rs2));
+            break;
+        case 0x6F:
+            insn->cls = JUMP;
+            operands(insn, x(rd), NONE, NONE);
+            break;
+        case 0x67:
+            insn->cls = JUMP;
+            operands(insn, x(rd), x(rs1), NONE);
+            break;
+        case 0x07: /* flw */
+            insn->cls = LOAD;
+            operands(insn, f(rd), x(rs1), NONE);
+            break;
+        case 0x27: /* fsw */
+            insn->cls = STORE;
+            operands(insn, NONE, x(rs1), f(rs2));
+            break;
+        case 0x43: /* fused multiply-add */
+        case 0x47:
+        case 0x4B:
+        case 0x4F:
+            insn->cls = FP;
+            operands(insn, f(rd), f(rs1), f(rs2));
+            insn->src[2] = f(bits >> 27);
+            break;
+        case 0x53:
+            insn->cls = FP;
+            switch (funct7) {
+                case 0x0C: /* fdiv */
+                    insn->cls = FPDIV;
+                    operands(insn, f(rd), f(rs1), f(rs2));
+                    break;
+                case 0x2C: /* fsqrt */
+                    insn->cls = FPDIV;
+                    operands(insn, f(rd), f(rs1), NONE);
+                    break;
+                case 0x50: /* compares */
+                    operands(insn, x(rd), f(rs1), f(rs2));
+                    break;
+                case 0x60: /* fcvt.w */
+                case 0x70: /* fmv.x.w, fclass */
+                    operands(insn, x(rd), f(rs1), NONE);
+                    break;
+                case 0x68: /* fcvt.s.w */
+                case 0x78: /* fmv.w.x */
+                    operands(insn, f(rd), x(rs1), NONE);
+                    break;
+                default:
+                    operands(insn, f(rd), f(rs1), f(rs2));
+                    break;
+            }
+            break;
+        case 0x73:
+            insn->cls = SYSTEM;
+            if (bits == 0x73) {
+                /* ecall takes its arguments in a0, a1 and a7 */
+                operands(insn, 10, 10, 11);
+                insn->src[2] = 17;
+            } else if (funct3 != 0) {
+                operands(insn, x(rd), funct3 < 4 ? x(rs1) : NONE, NONE);
+            }
+            break;
+    }
+}
+
+/* Producer pcs on the critical path of each consumer */
+static void count_edge(uint32_t from, uint32_t to) {
+    unsigned i = ((from * 2654435761u) ^ (to * 40503u)) & (MAX_EDGES - 1), probes;
+
+    for (probes = 0; probes < MAX_EDGES; probes++, i = (i + 1) & (MAX_EDGES - 1)) {
+        if (edges[i].count == 0) {
+            edges[i].from = from;
+            edges[i].to = to;
+        }
+        if (edges[i].from == from && edges[i].to == to) {
+            edges[i].count++;
+            return;
+        }
+    }
+    lost_edges++;
+}
+
+/* Schedules one dynamic instruction, returns when it finishes */
+static uint64_t schedule(const Insn *insn, const Value *memory) {
+    const Value *critical = NULL;
+    uint64_t ready = 0, finish, *slot = NULL;
+    unsigned i;
+
+    for (i = 0; i < 3; i++) {
+        if (insn->src[i] != NONE && regs[insn->src[i]].ready > ready) {
+            critical = &regs[insn->src[i]];
+            ready = critical->ready;
+        }
+    }
+    if (memory != NULL && memory->ready > ready) {
+        critical = memory;
+        ready = critical->ready;
+    }
+    if (window > 0) {
+        /* cannot enter before the instruction window places ahead retires */
+        slot = &retired[instructions % window];
+        if (*slot > ready) {
+            critical = NULL;
+            ready = *slot;
+        }
+    }
+    if (critical != NULL) {
+        count_edge(critical->producer, insn->pc);
+    }
+    finish = ready + latency[insn->cls];
+    if (insn->dst != NONE) {
+        regs[insn->dst].ready = finish;
+        regs[insn->dst].producer = insn->pc;
+    }
+    if (slot != NULL) {
+        last_retire = finish > last_retire ? finish : last_retire;
+        *slot = last_retire;
+    }
+    if (finish > critical_path) {
+        critical_path = finish;
+    }
+    instructions++;
+    return finish;
+}
+
+static void insn_exec(uint32_t pc, void *userdata) {
+    schedule(userdata, NULL);
+}
+
+static void mem_access(uint32_t pc, uint32_t address, unsigned size, int is_store,
+                       uint32_t value, void *userdata) {
+    ShadowWord *word = &shadow[(address >> 2) & ((1 << SHADOW_BITS) - 1)];
+    uint32_t tag = (address >> 2) + 1;
+    uint64_t finish;
+
+    if (!is_store) {
+        schedule(userdata, word->tag == tag ? &word->value : NULL);
+        return;
+    }
+    finish = schedule(userdata, NULL);
+    word->tag = tag;
+    word->value.ready = finish;
+    word->value.producer = pc;
+}
+
+static Insn *find_insn(uint32_t pc) {
+    unsigned i = (pc >> 2) & (MAX_INSNS - 1), probes;
+
+    for (probes = 0; probes < MAX_INSNS; probes++, i = (i + 1) & (MAX_INSNS - 1)) {
+        if (insns[i].pc == pc || insns[i].pc == 0) {
+            insns[i].pc = pc;
+            return &insns[i];
+        }
+    }
+    return NULL;
+}
+
+/* Rewritten code is decoded again into the same slot */
+static void translate(RvPlugin *plugin, RvBlock *block) {
+    unsigned i;
+
+    for (i = 0; i < rv_block_count(block); i++) {
+        RvInsn *rv_insn = rv_block_insn(block, i);
+        uint32_t bits = rv_insn_bits(rv_insn);
+        Insn *insn = find_insn(rv_insn_vaddr(rv_insn));
+
+        if (insn == NULL) {
+            insns_full = 1;
+            continue;
+        }
+        decode(insn, bits);
+        if (insn->cls == LOAD || insn->cls == STORE) {
+            rv_insn_register_mem(rv_insn, mem_access, insn);
+        } else {
+            rv_insn_register_exec(rv_insn, insn_exec, insn);
+        }
+    }
+}
+
+static const char *class_of(uint32_t pc) {
+    Insn *insn = find_insn(pc);
+    return insn != NULL ? class_names[insn->cls] : "?";
+}
+
+static int by_count(const void *a, const void *b) {
+    uint64_t x = ((const Edge *) a)->count, y = ((const Edge *) b)->count;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/* The edge into pc that was critical most often */
+static const Edge *heaviest_into(uint32_t pc) {
+    const Edge *best = NULL;
+    unsigned i;
+
+    for (i = 0; i < MAX_EDGES && edges[i].count > 0; i++) {
+        if (edges[i].to == pc && (best == NULL || edges[i].count > best->count)) {
+            best = &edges[i];
+        }
+    }
+    return best;
+}
+
+static int in_chain(const uint32_t *chain, unsigned length, uint32_t pc) {
+    unsigned i;
+    for (i = 0; i < length; i++) {
+        if (chain[i] == pc) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Follows the most frequent critical producers back from the busiest
+ * edges; a chain that comes back to itself is a loop-carried dependence */
+static void print_chains(void) {
+    static uint32_t shown[MAX_CHAIN * 64];
+    uint32_t chain[MAX_CHAIN];
+    unsigned shown_count = 0, printed = 0, length, i, e;
+    const Edge *edge;
+
+    if (top == 0) {
+        return;
+    }
+    qsort(edges, MAX_EDGES, sizeof(Edge), by_count);
+    fprintf(stderr, "%12s  %s\n", "critical", "chain (consumer <- producer)");
+    for (e = 0; e < MAX_EDGES && edges[e].count > 0 && printed < top; e++) {
+        if (in_chain(shown, shown_count, edges[e].to)) {
+            continue;
+        }
+        chain[0] = edges[e].to;
+        length = 1;
+        for (edge = &edges[e]; edge != NULL && length < MAX_CHAIN; edge = heaviest_into(edge->from)) {
+            if (in_chain(chain, length, edge->from)) {
+                break;
+            }
+            chain[length++] = edge->from;
+        }
+        fprintf(stderr, "%12llu ", (unsigned long long) edges[e].count);
+        for (i = 0; i < length; i++) {
+            fprintf(stderr, " %s0x%x:%s", i ? "<- " : "", chain[i], class_of(chain[i]));
+            if (shown_count < sizeof(shown) / sizeof(shown[0])) {
+                shown[shown_count++] = chain[i];
+            }
+        }
+        fprintf(stderr, "%s\n", edge != NULL && length < MAX_CHAIN ? " (loop)" : "");
+        printed++;
+    }
+}
+
+static void report(RvPlugin *plugin, void *userdata) {
+    unsigned i;
+
+    fprintf(stderr, "instructions   %llu\n", (unsigned long long) instructions);
+    fprintf(stderr, "critical path  %llu cycles\n", (unsigned long long) critical_path);
+    fprintf(stderr, "ILP            %.2f", critical_path ? (double) instructions / critical_path : 0.0);
+    if (window > 0) {
+        fprintf(stderr, " (window %u)", window);
+    }
+    fprintf(stderr, "\nlatencies     ");
+    for (i = 0; i < CLASSES; i++) {
+        fprintf(stderr, " %s=%u", class_names[i], latency[i]);
+    }
+    fprintf(stderr, "\n");
+    if (insns_full || lost_edges) {
+        fprintf(stderr, "warning: %s\n", insns_full ? "too many instructions, some were not analyzed"
+                                                    : "too many distinct dependences, some were not counted");
+    }
+    print_chains();
+    free(retired);
+}
+
+static int parse(const char *arg) {
+    const char *equals = strchr(arg, '=');
+    size_t length = equals ? (size_t) (equals - arg) : 0;
+    unsigned i;
+
+    if (equals == NULL) {
+        return -1;
+    }
+    if (length == 6 && strncmp(arg, "window", 6) == 0) {
+        window = atoi(equals + 1);
+        return window <= MAX_WINDOW ? 0 : -1;
+    }
+    if (length == 3 && strncmp(arg, "top", 3) == 0) {
+        top = atoi(equals + 1);
+        return 0;
+    }
+    for (i = 0; i < CLASSES; i++) {
+        if (strlen(class_names[i]) == length && strncmp(arg, class_names[i], length) == 0) {
+            latency[i] = atoi(equals + 1);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int rv_plugin_install(RvPlugin *plugin, int version, int argc, char **argv) {
+    int i;
+
+    if (version != RV_PLUGIN_VERSION) {
+        return -1;
+    }
+    for (i = 0; i < argc; i++) {
+        if (parse(argv[i]) != 0) {
+            fprintf(stderr, "ilp: bad argument %s\n", argv[i]);
+            return -1;
+        }
+    }
+    if (window > 0 && (retired = calloc(window, sizeof(uint64_t))) == NULL) {
+        return -1;
+    }
+    rv_register_translate(plugin, translate);
+    rv_register_exit(plugin, report, NULL);
+    return 0;
+}
@@ -0,0 +1,397 @@
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "memory.h"
+#include "devices.h"
+#include "syscalls.h"
+#include "reverse.h"
+
+static int push_snapshot(Reverse *reverse) {
+    Snapshot *snapshot;
+
+    if (reverse->count == reverse->capacity) {
+        unsigned capacity = reverse->capacity ? 2 * reverse->capacity : 64;
+        snapshot = realloc(reverse->snapshots, capacity * sizeof(Snapshot));
+        if (snapshot == NULL) {
+            return -1;
+        }
+        reverse->snapshots = snapshot;
+        reverse->capacity = capacity;
+    }
+    snapshot = &reverse->snapshots[reverse->count];
+    memset(snapshot, 0, sizeof(Snapshot));
+    if (reverse->state_size > 0) {
+        snapshot->state = malloc(reverse->state_size);
+        if (snapshot->state == NULL) {
+            return -1;
+        }
+        reverse->save_state(reverse->opaque, snapshot->state);
+    }
+    snapshot->time = reverse->now;
+    snapshot->processor = *reverse->processor;
+    snapshot->log_offset = event_log_tell(&reverse->log);
+    reverse->base = reverse->count++;
+    return 0;
+}
+
+static void free_pages(Reverse *reverse, Snapshot *snapshot) {
+    reverse->used -= (size_t) snapshot->page_count * PAGE_SIZE;
+    free(snapshot->pages);
+    free(snapshot->contents);
+    snapshot->pages = NULL;
+    snapshot->contents = NULL;
+    snapshot->page_count = 0;
+}
+
+/* Frees what a snapshot holds, for one that goes away */
+static void free_snapshot(Reverse *reverse, Snapshot *snapshot) {
+    free_pages(reverse, snapshot);
+    free(snapshot->state);
+    snapshot->state = NULL;
+}
+
+int reverse_init(Reverse *reverse, Processor *processor, Byte *memory, size_t limit,
+                 ReverseRunFn run, void *opaque) {
+    MemoryContext *context = MEMORY_CONTEXT(memory);
+
+    memset(reverse, 0, sizeof(Reverse));
+    /* the inputs are recorded into our own log */
+    if ((context->devices && context->devices->log) || (context->syscalls && context->syscalls->log)) {
+        return -1;
+    }
+    reverse->processor = processor;
+    reverse->memory = memory;
+    reverse->run = run;
+    reverse->opaque = opaque;
+    reverse->interval = REVERSE_INTERVAL;
+    reverse->limit = limit;
+    reverse->shadow = malloc(MEMORY_SPACE);
+    if (reverse->shadow == NULL || event_log_temporary(&reverse->log) != 0) {
+        free(reverse->shadow);
+        return -1;
+    }
+    if (context->devices) {
+        context->devices->log = &reverse->log;
+    }
+    if (context->syscalls) {
+        context->syscalls->log = &reverse->log;
+    }
+    memcpy(reverse->shadow, memory, MEMORY_SPACE);
+    clear_dirty(memory);
+    return push_snapshot(reverse);
+}
+
+void reverse_free(Reverse *reverse) {
+    MemoryContext *context = MEMORY_CONTEXT(reverse->memory);
+    unsigned i;
+
+    for (i = 0; i < reverse->count; i++) {
+        free_snapshot(reverse, &reverse->snapshots[i]);
+    }
+    free(reverse->snapshots);
+    free(reverse->shadow);
+    if (context->devices) {
+        context->devices->log = NULL;
+    }
+    if (context->syscalls) {
+        context->syscalls->log = NULL;
+    }
+    event_log_close(&reverse->log);
+}
+
+int reverse_track_state(Reverse *reverse, size_t size, void (*save)(void *opaque, void *state),
+                        void (*restore)(void *opaque, const void *state)) {
+    Snapshot *first = &reverse->snapshots[0];
+
+    /* only from the start of history, where there is one snapshot */
+    if (reverse->count != 1 || first->state != NULL || (first->state = malloc(size)) == NULL) {
+        return -1;
+    }
+    reverse->state_size = size;
+    reverse->save_state = save;
+    reverse->restore_state = restore;
+    save(reverse->opaque, first->state);
+    return 0;
+}
+
+/* Moves the pages written since the newest snapshot into its undo log */
+static int save_pages(Reverse *reverse) {
+    Snapshot *snapshot = &reverse->snapshots[reverse->base];
+    Byte *dirty = DIRTY_MAP(reverse->memory);
+    unsigned page, count = 0;
+
+    for (page = 0; page < NUM_PAGES; page++) {
+        count += dirty[page] != 0;
+    }
+    if (count > 0) {
+        snapshot->pages = malloc(count * sizeof(unsigned));
+        snapshot->contents = malloc((size_t) count * PAGE_SIZE);
+        if (snapshot->pages == NULL || snapshot->contents == NULL) {
+            free_pages(reverse, snapshot);
+            return -1;
+        }
+    }
+    for (page = 0; page < NUM_PAGES; page++) {
+        if (dirty[page]) {
+            memcpy(snapshot->contents + (size_t) snapshot->page_count * PAGE_SIZE,
+                   reverse->shadow + (page << PAGE_SHIFT), PAGE_SIZE);
+            memcpy(reverse->shadow + (page << PAGE_SHIFT), reverse->memory + (page << PAGE_SHIFT), PAGE_SIZE);
+            snapshot->pages[snapshot->page_count++] = page;
+        }
+    }
+    reverse->used += (size_t) count * PAGE_SIZE;
+    clear_dirty(reverse->memory);
+    return 0;
+}
+
+/* Folds snapshot index + 1 into index. Pages the later one saved that the
+ * earlier did not were not written in between, so they are also as they
+ * were at the earlier snapshot. */
+static void merge(Reverse *reverse, unsigned index) {
+    Snapshot *first = &reverse->snapshots[index], *second = first + 1;
+    Byte present[NUM_PAGES];
+    unsigned i, count = first->page_count;
+    unsigned *pages;
+    Byte *contents;
+
+    memset(present, 0, sizeof(present));
+    for (i = 0; i < first->page_count; i++) {
+        present[first->pages[i]] = 1;
+    }
+    for (i = 0; i < second->page_count; i++) {
+        count += !present[second->pages[i]];
+    }
+    if (count > first->page_count) {
+        pages = realloc(first->pages, count * sizeof(unsigned));
+        if (pages) {
+            first->pages = pages;
+        }
+        contents = realloc(first->contents, (size_t) count * PAGE_SIZE);
+        if (contents) {
+            first->contents = contents;
+        }
+        if (pages == NULL || contents == NULL) {
+            return;
+        }
+    }
+    for (i = 0; i < second->page_count; i++) {
+        if (!present[second->pages[i]]) {
+            memcpy(first->contents + (size_t) first->page_count * PAGE_SIZE,
+                   second->contents + (size_t) i * PAGE_SIZE, PAGE_SIZE);
+            first->pages[first->page_count++] = second->pages[i];
+            reverse->used += PAGE_SIZE;
+        }
+    }
+    free_snapshot(reverse, second);
+    memmove(second, second + 1, (reverse->count - index - 2) * sizeof(Snapshot));
+    reverse->count--;
+    reverse->base--;
+}
+
+/* Keeps the page copies within the limit: merges the closest pair of old
+ * snapshots, and forgets the oldest once nothing is left to merge */
+static void trim(Reverse *reverse) {
+    uint64_t span, best_span;
+    unsigned i, best;
+
+    while (reverse->used > reverse->limit && reverse->base > 0) {
+        if (reverse->base >= 2) {
+            best = 0;
+            best_span = UINT64_MAX;
+            for (i = 0; i + 2 <= reverse->base; i++) {
+                span = reverse->snapshots[i + 2].time - reverse->snapshots[i].time;
+                if (span < best_span) {
+                    best = i;
+                    best_span = span;
+                }
+            }
+            merge(reverse, best);
+        } else {
+            free_snapshot(reverse, &reverse->snapshots[0]);
+            memmove(reverse->snapshots, reverse->snapshots + 1, (reverse->count - 1) * sizeof(Snapshot));
+            reverse->count--;
+            reverse->base--;
+        }
+    }
+}
+
+/* The next snapshot: one taken before we went back, or a new one */
+static uint64_t next_snapshot(Reverse *reverse) {
+    if (reverse->base + 1 < reverse->count) {
+        return reverse->snapshots[reverse->base + 1].time;
+    }
+    return reverse->snapshots[reverse->base].time + reverse->interval;
+}
+
+static void reached_snapshot(Reverse *reverse) {
+    Byte *dirty = DIRTY_MAP(reverse->memory);
+    unsigned page;
+
+    if (reverse->base + 1 < reverse->count) {
+        /* history ran again: its undo log is already there */
+        for (page = 0; page < NUM_PAGES; page++) {
+            if (dirty[page]) {
+                memcpy(reverse->shadow + (page << PAGE_SHIFT), reverse->memory + (page << PAGE_SHIFT), PAGE_SIZE);
+            }
+        }
+        clear_dirty(reverse->memory);
+        reverse->base++;
+    } else if (save_pages(reverse) == 0 && push_snapshot(reverse) == 0) {
+        trim(reverse);
+    }
+}
+
+/* Runs forward, taking snapshots on the way. Output the guest already
+ * produced the first time through is not produced again. */
+uint64_t reverse_run(Reverse *reverse, uint64_t budget, int *stopped) {
+    MemoryContext *context = MEMORY_CONTEXT(reverse->memory);
+    uint64_t done = 0, chunk, executed;
+
+    *stopped = 0;
+    while (done < budget && !*stopped) {
+        chunk = next_snapshot(reverse) - reverse->now;
+        if (reverse->now < reverse->present && reverse->present - reverse->now < chunk) {
+            chunk = reverse->present - reverse->now;
+        }
+        if (chunk > budget - done) {
+            chunk = budget - done;
+        }
+        context->muted = reverse->now < reverse->present;
+        executed = reverse->run(reverse->opaque, chunk, stopped);
+        reverse->now += executed;
+        done += executed;
+        if (reverse->now > reverse->present) {
+            reverse->present = reverse->now;
+        }
+        if (reverse->now == next_snapshot(reverse)) {
+            reached_snapshot(reverse);
+        }
+        if (executed == 0) {
+            break;
+        }
+    }
+    context->muted = 0;
+    return done;
+}
+
+static void restore_page(Reverse *reverse, unsigned page, const Byte *contents) {
+    memcpy(reverse->memory + (page << PAGE_SHIFT), contents, PAGE_SIZE);
+    if (reverse->written) {
+        reverse->written(reverse->opaque, page << PAGE_SHIFT, PAGE_SIZE);
+    }
+}
+
+/* Puts the machine back the way it was at snapshot index */
+static void restore(Reverse *reverse, unsigned index) {
+    Byte *dirty = DIRTY_MAP(reverse->memory);
+    Snapshot *snapshot;
+    unsigned page, i, k;
+
+    for (page = 0; page < NUM_PAGES; page++) {
+        if (dirty[page]) {
+            restore_page(reverse, page, reverse->shadow + (page << PAGE_SHIFT));
+        }
+    }
+    for (k = reverse->base; k-- > index;) {
+        snapshot = &reverse->snapshots[k];
+        for (i = 0; i < snapshot->page_count; i++) {
+            page = snapshot->pages[i];
+            restore_page(reverse, page, snapshot->contents + (size_t) i * PAGE_SIZE);
+            memcpy(reverse->shadow + (page << PAGE_SHIFT), reverse->memory + (page << PAGE_SHIFT), PAGE_SIZE);
+        }
+    }
+    clear_dirty(reverse->memory);
+    snapshot = &reverse->snapshots[index];
+    *reverse->processor = snapshot->processor;
+    if (snapshot->state) {
+        reverse->restore_state(reverse->opaque, snapshot->state);
+    }
+    reverse->now = snapshot->time;
+    reverse->base = index;
+    event_log_rewind(&reverse->log, snapshot->log_offset);
+}
+
+/* Runs forward to time, through any breakpoints on the way */
+static int run_to(Reverse *reverse, uint64_t time) {
+    int stopped;
+
+    while (reverse->now < time) {
+        if (reverse_run(reverse, time - reverse->now, &stopped) == 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* The latest snapshot at or before time */
+static unsigned snapshot_before(Reverse *reverse, uint64_t time) {
+    unsigned index = reverse->base;
+
+    while (index > 0 && reverse->snapshots[index].time > time) {
+        index--;
+    }
+    return index;
+}
+
+/* Goes back count instructions. Returns -1 if history does not go back
+ * that far, leaving the machine at its start. */
+int reverse_step(Reverse *reverse, uint64_t count) {
+    uint64_t time;
+
+    if (count > reverse->now - reverse->snapshots[0].time) {
+        restore(reverse, 0);
+        return -1;
+    }
+    time = reverse->now - count;
+    restore(reverse, snapshot_before(reverse, time));
+    return run_to(reverse, time);
+}
+
+/* Goes back to the last time the run stopped at a breakpoint or
+ * watchpoint, searching history one snapshot at a time from the newest.
+ * Returns -1 if there was none, leaving the machine at the start of
+ * history. */
+int reverse_continue(Reverse *reverse) {
+    uint64_t end = reverse->now, hit = 0;
+    unsigned index = snapshot_before(reverse, end);
+    int found, stopped;
+
+    for (;;) {
+        if (reverse->snapshots[index].time == end) {
+            if (index == 0) {
+                restore(reverse, 0);
+                return -1;
+            }
+            index--;
+        }
+        restore(reverse, index);
+        found = reverse->at_breakpoint && reverse->at_breakpoint(reverse->opaque);
+        hit = reverse->now;
+        while (reverse->now < end) {
+            if (reverse_run(reverse, end - reverse->now, &stopped) == 0) {
+                break;
+            }
+            if (stopped && reverse->now < end) {
+                found = 1;
+                hit = reverse->now;
+            }
+        }
+        if (found) {
+            restore(reverse, index);
+            return run_to(reverse, hit);
+        }
+        end = reverse->snapshots[index].time;
+    }
+}
+
+/* The machine was changed by hand, so the recorded future will not
+ * happen any more */
+void reverse_forget_future(Reverse *reverse) {
+    while (reverse->count > reverse->base + 1) {
+        free_snapshot(reverse, &reverse->snapshots[--reverse->count]);
+    }
+    /* the undo log of the base snapshot is built again at the next one */
+    free_pages(reverse, &reverse->snapshots[reverse->base]);
+    reverse->present = reverse->now;
+    event_log_truncate(&reverse->log);
+}
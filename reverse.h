@@ -0,0 +1,71 @@
+#ifndef REVERSE_H
+#define REVERSE_H
+
+#include <stddef.h>
+#include "types.h"
+#include "eventlog.h"
+
+/* Instructions between snapshots to start with. Older snapshots are
+   merged pairwise when the history outgrows its budget, so the spacing
+   grows with the length of the run. */
+#define REVERSE_INTERVAL 65536
+
+/* The state of the machine some instructions ago. Memory is kept as an
+   undo log: the pages written before the next snapshot, as they were
+   when this one was taken. */
+typedef struct {
+    uint64_t time;              /* instructions since the start of history */
+    Processor processor;
+    long log_offset;            /* see event_log_tell() */
+    void *state;                /* see reverse_track_state(), or NULL */
+    unsigned page_count;
+    unsigned *pages;
+    Byte *contents;             /* page_count pages */
+} Snapshot;
+
+/* Runs the machine forward for at most budget instructions and returns how
+   many retired. Sets *stopped when it stopped early: a breakpoint (in front
+   of it), a watchpoint, a fault or the end of the guest. */
+typedef uint64_t (*ReverseRunFn)(void *opaque, uint64_t budget, int *stopped);
+
+/* Reverse execution: snapshots of the processor and the pages written
+   since the previous snapshot, and a recording of the guest's inputs so
+   history runs again exactly the same way. Going back restores the
+   nearest snapshot and runs forward to the instruction asked for. */
+typedef struct {
+    Processor *processor;
+    Byte *memory;               /* allocated with alloc_memory() */
+    ReverseRunFn run;
+    /* optional: the machine sits in front of a breakpoint */
+    int (*at_breakpoint)(void *opaque);
+    /* optional: memory changed behind the machine's back */
+    void (*written)(void *opaque, Address address, Word length);
+    /* optional: more of the machine, see reverse_track_state() */
+    size_t state_size;
+    void (*save_state)(void *opaque, void *state);
+    void (*restore_state)(void *opaque, const void *state);
+    void *opaque;
+    EventLog log;
+    uint64_t now;               /* instructions since the start of history */
+    uint64_t present;           /* furthest point reached, history ends here */
+    uint64_t interval;
+    size_t limit, used;         /* bytes of page copies */
+    Snapshot *snapshots;        /* oldest first */
+    unsigned count, capacity;
+    unsigned base;              /* latest snapshot at or before now */
+    Byte *shadow;               /* memory as of the base snapshot */
+} Reverse;
+
+int reverse_init(Reverse *reverse, Processor *processor, Byte *memory, size_t limit,
+                 ReverseRunFn run, void *opaque);
+void reverse_free(Reverse *reverse);
+/* Snapshots also keep size bytes the machine saves and restores itself,
+   like the instruction count and the timer that interrupts depend on */
+int reverse_track_state(Reverse *reverse, size_t size, void (*save)(void *opaque, void *state),
+                        void (*restore)(void *opaque, const void *state));
+uint64_t reverse_run(Reverse *reverse, uint64_t budget, int *stopped);
+int reverse_step(Reverse *reverse, uint64_t count);
+int reverse_continue(Reverse *reverse);
+void reverse_forget_future(Reverse *reverse);
+
+#endif
@@ -1,83 +1,264 @@
+#include "rvsim.h"
+#include "machine.h"
 #include "riscv.h"
+#include "cosim.h"
+#include "gdbstub.h"
+#include "tracesink.h"
+#include "reverse.h"
+#include "server.h"
+#include "tracewriter.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <stdarg.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
 
-/* WARNING: DO NOT CHANGE THIS FILE.
- YOU PROBABLY DON'T EVEN NEED TO LOOK AT IT... */
+/* The command line front end of librvsim (rvsim.h): loads a program and
+   runs, traces, debugs or cosimulates it as the options say. */
 
-// Pointer to simulator memory
-Byte *memory;
+// JSON run summary with -s, - for stderr
+static void write_stats(RvSim *sim,const char *path,const struct timespec *start_time) {
+    struct timespec now;
+    FILE *out;
 
-void execute(Processor *processor,int prompt,int print) {
-    /* fetch an instruction */
-    uint32_t instruction_bits = load(memory,processor->PC,LENGTH_WORD);
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    out = strcmp(path,"-") == 0 ? stderr : fopen(path,"w");
+    if(out == NULL) {
+        fprintf(stderr,"Cannot write statistics to %s\n",path);
+        return;
+    }
+    rvsim_write_stats(sim,out,
+                      (now.tv_sec - start_time->tv_sec) + (now.tv_nsec - start_time->tv_nsec) / 1e9);
+    if(out != stderr) {
+        fclose(out);
+    }
+}
+
+void print_registers(RvSim *sim,FILE *out) {
+    char dump[REGISTER_DUMP_SIZE];
+    format_registers(dump,sim->processor.R);
+    fwrite(dump,1,sizeof(dump),out);
+}
+
+/* Notes the registers a dump changed and checkpoints all of them every
+ * TRACE_CHECKPOINT_INTERVAL dumps, for the index of a compressed trace */
+static void index_dump(RvSim *sim,TraceSink *sink,uint64_t traced,Register *previous,Word *written) {
+    Register value;
+    int i;
 
-    /* interactive-mode prompt */
-    if(prompt) {
-        if(prompt==1) {
-            printf("simulator paused,enter to continue...");
-            while(getchar()!='\n');
+    for(i=0;i<32;i++) {
+        value = rvsim_get_register(sim,i);
+        if(value != previous[i]) {
+            *written |= 1U << i;
+            previous[i] = value;
         }
-        printf("%08x: ",processor->PC);
-        decode_instruction(instruction_bits);
     }
-    
-    execute_instruction(instruction_bits, processor, memory);
-    
-    // enforce $0 being hard-wired to 0
-    processor->R[0] = 0;
-    
-    // print trace
-    if(print) {
-        int i,j;
-        for(i=0;i<8;i++) {
-            for(j=0;j<4;j++) {
-                printf("r%2d=%08x ",i*4+j,processor->R[i*4+j]);
-            }
-            puts("");
+    if(traced % TRACE_CHECKPOINT_INTERVAL == 0) {
+        trace_checkpoint(sink,traced,previous,*written);
+        *written = 0;
+    }
+}
+
+/* Going backwards in interactive mode, see reverse.h. At the prompt
+ * "b [N]" goes back N instructions and "rc [ADDR]" back to the last time
+ * the PC was at ADDR, by default where it is now. */
+typedef struct {
+    RvSim *sim;
+    Reverse reverse;
+    Address breakpoint;
+    int armed;
+} History;
+
+static uint64_t step_guest(void *opaque,uint64_t budget,int *stopped) {
+    History *history = opaque;
+    uint64_t start = rvsim_instructions(history->sim);
+
+    while(budget-- > 0) {
+        if(rvsim_step(history->sim) != RVSIM_OK
+           || (history->armed && rvsim_get_pc(history->sim) == history->breakpoint)) {
+            *stopped = 1;
+            break;
         }
-	printf("\n");
     }
+    return rvsim_instructions(history->sim) - start;
+}
+
+static int at_breakpoint(void *opaque) {
+    History *history = opaque;
+    return history->armed && rvsim_get_pc(history->sim) == history->breakpoint;
 }
 
-void load_program(uint8_t *mem, size_t memsize, int startaddr, const char *filename, int disasm) {
-    FILE *file = fopen(filename, "r");
-    const int MAX_SIZE = 50;
-    char line[MAX_SIZE];
-    int instruction, offset = 0;    
-
-    while (fgets(line, MAX_SIZE, file) != NULL) {
-        instruction = (int32_t) strtol(line, NULL, 16);
-        mem[startaddr + offset] = instruction & 0xFF;
-	mem[startaddr + offset + 1] = (instruction >> 8) & 0xFF;
-	mem[startaddr + offset + 2] = (instruction >> 16) & 0xFF;
-	mem[startaddr + offset + 3] = (instruction >> 24) & 0xFF;
-        if (disasm) {
-	    printf("%08x: ", startaddr + offset);
-            decode_instruction((uint32_t) instruction);
-	}
-        offset += 4;
-    } 
+/* the clock and the timer, so interrupts come at the same time again */
+static void save_machine(void *opaque,void *state) {
+    rvsim_save_state(((History *)opaque)->sim,state);
+}
+
+static void restore_machine(void *opaque,const void *state) {
+    rvsim_restore_state(((History *)opaque)->sim,state);
+}
+
+/* Returns 1 if line was a command to go back */
+static int go_back(History *history,const char *line) {
+    char *end;
+    uint64_t count;
+    int result;
+
+    if(line[0] == 'b') {
+        count = strtoull(line+1,&end,0);
+        result = reverse_step(&history->reverse,end == line+1 ? 1 : count);
+    } else if(strncmp(line,"rc",2) == 0) {
+        history->breakpoint = strtoul(line+2,&end,16);
+        if(end == line+2) {
+            history->breakpoint = rvsim_get_pc(history->sim);
+        }
+        history->armed = 1;
+        result = reverse_continue(&history->reverse);
+        history->armed = 0;
+    } else {
+        return 0;
+    }
+    printf("%s instruction %llu\n",result == 0 ? "back at" : "start of history,",
+           (unsigned long long)history->reverse.now);
+    return 1;
+}
+
+/* Runs until the guest stops, single-stepping when prompting or tracing so
+ * every instruction gets its prompt and register dump. The trace and the
+ * guest's output go to out, which is sink's stream when compressing or
+ * writer's when the dumps are written in the background.
+ * Interactive mode keeps up to history bytes of snapshots to go back with.
+ * Returns the exit code for the simulator. */
+int run(RvSim *sim,FILE *out,TraceSink *sink,TraceWriter *writer,int prompt,int print,size_t history_size) {
+    RvSimStatus status = RVSIM_OK;
+    uint32_t instruction_bits;
+    Register previous[32];
+    Word written = 0;
+    uint64_t traced = 0;
+    History *history = NULL;
+    char line[64];
+    int i,stopped;
+
+    if(prompt==1 && history_size > 0) {
+        history = calloc(1,sizeof(History));
+        if(history == NULL
+           || reverse_init(&history->reverse,&sim->processor,sim->memory,history_size,step_guest,history) != 0) {
+            fprintf(stderr,"Cannot go backwards while recording or replaying\n");
+            free(history);
+            history = NULL;
+        } else {
+            history->sim = sim;
+            history->reverse.at_breakpoint = at_breakpoint;
+            if(reverse_track_state(&history->reverse,rvsim_state_size(sim),save_machine,restore_machine) != 0) {
+                fprintf(stderr,"Cannot keep history of the timer\n");
+                reverse_free(&history->reverse);
+                free(history);
+                history = NULL;
+            }
+        }
+    }
+
+    if(sink && print) {
+        for(i=0;i<32;i++) {
+            previous[i] = rvsim_get_register(sim,i);
+        }
+        trace_checkpoint(sink,0,previous,0);
+    }
+    do {
+        /* interactive-mode prompt */
+        if(prompt) {
+            if(prompt==1) {
+                printf("simulator paused,enter to continue...");
+                if(fgets(line,sizeof(line),stdin) && history && go_back(history,line)) {
+                    if(print) {
+                        print_registers(sim,out);
+                    }
+                    continue;
+                }
+            }
+            printf("%08x: ",rvsim_get_pc(sim));
+            if(rvsim_read_memory(sim,rvsim_get_pc(sim),&instruction_bits,4) == 0) {
+                decode_instruction(instruction_bits);
+            }
+        }
+        if(history) {
+            reverse_run(&history->reverse,1,&stopped);
+            status = sim->status;
+        } else {
+            status = prompt || print ? rvsim_step(sim) : rvsim_run(sim,UINT64_MAX,NULL);
+        }
+
+        // print trace
+        if(print && status == RVSIM_OK) {
+            if(writer) {
+                trace_writer_registers(writer,sim->processor.R);
+            } else {
+                print_registers(sim,out);
+            }
+            if(sink) {
+                index_dump(sim,sink,++traced,previous,&written);
+            }
+        }
+    } while(status == RVSIM_OK);
+    if(history) {
+        reverse_free(&history->reverse);
+        free(history);
+    }
+    if(sink && print && traced % TRACE_CHECKPOINT_INTERVAL != 0) {
+        trace_checkpoint(sink,traced,previous,written);
+    }
+
+    rvsim_report(sim,status,out);
+    if(!sim->config.interpreter && sim->engine.mmu.lookups > 0) {
+        fprintf(stderr,"TLB: %llu hits, %llu misses, %llu flushes\n",
+                (unsigned long long)(sim->engine.mmu.lookups - sim->engine.mmu.misses),
+                (unsigned long long)sim->engine.mmu.misses,(unsigned long long)sim->engine.mmu.flushes);
+    }
+    return rvsim_exit_code(sim);
 }
 
 int main(int argc,char** argv) {
     /* options */
-    int opt_disasm = 0,opt_regdump = 0,opt_interactive = 0;
+    int opt_disasm = 0,opt_regdump = 0,opt_interactive = 0,opt_engine = 0,opt_linux = 0;
+    int code;
+    unsigned i,plugin_count = 0;
+    uint64_t opt_cosim = 0;
+    size_t opt_history = (size_t)64 << 20;
+    const char *opt_gdb = NULL,*opt_block = NULL,*opt_stats = NULL,*opt_record = NULL,*opt_replay = NULL;
+    const char *opt_trace = NULL,*opt_serve = NULL,*opt_shared = NULL,*opt_coverage = NULL;
+    unsigned opt_workers = 0;
+    const char **opt_plugins = calloc(argc,sizeof(char *));
+    struct timespec start_time;
+    RvSimConfig config;
+    FILE *out = stdout;
+    TraceSink *sink = NULL;
+    TraceWriter *writer = NULL;
+    Byte *scratch;
     
-    /* the architectural state of the CPU */
-    Processor processor;
+    /* the simulated machine */
+    RvSim *sim;
     
     /* parse the command-line args */
+    static const struct option long_options[] = {
+        {"serve",required_argument,NULL,'S'},
+        {"workers",required_argument,NULL,'W'},
+        {NULL,0,NULL,0}
+    };
     int c;
-    while((c=getopt(argc,argv,"drit"))!=-1) {
+    while((c=getopt_long(argc,argv,"dritflc:g:b:s:p:e:E:z:m:M:C:",long_options,NULL))!=-1) {
         switch (c) {
+            case 'S':
+                /* stay resident and take jobs, see server.h */
+                opt_serve = optarg;
+                break;
+            case 'W':
+                opt_workers = strtoul(optarg,NULL,0);
+                break;
             case 'd':
                 opt_disasm = 1;
                 break;
@@ -90,51 +271,172 @@ int main(int argc,char** argv) {
             case 't':
                 opt_interactive = 2;
                 break;
+            case 'f':
+                opt_engine = 1;
+                break;
+            case 'l':
+                opt_linux = 1;
+                break;
+            case 'c':
+                opt_cosim = strtoull(optarg,NULL,0);
+                if(opt_cosim == 0) {
+                    fprintf(stderr,"Bad co-simulation interval %s\n",optarg);
+                    return -1;
+                }
+                break;
+            case 'g':
+                opt_gdb = optarg;
+                break;
+            case 'b':
+                opt_block = optarg;
+                break;
+            case 's':
+                opt_stats = optarg;
+                break;
+            case 'e':
+                opt_record = optarg;
+                break;
+            case 'E':
+                opt_replay = optarg;
+                break;
+            case 'z':
+                opt_trace = optarg;
+                break;
+            case 'm':
+                /* megabytes of snapshots for going backwards, 0 for none */
+                opt_history = (size_t)strtoul(optarg,NULL,0) << 20;
+                break;
+            case 'C':
+                /* merged into the file at exit, see covreport.c */
+                opt_coverage = optarg;
+                break;
+            case 'M':
+                /* guest memory other processes can map, see rvpeek.c */
+                opt_shared = optarg;
+                break;
+            case 'p':
+                /* plugins instrument the engine, so they imply -f */
+                opt_plugins[plugin_count++] = optarg;
+                opt_engine = 1;
+                break;
             default:
                 fprintf(stderr,"Bad option %c\n",c);
                 return -1;
         }
     }
     
+    if(opt_serve) {
+        return serve(opt_serve,opt_workers);
+    }
+
     /* make sure we got an executable filename on the command line */
     if(argc<=optind) {
         fprintf(stderr,"Give me an executable file to run!\n");
         return -1;
     }
     
-    
-    
-    /* load the executable into memory */
-    assert(memory == NULL);
-    memory = calloc(MEMORY_SPACE,sizeof(uint8_t)); // allocate zeroed memory
-    assert(memory != NULL);
-  
-    /* SEt the PC to 0x1000 */ 
-    processor.PC = 0x1000;
-    load_program(memory, MEMORY_SPACE, processor.PC, argv[optind], opt_disasm);
-    
-    /* if we're just disassembling,exit here */
+    /* if we're just disassembling,load into scratch memory and exit here */
     if(opt_disasm) {
+        scratch = alloc_memory();
+        assert(scratch != NULL);
+        if(load_program(scratch, MEMORY_SPACE, 0x1000, argv[optind], 1) < 0) {
+            fprintf(stderr,"Cannot read %s\n",argv[optind]);
+            return -1;
+        }
+        free_memory(scratch);
         return 0;
     }
-    
-    /* initialize the CPU */
-    /* zero out all registers */
-    int i;
-    for(i=0;i<32;i++) {
-        processor.R[i] = 0;
+    if(opt_linux && opt_cosim) {
+        fprintf(stderr,"Co-simulation does not support Linux system calls\n");
+        return -1;
+    }
+    if(opt_record && opt_replay) {
+        fprintf(stderr,"Cannot record and replay at the same time\n");
+        return -1;
+    }
+
+    /* compressed output, see tracesink.h */
+    if(opt_trace) {
+        sink = trace_open(opt_trace,0);
+        if(sink == NULL) {
+            fprintf(stderr,"Cannot write trace %s\n",opt_trace);
+            return -1;
+        }
+        out = trace_stream(sink);
+    }
+
+    /* a plain register trace is formatted here and written by a thread;
+       the guest's output has to take the same path to stay in order */
+    if(opt_regdump && !opt_trace && !opt_interactive && !opt_gdb && !opt_cosim) {
+        writer = trace_writer_open(out);
+        if(writer == NULL) {
+            fprintf(stderr,"Cannot set up the trace\n");
+            return -1;
+        }
+        out = trace_writer_stream(writer);
+    }
+
+    /* the debugger and co-simulation bring their own engines */
+    memset(&config,0,sizeof(config));
+    config.interpreter = !opt_engine || opt_interactive || opt_gdb || opt_cosim;
+    config.linux_abi = opt_linux;
+    config.console = out;
+    config.input = stdin;
+    config.block_device = opt_block;
+    config.record = opt_record;
+    config.replay = opt_replay;
+    config.shared_memory = opt_shared;
+    sim = rvsim_create(&config);
+    if(sim == NULL) {
+        if(opt_block) {
+            fprintf(stderr,"Cannot open block device %s\n",opt_block);
+        } else if(opt_record || opt_replay) {
+            fprintf(stderr,"Cannot open event log %s\n",opt_record ? opt_record : opt_replay);
+        } else {
+            fprintf(stderr,"Cannot create the simulator\n");
+        }
+        return -1;
+    }
+    if(opt_shared) {
+        fprintf(stderr,"Guest memory %s at /proc/%d/fd/%d\n",opt_shared,(int)getpid(),rvsim_memory_fd(sim));
+    }
+    if(opt_coverage && rvsim_enable_coverage(sim) != 0) {
+        fprintf(stderr,"Cannot record coverage\n");
+        return -1;
     }
-   
-    /* Set the global pointer to 0x3000. We arbitrarily call this the middle of the static data segment */
-    processor.R[3] = 0x3000;
 
-    /* Set the stack pointer near the top of the memory array */
-    processor.R[2] = 0xEFFFF;
+    /* load the executable into memory at 0x1000 */
+    if(rvsim_load(sim,argv[optind]) < 0) {
+        fprintf(stderr,"Cannot read %s\n",argv[optind]);
+        return -1;
+    }
+    for(i=0;i<plugin_count;i++) {
+        if(rvsim_load_plugin(sim,opt_plugins[i]) != 0) {
+            return -1;
+        }
+    }
+    free(opt_plugins);
  
-    /* simulate forever! */
-    for(;;) {
-        execute(&processor,opt_interactive,opt_regdump);
+    clock_gettime(CLOCK_MONOTONIC,&start_time);
+    if(opt_gdb) {
+        code = gdb_serve(&sim->processor,sim->memory,opt_gdb,opt_history);
+    } else if(opt_cosim) {
+        code = cosimulate(&sim->processor,sim->memory,opt_cosim);
+    } else {
+        code = run(sim,out,sink,writer,opt_interactive,opt_regdump,opt_history);
     }
-    
-    return 0;
+    if(writer && trace_writer_close(writer) != 0) {
+        fprintf(stderr,"Cannot write the trace\n");
+    }
+    if(sink && trace_close(sink) != 0) {
+        fprintf(stderr,"Cannot write trace %s\n",opt_trace);
+    }
+    if(opt_stats) {
+        write_stats(sim,opt_stats,&start_time);
+    }
+    if(opt_coverage && rvsim_save_coverage(sim,opt_coverage) != 0) {
+        fprintf(stderr,"Cannot write coverage %s\n",opt_coverage);
+    }
+    rvsim_destroy(sim);
+    return code;
 }
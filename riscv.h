@@ -1,14 +1,31 @@
 #ifndef MIPS_H
 #define MIPS_H
 
+#include <stddef.h>
 #include "types.h"
 
 /* see part1.c */
 void decode_instruction(uint32_t instruction_bits);
+void disassemble(const Word *words, unsigned count, Address address);
+
+/* What execute_instruction() returns, numbered like EngineStatus */
+typedef enum {
+    EXEC_OK,
+    EXEC_EXIT,
+    EXEC_INVALID_INSTRUCTION,
+    EXEC_BAD_READ,
+    EXEC_BAD_WRITE,
+} ExecStatus;
 
 /* see part2.c */
-void execute_instruction(uint32_t instruction_bits, Processor* processor, Byte *memory);
+int execute_instruction(uint32_t instruction_bits, Processor* processor, Byte *memory);
+int fetch_instruction(const Processor *processor, Byte *memory, uint32_t *instruction_bits);
 void store(Byte *memory, Address address, Alignment alignment, Word value);
 Word load(Byte *memory, Address address, Alignment alignment);
 
+/* see loader.c */
+int load_program(uint8_t *mem, size_t memsize, int startaddr, const char *filename, int disasm);
+int validate_program(const Word *words, unsigned count, Address address);
+void init_processor(Processor *processor);
+
 #endif
@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "types.h"
+#include "riscv.h"
+#include "memory.h"
+#include "engine.h"
+
+/* Translates a program in .input format to C ahead of time, one function
+ * per basic block, to be compiled against aot.h and librvsim.a:
+ *
+ *     ./riscv2c -o prog.c prog.input
+ *     gcc -O2 -I. -o prog prog.c librvsim.a -ldl -pthread
+ *
+ * The ISA has no indirect jumps, so following branches and jumps from
+ * 0x1000 finds every instruction that can run without the program
+ * rewriting itself. Each block keeps the registers it uses in locals,
+ * and a branch back to its own start becomes a loop in C. Whatever the
+ * blocks leave out is run by the interpreter, see aot.h. */
+
+#define LOAD_ADDRESS 0x1000
+
+static Word *image;
+static DecodedOp *ops;
+static unsigned words;
+static Byte *reachable, *leader;
+static Address code_start, code_end;
+static int loops, leaves;       /* the block being emitted uses top: or leave: */
+
+/* Operations a block runs itself; the rest end it. Floating point is
+ * left to the interpreter, like CSRs. */
+static int translatable(const DecodedOp *op) {
+    return op->kind < OP_FLW || (op->kind >= OP_BEQ && op->kind < OP_LOOP);
+}
+
+static int ends_block(const DecodedOp *op) {
+    return op->kind >= OP_BEQ;
+}
+
+/* A taken branch or jump. Going back to the top of the block leaves it
+ * instead once an event is due, so the timer still gets its interrupt in
+ * a loop that never ends on its own. */
+static void emit_jump(FILE *out, Address target, Address start, const char *indent) {
+    if (target == start) {
+        fprintf(out, "%sif (retired >= deadline) {\n%s    next = 0x%x;\n%s    goto leave;\n%s}\n%sgoto top;\n",
+                indent, indent, target, indent, indent, indent);
+        loops = 1;
+    } else {
+        fprintf(out, "%snext = 0x%x;\n%sgoto leave;\n", indent, target, indent);
+    }
+    leaves = 1;
+}
+
+static void mark(unsigned *work, unsigned *count, long index, int starts_block) {
+    if (index < 0 || (unsigned long) index >= words) {
+        return;
+    }
+    if (starts_block) {
+        leader[index] = 1;
+    }
+    if (!reachable[index]) {
+        reachable[index] = 1;
+        work[(*count)++] = index;
+    }
+}
+
+/* Finds every instruction reachable from the entry point and where the
+ * blocks start */
+static void discover(void) {
+    unsigned *work = malloc(words * sizeof(unsigned)), count = 0, i;
+    const DecodedOp *op;
+
+    mark(work, &count, 0, 1);
+    while (count > 0) {
+        i = work[--count];
+        op = &ops[i];
+        switch (op->kind) {
+            case OP_BEQ:
+            case OP_BNE:
+                if (op->imm % 4 == 0) {
+                    mark(work, &count, (long) i + op->imm / 4, 1);
+                }
+                mark(work, &count, (long) i + 1, 1);
+                break;
+            case OP_JAL:
+                if (op->imm % 4 == 0) {
+                    mark(work, &count, (long) i + op->imm / 4, 1);
+                }
+                break;
+            case OP_INVALID:
+                break;
+            default:
+                /* the interpreter continues after what blocks leave to it */
+                mark(work, &count, (long) i + 1, !translatable(op));
+                break;
+        }
+    }
+    free(work);
+
+    code_start = code_end = 0;
+    for (i = 0; i < words; i++) {
+        if (reachable[i]) {
+            if (code_end == 0) {
+                code_start = LOAD_ADDRESS + 4 * i;
+            }
+            code_end = LOAD_ADDRESS + 4 * i + 4;
+        }
+    }
+}
+
+static const char *reg(unsigned n) {
+    static char names[4][12];
+    static unsigned next;
+    char *name = names[next++ % 4];
+
+    if (n == 0) {
+        return "0";
+    }
+    snprintf(name, 12, "x%u", n);
+    return name;
+}
+
+/* The C for one operation at pc in the block starting at start. Every way
+ * out of the block first adds the instructions it retired; see aot.h. */
+static void emit_op(FILE *out, const DecodedOp *op, Address pc, Address start) {
+    static const char *binary[] = {
+        [OP_ADD] = "+", [OP_SUB] = "-", [OP_XOR] = "^", [OP_OR] = "|", [OP_AND] = "&",
+        [OP_ADDI] = "+", [OP_XORI] = "^", [OP_ORI] = "|", [OP_ANDI] = "&",
+    };
+    const char *d = reg(op->rd), *a = reg(op->rs1), *b = reg(op->rs2);
+    unsigned size, before = (pc - start) / 4;
+    Address target = pc + op->imm;
+
+    switch (op->kind) {
+        case OP_NOP:
+            break;
+        case OP_ADD: case OP_SUB: case OP_XOR: case OP_OR: case OP_AND:
+            fprintf(out, "    %s = %s %s %s;\n", d, a, binary[op->kind], b);
+            break;
+        case OP_ADDI: case OP_XORI: case OP_ORI: case OP_ANDI:
+            fprintf(out, "    %s = %s %s (Word) %d;\n", d, a, binary[op->kind], op->imm);
+            break;
+        case OP_MUL:
+            /* unsigned: the low half is the same and cannot overflow */
+            fprintf(out, "    %s = (Word) %s * (Word) %s;\n", d, a, b);
+            break;
+        case OP_MULH:
+            fprintf(out, "    %s = ((sDouble) (sWord) %s * (sWord) %s) >> 32;\n", d, a, b);
+            break;
+        case OP_SLL:
+            fprintf(out, "    %s = %s << (%s & 0x1F);\n", d, a, b);
+            break;
+        case OP_SRL:
+            fprintf(out, "    %s = (Word) %s >> (%s & 0x1F);\n", d, a, b);
+            break;
+        case OP_SRA:
+            fprintf(out, "    %s = (sWord) %s >> (%s & 0x1F);\n", d, a, b);
+            break;
+        case OP_SLT:
+            fprintf(out, "    %s = (sWord) %s < (sWord) %s;\n", d, a, b);
+            break;
+        case OP_DIV:
+            fprintf(out, "    %s = %s == 0 ? 0xFFFFFFFF : (%s == 0x80000000 && %s == 0xFFFFFFFF) ? 0x80000000\n"
+                         "        : (Word) ((sWord) %s / (sWord) %s);\n", d, b, a, b, a, b);
+            break;
+        case OP_REM:
+            fprintf(out, "    %s = %s == 0 ? %s : (%s == 0x80000000 && %s == 0xFFFFFFFF) ? 0\n"
+                         "        : (Word) ((sWord) %s %% (sWord) %s);\n", d, b, a, a, b, a, b);
+            break;
+        case OP_SLLI:
+            fprintf(out, "    %s = %s << %d;\n", d, a, op->imm);
+            break;
+        case OP_SRLI:
+            fprintf(out, "    %s = (Word) %s >> %d;\n", d, a, op->imm);
+            break;
+        case OP_SRAI:
+            fprintf(out, "    %s = (sWord) %s >> %d;\n", d, a, op->imm);
+            break;
+        case OP_SLTI:
+            fprintf(out, "    %s = (sWord) %s < %d;\n", d, a, op->imm);
+            break;
+        case OP_LUI:
+            fprintf(out, "    %s = 0x%08x;\n", d, (Word) op->imm);
+            break;
+        case OP_LB: case OP_LH: case OP_LW:
+            /* devices are the interpreter's */
+            size = 1 << (op->kind - OP_LB);
+            fprintf(out, "    address = %s + (Word) %d;\n", a, op->imm);
+            fprintf(out, "    if (address >= MEMORY_SPACE - %u) { retired += %u; next = 0x%x; goto leave; }\n",
+                    size - 1, before, pc);
+            leaves = 1;
+            if (op->rd != 0) {
+                fprintf(out, "    %s = %s;\n", d, size == 1 ? "(sByte) memory[address]"
+                        : size == 2 ? "*(sHalf *) (memory + address)" : "*(Word *) (memory + address)");
+            }
+            break;
+        case OP_SB: case OP_SH: case OP_SW:
+            /* and so are stores that rewrite translated code */
+            size = 1 << (op->kind - OP_SB);
+            fprintf(out, "    address = %s + (Word) %d;\n", a, op->imm);
+            fprintf(out, "    if (address >= MEMORY_SPACE - %u || address - 0x%x < 0x%x) {\n"
+                         "        retired += %u;\n        next = 0x%x;\n        goto leave;\n    }\n",
+                    size - 1, code_start - 3, code_end - code_start + 3, before, pc);
+            leaves = 1;
+            fprintf(out, "    %s = %s;\n", size == 1 ? "memory[address]" : size == 2 ? "*(Half *) (memory + address)"
+                    : "*(Word *) (memory + address)", b);
+            break;
+        case OP_BEQ: case OP_BNE:
+            fprintf(out, "    if (%s %s %s) {\n        retired += %u;\n", a, op->kind == OP_BEQ ? "==" : "!=", b,
+                    before + 1);
+            emit_jump(out, target, start, "        ");
+            fprintf(out, "    }\n    next = 0x%x;\n", pc + 4);
+            break;
+        case OP_JAL:
+            if (op->rd != 0) {
+                fprintf(out, "    %s = 0x%x;\n", d, pc + 4);
+            }
+            if (target == start) {
+                fprintf(out, "    retired += %u;\n", before + 1);
+                emit_jump(out, target, start, "    ");
+            } else {
+                fprintf(out, "    next = 0x%x;\n", target);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/* Writes the function for the block at index first */
+static void emit_block(FILE *out, unsigned first) {
+    Byte used[32], written[32];
+    Address start = LOAD_ADDRESS + 4 * first, end;
+    const DecodedOp *op;
+    unsigned i, last, n;
+    char *body = NULL;
+    size_t length = 0;
+    FILE *code;
+
+    /* up to a control transfer, an operation for the interpreter or the
+       next block */
+    memset(used, 0, sizeof(used));
+    memset(written, 0, sizeof(written));
+    for (last = first; last < words && reachable[last] && translatable(&ops[last]); last++) {
+        op = &ops[last];
+        used[op->rs1] = used[op->rs2] = 1;
+        if (op->kind != OP_NOP && op->kind < OP_SB) {
+            used[op->rd] = written[op->rd] = 1;
+        } else if (op->kind == OP_LUI || op->kind == OP_JAL) {
+            used[op->rd] = written[op->rd] = 1;
+        }
+        if (ends_block(op)) {
+            last++;
+            break;
+        }
+        if (last + 1 < words && leader[last + 1]) {
+            last++;
+            break;
+        }
+    }
+    end = LOAD_ADDRESS + 4 * last;
+
+    /* the labels are only written if something jumps to them */
+    code = open_memstream(&body, &length);
+    loops = leaves = 0;
+    for (i = first; i < last; i++) {
+        emit_op(code, &ops[i], LOAD_ADDRESS + 4 * i, start);
+    }
+    if (last == first || !ends_block(&ops[last - 1])) {
+        fprintf(code, "    next = 0x%x;\n", end);
+    }
+    fprintf(code, "    retired += %u;\n", last - first);
+    fclose(code);
+
+    fprintf(out, "static Address block_%05x(Processor *processor, Byte *memory, uint64_t *instret, uint64_t deadline) {\n",
+            start);
+    fprintf(out, "    Register *R = processor->R;\n");
+    for (n = 1; n < 32; n++) {
+        if (used[n]) {
+            fprintf(out, "    Register x%u = R[%u];\n", n, n);
+        }
+    }
+    fprintf(out, "    Address address, next;\n    uint64_t retired = *instret;\n\n");
+    fprintf(out, "    (void) R;\n    (void) address;\n    (void) deadline;\n");
+    fprintf(out, "%s%s%s", loops ? "top:\n" : "", body, leaves ? "leave:\n" : "");
+    free(body);
+    fprintf(out, "    *instret = retired;\n");
+    for (n = 1; n < 32; n++) {
+        if (written[n]) {
+            fprintf(out, "    R[%u] = x%u;\n", n, n);
+        }
+    }
+    fprintf(out, "    return next;\n}\n\n");
+}
+
+static void emit(FILE *out, const char *path) {
+    unsigned i;
+
+    fprintf(out, "/* Translated from %s by riscv2c, see aot.h */\n", path);
+    fprintf(out, "#include \"aot.h\"\n\n");
+    fprintf(out, "static const Word image[%u] = {", words ? words : 1);
+    for (i = 0; i < words; i++) {
+        fprintf(out, "%s0x%08x,", i % 6 ? " " : "\n    ", image[i]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    for (i = 0; i < words; i++) {
+        if (leader[i] && reachable[i] && translatable(&ops[i])) {
+            emit_block(out, i);
+        }
+    }
+
+    fprintf(out, "static const AotBlock blocks[%u] = {\n", words ? words : 1);
+    for (i = 0; i < words; i++) {
+        if (leader[i] && reachable[i] && translatable(&ops[i])) {
+            fprintf(out, "    [%u] = block_%05x,\n", i, LOAD_ADDRESS + 4 * i);
+        }
+    }
+    fprintf(out, "};\n\n");
+    fprintf(out, "static const AotProgram program = { image, %u, blocks, 0x%x, 0x%x };\n\n",
+            words, code_start, code_end);
+    fprintf(out, "int main(void) {\n    return aot_main(&program);\n}\n");
+}
+
+int main(int argc, char **argv) {
+    const char *output = NULL;
+    Byte *memory;
+    FILE *out = stdout;
+    unsigned i;
+    int c, count;
+
+    while ((c = getopt(argc, argv, "o:")) != -1) {
+        switch (c) {
+            case 'o':
+                output = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-o out.c] program.input\n", argv[0]);
+                return -1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-o out.c] program.input\n", argv[0]);
+        return -1;
+    }
+
+    memory = alloc_memory();
+    count = memory ? load_program(memory, MEMORY_SPACE, LOAD_ADDRESS, argv[optind], 0) : -1;
+    if (count < 0) {
+        fprintf(stderr, "Cannot read %s\n", argv[optind]);
+        return -1;
+    }
+    words = count;
+    image = (Word *) (memory + LOAD_ADDRESS);
+    ops = calloc(words + 1, sizeof(DecodedOp));
+    reachable = calloc(words + 1, 1);
+    leader = calloc(words + 1, 1);
+    for (i = 0; i < words; i++) {
+        ops[i] = decode_op(image[i]);
+    }
+    discover();
+
+    if (output && (out = fopen(output, "w")) == NULL) {
+        fprintf(stderr, "Cannot write %s\n", output);
+        return -1;
+    }
+    emit(out, argv[optind]);
+    if (out != stdout && fclose(out) != 0) {
+        fprintf(stderr, "Cannot write %s\n", output);
+        return -1;
+    }
+    free_memory(memory);
+    return 0;
+}
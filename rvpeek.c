@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "memory.h"
+
+/* Dumps guest memory of a running ./riscv -M NAME, which prints the path
+ * to pass here. The memory is mapped read-only and read in place, so the
+ * simulator neither stops nor slows down while it is being watched; a
+ * word it is writing at the same time may show half updated.
+ *
+ * With -w MS the range is compared every MS milliseconds and each line
+ * that changed is printed again, until the simulator exits. */
+
+#define WORDS_PER_LINE 4
+#define LINE_SIZE (WORDS_PER_LINE * 4)
+
+static void print_line(const Byte *line, Address address) {
+    int i;
+
+    printf("%08x:", address);
+    for (i = 0; i < WORDS_PER_LINE; i++) {
+        printf(" %08x", ((const Word *) line)[i]);
+    }
+    printf("\n");
+}
+
+static void watch(const char *path, const Byte *memory, Address start, Address end, unsigned milliseconds) {
+    struct timespec interval = {milliseconds / 1000, (milliseconds % 1000) * 1000000L};
+    Byte *seen = malloc(end - start);
+    Address address;
+    unsigned long round;
+    int changed;
+
+    memcpy(seen, memory + start, end - start);
+    /* the path goes away with the process that owns the memory */
+    for (round = 1; access(path, F_OK) == 0; round++) {
+        nanosleep(&interval, NULL);
+        changed = 0;
+        for (address = start; address < end; address += LINE_SIZE) {
+            if (memcmp(seen + (address - start), memory + address, LINE_SIZE) != 0) {
+                if (!changed) {
+                    printf("-- %lu ms\n", round * milliseconds);
+                    changed = 1;
+                }
+                memcpy(seen + (address - start), memory + address, LINE_SIZE);
+                print_line(seen + (address - start), address);
+            }
+        }
+        fflush(stdout);
+    }
+    free(seen);
+}
+
+int main(int argc, char **argv) {
+    unsigned milliseconds = 0;
+    Address start, end, address;
+    unsigned long length = 64;
+    struct stat info;
+    Byte *memory;
+    int fd, c;
+
+    while ((c = getopt(argc, argv, "w:")) != -1) {
+        switch (c) {
+            case 'w':
+                milliseconds = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "usage: rvpeek [-w milliseconds] path address [length]\n");
+                return 1;
+        }
+    }
+    if (argc - optind < 2 || argc - optind > 3) {
+        fprintf(stderr, "usage: rvpeek [-w milliseconds] path address [length]\n");
+        return 1;
+    }
+    start = strtoul(argv[optind + 1], NULL, 0);
+    if (argc - optind == 3) {
+        length = strtoul(argv[optind + 2], NULL, 0);
+    }
+    /* whole lines, inside RAM */
+    start &= ~(Address) (LINE_SIZE - 1);
+    if (start >= MEMORY_SPACE || length == 0 || length > MEMORY_SPACE - start) {
+        fprintf(stderr, "Addresses outside of guest memory\n");
+        return 1;
+    }
+    end = start + ((length + LINE_SIZE - 1) & ~(unsigned long) (LINE_SIZE - 1));
+    if (end > MEMORY_SPACE) {
+        end = MEMORY_SPACE;
+    }
+
+    fd = open(argv[optind], O_RDONLY);
+    if (fd < 0 || fstat(fd, &info) != 0 || info.st_size < MEMORY_SPACE) {
+        fprintf(stderr, "%s is not guest memory\n", argv[optind]);
+        return 1;
+    }
+    memory = mmap(NULL, MEMORY_SPACE, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        fprintf(stderr, "Cannot map %s\n", argv[optind]);
+        return 1;
+    }
+
+    for (address = start; address < end; address += LINE_SIZE) {
+        print_line(memory + address, address);
+    }
+    if (milliseconds > 0) {
+        fflush(stdout);
+        watch(argv[optind], memory, start, end, milliseconds);
+    }
+    munmap(memory, MEMORY_SPACE);
+    return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef RVPLUGIN_H
+#define RVPLUGIN_H
+
+#include <stdint.h>
+
+/* Instrumentation plugins for the predecoded engine.
+ *
+ * A plugin is a shared object loaded with -p plugin.so[,arg,...]. It
+ * exports rv_plugin_install(), which registers a block translation
+ * callback. That callback is called once for every block the engine
+ * translates and attaches execution or memory callbacks to exactly the
+ * blocks and instructions the plugin is interested in. Nothing else pays
+ * for instrumentation, and without plugins nothing is checked at all.
+ *
+ * Code is translated again after the guest overwrites it, so translation
+ * callbacks can see the same address more than once. */
+
+#define RV_PLUGIN_VERSION 1
+
+typedef struct RvPlugin RvPlugin;   /* one loaded plugin */
+typedef struct RvBlock RvBlock;     /* a block being translated */
+typedef struct RvInsn RvInsn;       /* an instruction in such a block */
+
+typedef void (*RvTranslateFn)(RvPlugin *plugin, RvBlock *block);
+/* pc is the (virtual) address of the instruction about to execute */
+typedef void (*RvExecFn)(uint32_t pc, void *userdata);
+/* called before the access with its virtual address; value is only
+   meaningful for stores */
+typedef void (*RvMemFn)(uint32_t pc, uint32_t address, unsigned size, int is_store,
+                        uint32_t value, void *userdata);
+typedef void (*RvExitFn)(RvPlugin *plugin, void *userdata);
+
+/* Exported by the plugin. args are the comma separated words after the
+ * file name. Returns 0 on success. */
+int rv_plugin_install(RvPlugin *plugin, int version, int argc, char **argv);
+
+/* Provided by the simulator */
+void rv_register_translate(RvPlugin *plugin, RvTranslateFn callback);
+void rv_register_exit(RvPlugin *plugin, RvExitFn callback, void *userdata);
+
+uint32_t rv_block_vaddr(const RvBlock *block);
+unsigned rv_block_count(const RvBlock *block);
+RvInsn *rv_block_insn(RvBlock *block, unsigned index);
+void rv_block_register_exec(RvBlock *block, RvExecFn callback, void *userdata);
+
+uint32_t rv_insn_vaddr(const RvInsn *insn);
+uint32_t rv_insn_bits(const RvInsn *insn);
+void rv_insn_register_exec(RvInsn *insn, RvExecFn callback, void *userdata);
+/* ignored for instructions that do not access memory */
+void rv_insn_register_mem(RvInsn *insn, RvMemFn callback, void *userdata);
+
+#endif
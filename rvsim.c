@@ -0,0 +1,422 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "rvsim.h"
+#include "machine.h"
+#include "riscv.h"
+#include "trap.h"
+
+/* Program entry point, like the simulator has always used */
+#define LOAD_ADDRESS 0x1000
+
+static const char *status_names[] = {
+    "ok", "exited", "invalid instruction", "bad read", "bad write", "page fault", "error"
+};
+
+RvSim *rvsim_create(const RvSimConfig *config) {
+    RvSim *sim = calloc(1, sizeof(RvSim));
+    MemoryContext *context;
+
+    if (sim == NULL) {
+        return NULL;
+    }
+    if (config) {
+        sim->config = *config;
+    }
+    sim->memory_fd = -1;
+    sim->memory = sim->config.shared_memory
+        ? alloc_shared_memory(sim->config.shared_memory, &sim->memory_fd) : alloc_memory();
+    if (sim->memory == NULL) {
+        free(sim);
+        return NULL;
+    }
+    context = MEMORY_CONTEXT(sim->memory);
+    context->console = sim->config.console;
+
+    device_map_init(&sim->devices, sim->memory);
+    device_map_add(&sim->devices, create_uart(sim->config.input, sim->config.console));
+    event_queue_init(&sim->events);
+    device_map_add(&sim->devices, create_timer(&sim->events, &sim->processor.mip));
+    if (sim->config.block_device
+        && device_map_add(&sim->devices, create_block_device(sim->config.block_device)) != 0) {
+        rvsim_destroy(sim);
+        return NULL;
+    }
+    context->devices = &sim->devices;
+    if (sim->config.linux_abi) {
+        syscalls_init(&sim->syscalls, sim->memory, LOAD_ADDRESS);
+        sim->syscalls.console = sim->config.console;
+        context->syscalls = &sim->syscalls;
+    }
+    if (sim->config.record || sim->config.replay) {
+        if (event_log_open(&sim->log, sim->config.record ? sim->config.record : sim->config.replay,
+                           sim->config.record ? LOG_RECORD : LOG_REPLAY) != 0) {
+            rvsim_destroy(sim);
+            return NULL;
+        }
+        sim->devices.log = &sim->log;
+        sim->syscalls.log = &sim->log;
+    }
+
+    if (!sim->config.interpreter
+        && engine_init(&sim->engine, &sim->processor, sim->memory, sim->config.console) != 0) {
+        rvsim_destroy(sim);
+        return NULL;
+    }
+    sim->engine.events = &sim->events;
+    init_processor(&sim->processor);
+    sim->processor.PC = LOAD_ADDRESS;
+    return sim;
+}
+
+void rvsim_destroy(RvSim *sim) {
+    unsigned i;
+
+    if (sim == NULL) {
+        return;
+    }
+    if (sim->plugins.count > 0) {
+        plugins_exit(&sim->plugins);
+    }
+    plugins_free(&sim->plugins);
+    syscalls_close(&sim->syscalls);
+    engine_free(&sim->engine);
+    for (i = 0; i < sim->devices.count; i++) {
+        device_destroy(sim->devices.devices[i]);
+    }
+    event_log_close(&sim->log);
+    free_memory(sim->memory);
+    if (sim->memory_fd >= 0) {
+        close(sim->memory_fd);
+    }
+    free(sim->pristine);
+    free(sim->coverage);
+    free(sim);
+}
+
+/* Starts over from LOAD_ADDRESS with the registers and counters of a
+ * fresh machine */
+static void restart(RvSim *sim) {
+    Syscalls hooks = sim->syscalls;
+    MemoryContext *context = MEMORY_CONTEXT(sim->memory);
+
+    init_processor(&sim->processor);
+    sim->processor.PC = LOAD_ADDRESS;
+    if (sim->config.linux_abi) {
+        /* the heap moves past the new program, the hooks stay */
+        syscalls_close(&sim->syscalls);
+        syscalls_init(&sim->syscalls, sim->memory, LOAD_ADDRESS + 4 * sim->words);
+        sim->syscalls.translate = hooks.translate;
+        sim->syscalls.written = hooks.written;
+        sim->syscalls.opaque = hooks.opaque;
+        sim->syscalls.log = hooks.log;
+        sim->syscalls.console = hooks.console;
+    }
+    if (!sim->config.interpreter) {
+        engine_reset(&sim->engine);
+    }
+    context->exit_code = 0;
+    context->faulted = 0;
+    context->fault = 0;
+    memset(&sim->stats, 0, sizeof(sim->stats));
+    sim->instret = 0;
+    sim->engine.instret = 0;
+    event_queue_reset(&sim->events);
+    device_map_reset(&sim->devices);
+    memset(&sim->engine.stats, 0, sizeof(sim->engine.stats));
+    sim->status = RVSIM_OK;
+}
+
+/* After new code went into memory: everything decoded before is stale, and
+ * memory as it is now is what rvsim_reset() goes back to */
+static int reset(RvSim *sim, unsigned words) {
+    if (sim->pristine == NULL && (sim->pristine = malloc(MEMORY_SPACE)) == NULL) {
+        return -1;
+    }
+    memcpy(sim->pristine, sim->memory, MEMORY_SPACE);
+    clear_dirty(sim->memory);
+    sim->words = words;
+    if (!sim->config.interpreter) {
+        engine_flush(&sim->engine);
+    }
+    restart(sim);
+    return 0;
+}
+
+int rvsim_load(RvSim *sim, const char *path) {
+    int words = load_program(sim->memory, MEMORY_SPACE, LOAD_ADDRESS, path, 0);
+
+    if (words < 0 || reset(sim, words) != 0) {
+        return -1;
+    }
+    return words;
+}
+
+int rvsim_load_words(RvSim *sim, const uint32_t *words, unsigned count) {
+    if (count > (MEMORY_SPACE - LOAD_ADDRESS) / 4
+        || rvsim_write_memory(sim, LOAD_ADDRESS, words, 4 * count) != 0
+        || reset(sim, count) != 0) {
+        return -1;
+    }
+    return count;
+}
+
+/* Only the pages written since the load are copied back, and only the code
+ * decoded from them is dropped */
+int rvsim_reset(RvSim *sim) {
+    if (sim->pristine == NULL) {
+        return -1;
+    }
+    if (sim->config.interpreter) {
+        restore_dirty(sim->memory, sim->pristine);
+    } else {
+        engine_restore_memory(&sim->engine, sim->pristine);
+    }
+    restart(sim);
+    return 0;
+}
+
+/* One instruction on the reference interpreter, counted the way the engine
+ * counts them: instructions that fault did not retire */
+static RvSimStatus interpret(RvSim *sim) {
+    Processor *processor = &sim->processor;
+    Address pc = processor->PC;
+    uint32_t instruction_bits;
+    int status;
+
+    status = fetch_instruction(processor, sim->memory, &instruction_bits);
+    if (status == EXEC_OK) {
+        status = execute_instruction(instruction_bits, processor, sim->memory);
+        processor->R[0] = 0;
+    }
+    if (status == EXEC_OK || status == EXEC_EXIT) {
+        count_instruction(&sim->stats, instruction_bits);
+        if ((instruction_bits & 0x7F) == 0x63 && processor->PC != pc + 4) {
+            sim->stats.branches_taken++;
+        }
+        if (sim->coverage) {
+            COVERAGE_MARK(sim->coverage->executed, pc);
+            if ((instruction_bits & 0x7F) == 0x63) {
+                COVERAGE_MARK(processor->PC != pc + 4 ? sim->coverage->taken : sim->coverage->not_taken, pc);
+            }
+        }
+        sim->instret++;
+    }
+    if ((instruction_bits & 0x7F) == 0x73
+        && (instruction_bits == MRET_BITS || (((instruction_bits >> 12) & 0x7) && IS_TRAP_CSR(instruction_bits >> 20)))) {
+        /* may have enabled a pending interrupt, like in the engine */
+        sim->events.changed = 1;
+    }
+    /* ExecStatus is numbered like RvSimStatus */
+    return status;
+}
+
+/* Brings the event queue up to the instructions retired, fires what is due
+ * and takes a pending interrupt before the next instruction */
+static void run_events(RvSim *sim) {
+    Word cause;
+
+    sim->events.now = rvsim_instructions(sim);
+    sim->events.changed = 0;
+    event_fire_due(&sim->events);
+    cause = trap_pending(&sim->processor);
+    if (cause) {
+        trap_enter(&sim->processor, cause);
+    }
+}
+
+/* Runs in slices that end where the next event is due, so neither the
+ * interpreter nor the engine has to look for events themselves; they only
+ * stop early when an instruction changed the schedule */
+RvSimStatus rvsim_run(RvSim *sim, uint64_t budget, uint64_t *executed) {
+    uint64_t start = rvsim_instructions(sim), slice, before;
+    RvSimStatus status = sim->status;
+
+    if (status == RVSIM_OK && !sim->config.interpreter && sim->plugins.count > 0) {
+        sim->engine.plugins = &sim->plugins;
+    }
+    while (status == RVSIM_OK && budget > 0) {
+        slice = event_budget(&sim->events, budget);
+        before = rvsim_instructions(sim);
+        if (sim->config.interpreter) {
+            for (; slice > 0 && status == RVSIM_OK && !sim->events.changed; slice--) {
+                sim->events.now = sim->instret;
+                status = interpret(sim);
+            }
+        } else {
+            switch (engine_run(&sim->engine, slice)) {
+                case ENGINE_BUDGET: status = RVSIM_OK; break;
+                case ENGINE_EVENT: status = RVSIM_OK; break;
+                case ENGINE_EXIT: status = RVSIM_EXITED; break;
+                case ENGINE_INVALID_INSTRUCTION: status = RVSIM_INVALID_INSTRUCTION; break;
+                case ENGINE_BAD_READ: status = RVSIM_BAD_READ; break;
+                case ENGINE_BAD_WRITE: status = RVSIM_BAD_WRITE; break;
+                case ENGINE_PAGE_FAULT: status = RVSIM_PAGE_FAULT; break;
+                default: status = RVSIM_ERROR; break;
+            }
+        }
+        budget -= rvsim_instructions(sim) - before;
+        if (status == RVSIM_OK) {
+            run_events(sim);
+        }
+    }
+    sim->status = status;
+    if (executed) {
+        *executed = rvsim_instructions(sim) - start;
+    }
+    return status;
+}
+
+RvSimStatus rvsim_step(RvSim *sim) {
+    return rvsim_run(sim, 1, NULL);
+}
+
+uint32_t rvsim_get_register(const RvSim *sim, unsigned index) {
+    return index < 32 ? sim->processor.R[index] : 0;
+}
+
+void rvsim_set_register(RvSim *sim, unsigned index, uint32_t value) {
+    if (index > 0 && index < 32) {
+        sim->processor.R[index] = value;
+    }
+}
+
+uint32_t rvsim_get_pc(const RvSim *sim) {
+    return sim->processor.PC;
+}
+
+void rvsim_set_pc(RvSim *sim, uint32_t pc) {
+    sim->processor.PC = pc;
+}
+
+int rvsim_read_memory(RvSim *sim, uint32_t address, void *buffer, uint32_t length) {
+    if (address > MEMORY_SPACE || length > MEMORY_SPACE - address) {
+        return -1;
+    }
+    memcpy(buffer, sim->memory + address, length);
+    return 0;
+}
+
+/* Writes count as guest stores: the pages are marked dirty and any code
+ * decoded from them is dropped */
+int rvsim_write_memory(RvSim *sim, uint32_t address, const void *buffer, uint32_t length) {
+    Address page;
+
+    if (address > MEMORY_SPACE || length > MEMORY_SPACE - address) {
+        return -1;
+    }
+    memcpy(sim->memory + address, buffer, length);
+    for (page = address >> PAGE_SHIFT; length > 0 && page <= (address + length - 1) >> PAGE_SHIFT; page++) {
+        MARK_DIRTY(sim->memory, page << PAGE_SHIFT);
+    }
+    if (!sim->config.interpreter) {
+        engine_dma_written(&sim->engine, address, length);
+    }
+    return 0;
+}
+
+uint64_t rvsim_instructions(const RvSim *sim) {
+    return sim->config.interpreter ? sim->instret : sim->engine.instret;
+}
+
+typedef struct {
+    uint64_t instret;
+    RvSimStatus status;
+    EventQueue events;
+} MachineState;
+
+size_t rvsim_state_size(const RvSim *sim) {
+    return sizeof(MachineState) + device_map_state_size(&sim->devices);
+}
+
+void rvsim_save_state(const RvSim *sim, void *state) {
+    MachineState *machine = state;
+
+    machine->instret = rvsim_instructions(sim);
+    machine->status = sim->status;
+    machine->events = sim->events;
+    device_map_save(&sim->devices, machine + 1);
+}
+
+void rvsim_restore_state(RvSim *sim, const void *state) {
+    const MachineState *machine = state;
+
+    if (sim->config.interpreter) {
+        sim->instret = machine->instret;
+    } else {
+        sim->engine.instret = machine->instret;
+    }
+    sim->status = machine->status;
+    sim->events = machine->events;
+    device_map_restore(&sim->devices, machine + 1);
+}
+
+int rvsim_exit_code(const RvSim *sim) {
+    if (sim->status != RVSIM_EXITED) {
+        return -1;
+    }
+    return sim->config.interpreter ? MEMORY_CONTEXT(sim->memory)->exit_code : sim->engine.exit_code;
+}
+
+uint32_t rvsim_fault(const RvSim *sim) {
+    return sim->config.interpreter ? MEMORY_CONTEXT(sim->memory)->fault : sim->engine.fault;
+}
+
+int rvsim_enable_coverage(RvSim *sim) {
+    if (sim->coverage == NULL && (sim->coverage = calloc(1, sizeof(Coverage))) == NULL) {
+        return -1;
+    }
+    sim->engine.coverage = sim->coverage;
+    return 0;
+}
+
+int rvsim_save_coverage(const RvSim *sim, const char *path) {
+    return sim->coverage ? coverage_save(sim->coverage, path) : -1;
+}
+
+int rvsim_memory_fd(const RvSim *sim) {
+    return sim->memory_fd;
+}
+
+const char *rvsim_status_name(RvSimStatus status) {
+    return status <= RVSIM_ERROR ? status_names[status] : "unknown";
+}
+
+/* the messages of the handle_invalid_* functions in utils.c */
+void rvsim_report(const RvSim *sim, RvSimStatus status, FILE *out) {
+    switch (status) {
+        case RVSIM_INVALID_INSTRUCTION:
+            fprintf(out, "Invalid Instruction: 0x%08x\n", rvsim_fault(sim));
+            break;
+        case RVSIM_BAD_READ:
+            fprintf(out, "Bad Read. Address: 0x%08x\n", rvsim_fault(sim));
+            break;
+        case RVSIM_BAD_WRITE:
+            fprintf(out, "Bad Write. Address: 0x%08x\n", rvsim_fault(sim));
+            break;
+        case RVSIM_PAGE_FAULT:
+            fprintf(out, "Page Fault. Address: 0x%08x\n", rvsim_fault(sim));
+            break;
+        default:
+            break;
+    }
+}
+
+int rvsim_load_plugin(RvSim *sim, const char *spec) {
+    if (sim->config.interpreter) {
+        return -1;
+    }
+    if (sim->plugins.hooks == NULL && plugins_init(&sim->plugins) != 0) {
+        return -1;
+    }
+    return plugin_load(&sim->plugins, spec);
+}
+
+void rvsim_write_stats(const RvSim *sim, FILE *out, double seconds) {
+    if (sim->config.interpreter) {
+        write_stats_json(out, &sim->stats, "interpreter", seconds);
+    } else {
+        write_stats_json(out, &sim->engine.stats, "engine", seconds);
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef RVSIM_H
+#define RVSIM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* librvsim: the simulator as a library. Every machine is self-contained
+ * (registers, memory, devices, system calls), nothing calls exit(), and
+ * any number of machines can live in one process. A machine is only ever
+ * used by one thread at a time. */
+
+typedef struct RvSim RvSim;
+
+typedef enum {
+    RVSIM_OK,                   /* ran the requested number of instructions */
+    RVSIM_EXITED,               /* guest exited, see rvsim_exit_code() */
+    RVSIM_INVALID_INSTRUCTION,  /* see rvsim_fault() for the bits */
+    RVSIM_BAD_READ,             /* see rvsim_fault() for the address */
+    RVSIM_BAD_WRITE,
+    RVSIM_PAGE_FAULT,
+    RVSIM_ERROR,                /* bad argument, or the machine already stopped */
+} RvSimStatus;
+
+typedef struct {
+    int interpreter;            /* reference interpreter instead of the predecoded engine */
+    int linux_abi;              /* Linux system calls instead of the print/exit ecalls */
+    FILE *console;              /* ecall and UART output, NULL to discard */
+    FILE *input;                /* UART input, NULL for none */
+    const char *block_device;   /* image file for the block device, or NULL */
+    const char *record;         /* log every input from the host here, or NULL */
+    const char *replay;         /* take the inputs from a recorded log, or NULL */
+    const char *shared_memory;  /* back memory with a memfd of this name, or NULL */
+} RvSimConfig;
+
+/* config may be NULL for the engine, legacy ecalls and no console */
+RvSim *rvsim_create(const RvSimConfig *config);
+void rvsim_destroy(RvSim *sim);
+
+/* Loads a program in .input format (one hex word per line) at 0x1000 and
+ * resets the registers and counters. Returns the number of words loaded,
+ * or -1. */
+int rvsim_load(RvSim *sim, const char *path);
+int rvsim_load_words(RvSim *sim, const uint32_t *words, unsigned count);
+/* Puts memory back the way the last load left it and resets the registers
+ * and counters, for running the same program again. Costs time in proportion to the
+ * pages written since, which are found in the dirty map: debugging modes
+ * that clear it (reverse execution, co-simulation) cannot be mixed with
+ * this. Returns -1 if nothing was loaded. */
+int rvsim_reset(RvSim *sim);
+
+/* Runs at most budget instructions, taking timer interrupts where they fall
+ * due; executed (if not NULL) gets the number actually retired */
+RvSimStatus rvsim_run(RvSim *sim, uint64_t budget, uint64_t *executed);
+RvSimStatus rvsim_step(RvSim *sim);
+
+uint32_t rvsim_get_register(const RvSim *sim, unsigned index);
+void rvsim_set_register(RvSim *sim, unsigned index, uint32_t value);
+uint32_t rvsim_get_pc(const RvSim *sim);
+void rvsim_set_pc(RvSim *sim, uint32_t pc);
+int rvsim_read_memory(RvSim *sim, uint32_t address, void *buffer, uint32_t length);
+int rvsim_write_memory(RvSim *sim, uint32_t address, const void *buffer, uint32_t length);
+
+uint64_t rvsim_instructions(const RvSim *sim);
+/* The rest of the machine that registers and memory do not cover: the
+ * instruction count, the event queue and the device registers, as
+ * rvsim_state_size() bytes. For snapshots, see reverse.h. */
+size_t rvsim_state_size(const RvSim *sim);
+void rvsim_save_state(const RvSim *sim, void *state);
+void rvsim_restore_state(RvSim *sim, const void *state);
+int rvsim_exit_code(const RvSim *sim);
+uint32_t rvsim_fault(const RvSim *sim);
+const char *rvsim_status_name(RvSimStatus status);
+/* Prints the message the simulator has always printed for a guest that
+ * stopped on a fault, nothing for the other statuses */
+void rvsim_report(const RvSim *sim, RvSimStatus status, FILE *out);
+
+/* The memfd behind guest memory with config.shared_memory, or -1. Other
+ * processes may map it read-only: guest address A is at offset A, and the
+ * layout past the end of RAM is described in memory.h. */
+int rvsim_memory_fd(const RvSim *sim);
+
+/* Records from now on which instructions ran and which way branches went,
+ * across rvsim_reset() too. Returns -1 if out of memory. */
+int rvsim_enable_coverage(RvSim *sim);
+/* Merges the coverage recorded so far into the file at path, see
+ * coverage.h. Returns -1 if coverage is off or the file cannot be
+ * written. */
+int rvsim_save_coverage(const RvSim *sim, const char *path);
+
+/* Loads an instrumentation plugin ("file.so,arg,..."), see rvplugin.h.
+ * Only the engine can be instrumented. */
+int rvsim_load_plugin(RvSim *sim, const char *spec);
+/* Writes the run summary as JSON */
+void rvsim_write_stats(const RvSim *sim, FILE *out, double seconds);
+
+#endif
@@ -0,0 +1,307 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "rvsim.h"
+#include "server.h"
+#include "tracewriter.h"
+
+#define MAX_WORKERS 64
+/* connections accepted but not picked up by a worker yet */
+#define QUEUE_SIZE 256
+
+typedef struct {
+    int engine, trace, stats;
+    uint64_t budget;
+    const char *path;
+} Job;
+
+/* A machine and the program it holds */
+typedef struct {
+    RvSim *sim;
+    char path[PATH_MAX];        /* empty if nothing usable is loaded */
+    struct stat loaded;         /* the file when it was loaded */
+    unsigned words;
+} Warm;
+
+typedef struct Server Server;
+
+typedef struct {
+    Server *server;
+    pthread_t thread;
+    int fd;                     /* the connection being served */
+    FILE *console;              /* framed output to fd, shared by all machines */
+    Warm warm[2];               /* interpreter, engine */
+} Worker;
+
+struct Server {
+    pthread_mutex_t lock;
+    pthread_cond_t arrived;
+    int queue[QUEUE_SIZE];
+    unsigned head, tail;
+    Worker workers[MAX_WORKERS];
+};
+
+/* send() rather than write(): a client that went away must not take the
+ * server down with SIGPIPE */
+static int send_all(int fd, const void *data, size_t length) {
+    const char *p = data;
+    ssize_t sent;
+
+    while (length > 0) {
+        sent = send(fd, p, length, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return -1;
+        }
+        p += sent;
+        length -= sent;
+    }
+    return 0;
+}
+
+static int send_frame(int fd, const char *kind, const void *data, size_t length) {
+    char header[32];
+
+    snprintf(header, sizeof(header), "%s %zu\n", kind, length);
+    return send_all(fd, header, strlen(header)) || send_all(fd, data, length) ? -1 : 0;
+}
+
+static ssize_t console_write(void *cookie, const char *data, size_t length) {
+    Worker *worker = cookie;
+
+    /* a client that left still gets its job run to the end, quietly */
+    send_frame(worker->fd, "out", data, length);
+    return length;
+}
+
+/* Splits line into a job; returns an error message or NULL */
+static const char *parse_job(char *line, Job *job) {
+    char *word, *end, *save = NULL;
+
+    memset(job, 0, sizeof(Job));
+    job->budget = UINT64_MAX;
+    for (word = strtok_r(line, " \t\r\n", &save); word; word = strtok_r(NULL, " \t\r\n", &save)) {
+        if (strcmp(word, "-f") == 0) {
+            job->engine = 1;
+        } else if (strcmp(word, "-r") == 0) {
+            job->trace = 1;
+        } else if (strcmp(word, "-s") == 0) {
+            job->stats = 1;
+        } else if (strcmp(word, "-n") == 0) {
+            word = strtok_r(NULL, " \t\r\n", &save);
+            if (word == NULL || (job->budget = strtoull(word, &end, 0), *end != '\0')) {
+                return "bad budget";
+            }
+        } else if (word[0] == '-') {
+            return "unknown option";
+        } else if (job->path) {
+            return "more than one program";
+        } else {
+            job->path = word;
+        }
+    }
+    return job->path ? NULL : "no program";
+}
+
+/* Gets a machine of the right kind with the program loaded and reset.
+ * Returns NULL if the program cannot be read. */
+static RvSim *prepare(Worker *worker, const Job *job) {
+    Warm *warm = &worker->warm[job->engine];
+    RvSimConfig config;
+    struct stat file;
+    uint32_t *zeros;
+    int words;
+
+    if (stat(job->path, &file) != 0) {
+        return NULL;
+    }
+    if (warm->sim == NULL) {
+        memset(&config, 0, sizeof(config));
+        config.interpreter = !job->engine;
+        config.console = worker->console;
+        warm->sim = rvsim_create(&config);
+        if (warm->sim == NULL) {
+            return NULL;
+        }
+    }
+    if (warm->path[0] && strcmp(warm->path, job->path) == 0 && warm->loaded.st_ino == file.st_ino
+        && warm->loaded.st_mtime == file.st_mtime && warm->loaded.st_size == file.st_size) {
+        rvsim_reset(warm->sim);
+        return warm->sim;
+    }
+
+    /* back to empty memory: only the previous program and what it wrote
+       are left to clear */
+    rvsim_reset(warm->sim);
+    if (warm->words > 0) {
+        zeros = calloc(warm->words, 4);
+        if (zeros == NULL) {
+            return NULL;
+        }
+        rvsim_write_memory(warm->sim, 0x1000, zeros, 4 * warm->words);
+        free(zeros);
+    }
+    warm->path[0] = '\0';
+    warm->words = 0;
+    words = rvsim_load(warm->sim, job->path);
+    if (words < 0) {
+        return NULL;
+    }
+    snprintf(warm->path, sizeof(warm->path), "%s", job->path);
+    warm->loaded = file;
+    warm->words = words;
+    return warm->sim;
+}
+
+/* Runs one job the way the command line would and answers it */
+static void run_job(Worker *worker, char *line) {
+    char reply[128], *summary = NULL;
+    size_t summary_length = 0;
+    struct timespec start, end;
+    RvSimStatus status = RVSIM_OK;
+    FILE *out = worker->console;
+    char dump[REGISTER_DUMP_SIZE];
+    Register R[32];
+    unsigned i;
+    const char *error;
+    uint64_t left;
+    RvSim *sim;
+    Job job;
+
+    error = parse_job(line, &job);
+    if (error == NULL && (sim = prepare(worker, &job)) == NULL) {
+        error = "cannot read the program";
+    }
+    if (error) {
+        snprintf(reply, sizeof(reply), "error %s\n", error);
+        send_all(worker->fd, reply, strlen(reply));
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (job.trace) {
+        for (left = job.budget; left > 0 && status == RVSIM_OK; left--) {
+            status = rvsim_step(sim);
+            if (status == RVSIM_OK) {
+                for (i = 0; i < 32; i++) {
+                    R[i] = rvsim_get_register(sim, i);
+                }
+                format_registers(dump, R);
+                fwrite(dump, 1, sizeof(dump), out);
+            }
+        }
+    } else {
+        status = rvsim_run(sim, job.budget, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    rvsim_report(sim, status, out);
+    fflush(out);
+
+    if (job.stats) {
+        FILE *json = open_memstream(&summary, &summary_length);
+        if (json) {
+            rvsim_write_stats(sim, json, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+            fclose(json);
+            send_frame(worker->fd, "stats", summary, summary_length);
+            free(summary);
+        }
+    }
+    snprintf(reply, sizeof(reply), "done %d %llu %s\n", rvsim_exit_code(sim),
+             (unsigned long long) rvsim_instructions(sim), rvsim_status_name(status));
+    send_all(worker->fd, reply, strlen(reply));
+}
+
+static void *work(void *opaque) {
+    Worker *worker = opaque;
+    Server *server = worker->server;
+    char *line = NULL;
+    size_t capacity = 0;
+    FILE *in;
+
+    for (;;) {
+        pthread_mutex_lock(&server->lock);
+        while (server->head == server->tail) {
+            pthread_cond_wait(&server->arrived, &server->lock);
+        }
+        worker->fd = server->queue[server->tail++ % QUEUE_SIZE];
+        pthread_mutex_unlock(&server->lock);
+
+        in = fdopen(worker->fd, "r");
+        if (in == NULL) {
+            close(worker->fd);
+            continue;
+        }
+        while (getline(&line, &capacity, in) > 0) {
+            run_job(worker, line);
+        }
+        fclose(in);
+    }
+    return NULL;
+}
+
+int serve(const char *path, unsigned workers) {
+    cookie_io_functions_t functions = { NULL, console_write, NULL, NULL };
+    struct sockaddr_un addr;
+    Server *server;
+    Worker *worker;
+    int listener, fd;
+    unsigned i;
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    if (listener < 0 || bind(listener, (struct sockaddr *) &addr, sizeof(addr)) != 0
+        || listen(listener, QUEUE_SIZE) != 0) {
+        fprintf(stderr, "Cannot listen on %s\n", path);
+        return -1;
+    }
+
+    server = calloc(1, sizeof(Server));
+    if (server == NULL) {
+        return -1;
+    }
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->arrived, NULL);
+    if (workers == 0) {
+        workers = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    workers = workers < MAX_WORKERS ? workers : MAX_WORKERS;
+    for (i = 0; i < workers; i++) {
+        worker = &server->workers[i];
+        worker->server = server;
+        worker->console = fopencookie(worker, "w", functions);
+        if (worker->console == NULL) {
+            return -1;
+        }
+        setvbuf(worker->console, NULL, _IOFBF, 65536);
+        pthread_create(&worker->thread, NULL, work, worker);
+    }
+    fprintf(stderr, "Serving on %s with %u workers\n", path, workers);
+
+    for (;;) {
+        fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        pthread_mutex_lock(&server->lock);
+        if (server->head - server->tail == QUEUE_SIZE) {
+            pthread_mutex_unlock(&server->lock);
+            close(fd);
+            continue;
+        }
+        server->queue[server->head++ % QUEUE_SIZE] = fd;
+        pthread_cond_signal(&server->arrived);
+        pthread_mutex_unlock(&server->lock);
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+/* A resident simulator taking jobs over a Unix socket. A client connects
+   and sends any number of jobs, one per line, each a program path after
+   options like the command line's:
+
+       [-f] [-r] [-s] [-n BUDGET] PATH
+
+   -f runs the predecoded engine instead of the interpreter, -r traces the
+   registers after every instruction, -s adds the JSON run summary and -n
+   stops after BUDGET instructions. Paths cannot contain spaces. Every job
+   is answered in order with
+
+       out N           followed by N bytes of guest output or trace, any
+                       number of times while the job runs
+       stats N         followed by N bytes of JSON, with -s
+       done EXIT INSTRUCTIONS STATUS
+                       STATUS as rvsim_status_name(), "ok" if the budget
+                       ran out, in which case EXIT is -1
+
+   or "error MESSAGE" if the job could not be started.
+
+   Connections are served by a pool of worker threads. Each worker keeps
+   its machines and the last program it ran, so running the same program
+   again only restores the memory the previous run wrote (see
+   rvsim_reset()) and keeps the code the engine decoded from it. */
+
+/* Serves jobs on the socket at path with workers threads, 0 for one per
+   CPU. Only returns if the socket cannot be opened. */
+int serve(const char *path, unsigned workers);
+
+#endif
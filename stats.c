@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include "types.h"
+#include "stats.h"
+
+InstructionClass instruction_class(Word instruction_bits) {
+    switch (instruction_bits & 0x7F) {
+        case 0x33: return CLASS_RTYPE;
+        case 0x13: return CLASS_ITYPE;
+        case 0x03: case 0x07: return CLASS_LOAD;
+        case 0x23: case 0x27: return CLASS_STORE;
+        case 0x63: return CLASS_BRANCH;
+        case 0x6F: return CLASS_JAL;
+        case 0x37: return CLASS_LUI;
+        case 0x53: case 0x43: case 0x47: case 0x4B: case 0x4F: return CLASS_FLOAT;
+        case 0x73: return ((instruction_bits >> 12) & 0x7) ? CLASS_SYSTEM
+                          : (instruction_bits >> 25) == 0x09 ? CLASS_SYSTEM : CLASS_ECALL;
+        default: return CLASS_OTHER;
+    }
+}
+
+/* Counts an instruction about to be run by execute_instruction(). Taken
+ * branches are only known afterwards, the caller counts those. */
+void count_instruction(RunStats *stats, Word instruction_bits) {
+    InstructionClass class = instruction_class(instruction_bits);
+
+    stats->classes[class]++;
+    if (class == CLASS_LOAD || class == CLASS_STORE) {
+        /* funct3 0, 1, 2 are byte, half word and word */
+        Word bytes = 1 << ((instruction_bits >> 12) & 0x3);
+        if (class == CLASS_LOAD) {
+            stats->bytes_loaded += bytes;
+        } else {
+            stats->bytes_stored += bytes;
+        }
+    }
+}
+
+void write_stats_json(FILE *out, const RunStats *stats, const char *mode, double seconds) {
+    static const char *names[NUM_CLASSES] = {
+        "rtype", "itype", "load", "store", NULL, "jal", "lui", "ecall", "float", "system", "other"
+    };
+    uint64_t total = 0;
+    int i;
+
+    for (i = 0; i < NUM_CLASSES; i++) {
+        total += stats->classes[i];
+    }
+    total -= stats->classes[CLASS_OTHER];
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"mode\": \"%s\",\n", mode);
+    fprintf(out, "  \"instructions\": %llu,\n", (unsigned long long) total);
+    fprintf(out, "  \"classes\": {\n");
+    for (i = 0; i < NUM_CLASSES; i++) {
+        if (i == CLASS_BRANCH) {
+            fprintf(out, "    \"branch_taken\": %llu,\n", (unsigned long long) stats->branches_taken);
+            fprintf(out, "    \"branch_not_taken\": %llu,\n",
+                    (unsigned long long) (stats->classes[i] - stats->branches_taken));
+        } else if (i != CLASS_OTHER) {
+            fprintf(out, "    \"%s\": %llu,\n", names[i], (unsigned long long) stats->classes[i]);
+        }
+    }
+    fprintf(out, "    \"other\": %llu\n", (unsigned long long) stats->classes[CLASS_OTHER]);
+    fprintf(out, "  },\n");
+    fprintf(out, "  \"bytes_loaded\": %llu,\n", (unsigned long long) stats->bytes_loaded);
+    fprintf(out, "  \"bytes_stored\": %llu,\n", (unsigned long long) stats->bytes_stored);
+    fprintf(out, "  \"wall_seconds\": %.6f,\n", seconds);
+    fprintf(out, "  \"mips\": %.3f\n", seconds > 0 ? total / seconds / 1e6 : 0.0);
+    fprintf(out, "}\n");
+}
@@ -0,0 +1,36 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include "types.h"
+
+/* What an instruction counts as in the run summary */
+typedef enum {
+    CLASS_RTYPE,
+    CLASS_ITYPE,
+    CLASS_LOAD,
+    CLASS_STORE,
+    CLASS_BRANCH,
+    CLASS_JAL,
+    CLASS_LUI,
+    CLASS_ECALL,
+    CLASS_FLOAT,        /* F extension, except for flw and fsw */
+    CLASS_SYSTEM,       /* CSR accesses and sfence.vma */
+    CLASS_OTHER,        /* never retired: invalid instructions, breakpoints */
+    NUM_CLASSES
+} InstructionClass;
+
+/* Execution counters. Both execution paths keep them unconditionally: one
+   increment per instruction, plus one per memory access and taken branch. */
+typedef struct {
+    uint64_t classes[NUM_CLASSES];
+    uint64_t branches_taken;
+    uint64_t bytes_loaded;
+    uint64_t bytes_stored;
+} RunStats;
+
+InstructionClass instruction_class(Word instruction_bits);
+void count_instruction(RunStats *stats, Word instruction_bits);
+void write_stats_json(FILE *out, const RunStats *stats, const char *mode, double seconds);
+
+#endif
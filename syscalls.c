@@ -0,0 +1,494 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "types.h"
+#include "memory.h"
+#include "syscalls.h"
+#include "eventlog.h"
+
+/* host iovecs one system call hands over at most */
+#define MAX_IOVECS 1024
+
+/* copy_from_guest() and copy_to_guest() move less than a page */
+#define MAX_COPY_IOVECS 2
+
+/* Linux asm-generic open flags, as the guest passes them */
+#define GUEST_O_ACCMODE 00000003
+#define GUEST_O_CREAT 00000100
+#define GUEST_O_EXCL 00000200
+#define GUEST_O_NOCTTY 00000400
+#define GUEST_O_TRUNC 00001000
+#define GUEST_O_APPEND 00002000
+#define GUEST_O_NONBLOCK 00004000
+#define GUEST_O_DIRECTORY 00200000
+#define GUEST_O_NOFOLLOW 00400000
+#define GUEST_O_CLOEXEC 02000000
+#define GUEST_AT_FDCWD -100
+
+/* struct stat64 of 32-bit asm-generic targets */
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint32_t mode;
+    uint32_t nlink;
+    uint32_t uid;
+    uint32_t gid;
+    uint64_t rdev;
+    uint64_t pad1;
+    int64_t size;
+    int32_t blksize;
+    int32_t pad2;
+    int64_t blocks;
+    int32_t atime;
+    uint32_t atime_nsec;
+    int32_t mtime;
+    uint32_t mtime_nsec;
+    int32_t ctime;
+    uint32_t ctime_nsec;
+    uint32_t unused4;
+    uint32_t unused5;
+} GuestStat;
+
+void syscalls_init(Syscalls *sys, Byte *memory, Address program_end) {
+    int fd;
+
+    memset(sys, 0, sizeof(Syscalls));
+    sys->memory = memory;
+    sys->console = stdout;
+    for (fd = 0; fd < MAX_GUEST_FILES; fd++) {
+        sys->fds[fd] = fd <= 2 ? fd : -1;
+    }
+    program_end = (program_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    sys->brk_start = sys->brk = program_end > BRK_START ? program_end : BRK_START;
+}
+
+/* Closes the files the guest left open */
+void syscalls_close(Syscalls *sys) {
+    int fd;
+
+    for (fd = 0; fd < MAX_GUEST_FILES; fd++) {
+        if (sys->fds[fd] > 2) {
+            close(sys->fds[fd]);
+        }
+        sys->fds[fd] = fd <= 2 ? fd : -1;
+    }
+}
+
+/* Builds host iovecs for the guest range [address, address + length), one
+ * per contiguous run of host memory. Returns the number of iovecs, which
+ * may cover less than length if iov fills up or the range runs into an
+ * unmapped page, or -1 if not even the first byte is accessible. */
+static int guest_iovec(Syscalls *sys, Address address, Word length, int write,
+                       struct iovec *iov, int max) {
+    Word chunk;
+    Byte *host;
+    int count = 0;
+
+    if (sys->translate == NULL) {
+        if (address >= MEMORY_SPACE) {
+            return -1;
+        }
+        if (length > MEMORY_SPACE - address) {
+            length = MEMORY_SPACE - address;
+        }
+        iov[0].iov_base = sys->memory + address;
+        iov[0].iov_len = length;
+        return 1;
+    }
+    if (length == 0) {
+        iov[0].iov_base = sys->memory;
+        iov[0].iov_len = 0;
+        return 1;
+    }
+    while (length > 0) {
+        chunk = PAGE_SIZE - (address & (PAGE_SIZE - 1));
+        if (chunk > length) {
+            chunk = length;
+        }
+        host = sys->translate(sys->opaque, address, chunk, write);
+        if (host == NULL) {
+            return count > 0 ? count : -1;
+        }
+        if (count > 0 && (Byte *) iov[count - 1].iov_base + iov[count - 1].iov_len == host) {
+            iov[count - 1].iov_len += chunk;
+        } else if (count == max) {
+            break;
+        } else {
+            iov[count].iov_base = host;
+            iov[count].iov_len = chunk;
+            count++;
+        }
+        address += chunk;
+        length -= chunk;
+    }
+    return count;
+}
+
+/* Marks the first bytes of iov as written by the host */
+static void guest_written(Syscalls *sys, const struct iovec *iov, int count, size_t bytes) {
+    Address physical, page;
+    Word length;
+    int i;
+
+    for (i = 0; i < count && bytes > 0; i++) {
+        physical = (Byte *) iov[i].iov_base - sys->memory;
+        length = iov[i].iov_len < bytes ? iov[i].iov_len : bytes;
+        if (length > 0) {
+            for (page = physical; page < physical + length; page += PAGE_SIZE) {
+                MARK_DIRTY(sys->memory, page);
+            }
+            MARK_DIRTY(sys->memory, physical + length - 1);
+            if (sys->written) {
+                sys->written(sys->opaque, physical, length);
+            }
+            if (sys->log && sys->log->mode == LOG_RECORD) {
+                log_memory(sys->log, physical, sys->memory + physical, length);
+            }
+        }
+        bytes -= length;
+    }
+}
+
+/* Small fixed-size copies (paths, structures) go through a bounce buffer */
+static int copy_from_guest(Syscalls *sys, void *to, Address from, Word length) {
+    struct iovec iov[MAX_COPY_IOVECS];
+    int count = guest_iovec(sys, from, length, 0, iov, MAX_COPY_IOVECS);
+    size_t done = 0;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        memcpy((Byte *) to + done, iov[i].iov_base, iov[i].iov_len);
+        done += iov[i].iov_len;
+    }
+    return done == length ? 0 : -EFAULT;
+}
+
+static int copy_to_guest(Syscalls *sys, Address to, const void *from, Word length) {
+    struct iovec iov[MAX_COPY_IOVECS];
+    int count = guest_iovec(sys, to, length, 1, iov, MAX_COPY_IOVECS);
+    size_t done = 0;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        memcpy(iov[i].iov_base, (const Byte *) from + done, iov[i].iov_len);
+        done += iov[i].iov_len;
+    }
+    if (done != length) {
+        return -EFAULT;
+    }
+    guest_written(sys, iov, count, length);
+    return 0;
+}
+
+static int host_fd(Syscalls *sys, Word fd) {
+    return fd < MAX_GUEST_FILES ? sys->fds[fd] : -1;
+}
+
+static int host_flags(Word flags) {
+    static const struct {
+        Word guest;
+        int host;
+    } table[] = {
+        { GUEST_O_CREAT, O_CREAT }, { GUEST_O_EXCL, O_EXCL }, { GUEST_O_NOCTTY, O_NOCTTY },
+        { GUEST_O_TRUNC, O_TRUNC }, { GUEST_O_APPEND, O_APPEND }, { GUEST_O_NONBLOCK, O_NONBLOCK },
+        { GUEST_O_DIRECTORY, O_DIRECTORY }, { GUEST_O_NOFOLLOW, O_NOFOLLOW }, { GUEST_O_CLOEXEC, O_CLOEXEC },
+    };
+    int host = (flags & GUEST_O_ACCMODE) == 1 ? O_WRONLY : (flags & GUEST_O_ACCMODE) == 2 ? O_RDWR : O_RDONLY;
+    unsigned i;
+
+    for (i = 0; i < sizeof(table) / sizeof(table[0]); i++) {
+        if (flags & table[i].guest) {
+            host |= table[i].host;
+        }
+    }
+    return host;
+}
+
+/* read, write, readv and writev. vector is set for the guest iovec forms,
+ * where buffer is the guest iovec array and length the number of entries. */
+static sWord transfer(Syscalls *sys, Word fd, Address buffer, Word length, int vector, int write) {
+    struct iovec iov[MAX_IOVECS];
+    Word guest_iov[2];
+    int host = host_fd(sys, fd), count = 0, n;
+    ssize_t done;
+    Word i;
+
+    if (host < 0) {
+        return -EBADF;
+    }
+    if (!vector) {
+        count = guest_iovec(sys, buffer, length, !write, iov, MAX_IOVECS);
+        if (count < 0) {
+            return -EFAULT;
+        }
+    } else {
+        if (length > MAX_IOVECS) {
+            return -EINVAL;
+        }
+        for (i = 0; i < length && count < MAX_IOVECS; i++) {
+            if (copy_from_guest(sys, guest_iov, buffer + 8 * i, 8) != 0) {
+                return -EFAULT;
+            }
+            n = guest_iovec(sys, guest_iov[0], guest_iov[1], !write, iov + count, MAX_IOVECS - count);
+            if (n < 0) {
+                return -EFAULT;
+            }
+            count += n;
+        }
+    }
+
+    if (write && (host == 1 || host == 2) && sys->console != stdout) {
+        for (i = 0, done = 0; i < (Word) count; i++) {
+            if (sys->console && fwrite(iov[i].iov_base, 1, iov[i].iov_len, sys->console) != iov[i].iov_len) {
+                return done > 0 ? (sWord) done : -EIO;
+            }
+            done += iov[i].iov_len;
+        }
+        return (sWord) done;
+    }
+    if (write) {
+        if (host == 1 || host == 2) {
+            /* keep ordering with anything the simulator printed */
+            fflush(stdout);
+        }
+        done = writev(host, iov, count);
+    } else {
+        done = readv(host, iov, count);
+        if (done > 0) {
+            guest_written(sys, iov, count, done);
+        }
+    }
+    return done < 0 ? -errno : (sWord) done;
+}
+
+static sWord do_openat(Syscalls *sys, sWord dirfd, Address path, Word flags, Word mode) {
+    char name[PATH_MAX];
+    Word i;
+    int host_dir = dirfd == GUEST_AT_FDCWD ? AT_FDCWD : host_fd(sys, dirfd);
+    int fd, guest;
+
+    if (host_dir == -1) {
+        return -EBADF;
+    }
+    for (i = 0; i < sizeof(name); i++) {
+        if (copy_from_guest(sys, &name[i], path + i, 1) != 0) {
+            return -EFAULT;
+        }
+        if (name[i] == '\0') {
+            break;
+        }
+    }
+    if (i == sizeof(name)) {
+        return -ENAMETOOLONG;
+    }
+    for (guest = 0; guest < MAX_GUEST_FILES && sys->fds[guest] != -1; guest++) {
+    }
+    if (guest == MAX_GUEST_FILES) {
+        return -EMFILE;
+    }
+    fd = openat(host_dir, name, host_flags(flags), (mode_t) mode);
+    if (fd < 0) {
+        return -errno;
+    }
+    sys->fds[guest] = fd;
+    return guest;
+}
+
+static sWord do_close(Syscalls *sys, Word fd) {
+    int host = host_fd(sys, fd);
+
+    if (host < 0) {
+        return -EBADF;
+    }
+    sys->fds[fd] = -1;
+    /* the simulator keeps its own standard streams */
+    if (host > 2 && close(host) != 0) {
+        return -errno;
+    }
+    return 0;
+}
+
+static sWord do_fstat(Syscalls *sys, Word fd, Address buffer) {
+    struct stat st;
+    GuestStat guest;
+    int host = host_fd(sys, fd);
+
+    if (host < 0) {
+        return -EBADF;
+    }
+    if (fstat(host, &st) != 0) {
+        return -errno;
+    }
+    memset(&guest, 0, sizeof(guest));
+    guest.dev = st.st_dev;
+    guest.ino = st.st_ino;
+    guest.mode = st.st_mode;
+    guest.nlink = st.st_nlink;
+    guest.uid = st.st_uid;
+    guest.gid = st.st_gid;
+    guest.rdev = st.st_rdev;
+    guest.size = st.st_size;
+    guest.blksize = st.st_blksize;
+    guest.blocks = st.st_blocks;
+    guest.atime = st.st_atim.tv_sec;
+    guest.atime_nsec = st.st_atim.tv_nsec;
+    guest.mtime = st.st_mtim.tv_sec;
+    guest.mtime_nsec = st.st_mtim.tv_nsec;
+    guest.ctime = st.st_ctim.tv_sec;
+    guest.ctime_nsec = st.st_ctim.tv_nsec;
+    return copy_to_guest(sys, buffer, &guest, sizeof(guest));
+}
+
+/* clock_gettime with a 32-bit or (time64) 64-bit struct timespec */
+static sWord do_clock_gettime(Syscalls *sys, Word clock, Address buffer, int time64) {
+    struct timespec now;
+    int32_t old[2];
+    int64_t wide[2];
+
+    if (clock_gettime((clockid_t) clock, &now) != 0) {
+        return -errno;
+    }
+    if (time64) {
+        wide[0] = now.tv_sec;
+        wide[1] = now.tv_nsec;
+        return copy_to_guest(sys, buffer, wide, sizeof(wide));
+    }
+    old[0] = now.tv_sec;
+    old[1] = now.tv_nsec;
+    return copy_to_guest(sys, buffer, old, sizeof(old));
+}
+
+/* The heap lives in guest memory, so growing it just moves the break.
+ * Like the kernel, a failed brk returns the old break. */
+static sWord do_brk(Syscalls *sys, Address address) {
+    struct iovec iov;
+    Address start;
+    Word chunk;
+
+    if (address >= sys->brk_start && address <= BRK_LIMIT) {
+        /* memory handed out again after a shrink reads as zero. Replay
+           does the same, so the zeros are not logged. */
+        for (start = sys->brk; start < address; start += chunk) {
+            chunk = PAGE_SIZE - (start & (PAGE_SIZE - 1));
+            if (chunk > address - start) {
+                chunk = address - start;
+            }
+            /* pages the guest has not mapped hold nothing to clear */
+            if (guest_iovec(sys, start, chunk, 1, &iov, 1) == 1 && iov.iov_len == chunk) {
+                memset(iov.iov_base, 0, chunk);
+                MARK_DIRTY(sys->memory, (Byte *) iov.iov_base - sys->memory);
+                if (sys->written) {
+                    sys->written(sys->opaque, (Byte *) iov.iov_base - sys->memory, chunk);
+                }
+            }
+        }
+        sys->brk = address;
+    }
+    return sys->brk;
+}
+
+/* While replaying, calls that only hand guest data to the host still run,
+ * so a replay prints what the recording did. Not when history runs again
+ * for reverse execution, that already happened. */
+static int runs_on_replay(Syscalls *sys, Word number) {
+    if (MEMORY_CONTEXT(sys->memory)->muted) {
+        return 0;
+    }
+    return number == SYS_WRITE || number == SYS_WRITEV || number == SYS_CLOSE || number == SYS_BRK;
+}
+
+/* Takes the memory a call wrote and its result from the log */
+static int replay_result(Syscalls *sys, Word number, sWord *result) {
+    struct iovec iov;
+    Address address;
+    Word length, value;
+
+    while (replay_peek(sys->log) == EVENT_MEMORY) {
+        if (replay_memory(sys->log, sys->memory, &address, &length) != 0) {
+            return -1;
+        }
+        iov.iov_base = sys->memory + address;
+        iov.iov_len = length;
+        guest_written(sys, &iov, 1, length);
+    }
+    if (replay_syscall(sys->log, number, &value) != 0) {
+        return -1;
+    }
+    *result = value;
+    return 0;
+}
+
+/* Runs the system call in a7 with arguments in a0-a5 and puts the result
+ * (or -errno) in a0. Returns 1 if the guest exited, see exit_code. */
+int linux_syscall(Syscalls *sys, Register *R) {
+    EventLog *log = sys->log;
+    sWord result, logged;
+
+    if (log && log->mode == LOG_REPLAY && !runs_on_replay(sys, R[17])
+        && R[17] != SYS_EXIT && R[17] != SYS_EXIT_GROUP && replay_result(sys, R[17], &result) == 0) {
+        R[10] = result;
+        return 0;
+    }
+    switch (R[17]) {
+        case SYS_OPENAT:
+            result = do_openat(sys, R[10], R[11], R[12], R[13]);
+            break;
+        case SYS_CLOSE:
+            result = do_close(sys, R[10]);
+            break;
+        case SYS_READ:
+            result = transfer(sys, R[10], R[11], R[12], 0, 0);
+            break;
+        case SYS_WRITE:
+            result = transfer(sys, R[10], R[11], R[12], 0, 1);
+            break;
+        case SYS_READV:
+            result = transfer(sys, R[10], R[11], R[12], 1, 0);
+            break;
+        case SYS_WRITEV:
+            result = transfer(sys, R[10], R[11], R[12], 1, 1);
+            break;
+        case SYS_FSTAT:
+            result = do_fstat(sys, R[10], R[11]);
+            break;
+        case SYS_EXIT:
+        case SYS_EXIT_GROUP:
+            sys->exit_code = R[10] & 0xFF;
+            return 1;
+        case SYS_CLOCK_GETTIME:
+            result = do_clock_gettime(sys, R[10], R[11], 0);
+            break;
+        case SYS_CLOCK_GETTIME64:
+            result = do_clock_gettime(sys, R[10], R[11], 1);
+            break;
+        case SYS_BRK:
+            result = do_brk(sys, R[10]);
+            break;
+        default:
+            result = -ENOSYS;
+            break;
+    }
+    if (log && log->mode == LOG_RECORD) {
+        log_syscall(log, R[17], result);
+    } else if (log && log->mode == LOG_REPLAY) {
+        /* the guest sees what the recording did. Files it opened are not
+           open on replay, any other difference is a divergence. */
+        if (replay_result(sys, R[17], &logged) == 0) {
+            if (logged != result && result != -EBADF) {
+                replay_diverged(log, "different system call result");
+            }
+            result = logged;
+        } else if (log->mode == LOG_RECORD) {
+            /* a rewound log caught up with the recording */
+            log_syscall(log, R[17], result);
+        }
+    }
+    R[10] = result;
+    return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef SYSCALLS_H
+#define SYSCALLS_H
+
+#include <stdio.h>
+#include "types.h"
+
+/* Linux RV32 system call numbers (asm-generic), taken from a7 */
+#define SYS_OPENAT 56
+#define SYS_CLOSE 57
+#define SYS_READ 63
+#define SYS_WRITE 64
+#define SYS_READV 65
+#define SYS_WRITEV 66
+#define SYS_FSTAT 80            /* fstat64 on 32-bit targets */
+#define SYS_EXIT 93
+#define SYS_EXIT_GROUP 94
+#define SYS_CLOCK_GETTIME 113
+#define SYS_BRK 214
+#define SYS_CLOCK_GETTIME64 403
+
+#define MAX_GUEST_FILES 64
+
+/* The heap starts past the program and the static data around gp, and
+   stops short of the stack */
+#define BRK_START 0x10000
+#define BRK_LIMIT 0xE0000
+
+/* Linux user-mode system calls. Guest buffers are handed to the host as
+   iovecs pointing straight into guest memory, never copied. */
+typedef struct Syscalls {
+    Byte *memory;
+    int fds[MAX_GUEST_FILES];   /* guest descriptor -> host descriptor, -1 if closed */
+    Address brk;
+    Address brk_start;
+    int exit_code;
+    /* Turns a guest range within one page into a host pointer, NULL if it
+       is not mapped. Without it guest addresses are physical. */
+    Byte *(*translate)(void *opaque, Address address, Word length, int write);
+    /* told about guest memory the host just wrote, like dma_written */
+    void (*written)(void *opaque, Address address, Word length);
+    void *opaque;
+    struct EventLog *log;       /* record or replay results, see eventlog.h */
+    /* where guest fds 1 and 2 go when it is not the host's stdout, NULL
+       to discard; traces and the thread that writes them use a FILE */
+    FILE *console;
+} Syscalls;
+
+void syscalls_init(Syscalls *sys, Byte *memory, Address program_end);
+void syscalls_close(Syscalls *sys);
+int linux_syscall(Syscalls *sys, Register *R);
+
+#endif
@@ -1,9 +1,22 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <CUnit/Basic.h>
 
 #include "utils.h"
 #include "types.h"
+#include "decode.h"
+#include "lz.h"
+#include "tracewriter.h"
+#include "events.h"
+#include "coverage.h"
+#include "syscalls.h"
+#include "eventlog.h"
+#include "reverse.h"
+#include "machine.h"
+#include "mmu.h"
 #include "part2.c"
 
 void test_sign_extend_number();
@@ -15,6 +28,17 @@ void test_parse_instruction_ujtype();
 void test_parse_instruction_utype();
 void test_load();
 void test_store();
+void test_decode_block();
+void test_lz_roundtrip();
+void test_format_registers();
+void test_fpu();
+void test_timer_interrupt();
+void test_coverage();
+void test_syscalls();
+void test_reverse_timer();
+void test_reverse_step();
+void test_mmu();
+void test_idioms();
 
 int main(int arc, char **argv) {
     CU_pSuite pSuite1 = NULL;
@@ -64,6 +88,50 @@ int main(int arc, char **argv) {
         goto exit;
     }
 
+    if(!CU_add_test(pSuite1, "test_decode_block", test_decode_block)) {
+        goto exit;
+    }
+
+    if(!CU_add_test(pSuite1, "test_lz_roundtrip", test_lz_roundtrip)) {
+        goto exit;
+    }
+
+    if(!CU_add_test(pSuite1, "test_format_registers", test_format_registers)) {
+        goto exit;
+    }
+
+    if(!CU_add_test(pSuite1, "test_fpu", test_fpu)) {
+        goto exit;
+    }
+
+    if(!CU_add_test(pSuite1, "test_timer_interrupt", test_timer_interrupt)) {
+        goto exit;
+    }
+
+    if(!CU_add_test(pSuite1, "test_coverage", test_coverage)) {
+        goto exit;
+    }
+
+    if(!CU_add_test(pSuite1, "test_syscalls", test_syscalls)) {
+        goto exit;
+    }
+
+    if(!CU_add_test(pSuite1, "test_reverse_timer", test_reverse_timer)) {
+        goto exit;
+    }
+
+    if(!CU_add_test(pSuite1, "test_reverse_step", test_reverse_step)) {
+        goto exit;
+    }
+
+    if(!CU_add_test(pSuite1, "test_mmu", test_mmu)) {
+        goto exit;
+    }
+
+    if(!CU_add_test(pSuite1, "test_idioms", test_idioms)) {
+        goto exit;
+    }
+
     CU_basic_set_mode(CU_BRM_VERBOSE);
     CU_basic_run_tests();
 
@@ -196,4 +264,675 @@ void test_store() {
     printf("|0x%x|\n", load(mem, 4, LENGTH_HALF_WORD));  // output: 0x1312
     printf("|0x%x|\n", load(mem, 4, LENGTH_BYTE));       // output: 0x12
      */
-}
\ No newline at end of file
+}
+
+void test_decode_block() {
+    /* add, addi, sw, beq -12, jal -12, lui, lw, then enough addi's to
+       cover both the vector and the scalar tail of decode_block() */
+    Word words[] = {0x009402b3, 0x00a50313, 0x014aa023, 0xfe040ae3, 0xff5ff06f,
+                    0xfffff437, 0x00012983, 0xffd10113, 0xffd10113, 0xffd10113};
+    DecodedBlock block;
+    Instruction inst;
+    int i;
+
+    decode_block(words, 10, &block);
+    for (i = 0; i < 10; i++) {
+        inst = parse_instruction(words[i]);
+        CU_ASSERT_EQUAL(block.opcode[i], inst.opcode);
+        CU_ASSERT_EQUAL(block.bits[i], words[i]);
+    }
+    CU_ASSERT_EQUAL(block.rd[0], 5);
+    CU_ASSERT_EQUAL(block.rs1[0], 8);
+    CU_ASSERT_EQUAL(block.rs2[0], 9);
+    CU_ASSERT_EQUAL(block.imm_i[1], 10);
+    CU_ASSERT_EQUAL(block.imm_s[2], get_store_offset(parse_instruction(words[2])));
+    CU_ASSERT_EQUAL(block.imm_b[3], get_branch_offset(parse_instruction(words[3])));
+    CU_ASSERT_EQUAL(block.imm_j[4], get_jump_offset(parse_instruction(words[4])));
+    CU_ASSERT_EQUAL(block.imm_u[5], 0xFFFFF000);
+    CU_ASSERT_EQUAL(block.imm_i[9], -3);
+}
+
+void test_lz_roundtrip() {
+    /* register dumps that only differ in one register, some noise, and
+       inputs too short to hold a match */
+    static uint8_t in[20000], packed[LZ_BOUND(20000)], out[20000];
+    size_t length, sizes[] = {0, 1, 9, 10, 20000};
+    unsigned i, k;
+
+    for (i = 0; i < 18000; i += 40) {
+        length = sprintf((char *) in + i, "r%2u=%08x r%2u=%08x r 2=%08x\n", i % 32, i / 40, 1, 0, 7);
+        memset(in + i + length, ' ', 40 - length);
+    }
+    for (; i < 20000; i++) {
+        in[i] = (i * 2654435761U) >> 24;
+    }
+    for (k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+        length = lz_compress(in, sizes[k], packed);
+        CU_ASSERT_EQUAL(length <= LZ_BOUND(sizes[k]), 1);
+        CU_ASSERT_EQUAL(lz_decompress(packed, length, out, sizes[k]), (long) sizes[k]);
+        CU_ASSERT_EQUAL(memcmp(in, out, sizes[k]), 0);
+    }
+    CU_ASSERT_EQUAL(lz_compress(in, 18000, packed) < 18000 / 4, 1);
+    /* truncated input is rejected, not overrun */
+    CU_ASSERT_EQUAL(lz_decompress(packed, 3, out, 1), -1);
+}
+
+void test_format_registers() {
+    char fast[REGISTER_DUMP_SIZE], slow[REGISTER_DUMP_SIZE + 1];
+    Register R[32];
+    int i, j, length = 0;
+
+    for (i = 0; i < 32; i++) {
+        R[i] = i * 0x9E3779B9U;
+    }
+    R[31] = 0xFFFFFFFF;
+    for (i = 0; i < 8; i++) {
+        for (j = 0; j < 4; j++) {
+            length += sprintf(slow + length, "r%2d=%08x ", i * 4 + j, R[i * 4 + j]);
+        }
+        length += sprintf(slow + length, "\n");
+    }
+    length += sprintf(slow + length, "\n");
+    format_registers(fast, R);
+    CU_ASSERT_EQUAL(length, REGISTER_DUMP_SIZE);
+    CU_ASSERT_EQUAL(memcmp(fast, slow, REGISTER_DUMP_SIZE), 0);
+}
+
+/* OP-FP with rd = f3/x3, rs1 = f1, rs2 = f2 */
+#define FP_OP(funct7, rm) (((funct7) << 25) | (2 << 20) | (1 << 15) | ((rm) << 12) | (3 << 7) | 0x53)
+
+void test_fpu() {
+    Processor p;
+
+    memset(&p, 0, sizeof(p));
+    /* fadd.s: 1 + 2^-30 is inexact, 1 + 2^-24 is a tie RMM rounds away */
+    p.F[1] = 0x3F800000;
+    p.F[2] = 0x30800000;
+    CU_ASSERT_EQUAL(fpu_execute(FP_OP(0x00, 7), &p), 0);
+    CU_ASSERT_EQUAL(p.F[3], 0x3F800000);
+    CU_ASSERT_EQUAL(fpu_read_csr(&p, CSR_FFLAGS), FFLAG_NX);
+    p.F[2] = 0x33800000;
+    fpu_execute(FP_OP(0x00, 0), &p);
+    CU_ASSERT_EQUAL(p.F[3], 0x3F800000);
+    fpu_execute(FP_OP(0x00, 4), &p);
+    CU_ASSERT_EQUAL(p.F[3], 0x3F800001);
+    /* a signaling NaN operand gives the canonical NaN */
+    fpu_write_csr(&p, CSR_FFLAGS, 0);
+    p.F[2] = 0x7F800001;
+    fpu_execute(FP_OP(0x00, 7), &p);
+    CU_ASSERT_EQUAL(p.F[3], 0x7FC00000);
+    CU_ASSERT_EQUAL(fpu_read_csr(&p, CSR_FFLAGS), FFLAG_NV);
+    /* feq.s is quiet on a quiet NaN, flt.s is not */
+    fpu_write_csr(&p, CSR_FFLAGS, 0);
+    p.F[2] = 0x7FC00000;
+    p.R[3] = 1;
+    fpu_execute(FP_OP(0x50, 2), &p);
+    CU_ASSERT_EQUAL(p.R[3], 0);
+    CU_ASSERT_EQUAL(fpu_read_csr(&p, CSR_FFLAGS), 0);
+    fpu_execute(FP_OP(0x50, 1), &p);
+    CU_ASSERT_EQUAL(fpu_read_csr(&p, CSR_FFLAGS), FFLAG_NV);
+    /* fmin.s orders -0 below +0 */
+    p.F[1] = 0x00000000;
+    p.F[2] = 0x80000000;
+    fpu_execute(FP_OP(0x14, 0), &p);
+    CU_ASSERT_EQUAL(p.F[3], 0x80000000);
+    /* fcvt.w.s saturates 3e9 and flags it invalid */
+    fpu_write_csr(&p, CSR_FFLAGS, 0);
+    p.F[1] = 0x4F32D05E;
+    fpu_execute(FP_OP(0x60, 1) & ~(0x1F << 20), &p);
+    CU_ASSERT_EQUAL(p.R[3], 0x7FFFFFFF);
+    CU_ASSERT_EQUAL(fpu_read_csr(&p, CSR_FFLAGS), FFLAG_NV);
+    /* fclass.s of -inf */
+    p.F[1] = 0xFF800000;
+    fpu_execute(FP_OP(0x70, 1) & ~(0x1F << 20), &p);
+    CU_ASSERT_EQUAL(p.R[3], 1);
+    /* reserved rounding modes, in the instruction or in frm */
+    p.F[3] = 0;
+    CU_ASSERT_EQUAL(fpu_execute(FP_OP(0x00, 5), &p), -1);
+    fpu_write_csr(&p, CSR_FRM, 6);
+    CU_ASSERT_EQUAL(fpu_execute(FP_OP(0x00, 7), &p), -1);
+    CU_ASSERT_EQUAL(p.F[3], 0);
+    CU_ASSERT_EQUAL(fpu_read_csr(&p, CSR_FCSR), (6 << 5) | FFLAG_NV);
+}
+
+static void raise_timer(void *opaque) {
+    ((Processor *) opaque)->mip |= MIP_MTIP;
+}
+
+void test_timer_interrupt() {
+    EventQueue queue;
+    DeviceMap map;
+    Processor p;
+    Word value;
+
+    memset(&p, 0, sizeof(p));
+    event_queue_init(&queue);
+    event_set_handler(&queue, EVENT_TIMER, raise_timer, &p);
+    CU_ASSERT_EQUAL(event_budget(&queue, 1000), 1000);
+    event_schedule(&queue, EVENT_TIMER, 100);
+    CU_ASSERT_EQUAL(queue.changed, 1);
+    CU_ASSERT_EQUAL(event_budget(&queue, 1000), 100);
+    queue.now = 99;
+    event_fire_due(&queue);
+    CU_ASSERT_EQUAL(p.mip, 0);
+    queue.now = 100;
+    event_fire_due(&queue);
+    CU_ASSERT_EQUAL(p.mip, MIP_MTIP);
+    CU_ASSERT_EQUAL(event_budget(&queue, 1000), 1000);
+
+    /* only taken once enabled in mie and mstatus, vectored through mtvec */
+    p.PC = 0x1234;
+    CU_ASSERT_EQUAL(trap_pending(&p), 0);
+    trap_write_csr(&p, CSR_MTVEC, 0x2001);
+    trap_write_csr(&p, CSR_MIE, 0xFFFFFFFF);
+    trap_write_csr(&p, CSR_MSTATUS, MSTATUS_MIE);
+    CU_ASSERT_EQUAL(trap_pending(&p), MCAUSE_MTI);
+    trap_enter(&p, MCAUSE_MTI);
+    CU_ASSERT_EQUAL(p.PC, 0x2000 + 4 * 7);
+    CU_ASSERT_EQUAL(trap_read_csr(&p, CSR_MEPC), 0x1234);
+    CU_ASSERT_EQUAL(trap_read_csr(&p, CSR_MSTATUS), MSTATUS_MPIE | MSTATUS_MPP);
+    CU_ASSERT_EQUAL(trap_pending(&p), 0);
+    trap_return(&p);
+    CU_ASSERT_EQUAL(p.PC, 0x1234);
+    CU_ASSERT_EQUAL(trap_pending(&p), MCAUSE_MTI);
+
+    /* a machine that starts over forgets mtimecmp */
+    device_map_init(&map, NULL);
+    device_map_add(&map, create_timer(&queue, &p.mip));
+    device_write(&map, TIMER_BASE + 0x4000, LENGTH_WORD, 300);
+    device_write(&map, TIMER_BASE + 0x4004, LENGTH_WORD, 0);
+    device_read(&map, TIMER_BASE + 0x4000, LENGTH_WORD, &value);
+    CU_ASSERT_EQUAL(value, 300);
+    event_queue_reset(&queue);
+    device_map_reset(&map);
+    device_read(&map, TIMER_BASE + 0x4000, LENGTH_WORD, &value);
+    CU_ASSERT_EQUAL(value, 0xFFFFFFFF);
+    device_read(&map, TIMER_BASE + 0x4004, LENGTH_WORD, &value);
+    CU_ASSERT_EQUAL(value, 0xFFFFFFFF);
+    device_destroy(map.devices[0]);
+}
+
+void test_coverage() {
+    static Coverage fast, slow, merged;
+    char path[] = "/tmp/test-coverage-XXXXXX";
+    Address address;
+    int fd;
+
+    /* ranges that start and end inside a bitmap byte, and cover whole ones */
+    coverage_mark_range(&fast, 0x1004, 1);
+    coverage_mark_range(&fast, 0x1014, 50);
+    for (address = 0x1004; address < 0x1008; address += 4) {
+        COVERAGE_MARK(slow.executed, address);
+    }
+    for (address = 0x1014; address < 0x1014 + 4 * 50; address += 4) {
+        COVERAGE_MARK(slow.executed, address);
+    }
+    CU_ASSERT_EQUAL(memcmp(&fast, &slow, sizeof(Coverage)), 0);
+    CU_ASSERT_EQUAL(COVERAGE_TEST(fast.executed, 0x1010), 0);
+    CU_ASSERT_EQUAL(COVERAGE_TEST(fast.executed, 0x10D8), 1);
+    CU_ASSERT_EQUAL(COVERAGE_TEST(fast.executed, 0x10DC), 0);
+
+    /* saving merges with what the file holds */
+    fd = mkstemp(path);
+    close(fd);
+    memset(&slow, 0, sizeof(Coverage));
+    COVERAGE_MARK(slow.taken, 0x2000);
+    CU_ASSERT_EQUAL(coverage_save(&fast, path), 0);
+    CU_ASSERT_EQUAL(coverage_save(&slow, path), 0);
+    CU_ASSERT_EQUAL(coverage_merge(&merged, path), 0);
+    CU_ASSERT_EQUAL(memcmp(merged.executed, fast.executed, sizeof(merged.executed)), 0);
+    CU_ASSERT_EQUAL(COVERAGE_TEST(merged.taken, 0x2000), 1);
+    unlink(path);
+    CU_ASSERT_EQUAL(coverage_merge(&merged, path), -1);
+}
+
+void test_syscalls() {
+    Syscalls sys;
+    Register R[32];
+    Byte *memory = alloc_memory();
+    char text[16];
+    FILE *console = tmpfile();
+    EventLog log;
+    long start;
+
+    /* guest stdout and stderr follow the console, not the host's fds */
+    syscalls_init(&sys, memory, 0x2000);
+    sys.console = console;
+    memcpy(memory + 0x3000, "hello, world", 12);
+    memset(R, 0, sizeof(R));
+    R[17] = SYS_WRITE;
+    R[10] = 1;
+    R[11] = 0x3000;
+    R[12] = 5;
+    CU_ASSERT_EQUAL(linux_syscall(&sys, R), 0);
+    CU_ASSERT_EQUAL(R[10], 5);
+    /* writev to stderr, with an empty entry in the middle */
+    store(memory, 0x3100, LENGTH_WORD, 0x3005);
+    store(memory, 0x3104, LENGTH_WORD, 2);
+    store(memory, 0x3108, LENGTH_WORD, 0x3000);
+    store(memory, 0x310C, LENGTH_WORD, 0);
+    store(memory, 0x3110, LENGTH_WORD, 0x3007);
+    store(memory, 0x3114, LENGTH_WORD, 5);
+    R[17] = SYS_WRITEV;
+    R[10] = 2;
+    R[11] = 0x3100;
+    R[12] = 3;
+    linux_syscall(&sys, R);
+    CU_ASSERT_EQUAL(R[10], 7);
+    rewind(console);
+    memset(text, 0, sizeof(text));
+    CU_ASSERT_EQUAL(fread(text, 1, sizeof(text), console), 12);
+    CU_ASSERT_EQUAL(memcmp(text, "hello, world", 12), 0);
+
+    /* no console discards the output but the guest sees it written */
+    sys.console = NULL;
+    R[17] = SYS_WRITE;
+    R[10] = 1;
+    R[11] = 0x3000;
+    R[12] = 12;
+    linux_syscall(&sys, R);
+    CU_ASSERT_EQUAL(R[10], 12);
+    R[10] = 9;
+    linux_syscall(&sys, R);
+    CU_ASSERT_EQUAL(R[10], (Register) -EBADF);
+
+    /* brk stays between the end of the program and the limit */
+    R[17] = SYS_BRK;
+    R[10] = 0;
+    linux_syscall(&sys, R);
+    CU_ASSERT_EQUAL(R[10], BRK_START);
+    R[10] = BRK_LIMIT + PAGE_SIZE;
+    linux_syscall(&sys, R);
+    CU_ASSERT_EQUAL(R[10], BRK_START);
+
+    /* a rewound log that runs out during a call records it */
+    CU_ASSERT_EQUAL(event_log_temporary(&log), 0);
+    sys.log = &log;
+    start = event_log_tell(&log);
+    R[17] = SYS_WRITE;
+    R[10] = 1;
+    linux_syscall(&sys, R);
+    CU_ASSERT_EQUAL(event_log_rewind(&log, start), 0);
+    R[10] = 1;
+    linux_syscall(&sys, R);
+    CU_ASSERT_EQUAL(R[10], 12);
+    CU_ASSERT_EQUAL(log.mode, LOG_REPLAY);
+    R[10] = 1;
+    linux_syscall(&sys, R);
+    CU_ASSERT_EQUAL(log.mode, LOG_RECORD);
+    CU_ASSERT_EQUAL(event_log_rewind(&log, start), 0);
+    R[10] = 1;
+    linux_syscall(&sys, R);
+    R[10] = 1;
+    linux_syscall(&sys, R);
+    CU_ASSERT_EQUAL(log.mode, LOG_REPLAY);
+
+    /* a call that runs again and gets another result ends the replay */
+    event_log_truncate(&log);
+    start = event_log_tell(&log);
+    R[17] = SYS_BRK;
+    R[10] = 0;
+    linux_syscall(&sys, R);
+    CU_ASSERT_EQUAL(event_log_rewind(&log, start), 0);
+    sys.brk += PAGE_SIZE;
+    R[10] = 0;
+    linux_syscall(&sys, R);
+    CU_ASSERT_EQUAL(R[10], BRK_START);
+    CU_ASSERT_EQUAL(log.mode, LOG_OFF);
+    event_log_close(&log);
+
+    syscalls_close(&sys);
+    fclose(console);
+    free_memory(memory);
+}
+
+static Address breakpoint;      /* for step_sim(), 0 for none */
+
+/* Reverse execution of an RvSim one instruction at a time, like ./riscv -i */
+static uint64_t step_sim(void *opaque, uint64_t budget, int *stopped) {
+    RvSim *sim = opaque;
+    uint64_t start = rvsim_instructions(sim);
+
+    while (budget-- > 0) {
+        if (rvsim_step(sim) != RVSIM_OK || (breakpoint && rvsim_get_pc(sim) == breakpoint)) {
+            *stopped = 1;
+            break;
+        }
+    }
+    return rvsim_instructions(sim) - start;
+}
+
+static int at_sim_breakpoint(void *opaque) {
+    return breakpoint && rvsim_get_pc(opaque) == breakpoint;
+}
+
+static void save_sim(void *opaque, void *state) {
+    rvsim_save_state(opaque, state);
+}
+
+static void restore_sim(void *opaque, const void *state) {
+    rvsim_restore_state(opaque, state);
+}
+
+/* A machine that ran count instructions from the start */
+static RvSim *run_fresh(const Word *program, unsigned words, uint64_t count) {
+    RvSimConfig config;
+    RvSim *sim;
+
+    memset(&config, 0, sizeof(config));
+    config.interpreter = 1;
+    sim = rvsim_create(&config);
+    rvsim_load_words(sim, program, words);
+    rvsim_run(sim, count, NULL);
+    return sim;
+}
+
+/* Whether two machines have the same registers and memory */
+static int same_machine(RvSim *a, RvSim *b) {
+    return rvsim_instructions(a) == rvsim_instructions(b)
+        && memcmp(a->processor.R, b->processor.R, sizeof(a->processor.R)) == 0
+        && a->processor.PC == b->processor.PC && a->processor.mip == b->processor.mip
+        && memcmp(a->memory, b->memory, MEMORY_SPACE) == 0;
+}
+
+void test_reverse_timer() {
+    /* mtimecmp = 300, then spin on "j ." while the handler counts in x9
+       and moves mtimecmp 300 further */
+    static const Word program[] = {
+        0x020042b7, 0x00001337, 0x02c30313, 0x30531073, 0x12c00393, 0x0072a023,
+        0x0002a223, 0x08000313, 0x30432073, 0x30046073, 0x0000006f, 0x00148493,
+        0x0002a383, 0x12c38393, 0x0072a023, 0x34102af3, 0x30200073,
+    };
+    unsigned words = sizeof(program) / sizeof(program[0]);
+    RvSim *sim = run_fresh(program, words, 0), *fresh;
+    Reverse reverse;
+    int stopped;
+
+    CU_ASSERT_EQUAL(reverse_init(&reverse, &sim->processor, sim->memory, 1 << 20, step_sim, sim), 0);
+    CU_ASSERT_EQUAL(reverse_track_state(&reverse, rvsim_state_size(sim), save_sim, restore_sim), 0);
+
+    /* back to before the first interrupt: it has not happened yet */
+    reverse_run(&reverse, 250, &stopped);
+    CU_ASSERT_EQUAL(reverse_step(&reverse, 100), 0);
+    fresh = run_fresh(program, words, 150);
+    CU_ASSERT_EQUAL(same_machine(sim, fresh), 1);
+    CU_ASSERT_EQUAL(sim->processor.R[9], 0);
+    rvsim_destroy(fresh);
+
+    /* forward again, the interrupts come when they did the first time */
+    reverse_run(&reverse, 550, &stopped);
+    fresh = run_fresh(program, words, 700);
+    CU_ASSERT_EQUAL(same_machine(sim, fresh), 1);
+    CU_ASSERT_EQUAL(sim->processor.R[9], 2);
+    rvsim_destroy(fresh);
+
+    /* and back past one of them */
+    CU_ASSERT_EQUAL(reverse_step(&reverse, 350), 0);
+    fresh = run_fresh(program, words, 350);
+    CU_ASSERT_EQUAL(same_machine(sim, fresh), 1);
+    CU_ASSERT_EQUAL(sim->processor.R[9], 1);
+    rvsim_destroy(fresh);
+
+    reverse_free(&reverse);
+    rvsim_destroy(sim);
+}
+
+/* Going back must leave registers and memory as a run that stopped there */
+void test_reverse_step() {
+    /* stores a counter over 128 KB, one word per 4 instructions */
+    static const Word program[] = {
+        0x000102b7, 0x00000313, 0x000083b7, 0x0062a023, 0x00428293,
+        0x00130313, 0xfe731ae3, 0x00a00513, 0x00000073,
+    };
+    unsigned words = sizeof(program) / sizeof(program[0]);
+    RvSim *sim = run_fresh(program, words, 0), *fresh;
+    Reverse reverse;
+    uint64_t time;
+    int stopped;
+
+    CU_ASSERT_EQUAL(reverse_init(&reverse, &sim->processor, sim->memory, 1 << 20, step_sim, sim), 0);
+    reverse_track_state(&reverse, rvsim_state_size(sim), save_sim, restore_sim);
+    reverse.at_breakpoint = at_sim_breakpoint;
+    reverse.interval = 1000;
+    reverse_run(&reverse, 100000, &stopped);
+    CU_ASSERT_EQUAL(reverse_step(&reverse, 1), 0);
+    fresh = run_fresh(program, words, 99999);
+    CU_ASSERT_EQUAL(same_machine(sim, fresh), 1);
+    rvsim_destroy(fresh);
+
+    /* across many snapshots, then forward again through history */
+    CU_ASSERT_EQUAL(reverse_step(&reverse, 40000), 0);
+    fresh = run_fresh(program, words, 59999);
+    CU_ASSERT_EQUAL(same_machine(sim, fresh), 1);
+    rvsim_destroy(fresh);
+    reverse_run(&reverse, 20000, &stopped);
+    fresh = run_fresh(program, words, 79999);
+    CU_ASSERT_EQUAL(same_machine(sim, fresh), 1);
+    rvsim_destroy(fresh);
+
+    /* the loop is about to store: back to the store before */
+    breakpoint = 0x100C;
+    CU_ASSERT_EQUAL(reverse_continue(&reverse), 0);
+    breakpoint = 0;
+    CU_ASSERT_EQUAL(rvsim_get_pc(sim), 0x100C);
+    CU_ASSERT_EQUAL(reverse.now, 79999 - 4);
+    fresh = run_fresh(program, words, reverse.now);
+    CU_ASSERT_EQUAL(same_machine(sim, fresh), 1);
+    rvsim_destroy(fresh);
+
+    /* further back than history goes stops at its start */
+    CU_ASSERT_EQUAL(reverse_step(&reverse, 100000), -1);
+    CU_ASSERT_EQUAL(reverse.now, 0);
+    CU_ASSERT_EQUAL(sim->processor.PC, 0x1000);
+    reverse_free(&reverse);
+    rvsim_destroy(sim);
+
+    /* with little room older snapshots are merged and dropped, what is
+       left still goes back right */
+    sim = run_fresh(program, words, 0);
+    CU_ASSERT_EQUAL(reverse_init(&reverse, &sim->processor, sim->memory, 8 * PAGE_SIZE, step_sim, sim), 0);
+    reverse_track_state(&reverse, rvsim_state_size(sim), save_sim, restore_sim);
+    reverse.interval = 1000;
+    reverse_run(&reverse, 100000, &stopped);
+    CU_ASSERT_EQUAL(reverse.snapshots[0].time > 0, 1);
+    time = reverse.snapshots[0].time;
+    CU_ASSERT_EQUAL(reverse_step(&reverse, 100000 - time), 0);
+    fresh = run_fresh(program, words, time);
+    CU_ASSERT_EQUAL(same_machine(sim, fresh), 1);
+    rvsim_destroy(fresh);
+    reverse_free(&reverse);
+    rvsim_destroy(sim);
+}
+
+static Address pte_written;
+
+static void note_pte_written(void *opaque, Address address, Word length) {
+    pte_written = address;
+}
+
+void test_mmu() {
+    static const Word program[] = {
+        /* satp = Sv32 with the root at 0x10000, read 0x400000, remap it
+           without and then with sfence.vma and read it again */
+        0x800002b7, 0x01028293, 0x18029073, 0x004003b7, 0x0003a303, 0x00011437,
+        0x000084b7, 0x4c748493, 0x00942023, 0x0003a603, 0x12038073, 0x0003a583,
+        0x00a00513, 0x00000073,
+    };
+    static const Word shared[] = {
+        0x800002b7, 0x01028293, 0x18029073, 0x0040f3b7, 0x0003a303, 0x00038093,
+        0x00700693, 0x00900713, 0x00000013, 0x00000013, 0x00000013, 0x00000013,
+        0x00000013, 0x00000013, 0x00000013, 0x00008023, 0x00a00513, 0x00000073,
+    };
+    Byte *memory = alloc_memory();
+    Word *root = (Word *) (memory + 0x10000), *table = (Word *) (memory + 0x11000);
+    RvSimConfig config;
+    RvSim *sim;
+    Mmu mmu;
+
+    /* 0x400000-0x7FFFFF through a second level table at 0x11000, with
+       pages that may be read, read and written, and executed */
+    mmu_init(&mmu, memory);
+    mmu.written = note_pte_written;
+    mmu.satp = SATP_MODE | 0x10;
+    root[1] = (0x11 << 10) | PTE_V;
+    table[0] = (0x20 << 10) | PTE_V | PTE_R;
+    table[1] = (0x21 << 10) | PTE_V | PTE_R | PTE_W;
+    table[2] = (0x22 << 10) | PTE_V | PTE_X;
+    /* a megapage at 0x800000 onto physical 0 */
+    root[2] = PTE_V | PTE_R | PTE_W | PTE_A | PTE_D;
+    CU_ASSERT_EQUAL(tlb_lookup(&mmu, 0x400004, 4, ACCESS_READ), memory + 0x20004);
+    CU_ASSERT_EQUAL(mmu.misses, 1);
+    CU_ASSERT_EQUAL(tlb_lookup(&mmu, 0x400008, 4, ACCESS_READ), memory + 0x20008);
+    CU_ASSERT_EQUAL(mmu.misses, 1);
+    CU_ASSERT_EQUAL(tlb_lookup(&mmu, 0x801234, 4, ACCESS_WRITE), memory + 0x1234);
+
+    /* accessed on the first read, dirty on the first write, and the
+       owner of the memory is told each time */
+    CU_ASSERT_EQUAL(table[0] & (PTE_A | PTE_D), PTE_A);
+    CU_ASSERT_EQUAL(pte_written, 0x11000);
+    CU_ASSERT_EQUAL(tlb_lookup(&mmu, 0x401000, 4, ACCESS_READ), memory + 0x21000);
+    CU_ASSERT_EQUAL(table[1] & (PTE_A | PTE_D), PTE_A);
+    CU_ASSERT_EQUAL(tlb_lookup(&mmu, 0x401000, 4, ACCESS_WRITE), memory + 0x21000);
+    CU_ASSERT_EQUAL(table[1] & (PTE_A | PTE_D), PTE_A | PTE_D);
+    CU_ASSERT_EQUAL(pte_written, 0x11004);
+    pte_written = 0;
+    tlb_flush(&mmu);
+    tlb_lookup(&mmu, 0x401000, 4, ACCESS_WRITE);
+    CU_ASSERT_EQUAL(pte_written, 0);
+
+    /* permission faults, bad entries and accesses across two pages */
+    CU_ASSERT_EQUAL(tlb_lookup(&mmu, 0x400000, 4, ACCESS_WRITE), NULL);
+    CU_ASSERT_EQUAL(mmu.fault, 1);
+    CU_ASSERT_EQUAL(tlb_lookup(&mmu, 0x400000, 4, ACCESS_FETCH), NULL);
+    CU_ASSERT_EQUAL(tlb_lookup(&mmu, 0x402000, 4, ACCESS_FETCH), memory + 0x22000);
+    CU_ASSERT_EQUAL(mmu.fault, 0);
+    CU_ASSERT_EQUAL(tlb_lookup(&mmu, 0x402000, 4, ACCESS_READ), NULL);
+    CU_ASSERT_EQUAL(tlb_lookup(&mmu, 0x403000, 4, ACCESS_READ), NULL);
+    CU_ASSERT_EQUAL(mmu.fault, 1);
+    table[3] = (0x23 << 10) | PTE_V | PTE_W;
+    CU_ASSERT_EQUAL(tlb_lookup(&mmu, 0x403000, 4, ACCESS_WRITE), NULL);
+    root[3] = (0x400 << 10) | PTE_V | PTE_R | (1 << 10);
+    CU_ASSERT_EQUAL(tlb_lookup(&mmu, 0xC00000, 4, ACCESS_READ), NULL);
+    CU_ASSERT_EQUAL(mmu.fault, 1);
+    CU_ASSERT_EQUAL(tlb_lookup(&mmu, 0x400FFE, 4, ACCESS_READ), NULL);
+    CU_ASSERT_EQUAL(mmu.fault, 1);
+
+    /* a changed entry is only seen once its page is flushed */
+    CU_ASSERT_EQUAL(tlb_lookup(&mmu, 0x400000, 4, ACCESS_READ), memory + 0x20000);
+    table[0] = (0x30 << 10) | PTE_V | PTE_R | PTE_A;
+    CU_ASSERT_EQUAL(tlb_lookup(&mmu, 0x400000, 4, ACCESS_READ), memory + 0x20000);
+    tlb_flush_page(&mmu, 0x401000);
+    CU_ASSERT_EQUAL(tlb_lookup(&mmu, 0x400000, 4, ACCESS_READ), memory + 0x20000);
+    tlb_flush_page(&mmu, 0x400000);
+    CU_ASSERT_EQUAL(tlb_lookup(&mmu, 0x400000, 4, ACCESS_READ), memory + 0x30000);
+    free_memory(memory);
+
+    /* the same through the engine: sfence.vma drops what the TLB had */
+    memset(&config, 0, sizeof(config));
+    sim = rvsim_create(&config);
+    rvsim_load_words(sim, program, sizeof(program) / sizeof(program[0]));
+    memory = sim->memory;
+    *(Word *) (memory + 0x10000) = PTE_V | PTE_R | PTE_W | PTE_X | PTE_A | PTE_D;
+    *(Word *) (memory + 0x10004) = (0x11 << 10) | PTE_V;
+    *(Word *) (memory + 0x11000) = (0x20 << 10) | PTE_V | PTE_R | PTE_W | PTE_A | PTE_D;
+    *(Word *) (memory + 0x20000) = 0x11111111;
+    *(Word *) (memory + 0x21000) = 0x22222222;
+    CU_ASSERT_EQUAL(rvsim_run(sim, 100, NULL), RVSIM_EXITED);
+    CU_ASSERT_EQUAL(sim->processor.R[6], 0x11111111);
+    CU_ASSERT_EQUAL(sim->processor.R[12], 0x11111111);
+    CU_ASSERT_EQUAL(sim->processor.R[11], 0x22222222);
+    rvsim_destroy(sim);
+
+    /* a walk that sets A in a table sharing a page with the block that
+       runs: word 15 is the PTE for 0x40F000, which runs as sb x0, 0(x1)
+       until A makes it beq x1, x0 */
+    sim = rvsim_create(&config);
+    rvsim_load_words(sim, shared, sizeof(shared) / sizeof(shared[0]));
+    memory = sim->memory;
+    *(Word *) (memory + 0x10000) = PTE_V | PTE_R | PTE_W | PTE_X | PTE_A | PTE_D;
+    *(Word *) (memory + 0x10004) = (0x1 << 10) | PTE_V;
+    *(Word *) (memory + 0x20000) = 0x33333333;
+    CU_ASSERT_EQUAL(rvsim_run(sim, 100, NULL), RVSIM_EXITED);
+    CU_ASSERT_EQUAL(sim->processor.R[6], 0x33333333);
+    CU_ASSERT_EQUAL(sim->processor.R[13], 7);
+    CU_ASSERT_EQUAL(sim->processor.R[14], 9);
+    CU_ASSERT_EQUAL(*(Word *) (memory + 0x103C), 0x8063);
+    rvsim_destroy(sim);
+}
+
+/* A machine about to run a loop on x6, x7 and x28, over 0x10000 onwards
+   holding bytes that are only zero at 0x10309 */
+static RvSim *idiom_sim(int interpreter, const Word *program, unsigned words, Word x6, Word x7, Word x28) {
+    RvSimConfig config;
+    RvSim *sim;
+    unsigned i;
+
+    memset(&config, 0, sizeof(config));
+    config.interpreter = interpreter;
+    sim = rvsim_create(&config);
+    rvsim_load_words(sim, program, words);
+    for (i = 0; i < 0x1000; i++) {
+        sim->memory[0x10000 + i] = i % 251 + 1;
+    }
+    sim->memory[0x10309] = 0;
+    sim->processor.R[6] = x6;
+    sim->processor.R[7] = x7;
+    sim->processor.R[28] = x28;
+    return sim;
+}
+
+/* Runs the loop on the engine and the interpreter, budget instructions
+   first and then to the end. Returns -1 if the two machines differ after
+   either, or else the number of loops the engine translated to OP_LOOP. */
+static int same_idiom(const Word *program, unsigned words, Word x6, Word x7, Word x28, uint64_t budget) {
+    RvSim *engine = idiom_sim(0, program, words, x6, x7, x28);
+    RvSim *interpreter = idiom_sim(1, program, words, x6, x7, x28);
+    int same;
+
+    same = rvsim_run(engine, budget, NULL) == rvsim_run(interpreter, budget, NULL)
+        && same_machine(engine, interpreter);
+    same = same && rvsim_run(engine, 100000, NULL) == RVSIM_EXITED
+        && rvsim_run(interpreter, 100000, NULL) == RVSIM_EXITED && same_machine(engine, interpreter);
+    same = same ? (int) engine->engine.idiom_count : -1;
+    rvsim_destroy(engine);
+    rvsim_destroy(interpreter);
+    return same;
+}
+
+void test_idioms() {
+    /* a byte copy from x7 to x6 of x28 bytes, as memmove() forwards */
+    static const Word copy[] = {
+        0x000e0e63, 0x00038283, 0x00530023, 0x00130313, 0x00138393, 0xfffe0e13,
+        0xfe0e16e3, 0x00a00513, 0x00000073,
+    };
+    /* x7 stored in words from x6 up to x28, as memset() */
+    static const Word fill[] = {
+        0x01c30863, 0x00732023, 0x00430313, 0xffc31ce3, 0x00a00513, 0x00000073,
+    };
+    /* bytes from x7 up to the first zero, as strlen() or memchr() for 0 */
+    static const Word scan[] = {
+        0x00038283, 0x00138393, 0xfe029ce3, 0x00a00513, 0x00000073,
+    };
+    unsigned copy_words = sizeof(copy) / sizeof(copy[0]);
+    unsigned fill_words = sizeof(fill) / sizeof(fill[0]);
+    unsigned scan_words = sizeof(scan) / sizeof(scan[0]);
+
+    CU_ASSERT_EQUAL(same_idiom(copy, copy_words, 0x11000, 0x10000, 300, 100000), 1);
+    CU_ASSERT_EQUAL(same_idiom(fill, fill_words, 0x12000, 0xA5A5A5A5, 0x12000 + 4 * 1000, 100000), 1);
+    CU_ASSERT_EQUAL(same_idiom(scan, scan_words, 0, 0x10000, 0, 100000), 1);
+
+    /* copies onto themselves: backwards is memmove(), forwards repeats
+       the first 16 bytes, which idiom_run() leaves to the normal path */
+    CU_ASSERT_EQUAL(same_idiom(copy, copy_words, 0x10000, 0x10010, 300, 100000), 1);
+    CU_ASSERT_EQUAL(same_idiom(copy, copy_words, 0x10010, 0x10000, 300, 100000), 1);
+
+    /* budgets that run out part of the way through an iteration */
+    CU_ASSERT_EQUAL(same_idiom(copy, copy_words, 0x11000, 0x10000, 300, 500), 1);
+    CU_ASSERT_EQUAL(same_idiom(fill, fill_words, 0x12000, 0xA5A5A5A5, 0x12000 + 4 * 1000, 1001), 1);
+    CU_ASSERT_EQUAL(same_idiom(scan, scan_words, 0, 0x10000, 0, 100), 1);
+
+    /* nothing to do, which never reaches the loop, and a single element */
+    CU_ASSERT_EQUAL(same_idiom(copy, copy_words, 0x11000, 0x10000, 0, 100000), 0);
+    CU_ASSERT_EQUAL(same_idiom(fill, fill_words, 0x12000, 1, 0x12000, 100000), 0);
+    CU_ASSERT_EQUAL(same_idiom(fill, fill_words, 0x12000, 1, 0x12004, 100000), 1);
+}
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tracesink.h"
+
+/* Decompresses trace files written with ./riscv -z to stdout, or stdin if
+ * no files are given, so traces can be piped into part2_tester.py.
+ *
+ * With an index, -k K prints the registers after instruction K and -w N
+ * every instruction that changed register N, without reading the rest of
+ * the file. */
+
+static void print_write(uint64_t instruction, Register value, void *userdata) {
+    printf("%llu %08x\n", (unsigned long long) instruction, value);
+}
+
+static int query(const char *path, long long instruction, int reg) {
+    FILE *file = fopen(path, "rb");
+    TraceIndex index;
+    Register R[32];
+    int i, j, result = -1;
+
+    if (file == NULL || trace_index_open(&index, file) != 0) {
+        fprintf(stderr, "%s has no trace index\n", path);
+        return 1;
+    }
+    if (instruction >= 0 && trace_registers_at(&index, instruction, R) == 0) {
+        for (i = 0; i < 8; i++) {
+            for (j = 0; j < 4; j++) {
+                printf("r%2d=%08x ", i * 4 + j, R[i * 4 + j]);
+            }
+            printf("\n");
+        }
+        result = 0;
+    } else if (instruction >= 0) {
+        fprintf(stderr, "%s has no instruction %lld\n", path, instruction);
+    }
+    if (reg >= 0) {
+        result = trace_register_writes(&index, reg, print_write, NULL);
+    }
+    trace_index_close(&index);
+    fclose(file);
+    return result == 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    long long instruction = -1;
+    int reg = -1, c, i;
+    FILE *in;
+
+    while ((c = getopt(argc, argv, "k:w:")) != -1) {
+        switch (c) {
+            case 'k':
+                instruction = strtoll(optarg, NULL, 0);
+                break;
+            case 'w':
+                reg = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: tracecat [-k instruction] [-w register] [file...]\n");
+                return 1;
+        }
+    }
+    if (instruction >= 0 || reg >= 0) {
+        if (optind + 1 != argc) {
+            fprintf(stderr, "Queries take exactly one trace file\n");
+            return 1;
+        }
+        return query(argv[optind], instruction, reg);
+    }
+    if (optind == argc) {
+        return trace_decompress(stdin, stdout) == 0 ? 0 : 1;
+    }
+    for (i = optind; i < argc; i++) {
+        in = fopen(argv[i], "rb");
+        if (in == NULL || trace_decompress(in, stdout) != 0) {
+            fprintf(stderr, "Cannot decompress %s\n", argv[i]);
+            return 1;
+        }
+        fclose(in);
+    }
+    return 0;
+}
@@ -0,0 +1,587 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "lz.h"
+#include "tracesink.h"
+
+/* blocks in flight: enough for every compressor to be busy while the
+ * simulation fills the next one and the writer drains the oldest */
+#define TRACE_SLOTS (2 * TRACE_MAX_THREADS + 2)
+
+typedef enum {
+    SLOT_FREE,          /* being filled by the simulation thread */
+    SLOT_FULL,          /* waiting for a compressor */
+    SLOT_PACKING,
+    SLOT_PACKED,        /* waiting for the writer */
+} SlotState;
+
+typedef struct {
+    uint8_t *raw;
+    uint8_t *packed;
+    size_t raw_length;
+    size_t packed_length;
+    SlotState state;
+} TraceSlot;
+
+/* Blocks are numbered in the order they were filled; block n lives in
+ * slot n % TRACE_SLOTS. Every block but the last is full, so block n
+ * starts at n * TRACE_BLOCK_SIZE in the uncompressed trace. */
+struct TraceSink {
+    FILE *file;
+    FILE *stream;
+    TraceSlot slots[TRACE_SLOTS];
+    uint64_t filled, taken, written;
+    pthread_t threads[TRACE_MAX_THREADS];
+    unsigned thread_count;
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int closing;
+    int failed;
+    uint64_t file_offset;       /* the writer's */
+    uint64_t *blocks;           /* file offset of every block written */
+    size_t block_count, block_capacity;
+    TraceCheckpoint *checkpoints;
+    size_t checkpoint_count, checkpoint_capacity;
+};
+
+static void put32(uint8_t *p, uint32_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void put64(uint8_t *p, uint64_t value) {
+    put32(p, value);
+    put32(p + 4, value >> 32);
+}
+
+static uint64_t get64(const uint8_t *p) {
+    return get32(p) | ((uint64_t) get32(p + 4) << 32);
+}
+
+/* Doubles *array when it is full. Returns -1 if it cannot grow. */
+static int grow(void **array, size_t count, size_t *capacity, size_t size) {
+    void *bigger;
+
+    if (count < *capacity) {
+        return 0;
+    }
+    bigger = realloc(*array, (*capacity ? 2 * *capacity : 1024) * size);
+    if (bigger == NULL) {
+        return -1;
+    }
+    *array = bigger;
+    *capacity = *capacity ? 2 * *capacity : 1024;
+    return 0;
+}
+
+static void *compressor(void *opaque) {
+    TraceSink *sink = opaque;
+    TraceSlot *slot;
+
+    pthread_mutex_lock(&sink->lock);
+    for (;;) {
+        while (sink->taken == sink->filled && !sink->closing) {
+            pthread_cond_wait(&sink->changed, &sink->lock);
+        }
+        if (sink->taken == sink->filled) {
+            break;
+        }
+        slot = &sink->slots[sink->taken++ % TRACE_SLOTS];
+        slot->state = SLOT_PACKING;
+        pthread_mutex_unlock(&sink->lock);
+
+        slot->packed_length = lz_compress(slot->raw, slot->raw_length, slot->packed);
+
+        pthread_mutex_lock(&sink->lock);
+        slot->state = SLOT_PACKED;
+        pthread_cond_broadcast(&sink->changed);
+    }
+    pthread_mutex_unlock(&sink->lock);
+    return NULL;
+}
+
+static void *writer(void *opaque) {
+    TraceSink *sink = opaque;
+    TraceSlot *slot;
+    uint8_t header[8];
+    int stored;
+
+    pthread_mutex_lock(&sink->lock);
+    for (;;) {
+        slot = &sink->slots[sink->written % TRACE_SLOTS];
+        while (slot->state != SLOT_PACKED && !(sink->closing && sink->written == sink->filled)) {
+            pthread_cond_wait(&sink->changed, &sink->lock);
+        }
+        if (slot->state != SLOT_PACKED) {
+            break;
+        }
+        pthread_mutex_unlock(&sink->lock);
+
+        stored = slot->packed_length < slot->raw_length;
+        if (grow((void **) &sink->blocks, sink->block_count, &sink->block_capacity, sizeof(uint64_t)) != 0) {
+            sink->failed = 1;
+        } else {
+            sink->blocks[sink->block_count++] = sink->file_offset;
+        }
+        put32(header, slot->raw_length);
+        put32(header + 4, stored ? slot->packed_length : slot->raw_length);
+        if (fwrite(header, 1, sizeof(header), sink->file) != sizeof(header)
+            || fwrite(stored ? slot->packed : slot->raw, 1, get32(header + 4), sink->file)
+               != get32(header + 4)) {
+            sink->failed = 1;
+        }
+        sink->file_offset += sizeof(header) + get32(header + 4);
+
+        pthread_mutex_lock(&sink->lock);
+        slot->raw_length = 0;
+        slot->state = SLOT_FREE;
+        sink->written++;
+        pthread_cond_broadcast(&sink->changed);
+    }
+    pthread_mutex_unlock(&sink->lock);
+    return NULL;
+}
+
+/* Hands the block being filled to the compressors and waits for the next
+ * slot to come free */
+static void submit(TraceSink *sink) {
+    pthread_mutex_lock(&sink->lock);
+    sink->slots[sink->filled % TRACE_SLOTS].state = SLOT_FULL;
+    sink->filled++;
+    pthread_cond_broadcast(&sink->changed);
+    while (sink->slots[sink->filled % TRACE_SLOTS].state != SLOT_FREE) {
+        pthread_cond_wait(&sink->changed, &sink->lock);
+    }
+    pthread_mutex_unlock(&sink->lock);
+}
+
+static ssize_t sink_write(void *cookie, const char *data, size_t length) {
+    TraceSink *sink = cookie;
+    TraceSlot *slot;
+    size_t chunk, done = 0;
+
+    while (done < length) {
+        slot = &sink->slots[sink->filled % TRACE_SLOTS];
+        chunk = TRACE_BLOCK_SIZE - slot->raw_length;
+        if (chunk > length - done) {
+            chunk = length - done;
+        }
+        memcpy(slot->raw + slot->raw_length, data + done, chunk);
+        slot->raw_length += chunk;
+        done += chunk;
+        if (slot->raw_length == TRACE_BLOCK_SIZE) {
+            submit(sink);
+        }
+    }
+    return length;
+}
+
+static void free_sink(TraceSink *sink) {
+    unsigned i;
+
+    free(sink->blocks);
+    free(sink->checkpoints);
+    for (i = 0; i < TRACE_SLOTS; i++) {
+        free(sink->slots[i].raw);
+        free(sink->slots[i].packed);
+    }
+    pthread_mutex_destroy(&sink->lock);
+    pthread_cond_destroy(&sink->changed);
+    free(sink);
+}
+
+void trace_checkpoint(TraceSink *sink, uint64_t instruction, const Register *R, Word written) {
+    TraceCheckpoint *checkpoint;
+
+    /* push what stdio buffered into the block being filled */
+    fflush(sink->stream);
+    if (grow((void **) &sink->checkpoints, sink->checkpoint_count, &sink->checkpoint_capacity,
+             sizeof(TraceCheckpoint)) != 0) {
+        sink->failed = 1;
+        return;
+    }
+    checkpoint = &sink->checkpoints[sink->checkpoint_count++];
+    checkpoint->instruction = instruction;
+    checkpoint->offset = sink->filled * TRACE_BLOCK_SIZE + sink->slots[sink->filled % TRACE_SLOTS].raw_length;
+    checkpoint->written = written;
+    memcpy(checkpoint->R, R, sizeof(checkpoint->R));
+}
+
+/* The index: a header (magic, block count, checkpoint count, interval),
+ * 8 bytes per block, 148 per checkpoint and the footer */
+static int write_index(TraceSink *sink, uint64_t index_offset) {
+    uint8_t record[20 + 4 * 32];
+    TraceCheckpoint *checkpoint;
+    size_t i;
+    int j, failed = 0;
+
+    put32(record, TRACE_INDEX_MAGIC);
+    put32(record + 4, sink->block_count);
+    put32(record + 8, sink->checkpoint_count);
+    put32(record + 12, TRACE_CHECKPOINT_INTERVAL);
+    failed |= fwrite(record, 1, 16, sink->file) != 16;
+    for (i = 0; i < sink->block_count; i++) {
+        put64(record, sink->blocks[i]);
+        failed |= fwrite(record, 1, 8, sink->file) != 8;
+    }
+    for (i = 0; i < sink->checkpoint_count; i++) {
+        checkpoint = &sink->checkpoints[i];
+        put64(record, checkpoint->instruction);
+        put64(record + 8, checkpoint->offset);
+        put32(record + 16, checkpoint->written);
+        for (j = 0; j < 32; j++) {
+            put32(record + 20 + 4 * j, checkpoint->R[j]);
+        }
+        failed |= fwrite(record, 1, sizeof(record), sink->file) != sizeof(record);
+    }
+    put64(record, index_offset);
+    put32(record + 8, TRACE_INDEX_MAGIC);
+    put32(record + 12, 0);
+    failed |= fwrite(record, 1, TRACE_FOOTER_SIZE, sink->file) != TRACE_FOOTER_SIZE;
+    return failed ? -1 : 0;
+}
+
+static int sink_close(void *cookie) {
+    TraceSink *sink = cookie;
+    uint8_t end[8];
+    unsigned i;
+    int failed;
+
+    if (sink->slots[sink->filled % TRACE_SLOTS].raw_length > 0) {
+        submit(sink);
+    }
+    pthread_mutex_lock(&sink->lock);
+    sink->closing = 1;
+    pthread_cond_broadcast(&sink->changed);
+    pthread_mutex_unlock(&sink->lock);
+    for (i = 0; i < sink->thread_count; i++) {
+        pthread_join(sink->threads[i], NULL);
+    }
+    pthread_join(sink->writer, NULL);
+
+    memset(end, 0, sizeof(end));
+    failed = sink->failed || fwrite(end, 1, sizeof(end), sink->file) != sizeof(end);
+    failed |= write_index(sink, sink->file_offset + sizeof(end)) != 0;
+    failed |= fclose(sink->file) != 0;
+    free_sink(sink);
+    return failed ? EOF : 0;
+}
+
+TraceSink *trace_open(const char *path, unsigned threads) {
+    cookie_io_functions_t functions = { NULL, sink_write, NULL, sink_close };
+    TraceSink *sink = calloc(1, sizeof(TraceSink));
+    uint8_t header[8];
+    unsigned i;
+
+    if (sink == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&sink->lock, NULL);
+    pthread_cond_init(&sink->changed, NULL);
+    for (i = 0; i < TRACE_SLOTS; i++) {
+        sink->slots[i].raw = malloc(TRACE_BLOCK_SIZE);
+        sink->slots[i].packed = malloc(LZ_BOUND(TRACE_BLOCK_SIZE));
+        if (sink->slots[i].raw == NULL || sink->slots[i].packed == NULL) {
+            free_sink(sink);
+            return NULL;
+        }
+    }
+    sink->file = fopen(path, "wb");
+    if (sink->file == NULL) {
+        free_sink(sink);
+        return NULL;
+    }
+    put32(header, TRACE_MAGIC);
+    put32(header + 4, TRACE_VERSION);
+    fwrite(header, 1, sizeof(header), sink->file);
+    sink->file_offset = sizeof(header);
+
+    if (threads == 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? sysconf(_SC_NPROCESSORS_ONLN) - 1 : 1;
+    }
+    sink->thread_count = threads < TRACE_MAX_THREADS ? threads : TRACE_MAX_THREADS;
+    for (i = 0; i < sink->thread_count; i++) {
+        pthread_create(&sink->threads[i], NULL, compressor, sink);
+    }
+    pthread_create(&sink->writer, NULL, writer, sink);
+
+    sink->stream = fopencookie(sink, "w", functions);
+    if (sink->stream == NULL) {
+        sink_close(sink);
+        return NULL;
+    }
+    setvbuf(sink->stream, NULL, _IOFBF, 65536);
+    return sink;
+}
+
+FILE *trace_stream(TraceSink *sink) {
+    return sink->stream;
+}
+
+int trace_close(TraceSink *sink) {
+    return fclose(sink->stream) == 0 ? 0 : -1;
+}
+
+int trace_decompress(FILE *in, FILE *out) {
+    uint8_t header[8], *stored = malloc(LZ_BOUND(TRACE_BLOCK_SIZE)), *raw = malloc(TRACE_BLOCK_SIZE);
+    uint32_t raw_length, stored_length;
+    int result = -1;
+
+    if (stored == NULL || raw == NULL || fread(header, 1, sizeof(header), in) != sizeof(header)
+        || get32(header) != TRACE_MAGIC || get32(header + 4) != TRACE_VERSION) {
+        goto done;
+    }
+    for (;;) {
+        if (fread(header, 1, sizeof(header), in) != sizeof(header)) {
+            goto done;
+        }
+        raw_length = get32(header);
+        stored_length = get32(header + 4);
+        if (raw_length == 0) {
+            break;
+        }
+        if (raw_length > TRACE_BLOCK_SIZE || stored_length > raw_length
+            || fread(stored, 1, stored_length, in) != stored_length) {
+            goto done;
+        }
+        if (stored_length < raw_length
+            && lz_decompress(stored, stored_length, raw, TRACE_BLOCK_SIZE) != raw_length) {
+            goto done;
+        }
+        fwrite(stored_length < raw_length ? raw : stored, 1, raw_length, out);
+    }
+    result = 0;
+
+done:
+    free(stored);
+    free(raw);
+    return result;
+}
+
+/* Reading an indexed trace */
+
+int trace_index_open(TraceIndex *index, FILE *file) {
+    uint8_t record[20 + 4 * 32];
+    uint64_t index_offset;
+    TraceCheckpoint *checkpoint;
+    unsigned i;
+    int j;
+
+    memset(index, 0, sizeof(TraceIndex));
+    index->file = file;
+    index->cached = -1;
+    if (fseek(file, -TRACE_FOOTER_SIZE, SEEK_END) != 0
+        || fread(record, 1, TRACE_FOOTER_SIZE, file) != TRACE_FOOTER_SIZE
+        || get32(record + 8) != TRACE_INDEX_MAGIC) {
+        return -1;
+    }
+    index_offset = get64(record);
+    if (fseek(file, index_offset, SEEK_SET) != 0 || fread(record, 1, 16, file) != 16
+        || get32(record) != TRACE_INDEX_MAGIC) {
+        return -1;
+    }
+    index->block_count = get32(record + 4);
+    index->checkpoint_count = get32(record + 8);
+    index->blocks = calloc(index->block_count + 1, sizeof(uint64_t));
+    index->checkpoints = calloc(index->checkpoint_count + 1, sizeof(TraceCheckpoint));
+    index->stored = malloc(LZ_BOUND(TRACE_BLOCK_SIZE));
+    index->raw = malloc(TRACE_BLOCK_SIZE);
+    if (index->blocks == NULL || index->checkpoints == NULL || index->stored == NULL || index->raw == NULL) {
+        trace_index_close(index);
+        return -1;
+    }
+    for (i = 0; i < index->block_count; i++) {
+        if (fread(record, 1, 8, file) != 8) {
+            trace_index_close(index);
+            return -1;
+        }
+        index->blocks[i] = get64(record);
+    }
+    for (i = 0; i < index->checkpoint_count; i++) {
+        if (fread(record, 1, sizeof(record), file) != sizeof(record)) {
+            trace_index_close(index);
+            return -1;
+        }
+        checkpoint = &index->checkpoints[i];
+        checkpoint->instruction = get64(record);
+        checkpoint->offset = get64(record + 8);
+        checkpoint->written = get32(record + 16);
+        for (j = 0; j < 32; j++) {
+            checkpoint->R[j] = get32(record + 20 + 4 * j);
+        }
+    }
+    return 0;
+}
+
+void trace_index_close(TraceIndex *index) {
+    free(index->blocks);
+    free(index->checkpoints);
+    free(index->stored);
+    free(index->raw);
+    memset(index, 0, sizeof(TraceIndex));
+}
+
+static int load_block(TraceIndex *index, unsigned block) {
+    uint8_t header[8];
+    uint32_t raw_length, stored_length;
+
+    if (index->cached == block) {
+        return 0;
+    }
+    index->cached = -1;
+    if (block >= index->block_count || fseek(index->file, index->blocks[block], SEEK_SET) != 0
+        || fread(header, 1, sizeof(header), index->file) != sizeof(header)) {
+        return -1;
+    }
+    raw_length = get32(header);
+    stored_length = get32(header + 4);
+    if (raw_length > TRACE_BLOCK_SIZE || stored_length > raw_length) {
+        return -1;
+    }
+    if (stored_length == raw_length) {
+        if (fread(index->raw, 1, raw_length, index->file) != raw_length) {
+            return -1;
+        }
+    } else if (fread(index->stored, 1, stored_length, index->file) != stored_length
+               || lz_decompress(index->stored, stored_length, index->raw, TRACE_BLOCK_SIZE) != raw_length) {
+        return -1;
+    }
+    index->raw_length = raw_length;
+    index->cached = block;
+    return 0;
+}
+
+/* The next byte of the uncompressed trace, or -1 at its end */
+static int next_char(TraceIndex *index, uint64_t *offset) {
+    unsigned block = *offset / TRACE_BLOCK_SIZE;
+    size_t position = *offset % TRACE_BLOCK_SIZE;
+
+    if (load_block(index, block) != 0 || position >= index->raw_length) {
+        return -1;
+    }
+    (*offset)++;
+    return index->raw[position];
+}
+
+static int hex_digit(int c) {
+    return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+/* Parses "r%2d=%08x" fields into R up to the end of the next register
+ * dump. Anything else, such as guest output, is skipped. */
+static int next_dump(TraceIndex *index, uint64_t *offset, Register *R) {
+    int c = next_char(index, offset), i, digit;
+    unsigned reg;
+    Word value;
+
+    while (c >= 0) {
+        if (c != 'r') {
+            c = next_char(index, offset);
+            continue;
+        }
+        reg = 0;
+        for (i = 0; i < 2; i++) {
+            c = next_char(index, offset);
+            if (c == ' ' && i == 0) {
+                continue;
+            }
+            if (c < '0' || c > '9') {
+                break;
+            }
+            reg = 10 * reg + c - '0';
+        }
+        if (i < 2 || (c = next_char(index, offset)) != '=') {
+            continue;
+        }
+        value = 0;
+        for (i = 0; i < 8 && (digit = hex_digit(c = next_char(index, offset))) >= 0; i++) {
+            value = (value << 4) | digit;
+        }
+        if (i < 8 || reg >= 32) {
+            continue;
+        }
+        R[reg] = value;
+        if (reg == 31) {
+            return 0;
+        }
+        c = next_char(index, offset);
+    }
+    return -1;
+}
+
+/* The last checkpoint at or before instruction, by binary search */
+static TraceCheckpoint *find_checkpoint(TraceIndex *index, uint64_t instruction) {
+    unsigned low = 0, high = index->checkpoint_count, middle;
+
+    while (high - low > 1) {
+        middle = (low + high) / 2;
+        if (index->checkpoints[middle].instruction <= instruction) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return index->checkpoint_count > 0 && index->checkpoints[low].instruction <= instruction
+        ? &index->checkpoints[low] : NULL;
+}
+
+/* The registers after the given number of traced instructions */
+int trace_registers_at(TraceIndex *index, uint64_t instruction, Register *R) {
+    TraceCheckpoint *checkpoint = find_checkpoint(index, instruction);
+    uint64_t offset, n;
+
+    if (checkpoint == NULL) {
+        return -1;
+    }
+    memcpy(R, checkpoint->R, sizeof(checkpoint->R));
+    offset = checkpoint->offset;
+    for (n = checkpoint->instruction; n < instruction; n++) {
+        if (next_dump(index, &offset, R) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Calls back for every instruction that changed reg, only reading the
+ * stretches between checkpoints that say it changed */
+int trace_register_writes(TraceIndex *index, unsigned reg, TraceWriteFn callback, void *userdata) {
+    TraceCheckpoint *checkpoint, *next;
+    Register R[32];
+    uint64_t offset, n;
+    unsigned i;
+
+    if (reg >= 32) {
+        return -1;
+    }
+    for (i = 0; i < index->checkpoint_count; i++) {
+        checkpoint = &index->checkpoints[i];
+        next = i + 1 < index->checkpoint_count ? &index->checkpoints[i + 1] : NULL;
+        if (next && !(next->written & (1U << reg))) {
+            continue;
+        }
+        memcpy(R, checkpoint->R, sizeof(R));
+        offset = checkpoint->offset;
+        for (n = checkpoint->instruction; next == NULL || n < next->instruction; n++) {
+            Register previous = R[reg];
+            if (next_dump(index, &offset, R) != 0) {
+                break;
+            }
+            if (R[reg] != previous) {
+                callback(n + 1, R[reg], userdata);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,70 @@
+#ifndef TRACESINK_H
+#define TRACESINK_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "types.h"
+
+/* Compressed trace files. The simulation thread only copies its output
+   into fixed-size blocks; a pool of threads compresses full blocks with
+   the codec in lz.h and a writer thread appends them to the file in
+   order. The file is a header followed by blocks, each a raw length, a
+   stored length (equal to the raw length if the block did not compress)
+   and the stored bytes, all lengths 32-bit little-endian. A raw length of
+   0 ends the blocks.
+
+   An index follows: the file offset of every block, and checkpoints of
+   the full register file every TRACE_CHECKPOINT_INTERVAL instructions
+   with their offset in the uncompressed trace and the registers that
+   changed since the previous checkpoint. The last TRACE_FOOTER_SIZE bytes
+   of the file locate the index. */
+#define TRACE_MAGIC 0x5A545652      /* "RVTZ" */
+#define TRACE_INDEX_MAGIC 0x49545652 /* "RVTI" */
+#define TRACE_VERSION 1
+#define TRACE_BLOCK_SIZE (256 * 1024)
+#define TRACE_MAX_THREADS 8
+#define TRACE_CHECKPOINT_INTERVAL 1024
+#define TRACE_FOOTER_SIZE 16
+
+typedef struct TraceSink TraceSink;
+
+typedef struct {
+    uint64_t instruction;       /* instructions traced before this point */
+    uint64_t offset;            /* in the uncompressed trace */
+    Word written;               /* registers that changed since the previous checkpoint */
+    Register R[32];
+} TraceCheckpoint;
+
+/* Opens path for a compressed trace; the output goes through the stdio
+   stream trace_stream() returns. threads 0 picks one per CPU. */
+TraceSink *trace_open(const char *path, unsigned threads);
+FILE *trace_stream(TraceSink *sink);
+/* Records the register file after instruction dumps have been written */
+void trace_checkpoint(TraceSink *sink, uint64_t instruction, const Register *R, Word written);
+/* Waits for the compressor threads and writes the index */
+int trace_close(TraceSink *sink);
+
+/* Writes the decompressed contents of a trace file to out */
+int trace_decompress(FILE *in, FILE *out);
+
+/* Random access to an indexed trace */
+typedef struct {
+    FILE *file;
+    uint64_t *blocks;           /* file offsets */
+    unsigned block_count;
+    TraceCheckpoint *checkpoints;
+    unsigned checkpoint_count;
+    uint8_t *stored;
+    uint8_t *raw;               /* the block last decompressed */
+    long cached;
+    size_t raw_length;
+} TraceIndex;
+
+typedef void (*TraceWriteFn)(uint64_t instruction, Register value, void *userdata);
+
+int trace_index_open(TraceIndex *index, FILE *file);
+void trace_index_close(TraceIndex *index);
+int trace_registers_at(TraceIndex *index, uint64_t instruction, Register *R);
+int trace_register_writes(TraceIndex *index, unsigned reg, TraceWriteFn callback, void *userdata);
+
+#endif
@@ -0,0 +1,191 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "tracewriter.h"
+
+struct TraceWriter {
+    FILE *out;
+    FILE *stream;
+    char *buffers[2];
+    unsigned filling;           /* the buffer being filled */
+    size_t used;                /* of it */
+    int pending;                /* the other buffer is waiting for the thread */
+    size_t pending_length;
+    int closing;
+    int failed;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+static const char hex_digits[] = "0123456789abcdef";
+
+void format_registers(char *buffer, const Register *R) {
+    char *p = buffer;
+    Register value;
+    int i, shift;
+
+    for (i = 0; i < 32; i++) {
+        p[0] = 'r';
+        p[1] = i < 10 ? ' ' : '0' + i / 10;
+        p[2] = '0' + i % 10;
+        p[3] = '=';
+        value = R[i];
+        for (shift = 0; shift < 8; shift++) {
+            p[11 - shift] = hex_digits[value & 0xF];
+            value >>= 4;
+        }
+        p[12] = ' ';
+        p += 13;
+        if (i % 4 == 3) {
+            *p++ = '\n';
+        }
+    }
+    *p = '\n';
+}
+
+static void *write_buffers(void *opaque) {
+    TraceWriter *writer = opaque;
+    const char *buffer;
+    size_t length;
+
+    pthread_mutex_lock(&writer->lock);
+    for (;;) {
+        while (!writer->pending && !writer->closing) {
+            pthread_cond_wait(&writer->changed, &writer->lock);
+        }
+        if (!writer->pending) {
+            break;
+        }
+        buffer = writer->buffers[writer->filling ^ 1];
+        length = writer->pending_length;
+        pthread_mutex_unlock(&writer->lock);
+
+        if (fwrite(buffer, 1, length, writer->out) != length) {
+            writer->failed = 1;
+        }
+
+        pthread_mutex_lock(&writer->lock);
+        writer->pending = 0;
+        pthread_cond_broadcast(&writer->changed);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+/* Gives the buffer being filled to the thread once it is done with the
+ * other one, and starts filling that */
+static void hand_off(TraceWriter *writer) {
+    pthread_mutex_lock(&writer->lock);
+    while (writer->pending) {
+        pthread_cond_wait(&writer->changed, &writer->lock);
+    }
+    writer->pending = 1;
+    writer->pending_length = writer->used;
+    writer->filling ^= 1;
+    writer->used = 0;
+    pthread_cond_broadcast(&writer->changed);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+static void append(TraceWriter *writer, const char *data, size_t length) {
+    size_t chunk;
+
+    while (length > 0) {
+        chunk = TRACE_WRITER_BUFFER - writer->used;
+        if (chunk > length) {
+            chunk = length;
+        }
+        memcpy(writer->buffers[writer->filling] + writer->used, data, chunk);
+        writer->used += chunk;
+        data += chunk;
+        length -= chunk;
+        if (writer->used == TRACE_WRITER_BUFFER) {
+            hand_off(writer);
+        }
+    }
+}
+
+void trace_writer_registers(TraceWriter *writer, const Register *R) {
+    if (TRACE_WRITER_BUFFER - writer->used < REGISTER_DUMP_SIZE) {
+        hand_off(writer);
+    }
+    format_registers(writer->buffers[writer->filling] + writer->used, R);
+    writer->used += REGISTER_DUMP_SIZE;
+}
+
+void trace_writer_flush(TraceWriter *writer) {
+    if (writer->used > 0) {
+        hand_off(writer);
+    }
+    pthread_mutex_lock(&writer->lock);
+    while (writer->pending) {
+        pthread_cond_wait(&writer->changed, &writer->lock);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    fflush(writer->out);
+}
+
+static ssize_t stream_write(void *cookie, const char *data, size_t length) {
+    append(cookie, data, length);
+    return length;
+}
+
+static int stream_close(void *cookie) {
+    TraceWriter *writer = cookie;
+    int failed;
+
+    trace_writer_flush(writer);
+    pthread_mutex_lock(&writer->lock);
+    writer->closing = 1;
+    pthread_cond_broadcast(&writer->changed);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+
+    failed = writer->failed || ferror(writer->out);
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->changed);
+    free(writer->buffers[0]);
+    free(writer->buffers[1]);
+    free(writer);
+    return failed ? EOF : 0;
+}
+
+TraceWriter *trace_writer_open(FILE *out) {
+    cookie_io_functions_t functions = { NULL, stream_write, NULL, stream_close };
+    TraceWriter *writer = calloc(1, sizeof(TraceWriter));
+
+    if (writer == NULL) {
+        return NULL;
+    }
+    writer->out = out;
+    writer->buffers[0] = malloc(TRACE_WRITER_BUFFER);
+    writer->buffers[1] = malloc(TRACE_WRITER_BUFFER);
+    if (writer->buffers[0] == NULL || writer->buffers[1] == NULL) {
+        free(writer->buffers[0]);
+        free(writer->buffers[1]);
+        free(writer);
+        return NULL;
+    }
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->changed, NULL);
+    pthread_create(&writer->thread, NULL, write_buffers, writer);
+
+    writer->stream = fopencookie(writer, "w", functions);
+    if (writer->stream == NULL) {
+        stream_close(writer);
+        return NULL;
+    }
+    setvbuf(writer->stream, NULL, _IONBF, 0);
+    return writer;
+}
+
+FILE *trace_writer_stream(TraceWriter *writer) {
+    return writer->stream;
+}
+
+int trace_writer_close(TraceWriter *writer) {
+    return fclose(writer->stream) == 0 ? 0 : EOF;
+}
@@ -0,0 +1,31 @@
+#ifndef TRACEWRITER_H
+#define TRACEWRITER_H
+
+#include <stdio.h>
+#include "types.h"
+
+/* The -r register dump: 8 lines of 4 "r%2d=%08x " fields and an empty
+   line, always exactly this many bytes */
+#define REGISTER_DUMP_SIZE (8 * (4 * 13 + 1) + 1)
+#define TRACE_WRITER_BUFFER (1 << 20)
+
+/* Formats the register dump into buffer without going through printf */
+void format_registers(char *buffer, const Register *R);
+
+/* Register dumps are formatted into one of two large buffers while a
+   thread writes the other one out. Everything else that goes to the same
+   output, like the guest's console, must go through trace_writer_stream()
+   so it stays in order with the dumps. */
+typedef struct TraceWriter TraceWriter;
+
+TraceWriter *trace_writer_open(FILE *out);
+/* Unbuffered: every write lands in the trace right away */
+FILE *trace_writer_stream(TraceWriter *writer);
+void trace_writer_registers(TraceWriter *writer, const Register *R);
+/* Waits until everything so far has been written to out */
+void trace_writer_flush(TraceWriter *writer);
+/* Flushes and stops the writer; out stays open. Returns EOF if writing
+   failed at any point. */
+int trace_writer_close(TraceWriter *writer);
+
+#endif
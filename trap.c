@@ -0,0 +1,66 @@
+#include "trap.h"
+
+Word trap_read_csr(const Processor *processor, Word csr) {
+    switch (csr) {
+        case CSR_MSTATUS: return processor->mstatus | MSTATUS_MPP;
+        case CSR_MIE: return processor->mie;
+        case CSR_MTVEC: return processor->mtvec;
+        case CSR_MSCRATCH: return processor->mscratch;
+        case CSR_MEPC: return processor->mepc;
+        case CSR_MCAUSE: return processor->mcause;
+        case CSR_MTVAL: return processor->mtval;
+        case CSR_MIP: return processor->mip;
+        default: return 0;
+    }
+}
+
+/* Only the fields that exist are writable; mip.MTIP belongs to the timer */
+void trap_write_csr(Processor *processor, Word csr, Word value) {
+    switch (csr) {
+        case CSR_MSTATUS:
+            processor->mstatus = value & (MSTATUS_MIE | MSTATUS_MPIE);
+            break;
+        case CSR_MIE:
+            processor->mie = value & MIP_MTIP;
+            break;
+        case CSR_MTVEC:
+            /* direct or vectored, the reserved modes read as direct */
+            processor->mtvec = value & ~(Word) 2;
+            break;
+        case CSR_MSCRATCH:
+            processor->mscratch = value;
+            break;
+        case CSR_MEPC:
+            processor->mepc = value & ~(Word) 3;
+            break;
+        case CSR_MCAUSE:
+            processor->mcause = value;
+            break;
+        case CSR_MTVAL:
+            processor->mtval = value;
+            break;
+    }
+}
+
+Word trap_pending(const Processor *processor) {
+    if ((processor->mstatus & MSTATUS_MIE) && (processor->mip & processor->mie & MIP_MTIP)) {
+        return MCAUSE_MTI;
+    }
+    return 0;
+}
+
+void trap_enter(Processor *processor, Word cause) {
+    processor->mepc = processor->PC;
+    processor->mcause = cause;
+    processor->mtval = 0;
+    processor->mstatus = (processor->mstatus & MSTATUS_MIE) ? MSTATUS_MPIE : 0;
+    processor->PC = processor->mtvec & ~(Word) 3;
+    if ((processor->mtvec & 1) && (cause & MCAUSE_INTERRUPT)) {
+        processor->PC += 4 * (cause & ~MCAUSE_INTERRUPT);
+    }
+}
+
+void trap_return(Processor *processor) {
+    processor->PC = processor->mepc;
+    processor->mstatus = MSTATUS_MPIE | ((processor->mstatus & MSTATUS_MPIE) ? MSTATUS_MIE : 0);
+}
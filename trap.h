@@ -0,0 +1,45 @@
+#ifndef TRAP_H
+#define TRAP_H
+
+#include "types.h"
+
+/* Machine-mode interrupts, shared by the interpreter and the engine. The
+   guest only ever runs in machine mode, and the only source is the CLINT
+   timer (see devices.c): mip.MTIP follows mtime >= mtimecmp, and when it
+   is enabled in mie and mstatus.MIE the run loop in rvsim.c enters the
+   handler at mtvec between two instructions. Synchronous exceptions still
+   stop the simulator like they always have. */
+
+/* CSRs */
+#define CSR_MSTATUS 0x300
+#define CSR_MIE 0x304
+#define CSR_MTVEC 0x305
+#define CSR_MSCRATCH 0x340
+#define CSR_MEPC 0x341
+#define CSR_MCAUSE 0x342
+#define CSR_MTVAL 0x343
+#define CSR_MIP 0x344
+#define IS_TRAP_CSR(csr) ((csr) == CSR_MSTATUS || (csr) == CSR_MIE || (csr) == CSR_MTVEC \
+                          || ((csr) >= CSR_MSCRATCH && (csr) <= CSR_MIP))
+
+#define MSTATUS_MIE 0x00000008
+#define MSTATUS_MPIE 0x00000080
+#define MSTATUS_MPP 0x00001800  /* always machine mode */
+#define MIP_MTIP 0x00000080     /* also the enable bit in mie */
+#define MCAUSE_INTERRUPT 0x80000000
+#define MCAUSE_MTI (MCAUSE_INTERRUPT | 7)
+
+/* SYSTEM instructions besides ecall and the CSR accesses; wfi is a nop */
+#define MRET_BITS 0x30200073
+#define WFI_BITS 0x10500073
+
+Word trap_read_csr(const Processor *processor, Word csr);
+void trap_write_csr(Processor *processor, Word csr, Word value);
+/* mcause of the interrupt to take now, or 0 */
+Word trap_pending(const Processor *processor);
+/* Enters the handler; the interrupted instruction at PC has not run */
+void trap_enter(Processor *processor, Word cause);
+/* mret */
+void trap_return(Processor *processor);
+
+#endif
@@ -26,10 +26,15 @@ typedef Word Register; /* unsigned 32-bit*/
 /* The processor data: 
     32 registers
     LO & HI special registers
-    PC program counter */
+    PC program counter
+    F and fcsr the floating point registers, see fpu.h
+    mstatus to mtval the machine-mode trap CSRs, see trap.h */
 typedef struct {
     Register R[32];
     Register PC;
+    Word F[32];
+    Word fcsr;
+    Word mstatus, mie, mip, mtvec, mscratch, mepc, mcause, mtval;
 } Processor;
 
 /* Possible lengths of data, and their lengths in bytes.
@@ -34,8 +34,9 @@ Instruction parse_instruction(uint32_t instruction_bits) {
     unsigned opcode = instruction_bits & ((1 << 7) - 1); /* Extract last 7 bits */
 
     switch(opcode) {
-        case 0x33:
-            /* R-Type */
+        case 0x33: case 0x53:
+        case 0x43: case 0x47: case 0x4B: case 0x4F:
+            /* R-Type, and R4-Type with rs3 and fmt in funct7 */
             instruction.rtype.opcode = get_bit_range(instruction_bits, 0, 6);
             instruction.rtype.rd = get_bit_range(instruction_bits, 7, 11);
             instruction.rtype.funct3 = get_bit_range(instruction_bits, 12, 14);
@@ -44,7 +45,7 @@ Instruction parse_instruction(uint32_t instruction_bits) {
             instruction.rtype.funct7 = get_bit_range(instruction_bits, 25, 31);
 
             break;
-        case 0x13: case 0x3: case 0x73:
+        case 0x13: case 0x3: case 0x73: case 0x7:
             /* I-Type */
             instruction.itype.opcode = get_bit_range(instruction_bits, 0, 6);
             instruction.itype.rd = get_bit_range(instruction_bits, 7, 11);
@@ -52,7 +53,7 @@ Instruction parse_instruction(uint32_t instruction_bits) {
             instruction.itype.rs1 = get_bit_range(instruction_bits, 15, 19);
             instruction.itype.imm = get_bit_range(instruction_bits, 20, 31);
             break;
-        case 0x23:
+        case 0x23: case 0x27:
             /* S-Type */
             instruction.stype.opcode = get_bit_range(instruction_bits, 0, 6);
             instruction.stype.imm5 = get_bit_range(instruction_bits, 7, 11);
@@ -185,12 +186,10 @@ void handle_invalid_instruction(Instruction instruction) {
 
 void handle_invalid_read(Address address) {
     printf("Bad Read. Address: 0x%08x\n", address);
-    exit(-1);
 }
 
 void handle_invalid_write(Address address) {
     printf("Bad Write. Address: 0x%08x\n", address);
-    exit(-1);
 }
 
 void debug_handle_invalid_instruction(Instruction instruction) {
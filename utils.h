@@ -7,6 +7,16 @@
 #define JAL_FORMAT "jal\tx%d, %d\n"
 #define BRANCH_FORMAT "%s\tx%d, x%d, %d\n"
 #define ECALL_FORMAT "ecall\n"
+#define CSR_FORMAT "%s\tx%d, 0x%03x, x%d\n"
+#define CSRI_FORMAT "%s\tx%d, 0x%03x, %d\n"
+#define SFENCE_FORMAT "sfence.vma\tx%d, x%d\n"
+#define MRET_FORMAT "mret\n"
+#define WFI_FORMAT "wfi\n"
+#define FMEM_FORMAT "%s\tf%d, %d(x%d)\n"
+#define FRTYPE_FORMAT "%s\tf%d, f%d, f%d%s\n"
+#define FR4TYPE_FORMAT "%s\tf%d, f%d, f%d, f%d%s\n"
+#define FCMP_FORMAT "%s\tx%d, f%d, f%d\n"
+#define FUNARY_FORMAT "%s\t%c%d, %c%d%s\n"
 
 int sign_extend_number(unsigned, unsigned);
 Instruction parse_instruction(uint32_t);